@@ -653,6 +653,7 @@ browse_host_open(
 		args.nagle = FALSE;
 		args.reduced = FALSE;
 		args.gzip = 0 != (flags & BH_F_GZIP);
+		args.threaded = FALSE;
 		args.buffer_flush = INT_MAX;		/* Flush only at the end */
 		args.buffer_size = BH_BUFSIZ;
 
@@ -2160,6 +2160,82 @@ bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 	return r;
 }
 
+/**
+ * Send several UDP datagrams with a single system call.
+ *
+ * The bandwidth is checked for the whole batch at once, which is trimmed to
+ * the datagrams we can afford to send, granting the last one the same
+ * BW_UDP_OVERSIZE leniency as bio_sendto().  Each datagram sent is then
+ * accounted for exactly as if it had been sent through bio_sendto().
+ *
+ * @param bio		the I/O source
+ * @param dg		the datagrams to send, the `sent' field being filled
+ * @param cnt		amount of datagrams in the vector
+ *
+ * @return -1 with errno set to EAGAIN, if we cannot write anything due
+ * to bandwidth constraints, the amount of datagrams sent otherwise.
+ */
+int
+bio_sendmmsg(bio_source_t *bio, wrap_dgram_t *dg, int cnt)
+{
+	size_t available, len;
+	int i, n, r;
+
+	bio_check(bio);
+	g_assert(bio->flags & BIO_F_WRITE);
+	g_assert(dg != NULL);
+	g_assert(cnt > 0);
+
+	for (i = 0, len = 0; i < cnt; i++)
+		len += dg[i].len;
+
+	available = bw_available(bio, len);
+
+	if (available == 0 || available + BW_UDP_OVERSIZE < dg[0].len) {
+		errno = VAL_EAGAIN;
+		return -1;
+	}
+
+	for (n = 0, len = 0; n < cnt; n++) {
+		if (len + dg[n].len > available + BW_UDP_OVERSIZE)
+			break;
+		len += dg[n].len;
+	}
+
+	g_assert(n > 0);
+
+	if (GNET_PROPERTY(bsched_debug) > 7) {
+		g_debug("BSCHED %s(wio=%d, cnt=%d, len=%zu) available=%zu, sending %d",
+			G_STRFUNC, bio->wio->fd(bio->wio), cnt, len, available, n);
+	}
+
+	g_assert(bio->wio != NULL);
+	g_assert(bio->wio->sendmmsg != NULL);
+	r = (*bio->wio->sendmmsg)(bio->wio, dg, n);
+
+	/*
+	 * XXX hack for broken libc, which can return -1 with errno = 0!
+	 */
+
+	if (-1 == r && 0 == errno) {
+		g_warning("wio->sendmmsg(fd=%d, cnt=%d) returned -1 with errno = 0, "
+			"assuming EAGAIN", bio->wio->fd(bio->wio), n);
+		errno = VAL_EAGAIN;
+	}
+
+	for (i = 0; i < r; i++) {
+		ssize_t sent = dg[i].sent;
+
+		if (sent > 0) {
+			bsched_bw_update(bsched_get(bio->bws),
+				sent + BW_UDP_MSG, dg[i].len + BW_UDP_MSG);
+			bio_bw_update(bio, sent + BW_UDP_MSG);
+		}
+	}
+
+	return r;
+}
+
 /**
  * Write at most `len' bytes to source's fd, as bandwidth permits.
  *
@@ -99,6 +99,7 @@
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/file.h"
+#include "lib/file_aio.h"
 #include "lib/file_object.h"
 #include "lib/filename.h"
 #include "lib/getdate.h"
@@ -201,6 +202,8 @@ static void download_queue_hold(struct download *d, uint32 hold,
 static void download_force_stop(struct download *d, const char * reason, ...);
 static void download_reparent(struct download *d, struct dl_server *new_server);
 static void download_silent_flush(struct download *d);
+static bool download_aio_wait(struct download *d);
+static bool download_write_data(struct download *d);
 static void change_server_addr(struct dl_server *server,
 	const host_addr_t new_addr, const uint16 new_port);
 static struct download *download_pick_another(const struct download *d);
@@ -1403,6 +1406,7 @@ buffers_free(struct download *d)
 	download_check(d);
 	g_assert(d->buffers != NULL);
 	g_assert(d->buffers->held == 0);	/* No pending data */
+	g_assert(NULL == d->buffers->aio);
 
 	b = d->buffers;
 	pmsg_slist_free_all(&b->list);
@@ -1477,6 +1481,8 @@ buffers_discard(struct download *d)
 	b = d->buffers;
 	fi = d->file_info;
 
+	(void) download_aio_wait(d);	/* Don't discard data being written */
+
 	if (fi->buffered >= b->held)
 		fi->buffered -= b->held;
 	else
@@ -1499,6 +1505,14 @@ buffers_full(const struct download *d)
 
 	b = d->buffers;
 
+	/*
+	 * While data are being written, reception is paused when enough data
+	 * were buffered, so the buffers can hold more than usual.
+	 */
+
+	if (b->aio != NULL)
+		return FALSE;
+
 	return b->held >= GNET_PROPERTY(download_buffer_size);
 }
 
@@ -1532,10 +1546,11 @@ buffers_add_read(struct download *d, pmsg_t *mb)
 	 *
 	 * We don't perform any copy if the amount of data we add is sufficient
 	 * to trigger a disk flush: why copy data we're about to write to disk?
+	 * Nor do we append to buffers while they are being written.
 	 */
 
 	size = pmsg_size(mb);
-	prev_mb = slist_tail(b->list);
+	prev_mb = b->aio != NULL ? NULL : slist_tail(b->list);
 	available = prev_mb != NULL ? pmsg_writable_length(prev_mb) : 0;
 
 	if (b->held + size < b->amount && size <= available) {
@@ -9187,6 +9202,65 @@ out:
 	return success;
 }
 
+/**
+ * Account for `size' bytes of buffered data written at the current position.
+ */
+static void
+download_written(struct download *d, size_t size)
+{
+	g_assert(size <= d->buffers->held);
+
+	file_info_update(d, d->pos, d->pos + size, DL_CHUNK_DONE);
+	gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
+		GNET_PROPERTY(dl_byte_count) + size);
+
+	d->pos += size;
+	buffers_strip_leading(d, size);
+}
+
+/**
+ * Handle failure to write `size' bytes of buffered data, errno being set.
+ *
+ * @param d			the download
+ * @param size		amount of data we attempted to write
+ * @param may_stop	whether we can stop the download
+ */
+static void
+download_write_failed(struct download *d, size_t size, bool may_stop)
+{
+	const char *error;
+
+	switch (errno) {
+	case ENOSPC:	/* No space left */
+		queue_frozen_on_write_error = TRUE;
+		/* FALL THROUGH */
+	case EDQUOT:	/* quota exceeded */
+	case EROFS:		/* read-only filesystem */
+	case EIO:		/* I/O error */
+		if (!download_queue_is_frozen()) {
+			download_freeze_queue();
+			g_warning("freezing download queue due to write error: %m");
+		}
+		break;
+	}
+
+	error = g_strerror(errno);
+	g_warning("write of %lu bytes to file \"%s\" failed: %m",
+		(ulong) size, download_basename(d));
+
+	/* FIXME: We should never discard downloaded data! This
+	 * causes a re-download of the same data. Instead we should
+	 * keep the buffered data around and periodically try to
+	 * flush the buffers. At least in the case of ENOSPC or
+	 * EDQUOT when the disk filled up and the condition can
+	 * be solved by the user but may hold for a long duration.
+	 */
+
+	if (may_stop)
+		download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
+			_("Can't save data: %s"), error);
+}
+
 /**
  * Flush buffered data to disk.
  *
@@ -9207,6 +9281,7 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 	download_check(d);
 	b = d->buffers;
 	g_assert(b != NULL);
+	g_assert(NULL == b->aio);
 	g_assert(d->status == GTA_DL_RECEIVING);
 
 	if (GNET_PROPERTY(download_debug) > 10) {
@@ -9281,54 +9356,13 @@ download_flush(struct download *d, bool *trimmed, bool may_stop)
 			}
 			break;
 		} else {
-			size_t size = (size_t) ret;
-
-			g_assert(size <= b->held);
-
-			file_info_update(d, d->pos, d->pos + size, DL_CHUNK_DONE);
-			gnet_prop_set_guint64_val(PROP_DL_BYTE_COUNT,
-				GNET_PROPERTY(dl_byte_count) + size);
-
-			d->pos += size;
-			written += size;
-
-			buffers_strip_leading(d, size);
+			download_written(d, ret);
+			written += ret;
 		}
 	} while (b->held > 0);
 
 	if ((ssize_t) -1 == written) {
-		const char *error;
-
-		switch (errno) {
-		case ENOSPC:	/* No space left */
-			queue_frozen_on_write_error = TRUE;
-			/* FALL THROUGH */
-		case EDQUOT:	/* quota exceeded */
-		case EROFS:		/* read-only filesystem */
-		case EIO:		/* I/O error */
-			if (!download_queue_is_frozen()) {
-				download_freeze_queue();
-				g_warning("freezing download queue due to write error: %m");
-			}
-			break;
-		}
-
-	   	error = g_strerror(errno);
-		g_warning("write of %lu bytes to file \"%s\" failed: %m",
-			(ulong) b->held, download_basename(d));
-
-		/* FIXME: We should never discard downloaded data! This
-		 * causes a re-download of the same data. Instead we should
-		 * keep the buffered data around and periodically try to
-		 * flush the buffers. At least in the case of ENOSPC or
-		 * EDQUOT when the disk filled up and the condition can
-		 * be solved by the user but may hold for a long duration.
-		 */
-
-		if (may_stop)
-			download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
-				_("Can't save data: %s"), error);
-
+		download_write_failed(d, b->held, may_stop);
 		return FALSE;
 	}
 
@@ -9364,6 +9398,8 @@ download_silent_flush(struct download *d)
 	g_assert(d->status != GTA_DL_IGNORING || 0 == d->buffers->held);
 	g_assert(d->status == GTA_DL_IGNORING || d->status == GTA_DL_RECEIVING);
 
+	(void) download_aio_wait(d);
+
 	if (d->buffers->held > 0) {
 		download_flush(d, NULL, FALSE);
 		if (d->buffers->held > 0) {
@@ -9372,6 +9408,65 @@ download_silent_flush(struct download *d)
 	}
 }
 
+/**
+ * Account for the completion of the pending asynchronous write.
+ *
+ * @param d			the download
+ * @param ret		amount of bytes written, -1 on error
+ */
+static void
+download_aio_end(struct download *d, ssize_t ret)
+{
+	struct dl_buffers *b = d->buffers;
+
+	g_assert(NULL == b->aio);
+	g_assert(b->inflight != 0);
+	g_assert(ret <= (ssize_t) b->inflight);
+
+	b->inflight = 0;
+
+	if (ret > 0)
+		download_written(d, ret);
+
+	if (b->rx_paused) {
+		b->rx_paused = FALSE;
+		if (d->rx != NULL)
+			rx_enable(d->rx);
+	}
+}
+
+/**
+ * Synchronously wait for the pending asynchronous write, if any.
+ *
+ * Only the written data are accounted for: when the write fails, data are
+ * left in the buffers and it is up to the caller to flush or discard them.
+ *
+ * @return FALSE if the write failed, with errno set.
+ */
+static bool
+download_aio_wait(struct download *d)
+{
+	struct dl_buffers *b;
+	ssize_t ret;
+	int error;
+
+	download_check(d);
+
+	b = d->buffers;
+	if (NULL == b || NULL == b->aio)
+		return TRUE;
+
+	ret = file_aio_wait(&b->aio, &error);
+	download_aio_end(d, ret);
+
+	if ((ssize_t) -1 == ret) {
+		errno = error;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /**
  * Called when a chunk has been fully received but the file is still incomplete
  * and more data is to be fetched.
@@ -9526,92 +9621,18 @@ cleanup:
 }
 
 /**
- * Write data in socket buffer to file.
+ * Check where we stand after having flushed the buffered data to disk.
+ *
+ * @param d			the download
+ * @param trimmed	whether we had to trim the tail of the received data
  *
  * @return FALSE if an error occurred.
  */
 static bool
-download_write_data(struct download *d)
+download_write_done(struct download *d, bool trimmed)
 {
-	struct dl_buffers *b;
-	fileinfo_t *fi;
-	bool trimmed = FALSE;
-	enum dl_chunk_status status = DL_CHUNK_BUSY;
-	bool should_flush;
-
-	download_check(d);
-
-	b = d->buffers;
-	fi = d->file_info;
-	g_assert(b->held > 0);
-	g_assert(fi->lifecount > 0);
-	g_assert(fi->lifecount <= fi->refcount);
-
-	/*
-	 * If we have an overlapping window and DL_F_OVERLAPPED is not set yet,
-	 * then the leading data we have in the buffer are overlapping data.
-	 *		--RAM, 12/01/2002, revised 23/11/2002
-	 */
-
-	if (d->chunk.overlap && !(d->flags & DL_F_OVERLAPPED)) {
-		g_assert(d->pos == d->chunk.start);
-		if (b->held < d->chunk.overlap)		/* Not enough bytes yet */
-			return TRUE;					/* Don't even write anything */
-		if (!download_overlap_check(d))		/* Mismatch on overlapped bytes? */
-			return FALSE;					/* Download was stopped */
-		d->flags |= DL_F_OVERLAPPED;		/* Don't come here again */
-		if (b->held == 0)					/* No bytes left to write */
-			return TRUE;
-		/* FALL THROUGH */
-	}
-
-	/*
-	 * Determine whether we should flush the data we have in the file
-	 * buffer.  We do so when we reach the configured buffering limit,
-	 * or when we determine that we have enough data to complete the
-	 * chunk or the file.
-	 */
-
-	g_assert(b->held > 0);
-
-	should_flush = buffers_should_flush(d);		/* Enough buffered data? */
-
-	if (!should_flush && b->held >= d->chunk.end - d->pos)
-		should_flush = TRUE;		/* Moving past our range */
-
-	/*
-	 * When we are overcommitting by doing aggressive swarming (i.e. we
-	 * have in our buffers more than the total file size), then we must
-	 * revert to more frequent flushing to avoid long waiting time, if we
-	 * are downloading from slow sources and can't flush to disk because
-	 * we have incomplete buffers: the earlier we flush, the sooner the
-	 * fileinfo's range will be updated and we will avoid spending our
-	 * time requesting parts we already have in memory.
-	 *		--RAM, 2006-03-11
-	 */
-
-	if (
-		!should_flush &&
-		download_filedone(d) >= download_filesize(d)
-	) {
-		should_flush = TRUE;
-	}
-
-	if (GNET_PROPERTY(download_debug) > 5) {
-		g_debug(
-			"%s(): %s: %sflushing pending %lu bytes for \"%s\", pos=%s, end=%s",
-			G_STRFUNC, download_host_info(d),
-			should_flush ? "" : "NOT ",
-			(ulong) b->held, download_basename(d),
-			uint64_to_string(d->pos),
-			uint64_to_string2(d->chunk.end));
-	}
-
-	if (!should_flush)
-		return TRUE;
-
-	if (!download_flush(d, &trimmed, TRUE))
-		return FALSE;
+	fileinfo_t *fi = d->file_info;
+	enum dl_chunk_status status;
 
 	/*
 	 * End download if we have completed it.
@@ -9739,6 +9760,211 @@ partial_done:
 	}
 }
 
+/**
+ * Can the flushing of buffered data be completed asynchronously?
+ *
+ * This is not possible when the data complete the requested chunk or the
+ * file, since we need to know where we stand before going further.
+ */
+static bool
+download_flush_may_defer(const struct download *d)
+{
+	return d->buffers->held < d->chunk.end - d->pos &&
+		download_filedone(d) < download_filesize(d);
+}
+
+/**
+ * Completion callback for asynchronous writes.
+ */
+static void
+download_aio_written(void *arg, ssize_t ret, int error)
+{
+	struct download *d = arg;
+	struct dl_buffers *b;
+
+	download_check(d);
+	g_assert(GTA_DL_RECEIVING == d->status);
+
+	b = d->buffers;
+	b->aio = NULL;			/* Freed when we return */
+
+	download_aio_end(d, ret);
+
+	if ((ssize_t) -1 == ret) {
+		errno = error;
+		download_write_failed(d, b->held, TRUE);
+		return;
+	}
+
+	if (0 == ret) {
+		g_warning("partial write (written=0, still held=%lu) to file \"%s\"",
+			(ulong) b->held, download_basename(d));
+		download_queue_delay(d, GNET_PROPERTY(download_retry_busy_delay),
+			_("Partial write to file"));
+		return;
+	}
+
+	/*
+	 * Process the data received whilst we were writing, if any.
+	 */
+
+	if (b->held != 0)
+		(void) download_write_data(d);
+	else
+		(void) download_write_done(d, FALSE);
+}
+
+/**
+ * Write all the buffered data asynchronously.
+ */
+static void
+download_flush_async(struct download *d)
+{
+	struct dl_buffers *b = d->buffers;
+	iovec_t *iov;
+	int n;
+
+	g_assert(NULL == b->aio);
+	g_assert(0 == b->inflight);
+
+	if (GNET_PROPERTY(download_debug) > 10) {
+		g_debug("%s(): writing %lu bytes (%u buffers) for \"%s\"",
+			G_STRFUNC, (ulong) b->held, slist_length(b->list),
+			download_basename(d));
+	}
+
+	buffers_check_held(d);
+
+	iov = buffers_to_iovec(d, &n);
+	b->aio = file_aio_pwritev(d->out_file, iov, n, d->pos,
+		download_aio_written, d);
+	HFREE_NULL(iov);
+
+	b->inflight = b->held;
+	b->mode = DL_BUF_READING;		/* Keep receiving meanwhile */
+}
+
+/**
+ * Write data in socket buffer to file.
+ *
+ * @return FALSE if an error occurred.
+ */
+static bool
+download_write_data(struct download *d)
+{
+	struct dl_buffers *b;
+	fileinfo_t *fi;
+	bool trimmed = FALSE;
+	bool should_flush;
+
+	download_check(d);
+
+	b = d->buffers;
+	fi = d->file_info;
+	g_assert(b->held > 0);
+	g_assert(fi->lifecount > 0);
+	g_assert(fi->lifecount <= fi->refcount);
+
+	/*
+	 * If we have an overlapping window and DL_F_OVERLAPPED is not set yet,
+	 * then the leading data we have in the buffer are overlapping data.
+	 *		--RAM, 12/01/2002, revised 23/11/2002
+	 */
+
+	if (d->chunk.overlap && !(d->flags & DL_F_OVERLAPPED)) {
+		g_assert(d->pos == d->chunk.start);
+		if (b->held < d->chunk.overlap)		/* Not enough bytes yet */
+			return TRUE;					/* Don't even write anything */
+		if (!download_overlap_check(d))		/* Mismatch on overlapped bytes? */
+			return FALSE;					/* Download was stopped */
+		d->flags |= DL_F_OVERLAPPED;		/* Don't come here again */
+		if (b->held == 0)					/* No bytes left to write */
+			return TRUE;
+		/* FALL THROUGH */
+	}
+
+	/*
+	 * While data are being written asynchronously, we keep buffering what
+	 * we receive, pausing reception when we have enough or when the disk
+	 * is lagging behind: we'll come back here when the write completes.
+	 * We wait for the write when we are about to complete the chunk though.
+	 */
+
+	if (b->aio != NULL) {
+		if (download_flush_may_defer(d)) {
+			if (
+				!b->rx_paused &&
+				(b->held - b->inflight >= b->amount || file_aio_congested())
+			) {
+				b->rx_paused = TRUE;
+				rx_disable(d->rx);
+			}
+			return TRUE;
+		}
+		if (!download_aio_wait(d)) {
+			download_write_failed(d, b->held, TRUE);
+			return FALSE;
+		}
+		if (0 == b->held)
+			return download_write_done(d, FALSE);
+	}
+
+	/*
+	 * Determine whether we should flush the data we have in the file
+	 * buffer.  We do so when we reach the configured buffering limit,
+	 * or when we determine that we have enough data to complete the
+	 * chunk or the file.
+	 */
+
+	g_assert(b->held > 0);
+
+	should_flush = buffers_should_flush(d);		/* Enough buffered data? */
+
+	if (!should_flush && b->held >= d->chunk.end - d->pos)
+		should_flush = TRUE;		/* Moving past our range */
+
+	/*
+	 * When we are overcommitting by doing aggressive swarming (i.e. we
+	 * have in our buffers more than the total file size), then we must
+	 * revert to more frequent flushing to avoid long waiting time, if we
+	 * are downloading from slow sources and can't flush to disk because
+	 * we have incomplete buffers: the earlier we flush, the sooner the
+	 * fileinfo's range will be updated and we will avoid spending our
+	 * time requesting parts we already have in memory.
+	 *		--RAM, 2006-03-11
+	 */
+
+	if (
+		!should_flush &&
+		download_filedone(d) >= download_filesize(d)
+	) {
+		should_flush = TRUE;
+	}
+
+	if (GNET_PROPERTY(download_debug) > 5) {
+		g_debug(
+			"%s(): %s: %sflushing pending %lu bytes for \"%s\", pos=%s, end=%s",
+			G_STRFUNC, download_host_info(d),
+			should_flush ? "" : "NOT ",
+			(ulong) b->held, download_basename(d),
+			uint64_to_string(d->pos),
+			uint64_to_string2(d->chunk.end));
+	}
+
+	if (!should_flush)
+		return TRUE;
+
+	if (file_aio_is_enabled() && download_flush_may_defer(d)) {
+		download_flush_async(d);
+		return TRUE;
+	}
+
+	if (!download_flush(d, &trimmed, TRUE))
+		return FALSE;
+
+	return download_write_done(d, trimmed);
+}
+
 #if 0 /* UNUSED */
 /**
  * Refresh IP:port, download index and name, by looking at the new location
@@ -13017,6 +13243,7 @@ http_version_nofix:
 		struct rx_inflate_args args;
 
 		args.cb = &download_rx_inflate_cb;
+		args.threaded = FALSE;
 		d->rx = rx_make_above(d->rx, rx_inflate_get_ops(), &args);
 		d->flags |= DL_F_NO_PIPELINE;	/* Disabled for this request */
 	}
@@ -139,6 +139,9 @@ enum dl_file_chunk_magic { DL_FILE_CHUNK_MAGIC = 0x563b483d };
  * These are linked to form the chunklist, the list of all the chunks defined
  * for the file and which are either completed, reserved, or empty (not yet
  * downloaded).
+ *
+ * The same chunks are also held in the chunktree, indexed by their range,
+ * so that we can quickly locate the chunk covering a given offset.
  */
 struct dl_file_chunk {
 	enum dl_file_chunk_magic magic;
@@ -147,6 +150,7 @@ struct dl_file_chunk {
 	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
 	slink_t lk;						/**< Embedded one-way link */
+	rbnode_t node;					/**< Embedded red-black tree node */
 };
 
 static inline void
@@ -217,6 +221,37 @@ static bool fileinfo_dirty = FALSE;
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
 
+/*
+ * Changes made to the fileinfo database are appended to a journal, which is
+ * compacted into the database when it becomes larger.
+ *
+ * The journal is made of records following the database format, each one
+ * superseding the previous record bearing the same GUID.  Removed entries
+ * are recorded as "DELE <guid>".  Both the database and the journal bear
+ * the epoch of the database when it was written, so that a journal left
+ * over by a crash during compaction is never replayed on a newer database.
+ */
+
+static const char file_info_journal_file[] = "fileinfo.journal";
+static const char file_info_journal_what[] = "fileinfo journal";
+static const char file_info_epoch_tag[] = "# Journal epoch ";
+static pslist_t *fi_journal_removed;	/**< GUIDs of entries removed */
+static time_t fi_journal_epoch;			/**< Epoch of last database write */
+static filesize_t fi_journal_size;		/**< Current size of journal */
+static filesize_t fi_snapshot_size;		/**< Size of the database */
+
+#define FI_JOURNAL_MIN	(64 * 1024)		/**< Minimum size before compaction */
+
+/**
+ * Mark fileinfo as needing to be persisted.
+ */
+static inline void
+file_info_journal(fileinfo_t *fi)
+{
+	fi->journal = TRUE;
+	fileinfo_dirty = TRUE;
+}
+
 #define	FILE_INFO_MAGIC32 0xD1BB1ED0U
 #define	FILE_INFO_MAGIC64 0X91E63640U
 
@@ -673,6 +708,143 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
+/**
+ * Compares two chunks so that two chunks are equal when they overlap.
+ */
+static int
+fi_chunk_overlap_cmp(const void *a, const void *b)
+{
+	const struct dl_file_chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+/**
+ * Append chunk at the end of the chunk list.
+ *
+ * A chunk overlapping with an already indexed one is not inserted in the
+ * tree, which will be caught by file_info_check_chunklist().
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	eslist_append(&fi->chunklist, fc);
+	(void) erbtree_insert(&fi->chunktree, &fc->node);
+}
+
+/**
+ * Insert new chunk `nfc' right after `fc' in the chunk list.
+ *
+ * The range of `fc' must have already been adjusted so that `nfc' does not
+ * overlap with it.
+ */
+static void
+fi_chunk_insert_after(fileinfo_t *fi,
+	struct dl_file_chunk *fc, struct dl_file_chunk *nfc)
+{
+	void *old;
+
+	eslist_insert_after(&fi->chunklist, fc, nfc);
+	old = erbtree_insert(&fi->chunktree, &nfc->node);
+
+	g_assert(NULL == old);
+}
+
+/**
+ * Remove the chunk following `fc' in the chunk list.
+ *
+ * @return the removed chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *removed;
+
+	removed = eslist_remove_after(&fi->chunklist, fc);
+	dl_file_chunk_check(removed);
+	erbtree_remove(&fi->chunktree, &removed->node);
+
+	return removed;
+}
+
+/**
+ * Find the chunk holding the byte at `pos'.
+ *
+ * @return the chunk, NULL if none covers that offset.
+ */
+static struct dl_file_chunk *
+fi_chunk_lookup(const fileinfo_t *fi, filesize_t pos)
+{
+	struct dl_file_chunk key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return erbtree_lookup(&fi->chunktree, &key);
+}
+
+/**
+ * @return the chunk preceding `fc' in the file, NULL if it is the first one.
+ */
+static struct dl_file_chunk *
+fi_chunk_prev(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	return erbtree_data(&fi->chunktree, erbtree_prev(&fc->node));
+}
+
+/**
+ * Find the first empty chunk overlapping with [from, to[.
+ *
+ * @return the chunk, NULL if none.
+ */
+static struct dl_file_chunk *
+fi_chunk_lookup_empty(const fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	struct dl_file_chunk key;
+	rbnode_t *rn, *prev;
+
+	key.from = from;
+	key.to = to;
+
+	rn = erbtree_getnode(&fi->chunktree, &key);
+
+	if (NULL == rn)
+		return NULL;
+
+	/*
+	 * We got one of the chunks overlapping with the range, move back to
+	 * the first one.
+	 */
+
+	while (NULL != (prev = erbtree_prev(rn))) {
+		const struct dl_file_chunk *fc = erbtree_data(&fi->chunktree, prev);
+
+		if (fc->to <= from)
+			break;
+		rn = prev;
+	}
+
+	for (; rn != NULL; rn = erbtree_next(rn)) {
+		struct dl_file_chunk *fc = erbtree_data(&fi->chunktree, rn);
+
+		dl_file_chunk_check(fc);
+
+		if (fc->from >= to)
+			break;
+
+		if (DL_CHUNK_EMPTY == fc->status)
+			return fc;
+	}
+
+	return NULL;
+}
+
 static struct dl_avail_chunk *
 dl_avail_chunk_alloc(void)
 {
@@ -741,6 +913,9 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 
 	file_info_check(fi);
 
+	if (eslist_count(&fi->chunklist) != erbtree_count(&fi->chunktree))
+		return FALSE;
+
 	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
 		dl_file_chunk_check(fc);
 		if (last != fc->from || fc->from >= fc->to)
@@ -861,7 +1036,7 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	}
 
 	fi->dirty = FALSE;
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 
 	entropy_harvest_time();
 }
@@ -1131,6 +1306,7 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
+	erbtree_clear(&fi->chunktree);
 	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
 }
 
@@ -1304,7 +1480,7 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	fc->from = fi->size;
 	fc->to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1344,7 +1520,7 @@ file_info_resize(fileinfo_t *fi, filesize_t size)
 
 	if (!(fi->flags & FI_F_TRANSIENT)) {
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 }
 
@@ -1908,6 +2084,8 @@ file_info_allocate(void)
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
 	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
+	erbtree_init(&fi->chunktree, fi_chunk_overlap_cmp,
+		offsetof(struct dl_file_chunk, node));
 	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
 
 	return fi;
@@ -2169,7 +2347,7 @@ G_STMT_START {				\
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2257,8 +2435,10 @@ eof:
 /**
  * Stores a file info record to the config_dir/fileinfo file, and
  * appends it to the output file in question if needed.
+ *
+ * @return TRUE if a record was written, FALSE if the entry is not persisted.
  */
-static void
+static bool
 file_info_store_one(FILE *f, fileinfo_t *fi)
 {
 	slink_t *cl;
@@ -2278,7 +2458,7 @@ file_info_store_one(FILE *f, fileinfo_t *fi)
 		goto persist;		/* Skip trailer writes, of course */
 
 	if (fi->flags & (FI_F_TRANSIENT | FI_F_SEEDING | FI_F_STRIPPED))
-		return;
+		return FALSE;
 
 	if (fi->use_swarming && fi->dirty) {
 		file_info_store_binary(fi, FALSE);
@@ -2295,7 +2475,7 @@ persist:
 		filestat_t st;
 
 		if (-1 == stat(fi->pathname, &st)) {
-			return; 	/* Skip: not referenced, and file no longer exists */
+			return FALSE;	/* Skip: not referenced, and file no longer exists */
 		}
 	}
 
@@ -2375,6 +2555,8 @@ persist:
 			(uint) fc->status);
 	}
 	fprintf(f, "\n");
+
+	return TRUE;
 }
 
 /**
@@ -2386,7 +2568,30 @@ file_info_store_list(void *value, void *user_data)
 	fileinfo_t *fi = value;
 
 	file_info_check(fi);
-	file_info_store_one(user_data, fi);
+	(void) file_info_store_one(user_data, fi);
+	fi->journal = FALSE;
+}
+
+/**
+ * Discard the fileinfo journal, once the database has been written.
+ */
+static void
+file_info_journal_clear(void)
+{
+	pslist_t *sl;
+	char *path;
+
+	PSLIST_FOREACH(fi_journal_removed, sl) {
+		atom_guid_free(sl->data);
+	}
+	pslist_free_null(&fi_journal_removed);
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+	if (-1 == unlink(path) && ENOENT != errno)
+		g_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, path);
+	HFREE_NULL(path);
+
+	fi_journal_size = 0;
 }
 
 /**
@@ -2433,9 +2638,80 @@ file_info_store(void)
 		f
 	);
 
+	/*
+	 * A new epoch prevents any journal from being applied to this version
+	 * of the database.
+	 */
+
+	fi_journal_epoch = MAX(tm_time(), fi_journal_epoch + 1);
+	fprintf(f, "%s%lu\n\n", file_info_epoch_tag, (ulong) fi_journal_epoch);
+
 	hikset_foreach(fi_by_outname, file_info_store_list, f);
 
-	file_config_close(f, &fp);
+	fi_snapshot_size = ftell(f);
+
+	if (file_config_close(f, &fp))
+		file_info_journal_clear();
+
+	fileinfo_dirty = FALSE;
+}
+
+/**
+ * Callback for hash table iterator. Used by file_info_journal_flush().
+ */
+static void
+file_info_journal_one(void *value, void *user_data)
+{
+	fileinfo_t *fi = value;
+	FILE *f = user_data;
+
+	file_info_check(fi);
+
+	if (!fi->journal && !fi->dirty)
+		return;
+
+	if (!file_info_store_one(f, fi))
+		fprintf(f, "DELE %s\n\n", guid_hex_str(fi->guid));
+
+	fi->journal = FALSE;
+}
+
+/**
+ * Append the records of the entries changed since the last save to the
+ * journal.
+ */
+static void
+file_info_journal_flush(void)
+{
+	FILE *f;
+	pslist_t *sl;
+	char *path;
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+	f = file_fopen(path, "a");
+	HFREE_NULL(path);
+
+	if (NULL == f)
+		return;
+
+	if (0 == fi_journal_size)
+		fprintf(f, "%s%lu\n\n", file_info_epoch_tag, (ulong) fi_journal_epoch);
+
+	PSLIST_FOREACH(fi_journal_removed, sl) {
+		fprintf(f, "DELE %s\n\n", guid_hex_str(sl->data));
+		atom_guid_free(sl->data);
+	}
+	pslist_free_null(&fi_journal_removed);
+
+	hikset_foreach(fi_by_outname, file_info_journal_one, f);
+
+	fi_journal_size = ftell(f);
+
+	if (0 != file_sync_fclose(f)) {
+		g_warning("%s(): cannot flush %s: %m",
+			G_STRFUNC, file_info_journal_what);
+	}
+
 	fileinfo_dirty = FALSE;
 }
 
@@ -2445,8 +2721,21 @@ file_info_store(void)
 void
 file_info_store_if_dirty(void)
 {
-	if (fileinfo_dirty)
+	if (!fileinfo_dirty)
+		return;
+
+	/*
+	 * Only rewrite the whole database when the journal becomes larger,
+	 * otherwise only append the changed entries to the journal.
+	 */
+
+	if (
+		0 == fi_journal_epoch ||
+		fi_journal_size >= MAX(fi_snapshot_size, FI_JOURNAL_MIN)
+	)
 		file_info_store();
+	else
+		file_info_journal_flush();
 }
 
 /*
@@ -2612,6 +2901,7 @@ void G_COLD
 file_info_close(void)
 {
 	unsigned i;
+	pslist_t *sl;
 
 	/*
 	 * Freeing callbacks expect that the freeing of the `fi_by_outname'
@@ -2648,6 +2938,11 @@ file_info_close(void)
 	hikset_free_null(&fi_by_guid);
 	hikset_free_null(&fi_by_outname);
 
+	PSLIST_FOREACH(fi_journal_removed, sl) {
+		atom_guid_free(sl->data);
+	}
+	pslist_free_null(&fi_journal_removed);
+
 	HFREE_NULL(tbuf.arena);
 }
 
@@ -2723,6 +3018,8 @@ file_info_hash_insert(fileinfo_t *fi)
 		file_info_hash_insert_name_size(fi);
 	}
 
+	file_info_journal(fi);
+
 transient:
 	/*
 	 * Obviously, GUID entries must be unique as well.
@@ -2797,6 +3094,16 @@ file_info_hash_remove(fileinfo_t *fi)
 	if (fi->file_size_known)
 		file_info_hash_remove_name_size(fi);
 
+	/*
+	 * Record the removal in the journal, so that the entry is not
+	 * resurrected should we be restarted before the next full save.
+	 */
+
+	fi_journal_removed =
+		pslist_prepend(fi_journal_removed, deconstify_pointer(
+			atom_guid_get(fi->guid)));
+	fileinfo_dirty = TRUE;
+
 transient:
 	hikset_remove(fi_by_guid, fi->guid);
 
@@ -2830,7 +3137,7 @@ file_info_upload_stop(fileinfo_t *fi, const char *reason)
 		}
 
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 }
 
@@ -2853,7 +3160,7 @@ file_info_pause(fileinfo_t *fi)
 	if (!(FI_F_PAUSED & fi->flags)) {
 		fi->flags |= FI_F_PAUSED;
 		file_info_changed(fi);
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 }
 
@@ -3136,7 +3443,7 @@ fi_reset_chunks(fileinfo_t *fi)
 		fc->from = 0;
 		fc->to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->generation = 0;		/* Restarting from scratch... */
@@ -3165,12 +3472,260 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 		dl_file_chunk_check(fc);
 		g_assert(fc->from <= fc->to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		fi_chunk_append(fi, WCOPY(fc));
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
 }
 
+/**
+ * Read a whole physical line from file into string, including the trailing
+ * new-line character.
+ *
+ * @return TRUE if a line was read, FALSE on EOF.
+ */
+static bool
+file_info_journal_getline(FILE *f, str_t *s)
+{
+	char buf[1024];
+
+	str_reset(s);
+
+	while (fgets(buf, sizeof buf, f)) {
+		str_cat(s, buf);
+		if ('\n' == str_at(s, -1))
+			return TRUE;
+	}
+
+	return 0 != str_len(s);
+}
+
+/**
+ * Context for the journal replay.
+ */
+struct fi_replay {
+	htable_t *by_guid;		/**< GUID hex string => record (str_t) */
+	pslist_t *records;		/**< Records, in reverse file order */
+	str_t *header;			/**< Leading comment lines of the database */
+	time_t epoch;			/**< Epoch read from the file */
+	bool journal;			/**< Reading the journal? */
+};
+
+/**
+ * Apply a record read from the database or the journal.
+ *
+ * @param fr		the replay context
+ * @param rec		the record text, without its terminating blank line
+ * @param guid		GUID hex string of the record (halloc-ed, taken over)
+ * @param dele		whether record is the deletion of the GUID entry
+ *
+ * @return the string to use for the next record.
+ */
+static str_t *
+file_info_journal_apply(struct fi_replay *fr,
+	str_t *rec, char *guid, bool dele)
+{
+	const void *key;
+	void *value;
+
+	if (NULL == guid) {
+		/* Leave the loader complain about the broken record */
+		fr->records = pslist_prepend(fr->records, rec);
+		return str_new(0);
+	}
+
+	if (htable_lookup_extended(fr->by_guid, guid, &key, &value)) {
+		str_t *old = value;
+
+		str_reset(old);			/* Empty records are not written back */
+		if (dele) {
+			htable_remove(fr->by_guid, key);
+			hfree(deconstify_pointer(key));
+		} else {
+			str_cat_len(old, str_2c(rec), str_len(rec));
+		}
+		str_reset(rec);
+		HFREE_NULL(guid);
+		return rec;
+	}
+
+	if (dele) {
+		str_reset(rec);
+		HFREE_NULL(guid);
+		return rec;
+	}
+
+	htable_insert(fr->by_guid, guid, rec);
+	fr->records = pslist_prepend(fr->records, rec);
+	return str_new(0);
+}
+
+/**
+ * Read all the records from the fileinfo database or its journal.
+ *
+ * @return FALSE if the journal was not written against the database.
+ */
+static bool
+file_info_journal_read(struct fi_replay *fr, FILE *f)
+{
+	str_t *line = str_new(0), *rec = str_new(0);
+	char *guid = NULL;
+	bool dele = FALSE, ok = TRUE, first = TRUE;
+
+	while (file_info_journal_getline(f, line)) {
+		const char *l;
+
+		if ('\n' != str_at(line, -1))
+			break;				/* Truncated write, ignore partial record */
+
+		str_chomp(line);
+		l = str_2c(line);
+
+		if (file_line_is_comment(l) && 0 == str_len(rec)) {
+			const char *p = is_strprefix(l, file_info_epoch_tag);
+
+			if (p != NULL) {
+				int error;
+				time_t epoch = parse_uint64(p, NULL, 10, &error);
+
+				if (fr->journal) {
+					if (!first || error || epoch != fr->epoch) {
+						ok = FALSE;
+						break;
+					}
+				} else if (!error) {
+					fr->epoch = epoch;
+				}
+			} else if (!fr->journal) {
+				str_catf(fr->header, "%s\n", l);
+			}
+		} else if (file_line_is_empty(l)) {
+			if (0 != str_len(rec) || dele)
+				rec = file_info_journal_apply(fr, rec, guid, dele);
+			guid = NULL;
+			dele = FALSE;
+		} else {
+			const char *p;
+
+			if (fr->journal && first) {
+				ok = FALSE;		/* Journal must start with its epoch */
+				break;
+			}
+
+			if (NULL != (p = is_strprefix(l, "DELE "))) {
+				HFREE_NULL(guid);
+				guid = h_strdup(p);
+				dele = TRUE;
+				continue;
+			}
+			if (NULL != (p = is_strprefix(l, "GUID ")) && NULL == guid)
+				guid = h_strdup(p);
+			str_catf(rec, "%s\n", l);
+		}
+
+		first = FALSE;
+	}
+
+	HFREE_NULL(guid);
+	str_destroy_null(&rec);
+	str_destroy_null(&line);
+
+	return ok;
+}
+
+/**
+ * Free keys of the replay table.
+ */
+static void
+file_info_journal_free_kv(const void *key, void *u_value, void *u_data)
+{
+	(void) u_value;
+	(void) u_data;
+
+	hfree(deconstify_pointer(key));
+}
+
+/**
+ * Apply the journal of changes, if any, to the fileinfo database so that
+ * the latter is brought up-to-date before we load it.
+ */
+static void G_COLD
+file_info_journal_replay(void)
+{
+	struct fi_replay fr;
+	file_path_t fp;
+	char *path;
+	FILE *f, *jf;
+	pslist_t *sl;
+	bool ok;
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+
+	if (!file_exists(path))
+		goto done;
+
+	file_path_set(&fp, settings_config_dir(), file_info_file);
+	f = file_config_open_read_norename(file_info_what, &fp, 1);
+	if (NULL == f)
+		goto discard;
+
+	ZERO(&fr);
+	fr.by_guid = htable_create(HASH_KEY_STRING, 0);
+	fr.header = str_new(0);
+
+	(void) file_info_journal_read(&fr, f);
+	fclose(f);
+
+	jf = file_fopen(path, "r");
+	if (NULL == jf) {
+		ok = FALSE;
+	} else {
+		fr.journal = TRUE;
+		ok = file_info_journal_read(&fr, jf);
+		fclose(jf);
+	}
+
+	if (!ok) {
+		g_warning("%s(): ignoring stale %s", G_STRFUNC, file_info_journal_what);
+	} else if (NULL != (f = file_config_open_write(file_info_what, &fp))) {
+		size_t n = 0;
+
+		fputs(str_2c(fr.header), f);
+		fputs("\n", f);
+
+		fr.records = pslist_reverse(fr.records);
+
+		PSLIST_FOREACH(fr.records, sl) {
+			str_t *rec = sl->data;
+
+			if (0 != str_len(rec)) {
+				fprintf(f, "%s\n", str_2c(rec));
+				n++;
+			}
+		}
+
+		if (file_config_close(f, &fp)) {
+			g_info("replayed %s, %zu fileinfo entr%s",
+				file_info_journal_what, n, plural_y(n));
+		}
+	}
+
+	PSLIST_FOREACH(fr.records, sl) {
+		str_destroy(sl->data);
+	}
+	pslist_free_null(&fr.records);
+	htable_foreach(fr.by_guid, file_info_journal_free_kv, NULL);
+	htable_free_null(&fr.by_guid);
+	str_destroy_null(&fr.header);
+
+discard:
+	if (-1 == unlink(path))
+		g_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, path);
+
+done:
+	HFREE_NULL(path);
+}
+
 /**
  * Loads the fileinfo database from disk, and saves a copy in fileinfo.orig.
  */
@@ -3201,6 +3756,8 @@ file_info_retrieve(void)
 
 	can_swarm = TRUE;			/* Allows file_info_try_to_swarm_with() */
 
+	file_info_journal_replay();
+
 	file_path_set(&fp, settings_config_dir(), file_info_file);
 	f = file_config_open_read(file_info_what, &fp, 1);
 	if (!f)
@@ -3799,7 +4356,7 @@ file_info_retrieve(void)
 							filesize_to_string(fi->size));
 						damaged = TRUE;
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3944,7 +4501,7 @@ file_info_create(const char *file, const char *path, filesize_t size,
 		fi->size = fc->to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4152,7 +4709,7 @@ file_info_moved(fileinfo_t *fi, const char *pathname)
 
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 	file_info_changed(fi);
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 }
 
 /**
@@ -4428,7 +4985,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 			void *removed;
 
 			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
+			removed = fi_chunk_remove_after(fi, fc1);
 			g_assert(removed == fc2);
 			dl_file_chunk_free(&fc2);
 			fc2 = fc1;					/* new current chunk */
@@ -4445,6 +5002,65 @@ file_info_merge_adjacent(fileinfo_t *fi)
 	g_assert(file_info_check_chunklist(fi, TRUE));
 }
 
+/**
+ * Merge adjacent chunks bearing the same status around [from, to[, the only
+ * part of the chunk list that was changed since the last merge.
+ *
+ * Contrary to file_info_merge_adjacent(), this does not recompute fi->done,
+ * hence it must only be used when the amount of completed data did not
+ * have to be corrected.
+ */
+static void
+file_info_merge_range(fileinfo_t *fi, filesize_t from, filesize_t to)
+{
+	struct dl_file_chunk *fc1, *fc2;
+	slink_t *sl;
+
+	file_info_check(fi);
+	g_assert(from < to);
+
+	fc1 = fi_chunk_lookup(fi, from);
+
+	if G_UNLIKELY(NULL == fc1) {
+		file_info_merge_adjacent(fi);
+		return;
+	}
+
+	fc2 = fi_chunk_prev(fi, fc1);
+	if (fc2 != NULL)
+		fc1 = fc2;				/* Start with the chunk before the range */
+
+	if (DL_CHUNK_DONE == fc1->status)
+		fc1->download = NULL;
+
+	while (NULL != (sl = eslist_next(&fc1->lk))) {
+		fc2 = eslist_data(&fi->chunklist, sl);
+		dl_file_chunk_check(fc2);
+
+		if (DL_CHUNK_DONE == fc2->status)
+			fc2->download = NULL;	/* Done, no longer reserved */
+
+		g_assert(fc1->to == fc2->from);
+
+		if (fc1->status == fc2->status && DL_CHUNK_BUSY != fc2->status) {
+			void *removed;
+
+			fc1->to = fc2->to;
+			removed = fi_chunk_remove_after(fi, fc1);
+			g_assert(removed == fc2);
+			dl_file_chunk_free(&fc2);
+			continue;
+		}
+
+		if (fc2->from >= to)
+			break;				/* Stop after the chunk following the range */
+
+		fc1 = fc2;
+	}
+
+	g_assert(file_info_check_chunklist(fi, TRUE));
+}
+
 /**
  * Signals that the file size became suddenly unknown.
  *
@@ -4460,7 +5076,7 @@ file_info_size_unknown(fileinfo_t *fi)
 	if (0 == (fi->flags & FI_F_TRANSIENT)) {
 		file_info_hash_remove_name_size(fi);
 		fi->dirty = TRUE;
-		fileinfo_dirty = TRUE;
+		file_info_journal(fi);
 	}
 
 	fi->file_size_known = FALSE;
@@ -4499,7 +5115,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			fc->to = fi->done;			/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
 			fc->to = fi->done;
 
@@ -4510,7 +5126,7 @@ file_info_size_known(struct download *d, filesize_t size)
 			while (NULL != eslist_next(&fc->lk)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
 		}
@@ -4529,14 +5145,14 @@ file_info_size_known(struct download *d, filesize_t size)
 		fc->to = size;				/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
 	fi->use_swarming = TRUE;
 	fi->size = MAX(size, fi->done);
 	fi->dirty = TRUE;
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 
 	if (0 == (FI_F_TRANSIENT & fi->flags)) {
 		file_info_hash_insert_name_size(fi);
@@ -4562,9 +5178,10 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 	slink_t *sl;
 	fileinfo_t *fi;
 	bool found = FALSE;
-	int n, againcount = 0;
-	bool need_merging;
+	int againcount = 0;
+	bool need_merging, need_recount = FALSE;
 	const struct download *newval;
+	filesize_t start = from, end;
 
 	download_check(d);
 	fi = d->file_info;
@@ -4635,10 +5252,13 @@ again:
 	 *		--RAM, 04/11/2002
 	 */
 
+	fc = fi_chunk_lookup(fi, from);
+	prevfc = NULL == fc ? NULL : fi_chunk_prev(fi, fc);
+
 	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
+		sl = NULL == fc ? NULL : &fc->lk;
 		sl != NULL;
-		n++, prevfc = fc, sl = eslist_next(sl)
+		prevfc = fc, sl = eslist_next(sl)
 	) {
 		fc = eslist_data(&fi->chunklist, sl);
 
@@ -4651,8 +5271,8 @@ again:
 
 			if (prevfc && prevfc->status == status)
 				need_merging = TRUE;
-			else if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
+			if (DL_CHUNK_DONE == fc->status)
+				need_recount = TRUE;		/* Writing to completed chunk! */
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
@@ -4666,8 +5286,8 @@ again:
 
 			if (prevfc && prevfc->status == status)
 				need_merging = TRUE;
-			else if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
+			if (DL_CHUNK_DONE == fc->status)
+				need_recount = TRUE;		/* Writing to completed chunk! */
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
@@ -4680,7 +5300,7 @@ again:
 		} else if (fc->from == from && fc->to > to) {
 
 			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
+				need_recount = TRUE;		/* Writing to completed chunk! */
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
@@ -4704,7 +5324,7 @@ again:
 				fc->to = to;
 				fc->status = status;
 				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 				g_assert(file_info_check_chunklist(fi, TRUE));
 			}
 
@@ -4718,18 +5338,21 @@ again:
 			 */
 
 			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;
+				need_recount = TRUE;
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += to - from;
 
-			if (fc->to > to) {
+			end = fc->to;
+			fc->to = from;		/* Shrink before indexing the new chunks */
+
+			if (end > to) {
 				nfc = dl_file_chunk_alloc();
 				nfc->from = to;
-				nfc->to = fc->to;
+				nfc->to = end;
 				nfc->status = fc->status;
 				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
+				fi_chunk_insert_after(fi, fc, nfc);
 
 				if (DL_CHUNK_BUSY == nfc->status) {
 					/*
@@ -4748,9 +5371,7 @@ again:
 			nfc->to = to;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-
-			fc->to = from;
+			fi_chunk_insert_after(fi, fc, nfc);
 
 			found = TRUE;
 			g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4761,20 +5382,21 @@ again:
 			filesize_t tmp;
 
 			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;
+				need_recount = TRUE;
 
 			if (DL_CHUNK_DONE == status)
 				fi->done += fc->to - from;
 
+			tmp = fc->to;
+			fc->to = from;
+
 			nfc = dl_file_chunk_alloc();
 			nfc->from = from;
-			nfc->to = fc->to;
+			nfc->to = tmp;
 			nfc->status = status;
 			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+			fi_chunk_insert_after(fi, fc, nfc);
 
-			tmp = fc->to;
-			fc->to = from;
 			from = tmp;
 			g_assert(file_info_check_chunklist(fi, TRUE));
 			goto again;
@@ -4797,8 +5419,10 @@ again:
 		}
 	}
 
-	if (need_merging)
+	if (need_recount)
 		file_info_merge_adjacent(fi);		/* Also updates fi->done */
+	else if (need_merging)
+		file_info_merge_range(fi, start, to);
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
@@ -4914,7 +5538,7 @@ restart:
 	}
 
 	file_info_merge_adjacent(fi);
-	fileinfo_dirty = TRUE;
+	file_info_journal(fi);
 }
 
 /**
@@ -4930,10 +5554,12 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, from);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
 
-		if (from >= fc->from && to <= fc->to)
+		if (to <= fc->to)
 			return fc->status;
 	}
 
@@ -4962,38 +5588,33 @@ file_info_new_chunk_owner(const struct download *d,
 {
 	fileinfo_t *fi;
 	const struct download *old = NULL;
-	const slink_t *sl;
+	struct dl_file_chunk *fc;
+	const slink_t *sl = NULL;
 
 	download_check(d);
 	fi = d->file_info;
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	/*
+	 * We're looking for the first busy chunk intersecting with [from, to],
+	 * which happens when one of the segment bounds lies within the chunk.
+	 */
 
-		dl_file_chunk_check(fc);
+	fc = fi_chunk_lookup(fi, from);
 
-		/*
-		 * We're looking for the first busy chunk intersecting with [from, to],
-		 * which happens when one of the segment bounds lies within the chunk.
-		 */
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		fc = fi_chunk_lookup(fi, to);
 
-		if (DL_CHUNK_BUSY != fc->status)
-			continue;
-
-		if (
-			(from >= fc->from && from < fc->to) ||
-			(to >= fc->from && to < fc->to)
-		) {
-			g_assert(fc->download != NULL);
-			download_check(fc->download);
-			g_assert(fc->download != d);
+	if (fc != NULL && DL_CHUNK_BUSY == fc->status) {
+		dl_file_chunk_check(fc);
+		g_assert(fc->download != NULL);
+		download_check(fc->download);
+		g_assert(fc->download != d);
 
-			old = fc->download;
-			fc->download = d;
-			break;
-		}
+		old = fc->download;
+		fc->download = d;
+		sl = &fc->lk;
 	}
 
 	if (old != NULL) {
@@ -5022,10 +5643,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -5118,23 +5740,6 @@ fi_available_log(const fileinfo_t *fi)
 	}
 }
 
-/**
- * Compares two offered ranges so that two ranges are equal when they overlap.
- */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_file_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping chunks are equal */
-}
-
 /**
  * Wrapper around http_rangeset_lookup_over() to simplify code logic in
  * fi_pick_rarest_chunk().
@@ -5178,7 +5783,6 @@ fi_rangeset_lookup_over(const http_rangeset_t *offered,
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
 	http_rangeset_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
@@ -5233,21 +5837,6 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		}
 	}
 
-	/*
-	 * The `missing' red-black tree contains the file chunks that are still
-	 * empty and need to be downloaded.
-	 */
-
-	missing = rbtree_create(fi_chunk_overlap_cmp);
-
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
-	}
-
 	/*
 	 * Find the first missing chunk that is also offered, starting with the
 	 * rarest available chunk: the fi->available list is sorted by increasing
@@ -5285,13 +5874,14 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 
 		while (NULL != (r = fi_rangeset_lookup_over(offered, fa, &r_dflt, r))) {
 			struct dl_file_chunk *dfc;
-			struct dl_file_chunk crange;
 			filesize_t start, end;
 
-			crange.from = r->start;
-			crange.to = r->end + 1;
+			/*
+			 * Find the first chunk still empty, hence needing to be
+			 * downloaded, within the range.
+			 */
 
-			dfc = rbtree_lookup(missing, &crange);
+			dfc = fi_chunk_lookup_empty(fi, r->start, r->end + 1);
 
 			if (NULL == dfc)
 				continue;	/* Rare range not overlapping with missing range */
@@ -5492,7 +6082,7 @@ selected:
 			nfc->status = dfc->status;
 			dfc->to = start;
 
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			fi_chunk_insert_after(fi, dfc, nfc);
 			candidate = nfc;
 
 			if (
@@ -5517,10 +6107,6 @@ selected:
 	/* FALL THROUGH */
 
 nothing:
-	rbtree_free_null(&missing);
-
-	/* FALL THROUGH */
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		if (candidate != NULL) {
@@ -5578,7 +6164,7 @@ fi_pick_chunk(fileinfo_t *fi)
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
-		const struct dl_file_chunk *fc;
+		struct dl_file_chunk *fc;
 		filesize_t last_chunk_offset;
 
 		/*
@@ -5591,7 +6177,11 @@ fi_pick_chunk(fileinfo_t *fi)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		fc = fi_chunk_lookup(fi, last_chunk_offset);
+		sl = NULL == fc ? NULL : &fc->lk;
+
+		for (; sl != NULL; sl = eslist_next(sl)) {
+			fc = eslist_data(&fi->chunklist, sl);
 			dl_file_chunk_check(fc);
 
 			if (DL_CHUNK_EMPTY != fc->status)
@@ -5730,7 +6320,7 @@ selected:
 		nfc->status = DL_CHUNK_EMPTY;
 		fc->to = nfc->from;
 
-		eslist_insert_after(&fi->chunklist, fc, nfc);
+		fi_chunk_insert_after(fi, fc, nfc);
 		candidate = nfc;
 	}
 
@@ -45,6 +45,7 @@
 #include "search.h"
 #include "settings.h"
 #include "sq.h"
+#include "tx_deflate.h"
 #include "vmsg.h"
 
 #include "g2/msg.h"
@@ -236,6 +237,7 @@ void G_COLD
 gmsg_close(void)
 {
 	zlib_deflater_free(gmsg_deflater, TRUE);
+	tx_deflate_share_close();
 }
 
 /**
@@ -750,6 +752,7 @@ gmsg_split_routeto_all_but_one(const gnutella_node_t *from,
 		skip_up_with_qrp = TRUE;
 
 	gmsg_header_check(head, size);
+	tx_deflate_share(mb);
 
 	/* relayed broadcasted message, cannot be sent with hops=0 */
 
@@ -782,6 +785,7 @@ gmsg_split_routeto_all(
 	pmsg_t *mb = gmsg_split_to_pmsg(head, data, size);
 
 	gmsg_header_check(head, size);
+	tx_deflate_share(mb);
 
 	/* relayed broadcasted message, cannot be sent with hops=0 */
 
@@ -48,7 +48,8 @@
 #include "settings.h"
 #include "share.h"
 #include "spam.h"
-#include "verify_sha1.h"
+#include "tth_cache.h"
+#include "verify_bitprint.h"
 #include "verify_tth.h"
 #include "version.h"
 
@@ -63,6 +64,7 @@
 #include "lib/hikset.h"
 #include "lib/parse.h"
 #include "lib/pattern.h"
+#include "lib/pslist.h"
 #include "lib/sha1.h"
 #include "lib/stringify.h"
 #include "lib/tm.h"
@@ -612,6 +614,60 @@ huge_need_sha1(shared_file_t *sf)
  * is put in a queue for it's SHA1 digest to be computed.
  */
 
+/*
+ * Verification jobs in progress, computing the SHA1 and the TTH.
+ *
+ * Several jobs can run concurrently in the verification threads, so the
+ * "rebuilding" properties are only cleared when the last job ends.
+ */
+static pslist_t *huge_sha1_jobs;
+static pslist_t *huge_tth_jobs;
+
+/**
+ * Record the start of a verification job.
+ */
+static void
+huge_job_start(pslist_t **jobs, const struct verify *ctx, property_t prop)
+{
+	if (NULL == *jobs)
+		gnet_prop_set_boolean_val(prop, TRUE);
+
+	*jobs = pslist_prepend(*jobs, deconstify_pointer(ctx));
+}
+
+/**
+ * Record the end of a verification job, if it was started.
+ */
+static void
+huge_job_end(pslist_t **jobs, const struct verify *ctx, property_t prop)
+{
+	if (NULL == pslist_find(*jobs, ctx))
+		return;		/* Job was not started */
+
+	*jobs = pslist_remove(*jobs, ctx);
+
+	if (NULL == *jobs)
+		gnet_prop_set_boolean_val(prop, FALSE);
+}
+
+/**
+ * Record the start of a TTH computation job.
+ */
+void
+huge_tth_job_start(const struct verify *ctx)
+{
+	huge_job_start(&huge_tth_jobs, ctx, PROP_TTH_REBUILDING);
+}
+
+/**
+ * Record the end of a TTH computation job, if it was started.
+ */
+void
+huge_tth_job_end(const struct verify *ctx)
+{
+	huge_job_end(&huge_tth_jobs, ctx, PROP_TTH_REBUILDING);
+}
+
 static bool
 huge_verify_callback(const struct verify *ctx, enum verify_status status,
 	void *user_data)
@@ -624,17 +680,37 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 	case VERIFY_START:
 		if (!huge_need_sha1(sf))
 			return FALSE;
-		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, TRUE);
+		huge_job_start(&huge_sha1_jobs, ctx, PROP_SHA1_REBUILDING);
+		if (verify_mask(ctx) & VERIFY_BITPRINT_TTH)
+			huge_job_start(&huge_tth_jobs, ctx, PROP_TTH_REBUILDING);
 		return TRUE;
 	case VERIFY_PROGRESS:
 		return shared_file_indexed(sf);
 	case VERIFY_DONE:
-		huge_update_hashes(sf, verify_sha1_digest(ctx), NULL);
-		request_tigertree(sf, TRUE);
+		{
+			const struct tth *tth = verify_bitprint_tth(ctx);
+
+			/*
+			 * Persist the TTH before updating the hashes, as done in
+			 * request_tigertree_callback(): huge_update_hashes() relies
+			 * on the TTH being already in the cache.
+			 */
+
+			if (tth != NULL) {
+				tth_cache_insert(tth, verify_bitprint_leaves(ctx),
+					verify_bitprint_leave_count(ctx));
+			}
+
+			huge_update_hashes(sf, verify_bitprint_sha1(ctx), tth);
+
+			if (NULL == tth)
+				request_tigertree(sf, TRUE);
+		}
 		/* FALL THROUGH */
 	case VERIFY_ERROR:
 	case VERIFY_SHUTDOWN:
-		gnet_prop_set_boolean_val(PROP_SHA1_REBUILDING, FALSE);
+		huge_job_end(&huge_sha1_jobs, ctx, PROP_SHA1_REBUILDING);
+		huge_job_end(&huge_tth_jobs, ctx, PROP_TTH_REBUILDING);
 		shared_file_unref(&sf);
 		return TRUE;
 	case VERIFY_INVALID:
@@ -647,18 +723,22 @@ huge_verify_callback(const struct verify *ctx, enum verify_status status,
 /**
  * Put the shared file on the stack of the things to do.
  *
- * We first begin with the computation of the SHA1, and when completed we
- * will continue with the TTH computation.
+ * The SHA1 and the TTH are computed in a single pass over the file, unless
+ * the TTH is already known, in which case only the SHA1 is computed.
  */
 static void
 queue_shared_file_for_sha1_computation(shared_file_t *sf)
 {
 	int inserted;
+	uint mask = VERIFY_BITPRINT_SHA1;
 
  	shared_file_check(sf);
 
-	inserted = verify_sha1_enqueue(FALSE, shared_file_path(sf),
-					shared_file_size(sf), huge_verify_callback,
+	if (!shared_file_tth_is_available(sf))
+		mask |= VERIFY_BITPRINT_TTH;
+
+	inserted = verify_bitprint_enqueue(FALSE, shared_file_path(sf),
+					shared_file_size(sf), mask, huge_verify_callback,
 					shared_file_ref(sf));
 
 	if (!inserted)
@@ -1102,6 +1182,8 @@ huge_close(void)
 
 	hikset_foreach(sha1_cache, cache_free_entry, NULL);
 	hikset_free_null(&sha1_cache);
+	pslist_free_null(&huge_sha1_jobs);
+	pslist_free_null(&huge_tth_jobs);
 
 	pattern_free(has_http_urls);
 	has_http_urls = NULL;
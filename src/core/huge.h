@@ -45,6 +45,7 @@ struct gnutella_host;
 struct shared_file;
 struct header;
 struct sha1;
+struct verify;
 
 void huge_init(void);		/**< Call this function at the beginning */
 void huge_close(void);		/**< Call this when servent is shutdown */
@@ -74,6 +75,9 @@ bool huge_cached_is_uptodate(const char *path, filesize_t size, time_t mtime);
 
 void huge_sha1_cache_prune(void);
 
+void huge_tth_job_start(const struct verify *ctx);
+void huge_tth_job_end(const struct verify *ctx);
+
 #endif	/* _core_huge_h_ */
 
 /*
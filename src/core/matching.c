@@ -38,7 +38,9 @@
 #include "lib/atoms.h"
 #include "lib/halloc.h"
 #include "lib/hset.h"
+#include "lib/htable.h"
 #include "lib/pattern.h"
+#include "lib/postings.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"	/* For hex_escape() */
 #include "lib/utf8.h"
@@ -84,6 +86,14 @@ typedef uint64 st_mask_t;
  *    bin["rc"] has 1
  *
  * Therefore we'll look for "arc" in the bin["rc"] list.
+ *
+ * Bins of common pairs hold a sizeable part of the library though, and
+ * a query made of several words is only narrowed down by its rarest pair.
+ * Therefore, sets can also index entries by the trigrams found within their
+ * words, each trigram pointing to the compressed posting list of the entries
+ * (given by their index in the set) where it appears.  Intersecting the
+ * lists of all the trigrams of the query words yields a superset of the
+ * matching entries, usually much smaller than the best bin.
  */
 
 #define ST_MIN_BIN_SIZE		4
@@ -103,6 +113,7 @@ struct st_set {
 	uint nentries, nchars, nbins;
 	struct st_bin **bins;
 	struct st_bin all_entries;
+	htable_t *trigrams;			/* trigram key -> postings_t, or NULL */
 	uchar index_map[MAX_INT_VAL(uchar)];
 	uchar fold_map[MAX_INT_VAL(uchar)];
 };
@@ -303,6 +314,9 @@ st_set_recreate(struct st_set *set)
 		set->bins[i] = NULL;
 
     bin_initialize(&set->all_entries, ST_MIN_BIN_SIZE);
+
+	set->trigrams = GNET_PROPERTY(search_posting_lists) ?
+		htable_create(HASH_KEY_SELF, 0) : NULL;
 }
 
 /**
@@ -317,6 +331,32 @@ st_recreate(search_table_t *table)
 	st_set_recreate(&table->alias);
 }
 
+/**
+ * htable_foreach() callback to free posting lists.
+ */
+static void
+st_free_postings(const void *unused_key, void *value, void *unused_udata)
+{
+	postings_t *pl = value;
+
+	(void) unused_key;
+	(void) unused_udata;
+
+	postings_free_null(&pl);
+}
+
+/**
+ * htable_foreach() callback to compact posting lists.
+ */
+static void
+st_compact_postings(const void *unused_key, void *value, void *unused_udata)
+{
+	(void) unused_key;
+	(void) unused_udata;
+
+	postings_compact(value);
+}
+
 /**
  * Destroy a set.
  */
@@ -325,6 +365,11 @@ st_set_destroy(struct st_set *set)
 {
 	uint i;
 
+	if (set->trigrams != NULL) {
+		htable_foreach(set->trigrams, st_free_postings, NULL);
+		htable_free_null(&set->trigrams);
+	}
+
 	if (set->bins) {
 		for (i = 0; i < set->nbins; i++) {
 			struct st_bin *bin = set->bins[i];
@@ -477,6 +522,52 @@ st_key(struct st_set *set, const char k[2])
 		set->index_map[(uchar) k[1]];
 }
 
+/**
+ * Get key of three-char sequence.
+ *
+ * @return the trigram key, or -1 if the sequence spans several words.
+ */
+static inline int
+st_trigram_key(const struct st_set *set, const char k[3])
+{
+	uint space = set->index_map[(uchar) ' '];
+	uint a = set->index_map[(uchar) k[0]];
+	uint b = set->index_map[(uchar) k[1]];
+	uint c = set->index_map[(uchar) k[2]];
+
+	if (space == a || space == b || space == c)
+		return -1;
+
+	return (a * set->nchars + b) * set->nchars + c;
+}
+
+/**
+ * Record entry in the posting lists of all the trigrams of its string.
+ */
+static void
+st_insert_trigrams(struct st_set *set, const char *s, size_t len, uint32 id)
+{
+	size_t i;
+
+	for (i = 0; i + 2 < len; i++) {
+		int key = st_trigram_key(set, &s[i]);
+		postings_t *pl;
+
+		if (key < 0)
+			continue;
+
+		pl = htable_lookup(set->trigrams, int_to_pointer(key));
+		if (NULL == pl) {
+			pl = postings_make();
+			htable_insert(set->trigrams, int_to_pointer(key), pl);
+		}
+
+		/* An entry is only recorded once, even if trigram repeats */
+
+		postings_append(pl, id);
+	}
+}
+
 /**
  * Insert an item into the search_table
  * one-char strings are silently ignored.
@@ -528,6 +619,8 @@ st_insert_item(search_table_t *table,
 
 		bin_insert_item(set->bins[key], entry);
 	}
+	if (set->trigrams != NULL)
+		st_insert_trigrams(set, entry->string, len, set->all_entries.nvals);
 	bin_insert_item(&set->all_entries, entry);
 	set->nentries++;
 
@@ -552,6 +645,9 @@ st_set_compact(struct st_set *set)
 		if (set->bins[i])
 			bin_compact(set->bins[i]);
 	}
+
+	if (set->trigrams != NULL)
+		htable_foreach(set->trigrams, st_compact_postings, NULL);
 }
 
 /**
@@ -656,6 +752,121 @@ st_bin_name(const char *str)
 	return buf;
 }
 
+/**
+ * Compute the candidate entries for a query by intersecting the posting
+ * lists of all the trigrams in the query words.
+ *
+ * @param set		set containing organized entries to search from
+ * @param wovec		the query words
+ * @param wocnt		amount of words in wovec[]
+ * @param ids_ptr	where the allocated array of entry indices is returned
+ * @param cnt_ptr	where the amount of entry indices is returned
+ *
+ * @return FALSE if no query word is long enough to have trigrams, in which
+ * case nothing is returned.
+ */
+static bool
+st_trigram_candidates(const struct st_set *set,
+	const word_vec_t *wovec, uint wocnt, uint32 **ids_ptr, size_t *cnt_ptr)
+{
+	const postings_t **lists = NULL;
+	size_t i, j, n = 0, max = 0, cnt = 0, maxcnt = 0;
+	uint32 *ids = NULL, *buf, *tmp;
+
+	g_assert(set->trigrams != NULL);
+
+	/*
+	 * Collect the distinct posting lists, a missing trigram meaning that
+	 * no entry can match.
+	 */
+
+	for (i = 0; i < wocnt; i++) {
+		const char *word = wovec[i].word;
+
+		for (j = 0; j + 2 < wovec[i].len; j++) {
+			int key = st_trigram_key(set, &word[j]);
+			const postings_t *pl;
+			size_t k;
+
+			if (key < 0)
+				continue;
+
+			pl = htable_lookup(set->trigrams, int_to_pointer(key));
+			if (NULL == pl)
+				goto empty;
+
+			for (k = 0; k < n; k++) {
+				if (lists[k] == pl)
+					break;
+			}
+			if (k != n)
+				continue;
+
+			if (n == max) {
+				max = MAX(8, max * 2);
+				HREALLOC_ARRAY(lists, max);
+			}
+			lists[n++] = pl;
+			maxcnt = MAX(maxcnt, postings_count(pl));
+		}
+	}
+
+	if (0 == n)
+		return FALSE;
+
+	/*
+	 * Start with the smallest list, so that intermediate results are
+	 * as small as possible.
+	 */
+
+	for (i = 1; i < n; i++) {
+		const postings_t *pl = lists[i];
+		size_t count = postings_count(pl);
+
+		for (j = i; j > 0 && postings_count(lists[j-1]) > count; j--)
+			lists[j] = lists[j-1];
+		lists[j] = pl;
+	}
+
+	HALLOC_ARRAY(ids, postings_count(lists[0]));
+	cnt = postings_decode(lists[0], ids);
+
+	if (n > 1) {
+		HALLOC_ARRAY(buf, maxcnt);
+		HALLOC_ARRAY(tmp, cnt);
+
+		for (i = 1; i < n && cnt != 0; i++) {
+			uint32 *swap;
+			size_t bcnt = postings_decode(lists[i], buf);
+
+			cnt = postings_intersect(ids, cnt, buf, bcnt, tmp);
+			swap = ids;
+			ids = tmp;
+			tmp = swap;
+		}
+
+		HFREE_NULL(buf);
+		HFREE_NULL(tmp);
+	}
+
+	if (GNET_PROPERTY(matching_debug) > 2) {
+		g_debug("MATCH %s(): intersected %zu posting list%s: "
+			"%zu entr%s, smallest list had %zu",
+			G_STRFUNC, PLURAL(n), PLURAL_Y(cnt), postings_count(lists[0]));
+	}
+
+	HFREE_NULL(lists);
+	*ids_ptr = ids;
+	*cnt_ptr = cnt;
+	return TRUE;
+
+empty:
+	HFREE_NULL(lists);
+	*ids_ptr = NULL;
+	*cnt_ptr = 0;
+	return TRUE;
+}
+
 enum search_mode {
 	SEARCH_NORMAL,		/* Original query string */
 	SEARCH_ALIAS		/* Query mangled with normalized aliases */
@@ -696,6 +907,8 @@ st_run_search(
 	cpattern_t **pattern;
 	struct st_entry **vals;
 	uint vcnt;
+	uint32 *ids = NULL;
+	size_t idcnt = 0;
 	int scanned = 0;		/* measure search mask efficiency */
 	pslist_t *local;
 	st_mask_t search_mask;
@@ -840,16 +1053,29 @@ st_run_search(
 		shared_file_name_canonic_len : shared_file_name_normalized_len;
 
 	/*
-	 * Search through the smallest bin
+	 * Search through the smallest bin, unless the intersection of the
+	 * trigram posting lists gives us less candidates.
 	 */
 
 	vcnt = best_bin->nvals;
 	vals = best_bin->vals;
 
+	if (
+		set->trigrams != NULL &&
+		st_trigram_candidates(set, wovec, wocnt, &ids, &idcnt)
+	) {
+		if (idcnt < vcnt) {
+			vcnt = idcnt;
+			vals = set->all_entries.vals;
+		} else {
+			HFREE_NULL(ids);
+		}
+	}
+
 	nres = 0;
 	local = *result;
 	for (i = 0; i < vcnt; i++) {
-		const struct st_entry *e = vals[i];
+		const struct st_entry *e = NULL == ids ? vals[i] : vals[ids[i]];
 		const shared_file_t *sf;
 		size_t filename_len;
 
@@ -906,9 +1132,10 @@ st_run_search(
 		}
 
 		g_debug("MATCH %s(): "
-			"scanned %d/%d bin entr%s, "
+			"scanned %d/%u %s entr%s, "
 			"compiled %u/%u pattern%s, got %d match%s",
-			G_STRFUNC, scanned, best_bin_size, plural_y(scanned),
+			G_STRFUNC, scanned, vcnt, NULL == ids ? "bin" : "trigram",
+			plural_y(scanned),
 			compiled, wocnt, plural(compiled), PLURAL_ES(nres));
 	}
 
@@ -926,6 +1153,7 @@ st_run_search(
 
 	WFREE_ARRAY(pattern, wocnt);
 	word_vec_free(wovec, wocnt);
+	HFREE_NULL(ids);
 
 	/* FALL THROUGH */
 
@@ -4939,6 +4939,7 @@ node_net_stack_create(gnutella_node_t *n)
 			g_debug("receiving compressed data from %s", node_infostr(n));
 
 		args.cb = &node_rx_inflate_cb;
+		args.threaded = TRUE;
 
 		n->rx = rx_make_above(n->rx, rx_inflate_get_ops(), &args);
 
@@ -4982,6 +4983,7 @@ node_net_stack_create(gnutella_node_t *n)
 		args.nagle = TRUE;
 		args.gzip = FALSE;
 		args.reduced = settings_is_ultra() && NODE_IS_LEAF(n);
+		args.threaded = TRUE;
 		args.buffer_size = NODE_TX_BUFSIZ;
 		args.buffer_flush = NODE_TX_FLUSH;
 
@@ -892,6 +892,7 @@ oob_send_reply_ind(struct oob_results *r)
  * to be replied to using out-of-band delivery.
  *
  * @param n				the node from which we got the query
+ * @param muid			the query's MUID
  * @param files			the list of shared_file_t entries that make up results
  * @param count			the amount of results
  * @param addr			address where we must send the OOB result indication
@@ -901,19 +902,22 @@ oob_send_reply_ind(struct oob_results *r)
  * @param flags			a combination of QHIT_F_* flags
  */
 void
-oob_got_results(gnutella_node_t *n, pslist_t *files,
+oob_got_results(gnutella_node_t *n, const guid_t *muid, pslist_t *files,
 	int count, host_addr_t addr, uint16 port,
 	bool secure, bool reliable, unsigned flags)
 {
 	struct oob_results *r;
 	gnet_host_t to;
-	const guid_t *muid;
 
 	g_assert(count > 0);
 	g_assert(files != NULL);
 
+	/*
+	 * The MUID is given explicitly because n->header can describe another
+	 * message by now, when the query was matched by a separate thread.
+	 */
+
 	gnet_host_set(&to, addr, port);
-	muid = gnutella_header_get_muid(&n->header);
 	r = results_make(muid, files, count, &to, secure, reliable, flags);
 	if (r != NULL) {
 		if (!oob_send_reply_ind(r))
@@ -61,6 +61,7 @@
 
 #include "lib/atoms.h"
 #include "lib/bg.h"
+#include "lib/cpufeat.h"
 #include "lib/cq.h"
 #include "lib/endian.h"
 #include "lib/halloc.h"
@@ -86,6 +87,11 @@
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
 
+#ifdef HAS_CPUFEAT_X86
+#include <immintrin.h>
+#define QRP_AVX2		/* Can compile the AVX2 bit operations */
+#endif
+
 #include "lib/override.h"			/* Must be the last header included */
 
 #define MIN_SPARSE_RATIO	1		/**< At most 1% of slots used */
@@ -571,6 +577,301 @@ qrt_compact(struct routing_table *rt)
 	}
 }
 
+/***
+ *** Operations on compacted arenas.
+ ***
+ *** Compacted arenas hold one bit per slot, slot #0 being bit 7 of byte 0.
+ *** The following routines process them a word at a time, or 32 bytes at
+ *** a time when the CPU supports AVX2.
+ ***/
+
+#ifdef QRP_AVX2
+/**
+ * OR `src' into `dst', 32 bytes at a time.
+ *
+ * @return amount of bytes processed, the tail being left to the caller.
+ */
+static size_t G_HOT G_TARGET("avx2")
+qrt_bits_or_x32(uint8 *dst, const uint8 *src, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i d = _mm256_loadu_si256((const __m256i *) &dst[i]);
+		__m256i s = _mm256_loadu_si256((const __m256i *) &src[i]);
+		_mm256_storeu_si256((__m256i *) &dst[i], _mm256_or_si256(d, s));
+	}
+
+	return i;
+}
+
+/**
+ * Store `a' XOR `b' into `dst', 32 bytes at a time.
+ *
+ * @param changed	set to TRUE if one of the resulting bytes is non-zero
+ *
+ * @return amount of bytes processed, the tail being left to the caller.
+ */
+static size_t G_HOT G_TARGET("avx2")
+qrt_bits_xor_x32(uint8 *dst, const uint8 *a, const uint8 *b, size_t len,
+	bool *changed)
+{
+	__m256i acc = _mm256_setzero_si256();
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32) {
+		__m256i va = _mm256_loadu_si256((const __m256i *) &a[i]);
+		__m256i vb = _mm256_loadu_si256((const __m256i *) &b[i]);
+		__m256i v = _mm256_xor_si256(va, vb);
+		_mm256_storeu_si256((__m256i *) &dst[i], v);
+		acc = _mm256_or_si256(acc, v);
+	}
+
+	if (!_mm256_testz_si256(acc, acc))
+		*changed = TRUE;
+
+	return i;
+}
+#endif	/* QRP_AVX2 */
+
+/**
+ * OR `len' bytes from `src' into `dst'.
+ */
+static void G_HOT
+qrt_bits_or(uint8 *dst, const uint8 *src, size_t len)
+{
+	size_t i = 0;
+
+#ifdef QRP_AVX2
+	if (cpufeat_has(CPUFEAT_AVX2))
+		i = qrt_bits_or_x32(dst, src, len);
+#endif
+
+	for (; i + 8 <= len; i += 8) {
+		uint64 d, s;
+
+		memcpy(&d, &dst[i], 8);
+		memcpy(&s, &src[i], 8);
+		d |= s;
+		memcpy(&dst[i], &d, 8);
+	}
+
+	for (; i < len; i++)
+		dst[i] |= src[i];
+}
+
+/**
+ * Store `a' XOR `b' into `dst', on `len' bytes.
+ *
+ * The `dst' arena may be the same as `a' or `b', but must not otherwise
+ * overlap them.
+ *
+ * @return whether the resulting arena has at least one bit set.
+ */
+static bool G_HOT
+qrt_bits_xor(uint8 *dst, const uint8 *a, const uint8 *b, size_t len)
+{
+	size_t i = 0;
+	uint64 acc = 0;
+	bool changed = FALSE;
+
+#ifdef QRP_AVX2
+	if (cpufeat_has(CPUFEAT_AVX2))
+		i = qrt_bits_xor_x32(dst, a, b, len, &changed);
+#endif
+
+	for (; i + 8 <= len; i += 8) {
+		uint64 x, y;
+
+		memcpy(&x, &a[i], 8);
+		memcpy(&y, &b[i], 8);
+		x ^= y;
+		memcpy(&dst[i], &x, 8);
+		acc |= x;
+	}
+
+	for (; i < len; i++) {
+		dst[i] = a[i] ^ b[i];
+		acc |= dst[i];
+	}
+
+	return changed || acc != 0;
+}
+
+/**
+ * @return amount of bits set in the `len' bytes of the arena.
+ */
+static size_t G_HOT
+qrt_bits_count(const uint8 *arena, size_t len)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		uint64 v;
+
+		memcpy(&v, &arena[i], 8);
+		n += bits_set64(v);
+	}
+
+	for (; i < len; i++)
+		n += bits_set(arena[i]);
+
+	return n;
+}
+
+/**
+ * Duplicate each bit of a byte, bit #k going to bits #2k and #2k+1.
+ */
+static inline uint16
+qrt_bits_spread2(uint8 x)
+{
+	uint32 v = x;
+
+	v = (v | (v << 4)) & 0x0f0f;
+	v = (v | (v << 2)) & 0x3333;
+	v = (v | (v << 1)) & 0x5555;
+
+	return v | (v << 1);
+}
+
+/**
+ * Quadruple each bit of a byte, bit #k going to bits #4k to #4k+3.
+ */
+static inline uint32
+qrt_bits_spread4(uint8 x)
+{
+	uint32 v = x;
+
+	v = (v | (v << 12)) & 0x000f000f;
+	v = (v | (v << 6))  & 0x03030303;
+	v = (v | (v << 3))  & 0x11111111;
+
+	return v * 0xf;
+}
+
+/**
+ * OR-merge `len' bytes of a compacted arena into a larger one, each slot
+ * of `src' covering `expand' slots in `dst'.
+ *
+ * @param dst		the destination arena, holding `len * expand' bytes
+ * @param src		the source arena
+ * @param len		amount of bytes to merge from `src'
+ * @param expand	the expansion factor, a power of 2
+ */
+static void G_HOT
+qrt_bits_merge(uint8 *dst, const uint8 *src, size_t len, int expand)
+{
+	size_t i;
+
+	g_assert(is_pow2(expand));
+
+	switch (expand) {
+	case 1:
+		qrt_bits_or(dst, src, len);
+		break;
+	case 2:
+		for (i = 0; i < len; i++) {
+			uint16 v;
+
+			if (0 == src[i])
+				continue;		/* "0 OR x = x" */
+
+			v = qrt_bits_spread2(src[i]);
+			dst[2 * i]     |= v >> 8;
+			dst[2 * i + 1] |= v & 0xff;
+		}
+		break;
+	case 4:
+		for (i = 0; i < len; i++) {
+			uint8 *p = &dst[4 * i];
+
+			if (0 == src[i])
+				continue;
+
+			poke_be32(p, peek_be32(p) | qrt_bits_spread4(src[i]));
+		}
+		break;
+	default:
+		/*
+		 * Each slot covers whole bytes in the destination.
+		 */
+		{
+			size_t n = expand / 8;
+
+			for (i = 0; i < len; i++) {
+				uint8 v = src[i];
+
+				while (v != 0) {
+					uint k = clz(v) - 24;		/* Slot in byte */
+
+					memset(&dst[(8 * i + k) * n], 0xff, n);
+					v &= ~(0x80U >> k);
+				}
+			}
+		}
+		break;
+	}
+}
+
+/**
+ * Shrink compacted arena inplace to use only `new_slots' instead of
+ * `old_slots'.  The memory area is also shrunk and the new location of
+ * the arena is returned.
+ */
+static void *
+qrt_shrink_bits(uint8 *arena, int old_slots, int new_slots)
+{
+	int factor;		/* Shrink factor */
+	int ratio;
+	int i;
+	uint8 mask = 0;
+
+	g_assert(old_slots > new_slots);
+	g_assert(is_pow2(old_slots));
+	g_assert(is_pow2(new_slots));
+	g_assert(new_slots >= 8);
+
+	ratio = highest_bit_set(old_slots) - highest_bit_set(new_slots);
+
+	g_assert(ratio > 0);
+
+	factor = 1 << ratio;
+
+	/*
+	 * A slot is set if any of the "factor" slots it covers in the larger
+	 * table is set.
+	 *
+	 * The new byte #j is only written once all its slots are known, and by
+	 * then we have read everything we needed from old byte #j.
+	 */
+
+	for (i = 0; i < new_slots; i++) {
+		bool set = FALSE;
+
+		if (factor >= 8) {
+			const uint8 *p = &arena[i * (factor / 8)];
+			int k;
+
+			for (k = 0; k < factor / 8 && !set; k++)
+				set = p[k] != 0;
+		} else {
+			uint j = i * factor;
+			uint8 m = ((1U << factor) - 1) << (8 - factor - (j & 0x7));
+
+			set = 0 != (arena[j >> 3] & m);
+		}
+
+		mask = (mask << 1) | (set ? 1 : 0);
+
+		if (0x7 == (i & 0x7)) {
+			arena[i >> 3] = mask;
+			mask = 0;
+		}
+	}
+
+	return hrealloc(arena, new_slots / 8);
+}
+
 /**
  * Computes the SHA1 of a compacted routing table.
  * @returns a pointer to static data.
@@ -704,11 +1005,37 @@ qrt_diff_4(struct routing_table *old, struct routing_table *new)
 	np = new->arena;
 
 	for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-		uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-		uint8 nbyte = *np++;
+		uint8 obyte, nbyte;
 		int j;
 		uint8 v;
 
+		/*
+		 * Most of the table is usually unchanged: compare 64 slots at a
+		 * time and generate the 32 bytes of 0 quartets at once when they
+		 * are identical.
+		 */
+
+		if (0 == (i & 0x7) && i + 8 <= bytes) {
+			uint64 ow = 0, nw;
+
+			if (op != NULL)
+				memcpy(&ow, op, 8);
+			memcpy(&nw, np, 8);
+
+			if (ow == nw) {
+				memset(pp, 0, 32);
+				pp += 32;
+				np += 8;
+				if (op != NULL)
+					op += 8;
+				i += 7;
+				continue;
+			}
+		}
+
+		obyte = op ? *op++ : 0x0;	/* Nothing */
+		nbyte = *np++;
+
 		/*
 		 * Optimize computation: if bytes are equal, we can immediately
 		 * generate 8 quartets of 0, i.e. 4 bytes.
@@ -818,34 +1145,21 @@ qrt_diff_1(struct routing_table *old, struct routing_table *new, bool reverse)
 	 * This is the truth table of XOR.
 	 */
 
-	if (reverse) {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-			uint8 v = obyte ^ *np++;
+	bytes = new->slots / 8;
 
-			if G_LIKELY(0 == v) {
-				*pp++ = v;
-			} else {
-				*pp++ = reverse_byte(v);
-				changed = TRUE;
-			}
-		}
+	if (op != NULL) {
+		changed = qrt_bits_xor(pp, op, np, bytes);
 	} else {
-		for (i = 0, bytes = new->slots / 8; i < bytes; i++) {
-			uint8 obyte = op ? *op++ : 0x0;	/* Nothing */
-			uint8 v = obyte ^ *np++;
-
-			*pp++ = v;
+		memcpy(pp, np, bytes);			/* Nothing XOR new = new */
+	}
 
-			if G_UNLIKELY(v != 0)
-				changed = TRUE;
+	if (reverse) {
+		for (i = 0; i < bytes; i++) {
+			if G_UNLIKELY(pp[i] != 0)
+				pp[i] = reverse_byte(pp[i]);
 		}
 	}
 
-	g_assert(np == (new->arena + new->slots / 8));
-	g_assert(op == NULL || op == (old->arena + old->slots / 8));
-	g_assert(pp == (rp->arena + rp->len));
-
 	if (!changed && old != NULL) {
 		qrt_patch_free(rp);
 		return NULL;
@@ -1060,11 +1374,11 @@ qrt_patch_compress(struct routing_patch *rp, bgtask_t *bt,
 }
 
 /**
- * Create a new query routing table, with supplied `arena' and `slots'.
+ * Allocate a new query routing table, with supplied `arena' and `slots'.
  * The value used for infinity is given as `max'.
  */
 static struct routing_table *
-qrt_create(const char *name, char *arena, int slots, int max)
+qrt_alloc(const char *name, void *arena, int slots, int max)
 {
 	struct routing_table *rt;
 
@@ -1076,7 +1390,7 @@ qrt_create(const char *name, char *arena, int slots, int max)
 
 	rt->magic         = QRP_ROUTE_MAGIC;
 	rt->name          = h_strdup(name);
-	rt->arena         = (uchar *) arena;
+	rt->arena         = arena;
 	rt->slots         = slots;
 	rt->generation    = generation++;
 	rt->refcnt        = 0;
@@ -1087,11 +1401,20 @@ qrt_create(const char *name, char *arena, int slots, int max)
 	rt->can_route_urn = qrp_can_route_default;
 	rt->can_route     = qrp_can_route_default;
 
-	qrt_compact(rt);
+	return rt;
+}
+
+/**
+ * Finish the creation of a compacted routing table.
+ */
+static struct routing_table *
+qrt_created(struct routing_table *rt)
+{
+	g_assert(rt->compacted);
 
 	gnet_prop_set_guint32_val(PROP_QRP_GENERATION, (uint32) rt->generation);
 	gnet_prop_set_guint32_val(PROP_QRP_MEMORY,
-		GNET_PROPERTY(qrp_memory) + slots / 8);
+		GNET_PROPERTY(qrp_memory) + rt->slots / 8);
 
 	if (qrp_debugging(2))
 		rt->digest = atom_sha1_get(qrt_sha1(rt));
@@ -1105,6 +1428,43 @@ qrt_create(const char *name, char *arena, int slots, int max)
 	return rt;
 }
 
+/**
+ * Create a new query routing table, with supplied `arena' and `slots'.
+ * The value used for infinity is given as `max'.
+ *
+ * The arena uses one byte per slot and is compacted by this routine.
+ */
+static struct routing_table *
+qrt_create(const char *name, char *arena, int slots, int max)
+{
+	struct routing_table *rt;
+
+	rt = qrt_alloc(name, arena, slots, max);
+	qrt_compact(rt);
+
+	return qrt_created(rt);
+}
+
+/**
+ * Create a new query routing table from an already compacted `arena'
+ * holding `slots' bits.
+ */
+static struct routing_table *
+qrt_create_compacted(const char *name, uint8 *arena, int slots)
+{
+	struct routing_table *rt;
+
+	g_assert(slots >= 8);
+	g_assert(0 == (slots & 0x7));
+
+	rt = qrt_alloc(name, arena, slots, LOCAL_INFINITY);
+	rt->len = slots / 8;
+	rt->set_count = qrt_bits_count(arena, rt->len);
+	rt->compacted = TRUE;
+
+	return qrt_created(rt);
+}
+
 /**
  * Create small empty table.
  */
@@ -1138,48 +1498,6 @@ qrt_free(struct routing_table *rt)
 	WFREE(rt);
 }
 
-/**
- * Shrink arena inplace to use only `new_slots' instead of `old_slots'.
- * The memory area is also shrunk and the new location of the arena is
- * returned.
- */
-static void *
-qrt_shrink_arena(char *arena, int old_slots, int new_slots, int inf_val)
-{
-	int factor;		/* Shrink factor */
-	int ratio;
-	int i, j;
-
-	g_assert(old_slots > new_slots);
-	g_assert(is_pow2(old_slots));
-	g_assert(is_pow2(new_slots));
-
-	ratio = highest_bit_set(old_slots) - highest_bit_set(new_slots);
-
-	g_assert(ratio >= 0);
-
-	factor = 1 << ratio;
-
-	/*
-	 * The shrinking algorithm: an entry is "set" to contain something if
-	 * any of the "factor" entries in the larger table contain something.
-	 */
-
-	for (i = 0, j = 0; i < new_slots && j < old_slots; i++, j += factor) {
-		int k;
-		int set = FALSE;
-
-		for (k = 0; k < factor && !set; k++) {
-			if ((uchar) arena[j + k] != inf_val)
-				set = TRUE;
-		}
-
-		arena[i] = set ? 0 : inf_val;
-	}
-
-	return hrealloc(arena, new_slots);
-}
-
 /**
  * @returns the query routing table, NULL if not computed yet.
  */
@@ -1276,7 +1594,7 @@ enum merge_magic {
 struct merge_context {
 	enum merge_magic magic;
 	pslist_t *tables;			/* Leaf routing tables */
-	uchar *arena;				/* Working arena (not compacted) */
+	uint8 *arena;				/* Working arena (compacted) */
 	int slots;					/* Amount of slots used for merged table */
 };
 
@@ -1371,10 +1689,8 @@ mrg_step_get_list(struct bgtask *unused_h, void *u, int unused_ticks)
 	g_assert(max_size > 0 || ctx->tables == NULL);
 
 	ctx->slots = max_size;
-	if (max_size > 0) {
-		ctx->arena = halloc(max_size);
-		memset(ctx->arena, LOCAL_INFINITY, max_size);
-	}
+	if (max_size > 0)
+		ctx->arena = halloc0(max_size / 8);		/* All slots empty */
 
 	return BGR_NEXT;
 }
@@ -1383,17 +1699,13 @@ mrg_step_get_list(struct bgtask *unused_h, void *u, int unused_ticks)
  * Merge routing table into specified arena.
  *
  * @param rt is the routing table to merge
- * @param arena is a non-compacted arena
+ * @param arena is a compacted arena
  * @param slots is the number of slots in the arena
  */
 static void
-merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
+merge_table_into_arena(struct routing_table *rt, uint8 *arena, int slots)
 {
 	int ratio;
-	int expand;
-	int i;
-	int b;
-	int bytes;
 
 	/*
 	 * By construction, the size of the arena is the max of all the sizes
@@ -1410,94 +1722,15 @@ merge_table_into_arena(struct routing_table *rt, uchar *arena, int slots)
 	ratio = highest_bit_set(slots) - highest_bit_set(rt->slots);
 
 	g_assert(ratio >= 0);
-
-	expand = 1 << ratio;
-	bytes = rt->slots / 8;
-
-	g_assert(rt->slots * expand <= slots);	/* Won't overflow */
+	g_assert(rt->slots << ratio <= slots);	/* Won't overflow */
 
 	/*
-	 * Loop over the supplied QRT, and expand each slot `expand' times into
-	 * the arena, doing an "OR" merging.
-	 *
-	 * Since this is going to be a tight loop, try to optimize the smallest
-	 * expansion factors by avoiding memset() calls.
-	 *
-	 * Furthermore, we avoid repeated RT_SLOT_READ() calls by accessing the
-	 * compacted table one byte at a time and then looping on each of its bits.
+	 * Expand each slot of the supplied QRT `1 << ratio' times into the
+	 * arena, doing an "OR" merging.  Since both are compacted, this is done
+	 * on whole bytes (or words) at once.
 	 */
 
-#define RT_FOR_EACH_BIT_SET(ON_CHANGE)				\
-for (b = 0, i = 0; b < bytes; b++) {				\
-	uint8 entry = rt->arena[b];						\
-	unsigned mask = 0x80;							\
-													\
-	do {											\
-		/* "0 OR x = x", hence skip unset bits */	\
-		if (entry & mask) {							\
-			ON_CHANGE								\
-		}											\
-		i++;										\
-		mask >>= 1;									\
-	} while (mask);									\
-}
-
-	switch (expand) {
-	case 1:
-		RT_FOR_EACH_BIT_SET(
-			arena[i] = 0;		/* less than "inf" => indicates presence */
-		);
-		break;
-	case 2:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 2;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j] = 0;
-		);
-		break;
-	case 4:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 4;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j] = 0;
-		);
-		break;
-	case 8:
-		RT_FOR_EACH_BIT_SET(
-			size_t j = i * 8;
-			arena[j++] = 0;		/* less than "inf" => indicates presence */
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j++] = 0;
-			arena[j] = 0;
-		);
-		break;
-	case 16:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * 16], 0, 16);
-		);
-		break;
-	case 32:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * 32], 0, 32);
-		);
-		break;
-	default:
-		RT_FOR_EACH_BIT_SET(
-			/* 0 is less than "infinity" => indicates presence */
-			memset(&arena[i * expand], 0, expand);
-		);
-		break;
-	}
-
-#undef RT_FOR_EACH_BIT_SET
+	qrt_bits_merge(arena, rt->arena, rt->slots / 8, 1 << ratio);
 }
 
 /**
@@ -1561,8 +1794,7 @@ mrg_step_install_table(struct bgtask *unused_h, void *u, int unused_ticks)
 	if (settings_is_ultra()) {
 		struct routing_table *mt;
 		if (ctx->slots != 0)
-			mt = qrt_create("Merged table",
-				cast_to_pointer(ctx->arena), ctx->slots, LOCAL_INFINITY);
+			mt = qrt_create_compacted("Merged table", ctx->arena, ctx->slots);
 		else {
 			g_assert(ctx->arena == NULL);
 			mt = qrt_empty_table("Empty merged table");
@@ -1900,8 +2132,7 @@ struct qrp_context {
 	struct routing_table *rt;	/**< The routing table object we computed */
 	struct routing_table *st;	/**< Smaller table */
 	struct routing_table *lt;	/**< Larger table for merging (destination) */
-	int sidx;					/**< Source index in `st' */
-	int lidx;					/**< Merging index in `lt' */
+	int sidx;					/**< Source byte index in `st' */
 	int expand;					/**< Expansion ratio from `st' to `lt' */
 	int npatch;					/**< Index of next patch to compute */
 	struct qrt_compress_context compress_ctx;
@@ -2447,7 +2678,7 @@ qrp_step_wait_for_merged_table(struct bgtask *h, void *u, int unused_ticks)
 	 *
 	 * Identify the smallest of the two tables, and put the smallest in `st'
 	 * and the largest in `lt'.  Then compute the expansion factor between
-	 * the two and allocate the arena for the merging.
+	 * the two and initialize the (compacted) merging arena with `lt'.
 	 */
 
 	g_assert(local_table != NULL);
@@ -2468,12 +2699,12 @@ qrp_step_wait_for_merged_table(struct bgtask *h, void *u, int unused_ticks)
 	g_assert(ratio >= 0);		/* By construction, lt is larger than st */
 
 	ctx->expand = 1 << ratio;
-	ctx->sidx = ctx->lidx = 0;
+	ctx->sidx = 0;
 
 	g_assert(ctx->table == NULL);
+	g_assert(ctx->lt->slots == ctx->slots);
 
-	ctx->table = halloc(ctx->slots);
-	memset(ctx->table, LOCAL_INFINITY, ctx->slots);
+	ctx->table = hcopy(ctx->lt->arena, ctx->slots / 8);
 
 	/* Ready for iterating */
 
@@ -2487,13 +2718,9 @@ static bgret_t
 qrp_step_merge_with_leaves(struct bgtask *unused_h, void *u, int ticks)
 {
 	struct qrp_context *ctx = u;
-	int used;
 	struct routing_table *st = ctx->st;
 	struct routing_table *lt = ctx->lt;
-	int max;
-	int i = ctx->sidx;
-	int expand = ctx->expand;
-	int j;
+	int max, len;
 
 	(void) unused_h;
 	g_assert(ctx->magic == QRP_MAGIC);
@@ -2510,27 +2737,21 @@ qrp_step_merge_with_leaves(struct bgtask *unused_h, void *u, int ticks)
 	g_assert(st->compacted);
 	g_assert(lt->compacted);
 
-	max = st->slots;
+	/*
+	 * The merging arena was initialized with `lt', which has the same size
+	 * as the merged table.  We OR the next bytes of `st' into it, each tick
+	 * accounting for one byte of `st', i.e. 8 slots.
+	 */
 
-	for (used = 0; used < ticks && i < max; i++, used++, ctx->sidx++) {
-		bool vs = RT_SLOT_READ(st->arena, i);
+	max = st->slots / 8;
+	len = MIN(ticks, max - ctx->sidx);
 
-		/*
-		 * Since `lt', the larger table, has the same size as the merged
-		 * table, the `ctx->lidx' also points to the next area to be merged
-		 * in the result.
-		 */
+	g_assert((ctx->sidx + len) * ctx->expand <= lt->slots / 8);
 
-		g_assert(ctx->lidx + expand <= lt->slots);	/* Won't overflow */
+	qrt_bits_merge((uint8 *) &ctx->table[ctx->sidx * ctx->expand],
+		&st->arena[ctx->sidx], len, ctx->expand);
 
-		for (j = 0; j < expand; j++) {
-			bool vl = RT_SLOT_READ(lt->arena, ctx->lidx);
-			if (vl || vs)
-				ctx->table[ctx->lidx++] = 0;	/* Present, less than oo */
-			else
-				ctx->table[ctx->lidx++] = LOCAL_INFINITY;	/* Absent => oo */
-		}
-	}
+	ctx->sidx += len;
 
 	return (ctx->sidx < max) ? BGR_MORE : BGR_NEXT;
 }
@@ -2567,8 +2788,8 @@ qrp_step_install_ultra(struct bgtask *h, void *u, int ticks)
 	 */
 
 	if (ctx->slots > MAX_UP_TABLE_SIZE) {
-		ctx->table = qrt_shrink_arena(
-			ctx->table, ctx->slots, MAX_UP_TABLE_SIZE, LOCAL_INFINITY);
+		ctx->table = qrt_shrink_bits(
+			(uint8 *) ctx->table, ctx->slots, MAX_UP_TABLE_SIZE);
 		ctx->slots = MAX_UP_TABLE_SIZE;
 	}
 
@@ -2576,7 +2797,8 @@ qrp_step_install_ultra(struct bgtask *h, void *u, int ticks)
 	 * Install merged table as `routing_table'.
 	 */
 
-	rt = qrt_create("Routing table", ctx->table, ctx->slots, LOCAL_INFINITY);
+	rt = qrt_create_compacted("Routing table",
+		(uint8 *) ctx->table, ctx->slots);
 	ctx->table = NULL;			/* Don't free arena when freeing context */
 
 	install_routing_table(rt);
@@ -4261,7 +4483,7 @@ qrt_apply_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 	const struct qrp_patch *patch)
 {
 	struct routing_table *rt = qrcv->table;
-	int i;
+	uint8 *p;
 
 	g_assert(qrcv->table != NULL);
 
@@ -4277,18 +4499,19 @@ qrt_apply_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 		return FALSE;
 
 	g_assert(qrcv->current_index + len * 8 <= rt->slots);
+	g_assert(0 == (qrcv->current_index & 0x7));
 
-	for (i = 0; i < len; i++) {
-		/*
-		 * Bits are processed in big-endian way.
-		 *
-		 * A non-zero bit means the current entry in the QRT needs to be
-		 * flipped, a zero bit means we need to keep it as-is.
-		 */
+	/*
+	 * Bits are processed in big-endian way, which is how the table is
+	 * compacted, hence the patch is applied to whole words at once.
+	 *
+	 * A non-zero bit means the current entry in the QRT needs to be
+	 * flipped, a zero bit means we need to keep it as-is.
+	 */
 
-		rt->arena[i >> 3] ^= data[i];
-		rt->set_count += bits_set(rt->arena[i >> 3]);
-	}
+	p = &rt->arena[qrcv->current_index / 8];
+	qrt_bits_xor(p, p, data, len);
+	rt->set_count += qrt_bits_count(p, len);
 
 	qrcv->current_index += len * 8;
 	qrcv->current_slot = qrcv->current_index;
@@ -4312,6 +4535,7 @@ qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 	const struct qrp_patch *patch)
 {
 	struct routing_table *rt = qrcv->table;
+	uint8 *p;
 	int i;
 
 	g_assert(qrcv->table != NULL);
@@ -4328,6 +4552,9 @@ qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 		return FALSE;
 
 	g_assert(qrcv->current_index + len * 8 <= rt->slots);
+	g_assert(0 == (qrcv->current_index & 0x7));
+
+	p = &rt->arena[qrcv->current_index / 8];
 
 	for (i = 0; i < len; i++) {
 		/*
@@ -4337,8 +4564,8 @@ qrt_apply_reversed_patch1(struct qrt_receive *qrcv, const uchar *data, int len,
 		 * flipped, a zero bit means we need to keep it as-is.
 		 */
 
-		rt->arena[i >> 3] ^= reverse_byte(data[i]);
-		rt->set_count += bits_set(rt->arena[i >> 3]);
+		p[i] ^= reverse_byte(data[i]);
+		rt->set_count += bits_set(p[i]);
 	}
 
 	qrcv->current_index += len * 8;
@@ -5408,6 +5635,193 @@ qrp_node_can_route(const gnutella_node_t *n, const query_hashvec_t *qhv)
 	   rt->can_route(qhv, rt);
 }
 
+/*
+ * Batched QRP lookups.
+ *
+ * When routing a query, the same hash vector is looked up in the tables of
+ * all our leaves, each lookup hitting a random place in a large table and
+ * therefore most likely missing the cache.  Rather than checking each node
+ * as we find it, we collect the tables to check and then look them all up
+ * in one pass, prefetching the slots of the next tables whilst checking the
+ * current one so that the memory accesses overlap.
+ */
+
+#define QRP_BATCH_SIZE		64	/**< Max amount of tables checked per batch */
+#define QRP_BATCH_AHEAD		4	/**< Tables prefetched ahead of lookups */
+
+struct qrp_batch {
+	gnutella_node_t *node[QRP_BATCH_SIZE];
+	const struct routing_table *rt[QRP_BATCH_SIZE];
+	bool ok[QRP_BATCH_SIZE];
+	size_t count;
+};
+
+/**
+ * Prefetch the slots of the routing table that the query hash vector hits.
+ */
+static inline void
+qrp_prefetch(const query_hashvec_t *qhv, const struct routing_table *rt)
+{
+	const uint8 *arena = rt->arena;
+	uint i, shift;
+
+	if G_UNLIKELY(rt->bits < 3)
+		return;
+
+	shift = 32 - rt->bits;
+
+	for (i = 0; i < qhv->count; i++)
+		G_PREFETCH_R(&arena[(qhv->vec[i].hashcode >> shift) >> 3]);
+}
+
+/**
+ * Check whether we can route a query identified by its hash vector to
+ * each of the supplied routing tables.
+ *
+ * @param qhv		the query hash vector
+ * @param tables	the routing tables to check
+ * @param n			amount of tables
+ * @param ok		where the outcome for each table is written
+ */
+static void G_HOT
+qrp_can_route_batch(const query_hashvec_t *qhv,
+	const struct routing_table * const *tables, size_t n, bool *ok)
+{
+	size_t i;
+
+	for (i = 0; i < MIN(n, QRP_BATCH_AHEAD); i++)
+		qrp_prefetch(qhv, tables[i]);
+
+	for (i = 0; i < n; i++) {
+		const struct routing_table *rt = tables[i];
+
+		if (i + QRP_BATCH_AHEAD < n)
+			qrp_prefetch(qhv, tables[i + QRP_BATCH_AHEAD]);
+
+		ok[i] = qhv->has_urn ?
+			rt->can_route_urn(qhv, rt) :
+			rt->can_route(qhv, rt);
+	}
+}
+
+/**
+ * Check whether we can send a query to a leaf whose QRT matched it.
+ *
+ * @param dn			the leaf node
+ * @param rt			the routing table of the leaf
+ * @param sha1_query	whether the query is a SHA1 query
+ */
+static bool
+qrt_leaf_can_send(const gnutella_node_t *dn, const struct routing_table *rt,
+	bool sha1_query)
+{
+	/*
+	 * If table for the leaf node is so full that we can't let all the
+	 * queries pass through, further restrict sending even though QRT says
+	 * we can let it go.
+	 *
+	 * We only do that when there are pending messages in the node's queue,
+	 * meaning we can't transmit all our packets fast enough.
+	 */
+
+	if (rt->pass_throw < 100 && NODE_MQUEUE_COUNT(dn) != 0) {
+		if ((int) random_value(99) >= rt->pass_throw)
+			return FALSE;
+	}
+
+	/*
+	 * If leaf is flow-controlled, it has trouble reading or we don't
+	 * have enough bandwidth to send everything.  If we were not skipping
+	 * it, the flow-control would cause the message queue to prioritize
+	 * the query in the queue, removing queries coming far away in favor
+	 * of closer ones (hops-wise).  But if we skip it alltogether, we loose
+	 * some potential for a match.
+	 *
+	 * Therefore, let only 50% of the queries pass to flow-controlled nodes.
+	 *
+	 * We don't let SHA1 queries through, as the chances they will match
+	 * are very slim: not all servents include the SHA1 in their QRP, and
+	 * there can be many hashing conflicts, so the fact that it matched
+	 * an entry in the QRP table does not imply there will be a match
+	 * in the leaf node.
+	 *		--RAM, 31/12/2003
+	 */
+
+	if (NODE_IN_TX_FLOW_CONTROL(dn)) {
+		if (sha1_query)
+			return FALSE;
+		if (random_value(255) >= 128)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Add node to the list of targets for the query.
+ *
+ * @param nodes		the list of targets
+ * @param dn		the node to which we can send the query
+ * @param matched	whether the query was routed to the node via its QRT
+ *
+ * @return the new list of targets.
+ */
+static pslist_t *
+qrt_target_add(pslist_t *nodes, gnutella_node_t *dn, bool matched)
+{
+	/*
+	 * Severely limit traffic to transient nodes since we're going
+	 * to shut them down soon anyway.  Send them something randomly
+	 * to limit easy spotting and account for the fact that the query
+	 * could be usefully relayed still (albeit it better have OOB
+	 * delivery).  The more spam they return, the less we send them.
+	 *		--RAM, 2011-11-24.
+	 */
+
+	if (NODE_IS_TRANSIENT(dn)) {
+		unsigned ratio;
+		ratio = uint_saturate_mult(dn->n_spam, 100) / (dn->received + 1);
+		if (random_value(99) < ratio)
+			return nodes;
+	}
+
+	if (matched)
+		node_inc_qrp_match(dn);
+
+	return pslist_prepend(nodes, dn);
+}
+
+/**
+ * Look up the query in all the tables of the batch and add the matching
+ * nodes to the list of targets.
+ *
+ * @return the new list of targets.
+ */
+static pslist_t *
+qrt_batch_flush(struct qrp_batch *b, const query_hashvec_t *qhvec,
+	bool sha1_query, pslist_t *nodes)
+{
+	size_t i;
+
+	qrp_can_route_batch(qhvec, b->rt, b->count, b->ok);
+
+	for (i = 0; i < b->count; i++) {
+		gnutella_node_t *dn = b->node[i];
+
+		if (!b->ok[i])
+			continue;
+
+		if (NODE_IS_LEAF(dn) && !qrt_leaf_can_send(dn, b->rt[i], sha1_query))
+			continue;
+
+		nodes = qrt_target_add(nodes, dn, TRUE);
+	}
+
+	b->count = 0;
+
+	return nodes;
+}
+
 /**
  * Compute list of nodes to send the query to, based on node's QRT.
  * The query is identified by its list of QRP hashes, by its hop count, TTL
@@ -5437,6 +5851,9 @@ qrt_build_query_target(
 	const pslist_t *sl;
 	bool sha1_query;
 	bool whats_new;
+	struct qrp_batch batch;
+	tm_nano_t start, end;
+	long elapsed;
 
 	g_assert(qhvec != NULL);
 	g_assert(hops >= 0);
@@ -5459,13 +5876,19 @@ qrt_build_query_target(
 		return NULL;
 	}
 
+	tm_precise_time(&start);
+
 	sha1_query = qhvec_has_urn(qhvec);
+	batch.count = 0;
 
 	/*
 	 * We need to special case processing of queries with TTL=1 so that they
 	 * get set to ultra peers that support last-hop QRP only if they can
 	 * provide a reply.  Ultrapeers that don't support last-hop QRP will
 	 * always get the query.
+	 *
+	 * Nodes whose QRT needs to be checked are gathered in a batch and
+	 * looked up together, the others being added to the targets directly.
 	 */
 
 	PSLIST_FOREACH(node_all_gnet_nodes(), sl) {
@@ -5539,79 +5962,35 @@ qrt_build_query_target(
 
 		node_inc_qrp_query(dn);			/* We have a QRT, mark we try routing */
 
-		if (!(qhvec->has_urn ?
-			  rt->can_route_urn(qhvec, rt) :
-			  rt->can_route(qhvec, rt)))
-			continue;
-
-		if (!is_leaf)
-			goto can_send;			/* Avoid indentation of remaining code */
-
-		/*
-		 * If table for the leaf node is so full that we can't let all the
-		 * queries pass through, further restrict sending even though QRT says
-		 * we can let it go.
-		 *
-		 * We only do that when there are pending messages in the node's queue,
-		 * meaning we can't transmit all our packets fast enough.
-		 */
-
-		if (rt->pass_throw < 100 && NODE_MQUEUE_COUNT(dn) != 0) {
-			if ((int) random_value(99) >= rt->pass_throw)
-				continue;
-		}
+		batch.node[batch.count] = dn;
+		batch.rt[batch.count] = rt;
 
-		/*
-		 * If leaf is flow-controlled, it has trouble reading or we don't
-		 * have enough bandwidth to send everything.  If we were not skipping
-		 * it, the flow-control would cause the message queue to prioritize
-		 * the query in the queue, removing queries coming far away in favor
-		 * of closer ones (hops-wise).  But if we skip it alltogether, we loose
-		 * some potential for a match.
-		 *
-		 * Therefore, let only 50% of the queries pass to flow-controlled nodes.
-		 *
-		 * We don't let SHA1 queries through, as the chances they will match
-		 * are very slim: not all servents include the SHA1 in their QRP, and
-		 * there can be many hashing conflicts, so the fact that it matched
-		 * an entry in the QRP table does not imply there will be a match
-		 * in the leaf node.
-		 *		--RAM, 31/12/2003
-		 */
+		if (++batch.count == QRP_BATCH_SIZE)
+			nodes = qrt_batch_flush(&batch, qhvec, sha1_query, nodes);
 
-		if (NODE_IN_TX_FLOW_CONTROL(dn)) {
-			if (sha1_query)
-				continue;
-			if (random_value(255) >= 128)
-				continue;
-		}
+		continue;
 
 		/*
 		 * OK, can send the query to that node.
 		 */
 
 	can_send:
+		nodes = qrt_target_add(nodes, dn, rt != NULL && !whats_new);
+	}
 
-		/*
-		 * Severely limit traffic to transient nodes since we're going
-		 * to shut them down soon anyway.  Send them something randomly
-		 * to limit easy spotting and account for the fact that the query
-		 * could be usefully relayed still (albeit it better have OOB
-		 * delivery).  The more spam they return, the less we send them.
-		 *		--RAM, 2011-11-24.
-		 */
+	if (batch.count != 0)
+		nodes = qrt_batch_flush(&batch, qhvec, sha1_query, nodes);
 
-		if (NODE_IS_TRANSIENT(dn)) {
-			unsigned ratio;
-			ratio = uint_saturate_mult(dn->n_spam, 100) / (dn->received + 1);
-			if (random_value(99) < ratio)
-				continue;
-		}
+	/*
+	 * Account for the time spent routing the query.
+	 */
 
-		nodes = pslist_prepend(nodes, dn);
-		if (rt != NULL && !whats_new)
-			node_inc_qrp_match(dn);
-	}
+	tm_precise_time(&end);
+	elapsed = tm_precise_elapsed_ns(&end, &start);
+
+	gnet_stats_inc_general(GNR_QRP_ROUTED_QUERIES);
+	gnet_stats_count_general(GNR_QRP_ROUTING_NS, elapsed);
+	gnet_stats_max_general(GNR_QRP_ROUTING_MAX_NS, elapsed);
 
 	return nodes;
 }
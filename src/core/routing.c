@@ -51,15 +51,13 @@
 #include "lib/aging.h"
 #include "lib/atoms.h"
 #include "lib/endian.h"
-#include "lib/halloc.h"
-#include "lib/hashing.h"
 #include "lib/host_addr.h"
 #include "lib/hset.h"
 #include "lib/htable.h"
 #include "lib/pslist.h"
+#include "lib/rtable.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
-#include "lib/tm.h"
 #include "lib/walloc.h"
 
 #include "lib/override.h"	/* Must be the last header included */
@@ -98,31 +96,9 @@ routing_udp_node_check(const struct routing_udp_node * const un)
 #define ROUTE_UDP_LIFETIME	180		/**< Keep UDP routes for 3 minutes */
 
 /**
- * An entry in the routing table.
- *
- * Each entry is stored in the "message_array[]", to keep track of the
- * order used to create the routes, and in a hash table for quick lookup,
- * hashing being made based on the muid and the function.
- *
- * Query hit routes and push routes are precious, therefore they are
- * moved to the tail of the "message_array[]" when they get used to increase
- * their liftime.
- */
-struct message {
-	struct guid muid;		/**< Message UID */
-	struct message **slot;	/**< Place where we're referenced from */
-	pslist_t *routes;		/**< route_data from where the message came */
-	pslist_t *ttls;			/**< For broadcasted messages: TTL by route */
-	uint8 function;			/**< Type of the message */
-	uint8 ttl;				/**< Max TTL we saw for this message */
-	uint8 chunk_idx;		/**< Index of chunk holding the slot */
-};
-
-/**
- * We don't store a list of nodes in the message structure, but a list of
- * route_data: the reason is that nodes can go away, but we don't want to
- * traverse the whole routing table to reclaim all the places where they
- * were referenced.
+ * We don't store nodes in the routing table entries, but route_data: the
+ * reason is that nodes can go away, but we don't want to traverse the whole
+ * routing table to reclaim all the places where they were referenced.
  *
  * The route_data structure points to a node and keeps track of the amount of
  * messages that it is used to track.  When a node disappears, the `node' field
@@ -145,8 +121,8 @@ static const char *debug_msg[256];
  * We're using the message table to store Query hit routes for Push requests,
  * but this is a temporary solution.  As we continuously refresh those
  * routes, we must make sure they stay alive for some time after having been
- * updated.  Given that we periodically supersede the message_array[] in a
- * round-robin fashion, it is not really appropriate.
+ * updated.  Given that we periodically expire the oldest messages from the
+ * table, it is not really appropriate.
  *		--RAM, 06/01/2002
  */
 #define QUERY_HIT_ROUTE_SAVE	0	/**< Function used to store QHit GUIDs */
@@ -154,35 +130,18 @@ static const char *debug_msg[256];
 /*
  * Routing table data structures.
  *
- * This is known as the "message_array[]".  It used to be a fixed-sized
- * array, but it is no more.  Instead, we use an array of chunks that
- * are dynamically allocated as needed.  The aim is to not cycle
- * back to the beginning of the table, loosing all the routing information
- * before at least TABLE_MIN_CYCLE seconds have elapsed or we have
- * allocated more than the amount of chunks we can tolerate.
- *
- * Each chunk contains pointers to dynamically allocated message entries,
- * each pointer being called a "slot" whilst the message structure is called
- * the "entry".
+ * Messages are remembered by MUID and function in a routing table which
+ * sizes itself from the measured rate of new messages, so as to keep the
+ * routing information for TABLE_MIN_CYCLE seconds.  Messages are expired
+ * by whole time buckets, and the table is bounded by TABLE_MAX_SIZE slots
+ * of 64 bytes, after which the oldest messages are expired earlier.
  */
 
-#define CHUNK_BITS			14 	  /**< log2 of # messages stored  in a chunk */
-#define MAX_CHUNKS			64	  /**< Max # of chunks */
-#define TABLE_MIN_CYCLE		3600  /**< 1 hour at least */
-
-#define CHUNK_MESSAGES		(1 << CHUNK_BITS)
-#define CHUNK_INDEX(x)		(((x) & ~(CHUNK_MESSAGES - 1)) >> CHUNK_BITS)
-#define ENTRY_INDEX(x)		((x) & (CHUNK_MESSAGES - 1))
+#define TABLE_MIN_SIZE		16384		/**< Initial amount of slots */
+#define TABLE_MAX_SIZE		(1U << 21)	/**< Max amount of slots */
+#define TABLE_MIN_CYCLE		3600		/**< Target route lifetime: 1 hour */
 
-static struct {
-	struct message **chunks[MAX_CHUNKS];
-	int next_idx;				 /**< Next slot to use in "message_array[]" */
-	int capacity;				 /**< Capacity in terms of messages */
-	int count;					 /**< Amount really stored */
-	unsigned nchunks;			 /**< Amount of allocated chunks */
-	hset_t *messages_hashed;	 /**< All messages (key = struct message) */
-	time_t last_rotation;		 /**< Last time we restarted from idx=0 */
-} routing;
+static rtable_t *routing_table;
 
 /**
  * "banned" GUIDs for push routing.
@@ -245,8 +204,8 @@ struct route_log {
 static aging_table_t *at_udp_routes;
 
 static bool find_message(
-	const struct guid *muid, uint8 function, struct message **m);
-static void free_route_list(struct message *m);
+	const struct guid *muid, uint8 function, rtable_entry_t **m);
+static void route_data_unref(void *rd);
 
 static inline bool
 is_banned_push(const struct guid *guid)
@@ -826,267 +785,23 @@ init_routing_data(gnutella_node_t *node)
 }
 
 /**
- * Make sure slot belongs to specified chunk index.
- */
-static void
-slot_check(struct message * const * const slot, unsigned chunk_idx)
-{
-	const void *chunk_base;
-	const void *chunk_end;
-
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk_idx < routing.nchunks);
-
-	chunk_base = routing.chunks[chunk_idx];
-	chunk_end = const_ptr_add_offset(chunk_base, CHUNK_MESSAGES * sizeof *slot);
-
-	g_assert(ptr_cmp(slot, chunk_base) >= 0);
-	g_assert(ptr_cmp(slot, chunk_end) < 0);
-}
-
-/**
- * Asserts that a message entry is consistent and belongs to the correct chunk.
- */
-static void
-message_check(const struct message * const m, unsigned chunk_idx)
-{
-	g_assert(m != NULL);
-	slot_check(m->slot, chunk_idx);
-	g_assert(chunk_idx == m->chunk_idx);
-}
-
-/**
- * Asserts that a message entry is consistent and belongs to the correct chunk.
- *
- * The "chunk" parameter points to the old chunk address and is used to
- * properly validate the m->slot value (before our caller can update it
- * to reflect the new chunk location).
+ * Update routing table statistics.
  */
 static void
-message_check_chunk(const struct message * const m, unsigned chunk_idx,
-	struct message * const *chunk)
+routing_table_stats(void)
 {
-	const void *chunk_end;
-
-	g_assert(m != NULL);
-	g_assert(chunk_idx == m->chunk_idx);
-
-	/*
-	 * Expand a variant of slot_check() since routing.chunks[chunk_idx]
-	 * has been re-allocated and the old chunk address is given.
-	 */
-
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk_idx < routing.nchunks);
-
-	chunk_end = const_ptr_add_offset(chunk, CHUNK_MESSAGES * sizeof m);
-
-	g_assert(ptr_cmp(m->slot, chunk) >= 0);
-	g_assert(ptr_cmp(m->slot, chunk_end) < 0);
-}
-
-/**
- * Clean already allocated entry.
- */
-static void
-clean_entry(struct message *entry)
-{
-	g_assert(entry != NULL);
-
-	hset_remove(routing.messages_hashed, entry);
-
-	if (entry->routes != NULL)
-		free_route_list(entry);
-
-	g_assert(entry->ttls == NULL);		/* Cleaned by free_route_list() */
-	g_assert(entry->routes == NULL);	/* Idem */
-
-	entry->ttl = 0;
-}
-
-/**
- * Prepare entry, cleaning any old value we can find at the referenced slot.
- * We try to avoid re-allocating something if we can.
- *
- * @return message entry to use
- */
-static struct message *
-prepare_entry(struct message **entryp, unsigned chunk_idx)
-{
-	struct message *entry = *entryp;
-
-	STATIC_ASSERT(MAX_CHUNKS <= MAX_INT_VAL(uint8));
-
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	slot_check(entryp, chunk_idx);
-
-	if (entry == NULL) {
-		WALLOC0(entry);
-		*entryp = entry;
-		entry->slot = entryp;
-		entry->chunk_idx = chunk_idx;	/* 8-bit value, must fit */
-		routing.count++;
-		gnet_stats_inc_general(GNR_ROUTING_TABLE_COUNT);
-		goto done;
-	}
-
-	/*
-	 * We cycled over the table, remove the message at the slot we're
-	 * going to supersede.  We don't need to allocate anything, we'll
-	 * reuse the old structure, which will be rehashed after being updated.
-	 */
-
-	g_assert(entryp == entry->slot);	/* Invariant we ensure */
-
-	clean_entry(entry);
-
-	/*
-	 * Attempt to move the object around if it can help compacting.
-	 */
-
-	{
-		struct message *nentry = WMOVE(entry);
-
-		if (nentry != entry) {
-			entry = *entryp = nentry;
-			/* PARANOID: move is not supposed to alter data but... */
-			g_assert(entryp == entry->slot);
-		}
-	}
-
-done:
-	g_assert(entryp == entry->slot);
-	message_check(entry, chunk_idx);
-
-	return entry;
-}
-
-/**
- * Attempt to reallocate an already allocated chunk to see if the VMM layer
- * can relocate a fragment.
- */
-static struct message **
-routing_chunk_move(struct message **chunk, unsigned chunk_idx)
-{
-	struct message **nchunk;
-	struct message **p;
-	unsigned i;
-
-	g_assert(chunk != NULL);
-	g_assert(uint_is_non_negative(chunk_idx));
-	g_assert(chunk_idx < MAX_CHUNKS);
-	g_assert(chunk == routing.chunks[chunk_idx]);
-
-	nchunk = hrealloc(chunk, CHUNK_MESSAGES * sizeof(struct message *));
-	if (nchunk == chunk)
-		return chunk;
-
-	/*
-	 * VMM layer chose to relocate the chunk, update all the entries.
-	 */
-
-	if (GNET_PROPERTY(routing_debug)) {
-		g_debug("RT moving chunk #%u from %p to %p",
-			chunk_idx, (void *) chunk, (void *) nchunk);
-	}
-
-	for (p = &nchunk[0], i = 0; i < CHUNK_MESSAGES; i++, p++) {
-		struct message *m = *p;
-
-		if (m != NULL) {
-			message_check_chunk(m, chunk_idx, chunk);
-			m->slot = p;
-		}
-	}
-
-	return routing.chunks[chunk_idx] = nchunk;
-}
-
-/**
- * Try to move the chunks we have, since the lowest indices
- * (which are going to be the more permanent chunks) will be
- * better hosted in the early VM space, freeing up the upper
- * VM space for more volatile data and possibly defragmenting.
- */
-static void
-routing_chunk_move_attempt(void)
-{
-	size_t i;
-
-	for (i = 0; i < routing.nchunks; i++) {
-		routing.chunks[i] = routing_chunk_move(routing.chunks[i], i);
-	}
-}
-
-/**
- * Advance slot index so that a call to get_next_slot() will return the
- * next available slot.
- */
-static void
-advance_slot(void)
-{
-	/*
-	 * It's OK to go beyond the last allocated chunk (a new chunk will
-	 * be allocated next time) unless we already reached the last chunk.
-	 */
-
-	routing.next_idx++;
-
-	if (CHUNK_INDEX(routing.next_idx) >= MAX_CHUNKS)
-		routing.next_idx = 0;		/* Will force cycling over next time */
-}
-
-/**
- * Clear routing table, starting with specified chunk index.
- *
- * @param idx	the index of the first chunk to clear
- */
-static void
-routing_clear(unsigned idx)
-{
-	size_t i;
-
-	for (i = idx; i < routing.nchunks; i++) {
-		struct message **rchunk = routing.chunks[i];
-		size_t j;
-
-		if (GNET_PROPERTY(routing_debug)) {
-			g_debug("RT freeing chunk #%zu at %p, now holds %d / %d",
-				i, (void *) rchunk, routing.count, routing.capacity);
-		}
-
-		for (j = 0; j < CHUNK_MESSAGES; j++) {
-			struct message *m = rchunk[j];
-
-			if (m != NULL) {
-				message_check(m, i);
-				g_assert(m->slot == &rchunk[j]);
-				clean_entry(m);
-				WFREE(m);
-				routing.count--;
-			}
-		}
-
-		routing.capacity -= CHUNK_MESSAGES;
-		HFREE_NULL(routing.chunks[i]);
-	}
-
-	routing.nchunks = idx;
-	gnet_stats_set_general(GNR_ROUTING_TABLE_CHUNKS, routing.nchunks);
-	gnet_stats_set_general(GNR_ROUTING_TABLE_CAPACITY, routing.capacity);
-	gnet_stats_set_general(GNR_ROUTING_TABLE_COUNT, routing.count);
-
-	g_assert(uint_is_non_negative(routing.nchunks));
-
-	/*
-	 * After freeing chunks, we may be able to move around some of the
-	 * remaining ones.
-	 */
-
-	routing_chunk_move_attempt();
+	gnet_stats_set_general(GNR_ROUTING_TABLE_EPOCHS,
+		rtable_epochs(routing_table));
+	gnet_stats_set_general(GNR_ROUTING_TABLE_CAPACITY,
+		rtable_capacity(routing_table));
+	gnet_stats_set_general(GNR_ROUTING_TABLE_COUNT,
+		rtable_count(routing_table));
+	gnet_stats_set_general(GNR_ROUTING_TABLE_RATE,
+		rtable_rate(routing_table));
+	gnet_stats_set_general(GNR_ROUTING_TABLE_LIFETIME,
+		rtable_lifetime(routing_table));
+	gnet_stats_set_general(GNR_ROUTING_TABLE_EXPIRED_EARLY,
+		rtable_expired_early(routing_table));
 }
 
 /**
@@ -1096,202 +811,22 @@ void
 routing_clear_all(void)
 {
 	if (GNET_PROPERTY(routing_debug)) {
-		g_debug("RT clearing whole table (holds %d / %d)",
-			routing.capacity, routing.count);
-	}
-
-	routing_clear(0);
-	routing.next_idx = 0;
-	routing.last_rotation = tm_time();
-	hset_clear(routing.messages_hashed);	/* Paranoid */
-}
-
-/**
- * Fetch next routing table slot, a pointer to a routing entry.
- *
- * When `advance' is FALSE, the slot is allocated as usual but there is
- * no increment of the slot index for next time.  This allows trial allocation
- * to see where the message will be allocated.  If the slot is kept, the
- * caller must call advance_slot().
- *
- * When `advance' is TRUE, the slot is allocated and the slot index is
- * incremented immediately.
- *
- * @param advance		whether to advance the slot index
- * @param cidx			if non-NULL, filled with the chunk index where slot is
- *
- * @return the address of the allocated slot.
- */
-static struct message **
-get_next_slot(bool advance, unsigned *cidx)
-{
-	unsigned idx;
-	unsigned chunk_idx;
-	struct message **chunk;
-	struct message **slot = NULL;
-	time_t now = tm_time();
-	time_delta_t elapsed = delta_time(now, routing.last_rotation);
-
-	idx = routing.next_idx;
-	chunk_idx = CHUNK_INDEX(idx);
-
-	g_assert(UNSIGNED(chunk_idx) < MAX_CHUNKS);
-
-	chunk = routing.chunks[chunk_idx];
-
-	/*
-	 * If we get back here with a next index of zero and the chunk is
-	 * allocated, it means we've naturally cycled over.  There is nothing
-	 * to free up (or we would discard the whole table).
-	 */
-
-	if G_UNLIKELY(0 == idx && NULL != chunk) {
-		if (GNET_PROPERTY(routing_debug)) {
-			g_debug("RT cycled naturally over table, elapsed=%u, holds %d / %d",
-				(unsigned) elapsed, routing.count, routing.capacity);
-		}
-		routing.last_rotation = now;	/* Just cycled over */
-		elapsed = 0;
-	}
-
-	/*
-	 * If we've taken more than TABLE_MIN_CYCLE seconds since the last
-	 * rotation and reach the start of an allocated chunk, it means we
-	 * have more chunks than we need.  Discard all remaining chunks before
-	 * rotating.
-	 */
-
-	if G_UNLIKELY(elapsed > TABLE_MIN_CYCLE) {
-		/*
-		 * 0 != ENTRY_INDEX(idx): means we're not at the start of a chunk.
-		 * chunk == NULL: means we've reached an empty chunk, nothing to free.
-		 */
-
-		if G_UNLIKELY(chunk != NULL && 0 == ENTRY_INDEX(idx)) {
-			routing_clear(chunk_idx);
-			chunk = NULL;
-		}
+		g_debug("RT clearing whole table (holds %zu / %zu)",
+			rtable_count(routing_table), rtable_capacity(routing_table));
 	}
 
-	if (chunk == NULL) {
-
-		g_assert(idx >= UNSIGNED(routing.capacity));
-
-		/*
-		 * Chunk does not exist yet, determine whether we should create
-		 * it or recycle the table by going back to the start.
-		 */
-
-		if (idx > 0 && elapsed > TABLE_MIN_CYCLE) {
-			if (GNET_PROPERTY(routing_debug)) {
-				g_debug("RT cycling over table, elapsed=%u, holds %d / %d",
-					(unsigned) elapsed, routing.count, routing.capacity);
-			}
-
-			chunk_idx = 0;
-			idx = routing.next_idx = 0;
-			routing.last_rotation = now;
-			slot = routing.chunks[0];
-		} else {
-			/*
-			 * Allocate new chunk, expanding the capacity of the table.
-			 */
-
-			g_assert(idx == 0 || chunk_idx > 0);
-			g_assert(chunk_idx == routing.nchunks);
-
-			routing_chunk_move_attempt();		/* Compact before allocating */
-
-			routing.nchunks++;
-			routing.capacity += CHUNK_MESSAGES;
-			routing.chunks[chunk_idx] =
-				halloc0(CHUNK_MESSAGES * sizeof(struct message *));
-
-			gnet_stats_inc_general(GNR_ROUTING_TABLE_CHUNKS);
-			gnet_stats_count_general(GNR_ROUTING_TABLE_CAPACITY,
-				CHUNK_MESSAGES);
-
-			if (GNET_PROPERTY(routing_debug)) {
-				g_debug("RT created new chunk #%d at %p, now holds %d / %d",
-					chunk_idx, (void *) routing.chunks[chunk_idx],
-					routing.count, routing.capacity);
-			}
-
-			slot = routing.chunks[chunk_idx];	/* First slot in new chunk */
-		}
-	} else {
-		unsigned entry_idx = ENTRY_INDEX(idx);
-
-		/*
-		 * Each time we move to a new chunk, see whether we can move some
-		 * of the existing ones around to compact the VM space.
-		 */
-
-		if (0 == entry_idx) {
-			routing_chunk_move_attempt();
-			chunk = routing.chunks[chunk_idx];	/* In case it moved */
-		}
-
-		/*
-		 * If we went back to the first index without allocating a chunk,
-		 * it means we finally cycled over the table, in a forced way,
-		 * because we have already allocated the maximum amount of chunks.
-		 */
-
-		if (0 == idx && MAX_CHUNKS == routing.nchunks) {
-			if (GNET_PROPERTY(routing_debug)) {
-				g_warning("RT cycling over FORCED, elapsed=%u, holds %d / %d",
-					(unsigned) elapsed, routing.count, routing.capacity);
-			}
-			routing.last_rotation = now;
-		}
-
-		slot = &chunk[entry_idx];
-	}
-
-	g_assert(slot != NULL);
-	g_assert(idx == UNSIGNED(routing.next_idx));
-	g_assert(idx < UNSIGNED(routing.capacity));
-	g_assert(routing.nchunks <= MAX_CHUNKS);
-
-	if (advance)
-		advance_slot();
-
-	if (cidx != NULL)
-		*cidx = chunk_idx;
-
-	slot_check(slot, chunk_idx);
-
-	return slot;
-}
-
-/**
- * Fetch next routing table entry to be able to store routing information.
- */
-static struct message *
-get_next_entry(void)
-{
-	struct message **slot;
-	unsigned chunk_idx;
-
-	slot = get_next_slot(TRUE, &chunk_idx);
-	return prepare_entry(slot, chunk_idx);
+	rtable_clear(routing_table);
+	routing_table_stats();
 }
 
 /**
  * When a precious route (for query hit or push) is used, revitalize the
- * entry by moving it to the end of the "message_array[]", thereby making
- * it unlikely that it expires soon.
- *
- * @return the new location of the revitalized entry
+ * entry by moving it to the current epoch of the routing table, thereby
+ * making it unlikely that it expires soon.
  */
 static void
-revitalize_entry(struct message *entry, bool force)
+revitalize_entry(rtable_entry_t *entry, bool force)
 {
-	struct message **relocated;
-	struct message *prev;
-	unsigned chunk_idx;
-
 	/*
 	 * Leaves don't route anything, so we usually don't revitalize their
 	 * entries.  The only exception is when it makes use of the recorded
@@ -1301,56 +836,16 @@ revitalize_entry(struct message *entry, bool force)
 	if (!force && settings_is_leaf())
 		return;
 
-	/*
-	 * Relocate at the end of the table, preventing early expiration.
-	 */
-
-	relocated = get_next_slot(FALSE, &chunk_idx);
-
-	/*
-	 * If slot is allocated in the same chunk, there's no need to revitalize
-	 * since entries in the same chunk will roughly have the same lifetime.
-	 */
-
-	if (chunk_idx == entry->chunk_idx)			/* Same chunk being used */
-		return;
-
-	/*
-	 * Clean and reclaim new slot content, if present.
-	 */
-
-	advance_slot();							/* Keeping the slot */
-	prev = *relocated;
-
-	if (prev != NULL) {
-		message_check(prev, chunk_idx);
-		g_assert(prev->slot == relocated);
-		clean_entry(prev);
-		WFREE(prev);
-		routing.count--;
-		gnet_stats_dec_general(GNR_ROUTING_TABLE_COUNT);
-	}
-
-	/*
-	 * Move `entry' to this new slot.
-	 */
-
-	*relocated = entry;
-	*(entry->slot) = NULL;					/* Old slot "freed" */
-	entry->slot = relocated;				/* Entry now at new slot */
-	entry->chunk_idx = chunk_idx;			/* Entry moved to new chunk */
-
-	message_check(entry, chunk_idx);
+	rtable_touch(routing_table, entry);
 }
 
 /**
  * Did node send the message?
  */
 static bool
-route_node_sent_message(gnutella_node_t *n, struct message *m)
+route_node_sent_message(gnutella_node_t *n, const rtable_entry_t *m)
 {
 	struct route_data *route;
-	pslist_t *sl;
 
 	if (n == fake_node)
 		route = &fake_route;
@@ -1365,12 +860,7 @@ route_node_sent_message(gnutella_node_t *n, struct message *m)
 	if (route == NULL)
 		return FALSE;
 
-	PSLIST_FOREACH(m->routes, sl) {
-		if (route == sl->data)
-			return TRUE;
-	}
-
-	return FALSE;
+	return -1 != rtable_entry_route_index(m, route);
 }
 
 /**
@@ -1382,11 +872,11 @@ route_node_sent_message(gnutella_node_t *n, struct message *m)
  * and the node should not have broadcasted this message again.
  */
 static bool
-route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
+route_node_ttl_higher(gnutella_node_t *n, rtable_entry_t *m, uint8 ttl)
 {
-	pslist_t *l;
 	int i;
 	struct route_data *route;
+	uint8 function = rtable_entry_function(m);
 
 	g_assert(n != fake_node);
 
@@ -1398,68 +888,27 @@ route_node_ttl_higher(gnutella_node_t *n, struct message *m, uint8 ttl)
 	 * It's really a duplicate message.
 	 */
 
-	if (GTA_MSG_G2_SEARCH == m->function)
+	if (GTA_MSG_G2_SEARCH == function)
 		return FALSE;		/* As a G2 leaf, we do not care, it's a dup */
 
-	g_assert(m->ttls != NULL);
-	g_assert(
-		m->function == GTA_MSG_PUSH_REQUEST || m->function == GTA_MSG_SEARCH);
+	g_assert(function == GTA_MSG_PUSH_REQUEST || function == GTA_MSG_SEARCH);
 
 	route = get_routing_data(n);
 
 	g_assert(route != NULL);
 
-	for (l = m->routes, i = 0; l; l = pslist_next(l), i++) {
-		if (route == l->data) {
-			pslist_t *t = pslist_nth(m->ttls, i);
-			uint8 old_ttl;
-
-			g_assert(t != NULL);
-			old_ttl = GPOINTER_TO_INT(t->data);
-			if (old_ttl >= ttl)
-				return FALSE;
+	i = rtable_entry_route_index(m, route);
 
-			t->data = GUINT_TO_POINTER((uint) ttl);
-			return TRUE;
-		}
+	if (-1 == i) {
+		g_error("route not found -- message was supposed to be a duplicate");
+		return FALSE;
 	}
 
-	g_error("route not found -- message was supposed to be a duplicate");
-	return FALSE;
-}
-
-/**
- * compares two message structures
- */
-static int
-message_compare_func(const void *p, const void *q)
-{
-	const struct message *a = p, *b = q;
-
-	return a->function == b->function && guid_eq(&a->muid, &b->muid);
-}
-
-/**
- * Hashes message structures for storage in a hash table.
- */
-static uint
-message_hash_func(const void *key)
-{
-	const struct message *msg = key;
-
-	return integer_hash_fast(msg->function) ^
-		universal_hash(&msg->muid, GUID_RAW_SIZE);
-}
-
-/**
- * Alternate hashing of message structures for storage in a hash table.
- */
-static uint
-message_hash_func2(const void *key)
-{
-	const struct message *msg = key;
+	if (rtable_entry_route_ttl(m, i) >= ttl)
+		return FALSE;
 
-	return integer_hash2(msg->function) ^ guid_hash(&msg->muid);
+	rtable_entry_set_route_ttl(m, i, ttl);
+	return TRUE;
 }
 
 /**
@@ -1561,9 +1010,9 @@ routing_init(void)
 	 * need to be deallocated
 	 */
 
-	routing.messages_hashed = hset_create_any(message_hash_func,
-		message_hash_func2, message_compare_func);
-	routing.last_rotation = tm_time();
+	routing_table = rtable_make(TABLE_MIN_SIZE, TABLE_MAX_SIZE,
+		TABLE_MIN_CYCLE, route_data_unref);
+	routing_table_stats();
 
 	/*
 	 * Push proxification and starving GUIDs.
@@ -1633,27 +1082,12 @@ remove_one_message_reference(struct route_data *rd)
 }
 
 /**
- * Dispose of route list in message.
+ * Invoked by the routing table on the routes of expired messages.
  */
 static void
-free_route_list(struct message *m)
+route_data_unref(void *rd)
 {
-	pslist_t *sl;
-
-	g_assert(m);
-
-	PSLIST_FOREACH(m->routes, sl) {
-		remove_one_message_reference(sl->data);
-	}
-
-	pslist_free_null(&m->routes);
-
-	/*
-	 * If the message was a broadcasted one, we kept track of the TTL of
-	 * each message along the route.  This needs to be freed as well.
-	 */
-
-	pslist_free_null(&m->ttls);	/* Data are ints, nothing to free */
+	remove_one_message_reference(rd);
 }
 
 /**
@@ -1702,8 +1136,8 @@ message_add(const struct guid *muid, uint8 function,
 	gnutella_node_t *node)
 {
 	struct route_data *route;
-	struct message *entry;
-	struct message *m;
+	rtable_entry_t *entry;
+	rtable_entry_t *m;
 	bool found;
 
 	found = find_message(muid, function, &m);
@@ -1748,14 +1182,8 @@ message_add(const struct guid *muid, uint8 function,
 
 	if (found)			/* Dup message forwarded due to higher TTL */
 		entry = m;		/* Reuse existing entry */
-	else {
-		entry = get_next_entry();
-		g_assert(entry->routes == NULL);
-
-		/* fill in that storage space */
-		entry->muid = *muid;
-		entry->function = function;
-	}
+	else
+		entry = rtable_insert(routing_table, muid, function);
 
 	g_assert(route != NULL);
 
@@ -1767,10 +1195,7 @@ message_add(const struct guid *muid, uint8 function,
 	 */
 
 	if (!found || !route_node_sent_message(node, m)) {
-		uint ttl;
-
-		route->saved_messages++;
-		entry->routes = pslist_append(entry->routes, route);
+		uint8 ttl = 0;
 
 		/*
 		 * If message is typically broadcasted, also record the TTL of
@@ -1779,16 +1204,17 @@ message_add(const struct guid *muid, uint8 function,
 		 *		--RAM, 2005-10-02
 		 */
 
-		ttl = node == fake_node
-				? GNET_PROPERTY(my_ttl)
-				: gnutella_header_get_ttl(&node->header);
-
 		switch (function) {
 		case GTA_MSG_PUSH_REQUEST:
 		case GTA_MSG_SEARCH:
-			entry->ttls = pslist_append(entry->ttls, GUINT_TO_POINTER(ttl));
+			ttl = node == fake_node
+					? GNET_PROPERTY(my_ttl)
+					: gnutella_header_get_ttl(&node->header);
 			break;
 		}
+
+		route->saved_messages++;
+		rtable_entry_add_route(entry, route, ttl);
 	}
 
 	if (found)
@@ -1799,12 +1225,11 @@ message_add(const struct guid *muid, uint8 function,
 	 */
 
 	if (node != fake_node)
-		entry->ttl = gnutella_header_get_ttl(&node->header);
+		rtable_entry_set_ttl(entry, gnutella_header_get_ttl(&node->header));
 	else
-		entry->ttl = GNET_PROPERTY(my_ttl);
+		rtable_entry_set_ttl(entry, GNET_PROPERTY(my_ttl));
 
-	/* insert the new message into the hash table */
-	hset_insert(routing.messages_hashed, entry);
+	routing_table_stats();
 }
 
 /**
@@ -1812,31 +1237,18 @@ message_add(const struct guid *muid, uint8 function,
  * a node, within the route list of the message.
  */
 static void
-purge_dangling_references(struct message *m)
+purge_dangling_references(rtable_entry_t *m)
 {
-	pslist_t *sl;
-	pslist_t *t;
+	uint i = 0;
 
-	for (sl = m->routes, t = m->ttls; sl; /* empty */) {
-		struct route_data *rd = sl->data;
+	while (i < rtable_entry_route_count(m)) {
+		struct route_data *rd = rtable_entry_route(m, i);
 
 		if (rd->node == NULL) {
-			pslist_t *next = pslist_next(sl);
-			m->routes = pslist_remove_link(m->routes, sl);
+			rtable_entry_remove_route(m, i);
 			remove_one_message_reference(rd);
-			pslist_free_1(sl);
-			sl = next;
-
-			if (t) {
-				next = pslist_next(t);
-				m->ttls = pslist_remove_link(m->ttls, t);
-				pslist_free_1(t);
-				t = next;
-			}
 		} else {
-			sl = pslist_next(sl);
-			if (t)
-				t = pslist_next(t);
+			i++;
 		}
 	}
 }
@@ -1852,10 +1264,9 @@ void
 message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
 {
 	bool found;
-	struct message *m;
-	pslist_t *sl;
-	pslist_t *t;
+	rtable_entry_t *m;
 	struct route_data *route;
+	int i;
 
 	g_assert(muid != NULL);
 	node_check(node);
@@ -1867,20 +1278,11 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
 	route = get_routing_data(node);
 	g_return_unless(route != NULL);
 
-	for (
-		sl = m->routes, t = m->ttls;
-		sl != NULL;
-		sl = pslist_next(sl), t = pslist_next(t)
-	) {
-		struct route_data *rd = sl->data;
+	i = rtable_entry_route_index(m, route);
 
-		if (route == rd) {
-			m->routes = pslist_remove_link(m->routes, sl);
-			if (t != NULL)
-				m->ttls = pslist_remove_link(m->ttls, t);
-			remove_one_message_reference(rd);
-			break;
-		}
+	if (i != -1) {
+		rtable_entry_remove_route(m, i);
+		remove_one_message_reference(route);
 	}
 }
 
@@ -1888,22 +1290,16 @@ message_forget(const struct guid *muid, uint8 function, gnutella_node_t *node)
  * Look for a particular message in the routing tables.
  *
  * If none of the nodes that sent us the message are still present, then
- * m->routes will be NULL.
+ * the message will have no routes left.
  *
  * @return TRUE if the message is found.
  */
 static bool
-find_message(const struct guid *muid, uint8 function, struct message **m)
+find_message(const struct guid *muid, uint8 function, rtable_entry_t **m)
 {
-	struct message dummy;
-	const void *orig_key;
-
-	dummy.muid = *muid;
-	dummy.function = function;
-
-	if (hset_contains_extended(routing.messages_hashed, &dummy, &orig_key)) {
-		struct message *msg = deconstify_pointer(orig_key);
+	rtable_entry_t *msg = rtable_lookup(routing_table, muid, function);
 
+	if (msg != NULL) {
 		/* wipe out dead references to old nodes */
 		purge_dangling_references(msg);
 
@@ -2011,9 +1407,9 @@ route_max_forward_ttl(const gnutella_node_t *sender)
  * The message is not physically sent yet, but the `dest' structure is filled
  * with proper routing information.
  *
- * `routes' is normally NULL unless we're forwarding a PUSH request.  In that
- * case, it must be sent to the whole list of routes we have, and `target' will
- * be NULL.
+ * `m' is normally NULL unless we're forwarding a PUSH request.  In that
+ * case, it must be sent to the whole list of routes we have for the message,
+ * and `target' will be NULL.
  *
  * @attention
  * NB: we're just *recording* routing information for the message into `dest',
@@ -2025,11 +1421,11 @@ static bool
 forward_message(
 	struct route_log *route_log,
 	gnutella_node_t **node,
-	gnutella_node_t *target, struct route_dest *dest, pslist_t *routes)
+	gnutella_node_t *target, struct route_dest *dest, const rtable_entry_t *m)
 {
 	gnutella_node_t *sender = *node;
 
-	g_assert(routes == NULL || target == NULL);
+	g_assert(m == NULL || target == NULL);
 	g_assert(settings_is_ultra());
 
 	/* Drop messages that would travel way too many nodes --RAM */
@@ -2081,19 +1477,19 @@ forward_message(
 	} else {
 		/*
 		 * Forward message to all others nodes, or the the ones specified
-		 * by the `routes' parameter if not NULL.
+		 * by the routes of `m' if not NULL.
 		 */
 
-		if (routes != NULL) {
-			pslist_t *l;
+		if (m != NULL) {
 			pslist_t *nodes = NULL;
 			int count = 0;
+			uint i;
 
 			g_assert(gnutella_header_get_function(&sender->header)
 					== GTA_MSG_PUSH_REQUEST);
 
-			PSLIST_FOREACH(routes, l) {
-				struct route_data *rd = l->data;
+			for (i = 0; i < rtable_entry_route_count(m); i++) {
+				struct route_data *rd = rtable_entry_route(m, i);
 				if (rd->node == sender)
 					continue;
 
@@ -2188,7 +1584,7 @@ forward_message(
  */
 static bool
 handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
-	struct message *m, bool oob)
+	rtable_entry_t *m, bool oob)
 {
 	gnutella_node_t *sender = *node;
 	bool forward = FALSE;
@@ -2212,18 +1608,19 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 
 	routing_log_extra(route_log, oob ? "dup OOB GUID" : "dup message");
 
-	if (ttl_forward > m->ttl) {
-		routing_log_extra(route_log, "higher TTL (%d>%u)", ttl_forward, m->ttl);
+	if (ttl_forward > rtable_entry_ttl(m)) {
+		routing_log_extra(route_log, "higher TTL (%d>%u)",
+			ttl_forward, rtable_entry_ttl(m));
 
 		gnet_stats_inc_general(GNR_DUPS_WITH_HIGHER_TTL);
 
 		if (GNET_PROPERTY(log_dup_gnutella_higher_ttl)) {
 			gmsg_log_duplicate(sender,
 				"from %s: %shigher TTL (previous TTL was %u)",
-				node_infostr(sender), oob ? "OOB, " : "", m->ttl);
+				node_infostr(sender), oob ? "OOB, " : "", rtable_entry_ttl(m));
 		}
 
-		m->ttl = ttl_forward;   /* Remember highest TTL */
+		rtable_entry_set_ttl(m, ttl_forward);	/* Remember highest TTL */
 
 		forward = TRUE;         /* Forward but don't handle */
 	}
@@ -2237,7 +1634,7 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 	 * each route.
 	 */
 
-	if (m->routes && route_node_sent_message(sender, m)) {
+	if (route_node_sent_message(sender, m)) {
 		bool higher_ttl;
 
 		/*
@@ -2303,7 +1700,7 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 				gmsg_log_bad(sender, "dup message from same node");
 		}
 	} else {
-		if (m->routes == NULL) {
+		if (0 == rtable_entry_route_count(m)) {
 			routing_log_extra(route_log, "all routes lost");
 
 			if (GNET_PROPERTY(log_dup_gnutella_other_node)) {
@@ -2313,13 +1710,13 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
 			}
 		} else {
 			if (GNET_PROPERTY(log_gnutella_routing)) {
-				unsigned count = pslist_length(m->routes);
+				unsigned count = rtable_entry_route_count(m);
 				routing_log_extra(route_log, "%u remaining route%s",
 					PLURAL(count));
 			}
 
 			if (GNET_PROPERTY(log_dup_gnutella_other_node)) {
-				unsigned count = pslist_length(m->routes);
+				unsigned count = rtable_entry_route_count(m);
 				gmsg_log_duplicate(sender,
 					"from %s: %sother node, %u route%s (dups=%u)",
 					node_infostr(sender), oob ? "OOB, " : "",
@@ -2346,7 +1743,7 @@ handle_duplicate(struct route_log *route_log, gnutella_node_t **node,
  */
 static bool
 check_duplicate(struct route_log *route_log, gnutella_node_t **node,
-	const guid_t *mangled, struct message **mp)
+	const guid_t *mangled, rtable_entry_t **mp)
 {
 	gnutella_node_t *sender = *node;
 	uint8 function = gnutella_header_get_function(&sender->header);
@@ -2396,7 +1793,7 @@ route_push(struct route_log *route_log,
 	gnutella_node_t **node, struct route_dest *dest)
 {
 	gnutella_node_t *sender = *node;
-	struct message *m;
+	rtable_entry_t *m;
 	const struct guid *guid;
 	gnutella_node_t *neighbour;
 	host_addr_t ip;
@@ -2485,7 +1882,10 @@ route_push(struct route_log *route_log,
 
 		forward_message(route_log, node, neighbour, dest, NULL);
 
-	} else if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->routes) {
+	} else if (
+		find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) &&
+		0 != rtable_entry_route_count(m)
+	) {
 		gnet_stats_inc_general(GNR_PUSH_RELAYED_VIA_TABLE_ROUTE);
 
 		/*
@@ -2494,16 +1894,17 @@ route_push(struct route_log *route_log,
 		 */
 
 		revitalize_entry(m, FALSE);
-		forward_message(route_log, node, NULL, dest, m->routes);
+		forward_message(route_log, node, NULL, dest, m);
 
 	} else {
-		if (m && m->routes == NULL) {
+		if (m != NULL && 0 == rtable_entry_route_count(m)) {
 			routing_log_extra(route_log, "route to target GUID %s gone",
 				guid_hex_str(guid));
 			gnet_stats_count_dropped(sender, MSG_DROP_ROUTE_LOST);
 		} else {
 			routing_log_extra(route_log, "no route to target GUID %s",
 				guid_hex_str(guid));
+			gnet_stats_inc_general(GNR_ROUTING_TABLE_MISSES);
 			gnet_stats_count_dropped(sender, MSG_DROP_NO_ROUTE);
 		}
 
@@ -2633,7 +2034,7 @@ route_query_hit(struct route_log *route_log,
 	gnutella_node_t **node, struct route_dest *dest)
 {
 	gnutella_node_t *sender = *node;
-	struct message *m;
+	rtable_entry_t *m;
 	bool node_is_target = FALSE;
 	gnutella_node_t *found;
 	bool is_oob_proxied;
@@ -2670,7 +2071,7 @@ route_query_hit(struct route_log *route_log,
 				message_add(origin_guid, QUERY_HIT_ROUTE_SAVE, sender);
 				route_starving_check(origin_guid);
 			}
-		} else if (m->routes == NULL || !route_node_sent_message(sender, m)) {
+		} else if (!route_node_sent_message(sender, m)) {
 			struct route_data *route;
 
 			/*
@@ -2690,9 +2091,7 @@ route_query_hit(struct route_log *route_log,
 			 * no recording of the TTLs at which we see it.
 			 */
 
-			g_assert(m->ttls == NULL);
-
-			m->routes = pslist_append(m->routes, route);
+			rtable_entry_add_route(m, route, 0);
 			route->saved_messages++;
 
 			/*
@@ -2721,6 +2120,7 @@ route_query_hit(struct route_log *route_log,
 
 		routing_log_extra(route_log, "no request matching the reply!");
 
+		gnet_stats_inc_general(GNR_ROUTING_TABLE_MISSES);
 		gnet_stats_count_dropped(sender, MSG_DROP_NO_ROUTE);
 		sender->n_bad++;	/* Node shouldn't have forwarded this message */
 
@@ -2734,18 +2134,18 @@ route_query_hit(struct route_log *route_log,
 	g_assert(m);		/* Or find_message() would have returned FALSE */
 
 	/*
-	 * Since this routing data is used, relocate it at the end of
-	 * the "message_array[]" to augment its lifetime.
+	 * Since this routing data is used, move it to the current epoch
+	 * of the routing table to augment its lifetime.
 	 */
 
 	revitalize_entry(m, FALSE);
 
 	/*
-	 * If `m->routes' is NULL, we have seen the request, but unfortunately
+	 * If `m' has no routes, we have seen the request, but unfortunately
 	 * none of the nodes that sent us the request are connected any more.
 	 */
 
-	if (m->routes == NULL)
+	if (0 == rtable_entry_route_count(m))
 		goto route_lost;
 
 	if (route_node_sent_message(fake_node, m)) {
@@ -2782,12 +2182,12 @@ route_query_hit(struct route_log *route_log,
 	 * XXX route for relaying. --RAM, 2004-08-29
 	 */
 	{
-		pslist_t *sl;
+		uint i, n = rtable_entry_route_count(m);
 		bool skipped_transient = FALSE;
 
 		found = NULL;
-		PSLIST_FOREACH(m->routes, sl) {
-			struct route_data *route = sl->data;
+		for (i = 0; i < n; i++) {
+			struct route_data *route = rtable_entry_route(m, i);
 
 			g_assert(route);
 			g_assert(route->node);
@@ -2810,7 +2210,7 @@ route_query_hit(struct route_log *route_log,
 				 * will be logged as a message targeted to a transient node.
 				 */
 
-				if (NULL != pslist_next(sl)) {
+				if (i + 1 < n) {
 					gnutella_node_t *rn;
 
 					rn = route_node_get_gnutella(route->node);
@@ -2933,7 +2333,7 @@ route_message(gnutella_node_t **node, struct route_dest *dest)
 {
 	bool handle_it = FALSE;
 	gnutella_node_t *sender = *node;
-	struct message *m;
+	rtable_entry_t *m;
 	bool duplicate = FALSE;
 	struct route_log route_log;
 	const guid_t *mangled = NULL;
@@ -3079,9 +2479,12 @@ done:
 bool
 route_exists_for_reply(const struct guid *muid, uint8 function)
 {
-	struct message *m;
+	rtable_entry_t *m;
 
-	if (!find_message(muid, function & ~0x01, &m) || m->routes == NULL)
+	if (
+		!find_message(muid, function & ~0x01, &m) ||
+		0 == rtable_entry_route_count(m)
+	)
 		return FALSE;
 
 	return TRUE;
@@ -3110,7 +2513,7 @@ pslist_t *
 route_towards_guid(const struct guid *guid)
 {
 	gnutella_node_t *node;
-	struct message *m;
+	rtable_entry_t *m;
 
 	if (is_banned_push(guid))
 		return NULL;
@@ -3119,12 +2522,16 @@ route_towards_guid(const struct guid *guid)
 	if (node)
 		return pslist_prepend(NULL, node);
 
-	if (find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) && m->routes) {
-		pslist_t *iter, *nodes = NULL;
+	if (
+		find_message(guid, QUERY_HIT_ROUTE_SAVE, &m) &&
+		0 != rtable_entry_route_count(m)
+	) {
+		pslist_t *nodes = NULL;
+		uint i;
 
 		revitalize_entry(m, TRUE);
-		PSLIST_FOREACH(m->routes, iter) {
-			struct route_data *rd = iter->data;
+		for (i = 0; i < rtable_entry_route_count(m); i++) {
+			struct route_data *rd = rtable_entry_route(m, i);
 			nodes = pslist_prepend(nodes, rd->node);
 		}
 		return nodes;
@@ -3196,25 +2603,9 @@ routing_close(void)
 {
 	uint cnt;
 
-	g_assert(routing.messages_hashed != NULL);
-
-	hset_free_null(&routing.messages_hashed);
+	g_assert(routing_table != NULL);
 
-	for (cnt = 0; cnt < MAX_CHUNKS; cnt++) {
-		struct message **chunk = routing.chunks[cnt];
-		if (chunk != NULL) {
-			int i;
-			for (i = 0; i < CHUNK_MESSAGES; i++) {
-				struct message *m = chunk[i];
-				if (m != NULL) {
-					message_check(m, cnt);
-					free_route_list(m);
-					WFREE(m);
-				}
-			}
-			HFREE_NULL(chunk);
-		}
-	}
+	rtable_free_null(&routing_table);
 
 	hset_foreach(ht_banned_push, free_banned_push, NULL);
 	hset_free_null(&ht_banned_push);
@@ -39,9 +39,12 @@
 #include "rx.h"
 #include "rx_inflate.h"
 #include "rxbuf.h"
+#include "zworker.h"
 
 #include "lib/base16.h"			/* For error messages */
+#include "lib/cq.h"
 #include "lib/pmsg.h"
+#include "lib/slist.h"
 #include "lib/str.h"			/* For error messages */
 #include "lib/stringify.h"		/* For plural() */
 #include "lib/walloc.h"
@@ -57,20 +60,64 @@ struct attr {
 	z_streamp inz;					/**< Decompressing stream */
 	size_t processed;				/**< Input bytes decompressed so far */
 	int flags;
+	struct inflate_job *job;		/**< Decompression job in flight */
+	slist_t *inq;					/**< Input messages not inflated yet */
+	slist_t *outq;					/**< Inflated messages not delivered yet */
+	cevent_t *deliver_ev;			/**< Delivery after reception enabled */
 };
 
 #define IF_ENABLED	0x00000001		/**< Reception enabled */
+#define IF_THREADED	0x00000002		/**< Inflating in compression threads */
+#define IF_ERROR	0x00000004		/**< Stream failed, discard input */
+
+/*
+ * When inflating in the compression threads, the input messages received
+ * whilst a job is in flight are queued and handed to the next job, so that
+ * each stream has at most one job at a time and data remain ordered.
+ *
+ * The job owns the decompressing stream until it completes.  Inflated data
+ * are delivered to the upper layer from the main thread, and are held
+ * whilst reception is disabled.
+ */
+
+enum inflate_job_magic { INFLATE_JOB_MAGIC = 0x1b7e42c9 };
+
+struct inflate_job {
+	enum inflate_job_magic magic;
+	rxdrv_t *rx;					/**< Driver, NULL if destroyed meanwhile */
+	z_streamp inz;					/**< Decompressing stream */
+	slist_t *in;					/**< Input messages */
+	slist_t *out;					/**< Inflated messages */
+	size_t processed;				/**< Input bytes decompressed so far */
+	size_t inflated;				/**< Output bytes produced by the job */
+	str_t *error;					/**< Error message, if inflate() failed */
+};
+
+static inline void
+inflate_job_check(const struct inflate_job * const ij)
+{
+	g_assert(ij != NULL);
+	g_assert(INFLATE_JOB_MAGIC == ij->magic);
+}
 
 /**
  * Decompress more data from the input buffer `mb'.
- * @returns decompressed data in a new buffer, or NULL if no more data.
+ *
+ * This routine only uses the supplied arguments so that it can be run from
+ * a compression thread.
+ *
+ * @param inz		the decompressing stream
+ * @param mb		the input buffer, whose read pointer is advanced
+ * @param processed	input bytes processed so far, updated
+ * @param error		written with a new error message on failure
+ *
+ * @returns decompressed data in a new buffer, or NULL if no more data or
+ * on error.
  */
 static pmsg_t *
-inflate_data(rxdrv_t *rx, pmsg_t *mb)
+inflate_buffer(z_streamp inz, pmsg_t *mb, size_t *processed, str_t **error)
 {
-	struct attr *attr = rx->opaque;
 	pdata_t *db;					/* Inflated buffer */
-	z_streamp inz = attr->inz;
 	int ret, old_size, old_avail, inflated, consumed;
 
 	/*
@@ -102,7 +149,7 @@ inflate_data(rxdrv_t *rx, pmsg_t *mb)
 
 		s = str_new(128);
 		str_printf(s, "decompression failed between offsets %zu and %zu: %s",
-			attr->processed, attr->processed + old_size, zlib_strerror(ret));
+			*processed, *processed + old_size, zlib_strerror(ret));
 
 		/*
 		 * If error happens at the beginning of the stream, include the
@@ -112,7 +159,7 @@ inflate_data(rxdrv_t *rx, pmsg_t *mb)
 		 *		--RAM, 2014-01-06
 		 */
 
-		if (0 == attr->processed) {
+		if (0 == *processed) {
 			char data[33];
 			size_t n = MIN(UNSIGNED(old_size), (sizeof data - 1) / 2);
 			size_t m;
@@ -124,9 +171,7 @@ inflate_data(rxdrv_t *rx, pmsg_t *mb)
 			str_catf(s, " [first %zu hex byte%s: %s]", PLURAL(m/2), data);
 		}
 
-		errno = EIO;
-		attr->cb->inflate_error(rx->owner, "%s", str_2c(s));
-		str_destroy_null(&s);
+		*error = s;
 		goto cleanup;
 	}
 
@@ -139,7 +184,7 @@ inflate_data(rxdrv_t *rx, pmsg_t *mb)
 
 	consumed = old_size - inz->avail_in;
 	mb->m_rptr += consumed;					/* Read that far */
-	attr->processed += consumed;
+	*processed += consumed;
 
 	/*
 	 * Check whether some data was produced.
@@ -154,9 +199,6 @@ inflate_data(rxdrv_t *rx, pmsg_t *mb)
 
 	inflated = old_avail - inz->avail_out;
 
-	if (attr->cb->add_rx_inflated != NULL)
-		attr->cb->add_rx_inflated(rx->owner, inflated);
-
 	return pmsg_alloc(PMSG_P_DATA, db, 0, inflated);
 
 cleanup:
@@ -164,6 +206,215 @@ cleanup:
 	return NULL;
 }
 
+/**
+ * Decompress more data from the input buffer `mb'.
+ * @returns decompressed data in a new buffer, or NULL if no more data.
+ */
+static pmsg_t *
+inflate_data(rxdrv_t *rx, pmsg_t *mb)
+{
+	struct attr *attr = rx->opaque;
+	str_t *error = NULL;
+	pmsg_t *imb;
+
+	imb = inflate_buffer(attr->inz, mb, &attr->processed, &error);
+
+	if (error != NULL) {
+		errno = EIO;
+		attr->cb->inflate_error(rx->owner, "%s", str_2c(error));
+		str_destroy_null(&error);
+		return NULL;
+	}
+
+	if (imb != NULL && attr->cb->add_rx_inflated != NULL)
+		attr->cb->add_rx_inflated(rx->owner, pmsg_size(imb));
+
+	return imb;
+}
+
+/**
+ * Decompress the input of the job, from a compression thread.
+ */
+static void
+inflate_job_run(void *data)
+{
+	struct inflate_job *ij = data;
+	slist_iter_t *iter;
+
+	inflate_job_check(ij);
+
+	iter = slist_iter_on_head(ij->in);
+
+	while (NULL == ij->error && slist_iter_has_item(iter)) {
+		pmsg_t *mb = slist_iter_current(iter);
+		pmsg_t *imb;
+
+		while (NULL != (imb = inflate_buffer(ij->inz, mb,
+				&ij->processed, &ij->error))
+		) {
+			ij->inflated += pmsg_size(imb);
+			slist_append(ij->out, imb);
+		}
+
+		slist_iter_next(iter);
+	}
+
+	slist_iter_free(&iter);
+}
+
+/**
+ * Free decompression job.
+ */
+static void
+inflate_job_free(struct inflate_job *ij)
+{
+	inflate_job_check(ij);
+
+	pmsg_slist_free(&ij->in);
+	pmsg_slist_free(&ij->out);
+	str_destroy_null(&ij->error);
+	ij->magic = 0;
+	WFREE(ij);
+}
+
+/**
+ * Deliver the inflated messages to the upper layer, for as long as
+ * reception remains enabled.
+ *
+ * @return FALSE if the upper layer reported an error.
+ */
+static bool
+inflate_deliver(rxdrv_t *rx)
+{
+	struct attr *attr = rx->opaque;
+	pmsg_t *imb;
+
+	while (
+		(attr->flags & IF_ENABLED) &&
+		NULL != (imb = slist_shift(attr->outq))
+	) {
+		if (!(*rx->data.ind)(rx, imb)) {
+			attr->flags |= IF_ERROR;
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void inflate_job_done(void *data);
+
+/**
+ * Hand the queued input to the compression threads, unless a job is
+ * already in flight or reception is disabled.
+ */
+static void
+inflate_dispatch(rxdrv_t *rx)
+{
+	struct attr *attr = rx->opaque;
+	struct inflate_job *ij;
+
+	g_assert(attr->flags & IF_THREADED);
+
+	if (attr->job != NULL || 0 == slist_length(attr->inq))
+		return;
+
+	if ((attr->flags & (IF_ENABLED | IF_ERROR)) != IF_ENABLED)
+		return;
+
+	WALLOC0(ij);
+	ij->magic = INFLATE_JOB_MAGIC;
+	ij->rx = rx;
+	ij->inz = attr->inz;
+	ij->in = attr->inq;
+	ij->out = slist_new();
+	ij->processed = attr->processed;
+
+	attr->inq = slist_new();
+	attr->job = ij;
+
+	zworker_submit(inflate_job_run, inflate_job_done, ij);
+}
+
+/**
+ * Decompression job completed, from the main thread.
+ */
+static void
+inflate_job_done(void *data)
+{
+	struct inflate_job *ij = data;
+	rxdrv_t *rx = ij->rx;
+	struct attr *attr;
+	pmsg_t *imb;
+	str_t *error;
+
+	inflate_job_check(ij);
+
+	/*
+	 * If the driver was destroyed whilst the job was running, we now own
+	 * the decompressing stream.
+	 */
+
+	if (NULL == rx) {
+		(void) inflateEnd(ij->inz);
+		WFREE(ij->inz);
+		inflate_job_free(ij);
+		return;
+	}
+
+	attr = rx->opaque;
+	g_assert(ij == attr->job);
+
+	attr->job = NULL;
+	attr->processed = ij->processed;
+
+	if (ij->inflated != 0 && attr->cb->add_rx_inflated != NULL)
+		attr->cb->add_rx_inflated(rx->owner, ij->inflated);
+
+	while (NULL != (imb = slist_shift(ij->out)))
+		slist_append(attr->outq, imb);
+
+	error = ij->error;
+	ij->error = NULL;
+	inflate_job_free(ij);
+
+	/*
+	 * Data inflated before an error are delivered first, as they would
+	 * have been had we decompressed synchronously.
+	 */
+
+	if (!inflate_deliver(rx)) {
+		str_destroy_null(&error);
+		return;
+	}
+
+	if (error != NULL) {
+		attr->flags |= IF_ERROR;
+		pmsg_slist_discard_all(attr->inq);
+		errno = EIO;
+		attr->cb->inflate_error(rx->owner, "%s", str_2c(error));
+		str_destroy_null(&error);
+		return;
+	}
+
+	inflate_dispatch(rx);
+}
+
+/**
+ * Callout queue callback to resume delivery once reception was enabled.
+ */
+static void
+inflate_deliver_resume(cqueue_t *cq, void *data)
+{
+	rxdrv_t *rx = data;
+	struct attr *attr = rx->opaque;
+
+	cq_zero(cq, &attr->deliver_ev);
+
+	if (inflate_deliver(rx))
+		inflate_dispatch(rx);
+}
+
 /***
  *** Polymorphic routines.
  ***/
@@ -200,6 +451,12 @@ rx_inflate_init(rxdrv_t *rx, const void *args)
 	attr->cb = rargs->cb;
 	attr->inz = inz;
 
+	if (rargs->threaded && zworker_is_enabled()) {
+		attr->flags |= IF_THREADED;
+		attr->inq = slist_new();
+		attr->outq = slist_new();
+	}
+
 	rx->opaque = attr;
 
 	return rx;		/* OK */
@@ -216,12 +473,28 @@ rx_inflate_destroy(rxdrv_t *rx)
 
 	g_assert(attr->inz);
 
-	ret = inflateEnd(attr->inz);
-	if (ret != Z_OK)
-		g_warning("while freeing decompressor for peer %s: %s",
-			gnet_host_to_string(&rx->host), zlib_strerror(ret));
+	/*
+	 * When a job is in flight, the decompressing stream is in use by a
+	 * compression thread and will be freed when the job completes.
+	 */
+
+	if (attr->job != NULL) {
+		attr->job->rx = NULL;
+	} else {
+		ret = inflateEnd(attr->inz);
+		if (ret != Z_OK)
+			g_warning("while freeing decompressor for peer %s: %s",
+				gnet_host_to_string(&rx->host), zlib_strerror(ret));
 
-	WFREE_TYPE_NULL(attr->inz);
+		WFREE(attr->inz);
+	}
+
+	attr->inz = NULL;
+	cq_cancel(&attr->deliver_ev);
+	if (attr->flags & IF_THREADED) {
+		pmsg_slist_free(&attr->inq);
+		pmsg_slist_free(&attr->outq);
+	}
 	WFREE(attr);
 	rx->opaque = NULL;
 }
@@ -239,6 +512,22 @@ rx_inflate_recv(rxdrv_t *rx, pmsg_t *mb)
 	rx_check(rx);
 	g_assert(mb);
 
+	/*
+	 * When inflating in the compression threads, data are delivered to
+	 * the upper layer when the job completes.
+	 */
+
+	if (attr->flags & IF_THREADED) {
+		if (attr->flags & IF_ERROR) {
+			pmsg_free(mb);
+			return FALSE;
+		}
+
+		slist_append(attr->inq, mb);
+		inflate_dispatch(rx);
+		return TRUE;
+	}
+
 	/*
 	 * Decompress the stream, forwarding inflated data to the upper layer.
 	 * At any time, a packet we forward can cause the reception to be
@@ -264,6 +553,18 @@ rx_inflate_enable(rxdrv_t *rx)
 	struct attr *attr = rx->opaque;
 
 	attr->flags |= IF_ENABLED;
+
+	/*
+	 * Resume delivery of the data we held, but not from here since the
+	 * upper layer does not expect to be called back when enabling us.
+	 */
+
+	if (
+		(attr->flags & IF_THREADED) && NULL == attr->deliver_ev &&
+		(0 != slist_length(attr->outq) || 0 != slist_length(attr->inq))
+	) {
+		attr->deliver_ev = cq_main_insert(1, inflate_deliver_resume, rx);
+	}
 }
 
 /**
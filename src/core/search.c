@@ -88,6 +88,7 @@
 
 #include "lib/aging.h"
 #include "lib/array.h"
+#include "lib/aq.h"
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/compat_misc.h"
@@ -118,6 +119,8 @@
 #include "lib/sectoken.h"
 #include "lib/str.h"
 #include "lib/stringify.h"		/* For hex_escape() */
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/tm.h"
 #include "lib/tokenizer.h"
 #include "lib/urn.h"
@@ -269,6 +272,8 @@ static const char WHATS_NEW[] = "What's New?";
 static time_t search_last_whats_new;	/**< When we last sent "What's New?" */
 
 static bool search_reissue_timeout_callback(void *data);
+static void search_match_pool_create(void);
+static void search_match_pool_terminate(void);
 
 static uint
 query_desc_hash(const void *key)
@@ -5513,11 +5518,15 @@ search_init(void)
 		gnet_host_hash, gnet_host_equal, gnet_host_free_atom2);
 
 	cq_periodic_main_add(SEARCH_GC_PERIOD * 1000, search_gc, NULL);
+
+	search_match_pool_create();
 }
 
 void G_COLD
 search_shutdown(void)
 {
+	search_match_pool_terminate();
+
 	while (sl_search_ctrl != NULL) {
 		search_ctrl_t *sch = sl_search_ctrl->data;
 
@@ -9116,6 +9125,386 @@ drop:
 	return TRUE;
 }
 
+/**
+ * Report on the local matches of a query and deliver them, if any.
+ *
+ * This is the last stage of search_request(), which is deferred when the
+ * query is matched against the library by a separate thread.  The query
+ * context is freed.
+ *
+ * @param n				the node from which the query comes from (relay)
+ * @param sri			the information gathered about the query
+ * @param qctx			the query context, holding the matched files
+ * @param muid			the query's MUID
+ * @param hops			the hops travelled by the query
+ * @param ttl			the TTL of the query
+ * @param search		the query string
+ * @param safe_search	the query string, escaped for logging
+ */
+static void
+search_request_reply(gnutella_node_t *n,
+	const search_request_info_t *sri, struct query_context *qctx,
+	const guid_t *muid, uint8 hops, uint8 ttl,
+	const char *search, const char *safe_search)
+{
+	if (GNET_PROPERTY(query_trace)) {
+		g_info("Q #%s %s [%c %u/%u] hit=%03d \"%s\" (%s)%s%s%s%s%s",
+			guid_hex_str(muid),
+			search_request_info_as_bits(sri),
+			NODE_IS_UDP(n) ? 'G' : NODE_IS_LEAF(n) ? 'L' : 'U',
+			hops, ttl,
+			qctx->found,
+			sri->whats_new ? WHATS_NEW : lazy_safe_search(search),
+			search_media_mask_to_string(sri->media_types),
+			sri->skip_file_search ? " (skipped local)" : "",
+			sri->exv_sha1cnt > 0 ? " (SHA1)" : "",
+			sri->oob ? " <" : "",
+			sri->oob ? host_addr_port_to_string(sri->addr, sri->port) : "",
+			sri->oob ? ">" : "");
+	}
+
+	if (qctx->found > 0) {
+		if (
+			(settings_is_leaf() && node_ultra_received_qrp(n)) ||
+			(NODE_TALKS_G2(n) && node_hub_received_qrp(n))
+		)
+			node_inc_qrp_match(n);
+
+		if (GNET_PROPERTY(share_debug) > 3) {
+			g_debug("share HIT %u file%s '%s'%s for #%s%s",
+				PLURAL(qctx->found),
+				sri->whats_new ? WHATS_NEW : safe_search,
+				sri->skip_file_search ? " (skipped)" : "",
+				guid_hex_str(muid),
+				NODE_TALKS_G2(n) ? " (G2)" : "");
+			if (sri->exv_sha1cnt) {
+				int i;
+				for (i = 0; i < sri->exv_sha1cnt; i++)
+					g_debug("\t%c(%32s)",
+						sri->exv_sha1[i].matched ? '+' : '-',
+						sha1_base32(&sri->exv_sha1[i].sha1));
+			}
+			g_debug("\tflags=0x%04x max-hits=%u (%s) "
+				"ttl=%u hops=%u",
+				(uint) sri->flags,
+				(uint) (sri->flags & QUERY_F_MAX_HITS),
+				search_flags_to_string(sri->flags),
+				ttl, hops);
+		}
+	}
+
+	if (GNET_PROPERTY(query_debug) > 14) {
+		g_debug("QUERY #%s \"%s\" [hops=%u, TTL=%u] has %u hit%s%s%s (%s)",
+				guid_hex_str(muid),
+				sri->whats_new ? WHATS_NEW : lazy_safe_search(search),
+				hops, ttl,
+				PLURAL(qctx->found),
+				sri->skip_file_search ? " (skipped local)" : "",
+				sri->exv_sha1cnt > 0 ? " (SHA1)" : "",
+				search_media_mask_to_string(sri->media_types));
+	}
+
+	/*
+	 * If we got a query marked for OOB results delivery, send them
+	 * a reply out-of-band but only if the query's hops is > 1.  Otherwise,
+	 * we have a direct link to the queryier.
+	 */
+
+	if (qctx->found) {
+		bool should_oob;
+		unsigned flags = 0;
+
+		flags |= (sri->flags & QUERY_F_GGEP_H) ? QHIT_F_GGEP_H : 0;
+		flags |= sri->ipv6 ? QHIT_F_IPV6 : 0;
+		flags |= sri->ipv6_only ? QHIT_F_IPV6_ONLY : 0;
+
+		should_oob = sri->oob && !sri->g2_query &&
+						GNET_PROPERTY(process_oob_queries) &&
+						GNET_PROPERTY(recv_solicited_udp) &&
+						udp_active() &&
+						hops > 1 &&
+						settings_running_same_net(sri->addr);
+
+		if (should_oob) {
+			oob_got_results(n, muid, qctx->files, qctx->found,
+				sri->addr, sri->port, sri->secure_oob, sri->sr_udp, flags);
+		} else if (sri->g2_query) {
+			gnutella_node_t *g = n;
+			if (sri->oob)
+				g = node_udp_g2_get_addr_port(sri->addr, sri->port);
+			flags |= sri->g2_wants_url ? QHIT_F_G2_URL : 0;
+			flags |= sri->g2_wants_dn  ? QHIT_F_G2_DN  : 0;
+			flags |= sri->g2_wants_alt ? QHIT_F_G2_ALT : 0;
+			g2_build_send_qh2(n, g, qctx->files, qctx->found, muid, flags);
+		} else {
+			qhit_send_results(n, qctx->files, qctx->found, muid, flags);
+		}
+	}
+
+	share_query_context_free(qctx);
+}
+
+/***
+ *** Query matching thread pool.
+ ***/
+
+#define SEARCH_MATCH_THREAD_MAX	32		/**< Max threads in pool */
+#define SEARCH_MATCH_PENDING	256		/**< Max queries handed to the pool */
+
+enum search_match_magic { SEARCH_MATCH_MAGIC = 0x46a3c9b1 };
+
+/**
+ * A query whose matching against the library is handed to the pool.
+ *
+ * The query information is copied since search_request() callers do not
+ * keep it around, and the node is referred to by its ID since it can go
+ * away before the matching is done.
+ */
+struct search_match {
+	enum search_match_magic magic;
+	search_request_info_t sri;		/**< Copy of the query information */
+	struct query_context *qctx;		/**< Query context, referring to sri */
+	const struct nid *node_id;		/**< Node from which query comes */
+	char *search;					/**< The query string (halloc-ed) */
+	guid_t muid;					/**< The query's MUID */
+	uint32 max_replies;				/**< Max amount of matches */
+	uint32 flags;					/**< SHARE_FM_* flags */
+	uint8 hops;						/**< Query hops */
+	uint8 ttl;						/**< Query TTL */
+};
+
+static inline void
+search_match_check(const struct search_match * const sm)
+{
+	g_assert(sm != NULL);
+	g_assert(SEARCH_MATCH_MAGIC == sm->magic);
+}
+
+static aqueue_t *search_match_queue;	/**< Queries waiting for a thread */
+static uint search_match_threads;		/**< Amount of threads in pool */
+static uint search_match_pending;		/**< Queries handed to the pool */
+static bool search_match_stopping;		/**< Set when pool is terminated */
+static int search_match_exit;			/**< Its address tells thread to exit */
+
+/**
+ * Free query handed to the pool, along with its matches if not delivered.
+ */
+static void
+search_match_free(struct search_match *sm)
+{
+	search_match_check(sm);
+
+	if (sm->qctx != NULL) {
+		shared_file_slist_free_null(&sm->qctx->files);
+		share_query_context_free(sm->qctx);
+	}
+	nid_unref(sm->node_id);
+	HFREE_NULL(sm->search);
+	sm->magic = 0;
+	WFREE(sm);
+}
+
+/**
+ * Invoked in the main thread when the matching of a query is done,
+ * to deliver the hits.
+ */
+static void
+search_match_done(void *data)
+{
+	struct search_match *sm = data;
+	gnutella_node_t *n;
+	char *safe_search;
+
+	search_match_check(sm);
+	g_assert(thread_is_main());
+
+	search_match_pending--;
+
+	n = search_match_stopping ? NULL : node_by_id(sm->node_id);
+
+	if (NULL == n || NODE_IS_REMOVING(n)) {
+		if (GNET_PROPERTY(query_debug) > 1) {
+			g_debug("QUERY #%s \"%s\": dropping %u hit%s, node %s is gone",
+				guid_hex_str(&sm->muid), lazy_safe_search(sm->search),
+				PLURAL(sm->qctx->found), nid_to_string(sm->node_id));
+		}
+		search_match_free(sm);
+		return;
+	}
+
+	safe_search = hex_escape(sm->search, FALSE);
+
+	search_request_reply(n, &sm->sri, sm->qctx, &sm->muid,
+		sm->hops, sm->ttl, sm->search, safe_search);
+	sm->qctx = NULL;		/* Freed by search_request_reply() */
+
+	if (safe_search != sm->search)
+		HFREE_NULL(safe_search);
+
+	search_match_free(sm);
+}
+
+/**
+ * Query matching thread main loop.
+ */
+static void *
+search_match_thread_main(void *arg)
+{
+	const char *name = arg;
+
+	thread_set_name(name);
+
+	for (;;) {
+		struct search_match *sm = aq_remove(search_match_queue);
+
+		if (&search_match_exit == (void *) sm)
+			break;
+
+		search_match_check(sm);
+
+		shared_files_match(sm->search, &sm->sri,
+			got_match, sm->qctx, sm->max_replies, sm->flags, NULL);
+
+		teq_safe_post(THREAD_MAIN_ID, search_match_done, sm);
+	}
+
+	if (GNET_PROPERTY(query_debug))
+		g_debug("query %s exiting", thread_name());
+
+	return NULL;
+}
+
+/**
+ * Create the pool of query matching threads, if configured.
+ */
+static void G_COLD
+search_match_pool_create(void)
+{
+	uint i, n = GNET_PROPERTY(search_match_threads);
+
+	g_assert(thread_is_main());
+
+	if (0 == n)
+		return;
+
+	n = MIN(n, SEARCH_MATCH_THREAD_MAX);
+	search_match_queue = aq_make();
+
+	for (i = 0; i < n; i++) {
+		const char *name = constant_str(str_smsg("match #%u", i + 1));
+
+		(void) thread_create(search_match_thread_main,
+				deconstify_char(name),
+				THREAD_F_DETACH | THREAD_F_NO_CANCEL |
+					THREAD_F_NO_POOL | THREAD_F_PANIC,
+				THREAD_STACK_DFLT);
+	}
+
+	search_match_threads = n;
+
+	if (GNET_PROPERTY(query_debug))
+		g_debug("created %u query matching thread%s", PLURAL(n));
+}
+
+/**
+ * Terminate the pool of query matching threads.
+ *
+ * Queries still waiting for a thread are discarded, and the ones being
+ * processed will be discarded when handed back to the main thread.
+ */
+static void G_COLD
+search_match_pool_terminate(void)
+{
+	struct search_match *sm;
+	uint i;
+
+	g_assert(thread_is_main());
+
+	if (NULL == search_match_queue)
+		return;
+
+	search_match_stopping = TRUE;
+
+	while (NULL != (sm = aq_remove_try(search_match_queue))) {
+		search_match_pending--;
+		search_match_free(sm);
+	}
+
+	for (i = 0; i < search_match_threads; i++)
+		aq_put(search_match_queue, &search_match_exit);
+
+	/*
+	 * The queue is referenced by the threads which may not have exited yet,
+	 * therefore we leave it around.
+	 */
+
+	search_match_threads = 0;
+}
+
+/**
+ * Hand the matching of the query string against the library to the pool
+ * of matching threads, if possible.
+ *
+ * Only queries whose hits will be delivered back through the node from
+ * which they came or via OOB are handled: G2 and GUESS queries use the
+ * node for replying to the host they came from, which is only known at
+ * the time the query is received.
+ *
+ * @param n				the node from which the query comes from (relay)
+ * @param sri			the information gathered about the query
+ * @param qctx			the query context, possibly holding SHA1 matches
+ * @param search		the query string
+ * @param max_replies	maximum amount of matches
+ * @param flags			SHARE_FM_* flags for shared_files_match()
+ *
+ * @return TRUE if the query was handed over, in which case the pool now
+ * owns the query context and will reply via search_request_reply().
+ */
+static bool
+search_match_offload(gnutella_node_t *n,
+	const search_request_info_t *sri, struct query_context *qctx,
+	const char *search, uint32 max_replies, uint32 flags)
+{
+	struct search_match *sm;
+
+	if (0 == search_match_threads || search_match_stopping)
+		return FALSE;
+
+	if (sri->g2_query || NODE_IS_UDP(n))
+		return FALSE;
+
+	/*
+	 * When the pool is lagging behind, match synchronously: this slows
+	 * down the main thread, hence the rate at which we get new queries.
+	 */
+
+	if (search_match_pending >= SEARCH_MATCH_PENDING) {
+		gnet_stats_inc_general(GNR_QUERY_MATCH_SYNC);
+		return FALSE;
+	}
+
+	WALLOC0(sm);
+	sm->magic = SEARCH_MATCH_MAGIC;
+	sm->sri = *sri;
+	sm->sri.extended_query = NULL;		/* Already in `search' */
+	sm->qctx = qctx;
+	sm->node_id = nid_ref(NODE_ID(n));
+	sm->search = h_strdup(search);
+	sm->muid = *gnutella_header_get_muid(&n->header);
+	sm->max_replies = max_replies;
+	sm->flags = flags;
+	sm->hops = gnutella_header_get_hops(&n->header);
+	sm->ttl = gnutella_header_get_ttl(&n->header);
+
+	qctx->sri = &sm->sri;
+
+	search_match_pending++;
+	gnet_stats_inc_general(GNR_QUERY_MATCH_OFFLOADED);
+	aq_put(search_match_queue, sm);
+
+	return TRUE;
+}
+
 /**
  * Searches requests (from others nodes)
  * Basic matching. The search request is made lowercase and
@@ -9364,110 +9753,24 @@ search_request(gnutella_node_t *n,
 			flags |= sri->partials ? SHARE_FM_PARTIALS : 0;
 			flags |= NODE_TALKS_G2(n) ? SHARE_FM_G2 : 0;
 
+			/*
+			 * When matching is done by the thread pool, the hits will be
+			 * delivered later.  The query hash vector is filled below.
+			 */
+
+			if (search_match_offload(n, sri, qctx, search, max_replies, flags))
+				goto finish;
+
 			shared_files_match(search, sri,
 				got_match, qctx, max_replies, flags, qhv);
 
 			qhv_filled = TRUE;		/* A side effect of st_search() */
 		}
 
-		if (GNET_PROPERTY(query_trace)) {
-			g_info("Q #%s %s [%c %u/%u] hit=%03d \"%s\" (%s)%s%s%s%s%s",
-				guid_hex_str(gnutella_header_get_muid(&n->header)),
-				search_request_info_as_bits(sri),
-				NODE_IS_UDP(n) ? 'G' : NODE_IS_LEAF(n) ? 'L' : 'U',
-				gnutella_header_get_hops(&n->header),
-				gnutella_header_get_ttl(&n->header),
-				qctx->found,
-				sri->whats_new ? WHATS_NEW : lazy_safe_search(search),
-				search_media_mask_to_string(sri->media_types),
-				sri->skip_file_search ? " (skipped local)" : "",
-				sri->exv_sha1cnt > 0 ? " (SHA1)" : "",
-				sri->oob ? " <" : "",
-				sri->oob ? host_addr_port_to_string(sri->addr, sri->port) : "",
-				sri->oob ? ">" : "");
-		}
-
-		if (qctx->found > 0) {
-			if (
-				(settings_is_leaf() && node_ultra_received_qrp(n)) ||
-				(NODE_TALKS_G2(n) && node_hub_received_qrp(n))
-			)
-				node_inc_qrp_match(n);
-
-			if (GNET_PROPERTY(share_debug) > 3) {
-				g_debug("share HIT %u file%s '%s'%s for #%s%s",
-					PLURAL(qctx->found),
-					sri->whats_new ? WHATS_NEW : safe_search,
-					sri->skip_file_search ? " (skipped)" : "",
-					guid_hex_str(gnutella_header_get_muid(&n->header)),
-					NODE_TALKS_G2(n) ? " (G2)" : "");
-				if (sri->exv_sha1cnt) {
-					int i;
-					for (i = 0; i < sri->exv_sha1cnt; i++)
-						g_debug("\t%c(%32s)",
-							sri->exv_sha1[i].matched ? '+' : '-',
-							sha1_base32(&sri->exv_sha1[i].sha1));
-				}
-				g_debug("\tflags=0x%04x max-hits=%u (%s) "
-					"ttl=%u hops=%u",
-					(uint) sri->flags,
-					(uint) (sri->flags & QUERY_F_MAX_HITS),
-					search_flags_to_string(sri->flags),
-					gnutella_header_get_ttl(&n->header),
-					gnutella_header_get_hops(&n->header));
-			}
-		}
-
-		if (GNET_PROPERTY(query_debug) > 14) {
-			g_debug("QUERY #%s \"%s\" [hops=%u, TTL=%u] has %u hit%s%s%s (%s)",
-					guid_hex_str(gnutella_header_get_muid(&n->header)),
-					sri->whats_new ? WHATS_NEW : lazy_safe_search(search),
-					gnutella_header_get_hops(&n->header),
-					gnutella_header_get_ttl(&n->header),
-					PLURAL(qctx->found),
-					sri->skip_file_search ? " (skipped local)" : "",
-					sri->exv_sha1cnt > 0 ? " (SHA1)" : "",
-					search_media_mask_to_string(sri->media_types));
-		}
-
-		/*
-		 * If we got a query marked for OOB results delivery, send them
-		 * a reply out-of-band but only if the query's hops is > 1.  Otherwise,
-		 * we have a direct link to the queryier.
-		 */
-
-		if (qctx->found) {
-			bool should_oob;
-			unsigned flags = 0;
-
-			flags |= (sri->flags & QUERY_F_GGEP_H) ? QHIT_F_GGEP_H : 0;
-			flags |= sri->ipv6 ? QHIT_F_IPV6 : 0;
-			flags |= sri->ipv6_only ? QHIT_F_IPV6_ONLY : 0;
-
-			should_oob = oob && !sri->g2_query &&
-							GNET_PROPERTY(process_oob_queries) &&
-							GNET_PROPERTY(recv_solicited_udp) &&
-							udp_active() &&
-							gnutella_header_get_hops(&n->header) > 1 &&
-							settings_running_same_net(sri->addr);
-
-			if (should_oob) {
-				oob_got_results(n, qctx->files, qctx->found,
-					sri->addr, sri->port, sri->secure_oob, sri->sr_udp, flags);
-			} else if (sri->g2_query) {
-				gnutella_node_t *g = n;
-				if (sri->oob)
-					g = node_udp_g2_get_addr_port(sri->addr, sri->port);
-				flags |= sri->g2_wants_url ? QHIT_F_G2_URL : 0;
-				flags |= sri->g2_wants_dn  ? QHIT_F_G2_DN  : 0;
-				flags |= sri->g2_wants_alt ? QHIT_F_G2_ALT : 0;
-				g2_build_send_qh2(n, g, qctx->files, qctx->found, muid, flags);
-			} else {
-				qhit_send_results(n, qctx->files, qctx->found, muid, flags);
-			}
-		}
-
-		share_query_context_free(qctx);
+		search_request_reply(n, sri, qctx, muid,
+			gnutella_header_get_hops(&n->header),
+			gnutella_header_get_ttl(&n->header),
+			search, safe_search);
 	}
 
 finish:
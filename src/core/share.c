@@ -70,9 +70,12 @@
 #include "lib/atoms.h"
 #include "lib/barrier.h"
 #include "lib/bg.h"
+#include "lib/bstr.h"
 #include "lib/cq.h"
 #include "lib/crash.h"
+#include "lib/dirwatch.h"
 #include "lib/endian.h"
+#include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/getcpucount.h"
 #include "lib/halloc.h"
@@ -82,7 +85,9 @@
 #include "lib/htable.h"
 #include "lib/listener.h"
 #include "lib/mime_type.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
+#include "lib/sha1.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/teq.h"
@@ -90,6 +95,7 @@
 #include "lib/tm.h"
 #include "lib/tsig.h"
 #include "lib/utf8.h"
+#include "lib/vmm.h"
 #include "lib/vsort.h"
 #include "lib/walloc.h"
 #include "lib/xmalloc.h"
@@ -98,6 +104,24 @@
 
 #define SHARE_RECENT_THRESH		(2 * 7 * 24 * 60 * 60)	/* 2 weeks */
 
+#define SHARE_DELTA_DELAY		(2 * 1000)	/* ms: let changes settle first */
+#define SHARE_DELTA_MIN			1000		/* Changes before full rescan */
+#define SHARE_DELTA_RATIO		8			/* Full rescan if 1/8 changed */
+
+#define SHARE_INDEX_FILE		"library_index"
+#define SHARE_INDEX_WHAT		"library index"
+#define SHARE_INDEX_MAGIC		"GTKG-LIB"	/* File magic, no trailing NUL */
+#define SHARE_INDEX_MAGIC_LEN	8
+#define SHARE_INDEX_VERSION		1
+#define SHARE_INDEX_RECSIZE		1024		/* Initial record buffer size */
+
+/*
+ * Flags for the library index records.
+ */
+#define SHARE_INDEX_F_DIGESTS	(1U << 0)	/* SHA1 and TTH follow */
+#define SHARE_INDEX_F_RELATIVE	(1U << 1)	/* Relative path present */
+#define SHARE_INDEX_F_NORMAL	(1U << 2)	/* Normalized name present */
+
 enum shared_file_magic {
 	SHARED_FILE_MAGIC = 0x3702b437U
 };
@@ -176,6 +200,8 @@ static htable_t *special_names;
 static hset_t *extensions;	/* Shared filename extensions */
 static pslist_t *shared_dirs;
 static cevent_t *share_qrp_rebuild_ev;
+static dirwatch_t *share_dirwatch;	/* Monitors shared directories */
+static cevent_t *share_delta_ev;	/* Delayed incremental library update */
 
 static hset_t *partial_files;	/* Contains partial files, thread-safe */
 
@@ -199,6 +225,9 @@ static struct shared_library {
 	search_table_t *partial_table;
 	shared_file_t **file_table;			/* Sorted by mtime */
 	shared_file_t **sorted_file_table;	/* Sorted by name */
+	search_table_t *delta_table;		/* Files added since last rescan */
+	pslist_t *delta_files;				/* Files listed in delta_table */
+	uint64 delta_changes;				/* Changes applied since last rescan */
 } shared_libfile;
 static spinlock_t shared_libfile_slk = SPINLOCK_INIT;
 
@@ -223,10 +252,11 @@ GENERATE_ACCESSOR(uint64, bytes_scanned)
 #undef GENERATE_ACCESSOR
 
 /**
- * The recursive_scan_context is the context used by two distinct background
+ * The recursive_scan_context is the context used by three distinct background
  * tasks, which cannot run at the same time:
  *
  * - the library rescan
+ * - the incremental library update
  * - the rebuilding of the QRP tables
  *
  * The library rescan looks through all the shared directories to identify the
@@ -234,6 +264,10 @@ GENERATE_ACCESSOR(uint64, bytes_scanned)
  * in the shared list.  It terminates with the rebuilding of the QRP tables,
  * in the same task context.
  *
+ * The incremental library update only looks at the directories which we were
+ * told have changed, and patches the current library with the differences.
+ * It also terminates with the rebuilding of the QRP tables.
+ *
  * When running on a system with more than 1 CPU, the background task actually
  * runs in a dedicated thread, but the task does not need to know that.
  *
@@ -270,13 +304,17 @@ static struct share_thread_vars {
 	spinlock_t lock;					/* Lock to allow concurrent access */
 	bgsched_t *sched;					/* Background task scheduler */
 	struct bgtask *task;				/* Current task, NULL if none */
+	htable_t *deltas;					/* Changed directories to rescan */
 	bool qrp_rebuild;					/* Whether QRP rebuild is pending */
+	bool delta;							/* Whether library update is pending */
 	bool exiting;						/* Whether thread should exit */
 } share_thread_vars = {
 	SPINLOCK_INIT,			/* lock */
 	NULL,					/* sched */
 	NULL,					/* task */
+	NULL,					/* deltas */
 	FALSE,					/* qrp_rebuild */
+	FALSE,					/* delta */
 	FALSE,					/* exiting */
 };
 static unsigned share_thread_id = THREAD_INVALID_ID;
@@ -783,7 +821,7 @@ shared_files_match(const char *query,
 {
 	int n;
 	int remain;
-	search_table_t *gt, *pt;
+	search_table_t *gt, *dt, *pt;
 	bool partials = booleanize(flags & SHARE_FM_PARTIALS);
 	bool g2_query = booleanize(flags & SHARE_FM_G2);
 
@@ -794,15 +832,21 @@ shared_files_match(const char *query,
 
 	SHARED_LIBFILE_LOCK;
 	gt = st_refcnt_inc(shared_libfile.search_table);
+	dt = NULL == shared_libfile.delta_table ?
+		NULL : st_refcnt_inc(shared_libfile.delta_table);
 	pt = partials ? st_refcnt_inc(shared_libfile.partial_table) : NULL;
 	SHARED_LIBFILE_UNLOCK;
 
 	/*
-	 * First search from the library.
+	 * First search from the library, including the files that were added
+	 * by incremental updates since the last full rescan.
 	 */
 
 	n = st_search(gt, query, sri, callback, user_data, max_res, qhv);
 
+	if (dt != NULL && n < max_res)
+		n += st_search(dt, query, sri, callback, user_data, max_res - n, NULL);
+
 
 	gnet_stats_count_general(g2_query ? GNR_LOCAL_G2_HITS : GNR_LOCAL_HITS, n);
 	remain = max_res - n;
@@ -823,6 +867,7 @@ shared_files_match(const char *query,
 	}
 
 	st_free(&gt);
+	st_free(&dt);
 	st_free(&pt);
 }
 
@@ -1526,6 +1571,15 @@ share_tthset_free(hset_t *set)
 	hset_free_null(&set);
 }
 
+/**
+ * A changed directory, to be rescanned during incremental library updates.
+ */
+struct share_delta_dir {
+	const char *dir;			/* directory to rescan (atom) */
+	const char *base;			/* shared directory holding it (atom) */
+	bool recursive;				/* whether to also rescan sub-directories */
+};
+
 enum recursive_scan_magic { RECURSIVE_SCAN_MAGIC = 0x16926d87U };
 
 struct recursive_scan {
@@ -1540,6 +1594,11 @@ struct recursive_scan {
 	slist_t *sub_dirs;			/* list of g_malloc()ed strings */
 	slist_t *shared_files;		/* list of struct shared_file */
 	slist_t *partial_files;		/* list of struct shared_file */
+	slist_t *dirs;				/* scanned directories (atoms), to watch */
+	slist_t *deltas;			/* changed directories left to rescan */
+	htable_t *scope;			/* changed directories -> share_delta_dir */
+	pslist_t *added;			/* files added by incremental update */
+	pslist_t *removed;			/* files removed by incremental update */
 	slist_iter_t *iter;			/* list iterator */
 	htable_t *words;			/* records words making up filenames, for QRP */
 	htable_t *basenames;		/* known file basenames */
@@ -1555,6 +1614,10 @@ struct recursive_scan {
 	int idx;					/* iterating index */
 	int ticks;					/* ticks used */
 	size_t ftable_capacity;		/* Amount of entries in ftable[] */
+	bool rescan;				/* whether doing a full library rescan */
+	bool watch;					/* whether to record scanned directories */
+	bool flat;					/* whether to skip sub-directories */
+	bool loaded;				/* whether library was loaded from index */
 };
 
 static inline void
@@ -1566,6 +1629,7 @@ recursive_scan_check(const struct recursive_scan * const ctx)
 	g_assert(ctx->sub_dirs != NULL);
 	g_assert(ctx->shared_files != NULL);
 	g_assert(ctx->partial_files != NULL);
+	g_assert(ctx->dirs != NULL);
 }
 
 static struct recursive_scan *
@@ -1581,6 +1645,8 @@ recursive_scan_new(const pslist_t *base_dirs, time_t now)
 	ctx->sub_dirs = slist_new();
 	ctx->shared_files = slist_new();
 	ctx->partial_files = slist_new();
+	ctx->dirs = slist_new();
+	ctx->watch = GNET_PROPERTY(share_incremental_rescan);
 	ctx->words = htable_create(HASH_KEY_STRING, 0);
 	ctx->basenames = htable_create(HASH_KEY_STRING, 0);
 	PSLIST_FOREACH(base_dirs, iter) {
@@ -1634,6 +1700,54 @@ scan_base_dir_free(void *data)
 	atom_str_free(data);
 }
 
+/**
+ * Hash table iterator callback to free a changed directory description.
+ */
+static void
+share_delta_dir_free(const void *unused_key, void *value, void *unused_data)
+{
+	struct share_delta_dir *d = value;
+
+	(void) unused_key;
+	(void) unused_data;
+
+	atom_str_free_null(&d->dir);
+	atom_str_free_null(&d->base);
+	WFREE(d);
+}
+
+/**
+ * Free table of changed directories and nullify its pointer.
+ */
+static void
+share_delta_free_null(htable_t **ht_ptr)
+{
+	htable_t *ht = *ht_ptr;
+
+	if (ht != NULL) {
+		htable_foreach(ht, share_delta_dir_free, NULL);
+		htable_free_null(ht_ptr);
+	}
+}
+
+
+/**
+ * Release the snapshot copy of the file table, if any.
+ */
+static void
+recursive_scan_free_ftable(struct recursive_scan *ctx)
+{
+	if (ctx->ftable != NULL) {
+		size_t i;
+
+		for (i = 0; i < ctx->ftable_capacity; i++) {
+			shared_file_unref(&ctx->ftable[i]);
+		}
+
+		XFREE_NULL(ctx->ftable);
+		ctx->ftable_capacity = 0;
+	}
+}
 
 /**
  * Free the background task context for library / QRP rebuilds.
@@ -1655,6 +1769,11 @@ recursive_scan_context_free(void *data)
 	slist_free_all(&ctx->sub_dirs, do_hfree);
 	slist_free_all(&ctx->shared_files, recursive_sf_unref);
 	slist_free_all(&ctx->partial_files, recursive_sf_unref);
+	slist_free_all(&ctx->dirs, scan_base_dir_free);
+	slist_free(&ctx->deltas);			/* Items held in ctx->scope */
+	share_delta_free_null(&ctx->scope);
+	shared_file_slist_free_null(&ctx->added);
+	shared_file_slist_free_null(&ctx->removed);
 
 	htable_free_null(&ctx->basenames);
 	st_free(&ctx->search_tb);
@@ -1665,16 +1784,7 @@ recursive_scan_context_free(void *data)
 	HFREE_NULL(ctx->files);
 	HFREE_NULL(ctx->sorted);
 
-	if (ctx->ftable != NULL) {
-		size_t i;
-
-		for (i = 0; i < ctx->ftable_capacity; i++) {
-			shared_file_unref(&ctx->ftable[i]);
-		}
-
-		XFREE_NULL(ctx->ftable);
-	}
-
+	recursive_scan_free_ftable(ctx);
 	shared_file_slist_free_null(&ctx->shared);
 
 	ctx->task = NULL;
@@ -1693,6 +1803,9 @@ share_free(void)
 	shared_file_slist_free_null(&shared_libfile.shared_files);
 	HFREE_NULL(shared_libfile.file_table);
 	HFREE_NULL(shared_libfile.sorted_file_table);
+	st_free(&shared_libfile.delta_table);
+	shared_file_slist_free_null(&shared_libfile.delta_files);
+	shared_libfile.delta_changes = 0;
 }
 
 /**
@@ -1780,6 +1893,9 @@ recursive_scan_opendir(struct recursive_scan *ctx, const char * const dir)
 	}
 	ctx->current_dir = atom_str_get(dir);
 
+	if (ctx->watch)
+		slist_append(ctx->dirs, deconstify_char(atom_str_get(dir)));
+
 	if (GNET_PROPERTY(share_debug) > 5)
 		g_debug("SHARE scanning directory \"%s\"", ctx->current_dir);
 }
@@ -1908,8 +2024,10 @@ recursive_scan_readdir(struct recursive_scan *ctx)
 
 		if (S_ISDIR(sb.st_mode)) {
 			/* If a directory, add to list for later processing */
-			slist_prepend(ctx->sub_dirs, fullpath);
-			fullpath = NULL;
+			if (!ctx->flat) {
+				slist_prepend(ctx->sub_dirs, fullpath);
+				fullpath = NULL;
+			}
 		} else if (S_ISREG(sb.st_mode)) {
 			shared_file_t *sf;
 
@@ -1929,6 +2047,8 @@ finish:
 	HFREE_NULL(fullpath);
 }
 
+static void share_thread_lib_delta(void *unused_arg);
+
 /**
  * Callback invoked by the background task layer when a task is terminated.
  */
@@ -1959,6 +2079,7 @@ recursive_scan_done(struct bgtask *bt, void *data, bgstatus_t status, void *arg)
 
 	if (THREAD_MAIN_ID == share_thread_id) {
 		struct share_thread_vars *v = &share_thread_vars;
+		bool delta;
 
 		/*
 		 * Taking the lock is not really necessary here because if we run
@@ -1971,8 +2092,17 @@ recursive_scan_done(struct bgtask *bt, void *data, bgstatus_t status, void *arg)
 
 		if (bt == v->task)
 			v->task = NULL;
+		delta = v->delta;
 
 		spinunlock(&v->lock);
+
+		/*
+		 * Launch any incremental update recorded whilst the task was
+		 * running, but not from within the background task scheduler.
+		 */
+
+		if (delta)
+			teq_post_unique(THREAD_MAIN_ID, share_thread_lib_delta, NULL);
 	}
 }
 
@@ -2063,14 +2193,32 @@ recursive_scan_next_dir(struct recursive_scan *ctx)
 		char *dir;
 
 		dir = slist_shift(ctx->sub_dirs);
+		ctx->flat = FALSE;
 		recursive_scan_opendir(ctx, dir);
 		HFREE_NULL(dir);
 		return FALSE;
 	} else if (slist_length(ctx->base_dirs) > 0) {
 		atom_str_free_null(&ctx->base_dir);
 		ctx->base_dir = slist_shift(ctx->base_dirs);
+		ctx->flat = FALSE;
 		recursive_scan_opendir(ctx, ctx->base_dir);
 		return FALSE;
+	} else if (ctx->deltas != NULL && slist_length(ctx->deltas) > 0) {
+		const struct share_delta_dir *d = slist_shift(ctx->deltas);
+
+		/*
+		 * During incremental updates, changed directories may have been
+		 * removed since we were notified: they will simply be found empty.
+		 * Directories flagged as non-recursive were notified about changes
+		 * in their files only, their sub-directories being already known.
+		 */
+
+		atom_str_free_null(&ctx->base_dir);
+		ctx->base_dir = atom_str_get(d->base);
+		ctx->flat = !d->recursive;
+		if (is_directory(d->dir))
+			recursive_scan_opendir(ctx, d->dir);
+		return FALSE;
 	} else {
 		atom_str_free_null(&ctx->base_dir);
 		return TRUE;
@@ -2366,7 +2514,7 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 {
 	struct recursive_scan *ctx = data;
 	size_t i;
-	pslist_t *files;
+	pslist_t *files, *delta;
 
 	recursive_scan_check(ctx);
 	g_assert(ctx->search_tb != NULL);
@@ -2409,11 +2557,13 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 	SHARED_LIBFILE_LOCK;
 
 	/*
-	 * Don't let share_free() free the list of files whilst we hold the lock.
+	 * Don't let share_free() free the lists of files whilst we hold the lock.
 	 */
 
 	files = shared_libfile.shared_files;
 	shared_libfile.shared_files = NULL;
+	delta = shared_libfile.delta_files;
+	shared_libfile.delta_files = NULL;
 	share_free();
 
 	/*
@@ -2451,6 +2601,7 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 	SHARED_LIBFILE_UNLOCK;
 
 	shared_file_slist_free_null(&files);
+	shared_file_slist_free_null(&delta);
 
 	/*
 	 * If we're not running in the main thread, we need to funnel this
@@ -2471,6 +2622,30 @@ recursive_scan_step_install_shared(struct bgtask *bt, void *data, int ticks)
 	return BGR_NEXT;
 }
 
+static void *share_watch_install(void *data);
+
+/**
+ * Update the set of watched directories with the ones we scanned.
+ */
+static bgret_t
+recursive_scan_step_watch(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+	(void) ticks;
+
+	/*
+	 * Directory watching is driven by the I/O event loop, which runs in
+	 * the main thread.
+	 */
+
+	teq_safe_rpc(THREAD_MAIN_ID, share_watch_install, ctx);
+
+	bg_task_ticks_used(bt, 0);
+	return BGR_NEXT;
+}
+
 /**
  * Get a snapshot copy (atomically) of all the shared files currently
  * visible from the application.
@@ -2505,168 +2680,1187 @@ recursive_scan_load_ftable(struct recursive_scan *ctx)
 	ctx->ticks += ctx->ftable_capacity;
 }
 
-static bgret_t
-recursive_scan_step_request_sha1(struct bgtask *bt, void *data, int ticks)
+/*
+ * Persistent library index.
+ *
+ * To be able to serve files right after startup, the shared library is saved
+ * to disk after each full rescan and when we shut down.  At startup, we load
+ * that index instead of scanning the shared directories, and only then do we
+ * check it against the filesystem, in the background.
+ *
+ * The index is a binary file, made of a header followed by one record per
+ * shared file.  All numbers are stored in big-endian, strings are stored
+ * with their ule64-encoded length, without any trailing NUL.
+ *
+ * The header is:
+ *
+ *   magic          8 bytes, "GTKG-LIB"
+ *   version        4 bytes
+ *   fingerprint    20 bytes, SHA1 of the configuration used to build index
+ *   count          4 bytes, amount of records that follow
+ *
+ * Each record is:
+ *
+ *   size           8 bytes
+ *   mtime          8 bytes
+ *   ctime          8 bytes
+ *   flags          1 byte, see SHARE_INDEX_F_* values
+ *   sha1           20 bytes, if SHARE_INDEX_F_DIGESTS
+ *   tth            24 bytes, if SHARE_INDEX_F_DIGESTS
+ *   path           string, absolute path of the file
+ *   relative       string, if SHARE_INDEX_F_RELATIVE
+ *   nfc            string, the NFC filename
+ *   canonic        string, the canonized name used for matching
+ *   normal         string, if SHARE_INDEX_F_NORMAL
+ *
+ * Because the names are stored in the form used for matching, we do not
+ * need to run the costly Unicode normalizations when loading the index.
+ */
+
+/**
+ * Compute fingerprint of the configuration parameters which influence the
+ * content of the library index: if any of them changes, the index is stale.
+ */
+static void
+share_index_fingerprint(struct sha1 *digest)
 {
-	struct recursive_scan *ctx = data;
+	static const property_t props[] = {
+		PROP_SHARED_DIRS_PATHS,
+		PROP_SCAN_EXTENSIONS,
+	};
+	SHA1_context ctx;
+	uint8 flags = 0;
+	uint i;
 
-	recursive_scan_check(ctx);
+	SHA1_reset(&ctx);
 
-	/*
-	 * The new library has been installed, we must now access the global
-	 * variables.
-	 */
+	for (i = 0; i < N_ITEMS(props); i++) {
+		char *s = gnet_prop_get_string(props[i], NULL, 0);
 
-	g_assert(NULL == ctx->files);		/* Indicates installation was done */
+		if (s != NULL)
+			SHA1_input(&ctx, s, vstrlen(s));
+		SHA1_input(&ctx, "\n", 1);
+		G_FREE_NULL(s);
+	}
 
-	ctx->ticks = 0;
+	if (GNET_PROPERTY(search_results_expose_relative_paths))
+		flags |= 1U << 0;
+	if (GNET_PROPERTY(scan_ignore_symlink_dirs))
+		flags |= 1U << 1;
+	if (GNET_PROPERTY(scan_ignore_symlink_regfiles))
+		flags |= 1U << 2;
 
-	/*
-	 * All the files are now shared and visible in the global data structures,
-	 * yet we need to iterate to request SHA1 computation.
-	 *
-	 * To avoid taking the global lock for too long, we duplicate the
-	 * file_table[] array, increment the reference on all the items, and
-	 * then release the global lock.
-	 *
-	 * Iterating on the copy is OK because request_sha1() will do nothing if
-	 * the file is no longer indexed.
-	 */
+	SHA1_input(&ctx, &flags, sizeof flags);
+	SHA1_result(&ctx, digest);
+}
 
-	if (0 == ctx->idx)
-		recursive_scan_load_ftable(ctx);
+/**
+ * Install the digests loaded from the index for a shared file.
+ */
+static void
+share_index_restore_digests(shared_file_t *sf)
+{
+	const struct sha1 *sha1 = sf->sha1;
+	const struct tth *tth = sf->tth;
 
-	while (UNSIGNED(ctx->idx) < ctx->ftable_capacity) {
-		shared_file_t *sf;
-		int i = ctx->idx++;
+	shared_file_check(sf);
 
-		sf = ctx->ftable[i];
+	/*
+	 * The digests were recorded in the structure when loading the index,
+	 * but they were not registered: do it now that the file is indexed.
+	 */
 
-		if (NULL == sf)
-			continue;
+	sf->sha1 = NULL;
+	sf->tth = NULL;
+	shared_file_set_sha1(sf, sha1);
+	shared_file_set_tth(sf, tth);
+	atom_sha1_free_null(&sha1);
+	atom_tth_free_null(&tth);
+}
 
-		shared_file_check(sf);
+/**
+ * Serialize shared file into the index record buffer.
+ *
+ * @param mb_ptr	the record buffer, resized as needed
+ * @param sf		the shared file to serialize
+ */
+static void
+share_index_record(pmsg_t **mb_ptr, const shared_file_t *sf)
+{
+	size_t rlen, needed;
+	uint8 flags = 0;
+	pmsg_t *mb = *mb_ptr;
 
-		/*
-		 * We must not change the file index after request_sha1() since this
-		 * can synchronously call routines to set the SHA1 if it's known
-		 * already.
-		 */
+	if (sha1_hash_available(sf) && sf->tth != NULL)
+		flags |= SHARE_INDEX_F_DIGESTS;
+	if (sf->relative_path != NULL)
+		flags |= SHARE_INDEX_F_RELATIVE;
+	if (sf->name_normal != NULL)
+		flags |= SHARE_INDEX_F_NORMAL;
 
-		request_sha1(sf);
+	rlen = NULL == sf->relative_path ? 0 : vstrlen(sf->relative_path);
 
-		if (ctx->ticks++ >= ticks)
-			return BGR_MORE;
+	needed = 3 * 8 + 1 + SHA1_RAW_SIZE + TTH_RAW_SIZE +
+		vstrlen(sf->file_path) + rlen +
+		sf->name_nfc_len + sf->name_canonic_len + sf->name_normal_len +
+		5 * 10;		/* Room for the ule64-encoded string lengths */
 
-		if (0 == (ctx->ticks & 0xf))
-			bg_task_cancel_test(ctx->task);
+	if (needed > UNSIGNED(pmsg_phys_len(mb))) {
+		pmsg_free(mb);
+		*mb_ptr = mb = pmsg_new(PMSG_P_DATA, NULL, needed);
+	} else {
+		pmsg_reset(mb);
 	}
 
-	/* Done rebuilding the SHA1 table */
-	atomic_bool_set(&share_rebuilding, FALSE);
+	pmsg_write_be64(mb, sf->file_size);
+	pmsg_write_be64(mb, sf->mtime);
+	pmsg_write_be64(mb, sf->ctime);
+	pmsg_write_u8(mb, flags);
 
-	bg_task_ticks_used(bt, ctx->ticks);
-	return BGR_NEXT;
+	if (flags & SHARE_INDEX_F_DIGESTS) {
+		pmsg_write(mb, sf->sha1, SHA1_RAW_SIZE);
+		pmsg_write(mb, sf->tth, TTH_RAW_SIZE);
+	}
+
+	pmsg_write_string(mb, sf->file_path, (size_t) -1);
+	if (flags & SHARE_INDEX_F_RELATIVE)
+		pmsg_write_string(mb, sf->relative_path, rlen);
+	pmsg_write_string(mb, sf->name_nfc, sf->name_nfc_len);
+	pmsg_write_string(mb, sf->name_canonic, sf->name_canonic_len);
+	if (flags & SHARE_INDEX_F_NORMAL)
+		pmsg_write_string(mb, sf->name_normal, sf->name_normal_len);
 }
 
-static bgret_t
-recursive_scan_step_tth_cache_cleanup(struct bgtask *bt, void *data, int ticks)
+/**
+ * Save the current library to the persistent index.
+ *
+ * This can be called from the main thread or from the library thread.
+ */
+static void
+share_index_save(void)
 {
-	struct recursive_scan *ctx = data;
+	shared_file_t **files;
+	size_t i, n, count = 0;
+	struct sha1 fingerprint;
+	file_path_t fp;
+	pmsg_t *mb;
+	FILE *f;
+	bool ok = TRUE;
 
-	recursive_scan_check(ctx);
-	(void) bt;
-	(void) ticks;
+	if (!GNET_PROPERTY(share_library_index))
+		return;
 
 	/*
-	 * Now that we have the library of shared files all setup, see whether
-	 * there are entries in the TTH cache that are no longer required
-	 * because their TTH is no longer associated with a shared file.
+	 * Take a snapshot of the library, to avoid holding the lock whilst
+	 * we are writing to disk.
 	 */
 
-	tth_cache_cleanup();
-	return BGR_NEXT;
-}
+	SHARED_LIBFILE_LOCK;
 
-/**
- * First step, intalling signal handler to trap task cancel.
- */
-static bgret_t
-recursive_scan_step_qrp_setup(struct bgtask *bt, void *data, int uticks)
-{
-	struct recursive_scan *ctx = data;
+	n = shared_libfile.files_scanned;
+	XMALLOC_ARRAY(files, MAX(n, 1));
 
-	recursive_scan_check(ctx);
+	for (i = 0; i < n; i++) {
+		shared_file_t *sf = shared_libfile.file_table[i];
 
-	(void) uticks;
+		if (sf != NULL && shared_file_indexed(sf))
+			files[count++] = shared_file_ref(sf);
+	}
+
+	SHARED_LIBFILE_UNLOCK;
 
 	/*
-	 * The BG_SIG_TERM signal will be sent by the background task scheduler
-	 * when the task is cancelled.
+	 * An empty index would be useless: it would only make us validate
+	 * an empty library at startup.
 	 */
 
-	bg_task_signal(bt, BG_SIG_TERM, recursive_scan_sighandler);
+	if (0 == count)
+		goto done;
 
-	bg_task_ticks_used(bt, 0);
-	return BGR_NEXT;
-}
+	file_path_set(&fp, settings_config_dir(), SHARE_INDEX_FILE);
+	f = file_config_open_write(SHARE_INDEX_WHAT, &fp);
 
-static bgret_t
-recursive_scan_step_load_partials(struct bgtask *bt, void *data, int ticks)
-{
-	struct recursive_scan *ctx = data;
+	if (NULL == f)
+		goto done;
 
-	recursive_scan_check(ctx);
-	(void) ticks;
+	share_index_fingerprint(&fingerprint);
 
-	bg_task_cancel_test(ctx->task);
+	mb = pmsg_new(PMSG_P_DATA, NULL, SHARE_INDEX_RECSIZE);
+	pmsg_write(mb, SHARE_INDEX_MAGIC, SHARE_INDEX_MAGIC_LEN);
+	pmsg_write_be32(mb, SHARE_INDEX_VERSION);
+	pmsg_write(mb, &fingerprint, SHA1_RAW_SIZE);
+	pmsg_write_be32(mb, count);
 
-	if (share_can_answer_partials()) {
-		hset_iter_t *iter;
-		const void *item;
+	ok = 1 == fwrite(pmsg_start(mb), pmsg_written_size(mb), 1, f);
 
-		hset_lock(partial_files);
-		iter = hset_iter_new(partial_files);
-		ctx->partial_files_count = hset_count(partial_files);
+	for (i = 0; ok && i < count; i++) {
+		share_index_record(&mb, files[i]);
+		ok = 1 == fwrite(pmsg_start(mb), pmsg_written_size(mb), 1, f);
+	}
 
-		while (hset_iter_next(iter, &item)) {
-			const shared_file_t *sf = item;
-			slist_append(ctx->partial_files, shared_file_ref(sf));
-		}
+	pmsg_free(mb);
 
-		hset_iter_release(&iter);
-		hset_unlock(partial_files);
+	if (!ok) {
+		g_warning("%s(): cannot write %s: %m", G_STRFUNC, SHARE_INDEX_WHAT);
+		fclose(f);
+	} else if (file_config_close(f, &fp)) {
+		if (GNET_PROPERTY(share_debug)) {
+			g_debug("SHARE saved %zu file%s in %s",
+				PLURAL(count), SHARE_INDEX_WHAT);
+		}
 	}
 
-	bg_task_ticks_used(bt, 0);
-	return BGR_NEXT;
+done:
+	for (i = 0; i < count; i++) {
+		shared_file_unref(&files[i]);
+	}
+	XFREE_NULL(files);
 }
 
-static bgret_t
-recursive_scan_step_build_partial_table(struct bgtask *bt,
-	void *data, int ticks)
+/**
+ * Read a string from the index, making sure its encoded length does not
+ * exceed the remaining input before allocating anything.
+ *
+ * @param bs		the binary stream to read from
+ * @param slen		where the string length is written, if not NULL
+ * @param sptr		where the allocated string is returned
+ *
+ * @return TRUE if OK, FALSE if the string was invalid.
+ */
+static bool
+share_index_read_string(bstr_t *bs, size_t *slen, char **sptr)
 {
-	struct recursive_scan *ctx = data;
+	uint64 length;
+	char *buf;
 
-	recursive_scan_check(ctx);
+	if (!bstr_read_ule64(bs, &length))
+		return FALSE;
 
-	ctx->ticks = 0;
+	if (length > bstr_unread_size(bs))
+		return FALSE;		/* Truncated or corrupted index */
 
-	if (NULL == ctx->iter) {
-		ctx->iter = slist_iter_before_head(ctx->partial_files);
-		g_assert(NULL == ctx->partial_tb);
-		ctx->partial_tb = st_create();
-	}
+	buf = halloc(length + 1);
+	buf[length] = '\0';
 
-	if (!share_can_answer_partials())
-		goto next;
+	if (0 != length && !bstr_read(bs, buf, length)) {
+		hfree(buf);
+		return FALSE;
+	}
 
-	while (slist_iter_has_next(ctx->iter)) {
-		const shared_file_t *sf = slist_iter_next(ctx->iter);
+	if (slen != NULL)
+		*slen = length;
+	*sptr = buf;
 
-		shared_file_check(sf);
+	return TRUE;
+}
 
-		/*
+/**
+ * Read one shared file record from the index.
+ *
+ * @param bs		the binary stream to read from
+ * @param sf_ptr	where the new shared file is returned, NULL if skipped
+ *
+ * @return TRUE if OK, FALSE if the record was invalid.
+ */
+static bool
+share_index_read_file(bstr_t *bs, shared_file_t **sf_ptr)
+{
+	uint64 size, mtime, ctime;
+	uint8 flags;
+	struct sha1 sha1;
+	struct tth tth;
+	char *path = NULL, *relative = NULL;
+	char *nfc = NULL, *canonic = NULL, *normal = NULL;
+	size_t path_len, nfc_len, canonic_len, normal_len = 0;
+	shared_file_t *sf;
+	bool ok = FALSE;
+
+	*sf_ptr = NULL;
+
+	if (
+		!bstr_read_be64(bs, &size) ||
+		!bstr_read_be64(bs, &mtime) ||
+		!bstr_read_be64(bs, &ctime) ||
+		!bstr_read_u8(bs, &flags)
+	)
+		return FALSE;
+
+	if (
+		(flags & SHARE_INDEX_F_DIGESTS) && (
+			!bstr_read(bs, &sha1, SHA1_RAW_SIZE) ||
+			!bstr_read(bs, &tth, TTH_RAW_SIZE)
+		)
+	)
+		return FALSE;
+
+	if (
+		!share_index_read_string(bs, &path_len, &path) ||
+		(
+			(flags & SHARE_INDEX_F_RELATIVE) &&
+			!share_index_read_string(bs, NULL, &relative)
+		) ||
+		!share_index_read_string(bs, &nfc_len, &nfc) ||
+		!share_index_read_string(bs, &canonic_len, &canonic) ||
+		(
+			(flags & SHARE_INDEX_F_NORMAL) &&
+			!share_index_read_string(bs, &normal_len, &normal)
+		)
+	)
+		goto done;
+
+	if (
+		0 == size || too_big_for_gnutella(size) ||
+		path_len >= MAX_PATH_LEN || !is_absolute_path(path) ||
+		0 == nfc_len || 0 == canonic_len ||
+		((flags & SHARE_INDEX_F_NORMAL) && 0 == normal_len)
+	)
+		goto done;
+
+	ok = TRUE;
+
+	/*
+	 * Files which were shared when we saved the index but are now listed
+	 * as spam are simply skipped.
+	 */
+
+	if (spam_check_filename_size(nfc, size))
+		goto done;
+
+	sf = shared_file_alloc();
+	sf->file_path = atom_str_get(path);
+	sf->relative_path = NULL == relative ? NULL : atom_str_get(relative);
+	sf->name_nfc = atom_str_get(nfc);
+	sf->name_canonic = atom_str_get(canonic);
+	sf->name_normal = NULL == normal ? NULL : atom_str_get(normal);
+	sf->name_nfc_len = nfc_len;
+	sf->name_canonic_len = canonic_len;
+	sf->name_normal_len = normal_len;
+	sf->file_size = size;
+	sf->mtime = mtime;
+	sf->ctime = ctime;
+	sf->mime_type = mime_type_from_filename(sf->name_nfc);
+	sf->media_type = shared_file_media_type(sf->mime_type);
+
+	if (flags & SHARE_INDEX_F_DIGESTS) {
+		sf->sha1 = atom_sha1_get(&sha1);
+		sf->tth = atom_tth_get(&tth);
+	}
+
+	shared_file_name_check(sf);
+	*sf_ptr = sf;
+
+done:
+	HFREE_NULL(path);
+	HFREE_NULL(relative);
+	HFREE_NULL(nfc);
+	HFREE_NULL(canonic);
+	HFREE_NULL(normal);
+
+	return ok;
+}
+
+/**
+ * Load the library index, appending the files to ctx->shared_files.
+ *
+ * @return TRUE if the index was loaded, FALSE if it cannot be used.
+ */
+static bool
+share_index_load(struct recursive_scan *ctx)
+{
+	char magic[SHARE_INDEX_MAGIC_LEN];
+	struct sha1 fingerprint, expected;
+	uint32 version, count = 0, i;
+	pslist_t *files = NULL;
+	const char *error = NULL;
+	filestat_t sb;
+	char *path;
+	void *base = NULL;
+	size_t size = 0;
+	bstr_t *bs;
+	int fd;
+
+	path = make_pathname(settings_config_dir(), SHARE_INDEX_FILE);
+	fd = file_open_missing(path, O_RDONLY);
+
+	if (-1 == fd)
+		goto done;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat \"%s\": %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	if (!S_ISREG(sb.st_mode) || sb.st_size <= 0) {
+		error = "not a regular file";
+		goto done;
+	}
+
+	if (UNSIGNED(sb.st_size) >= MAX_INT_VAL(size_t)) {
+		error = "file is too large";
+		goto done;
+	}
+
+	size = sb.st_size;
+
+	/*
+	 * Map the file in memory, to let the kernel page it in as we parse it.
+	 */
+
+#ifdef HAS_MMAP
+	base = vmm_mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (MAP_FAILED == base) {
+		g_warning("%s(): cannot map \"%s\": %m", G_STRFUNC, path);
+		base = NULL;
+		goto done;
+	}
+#else
+	{
+		size_t n = 0;
+
+		base = halloc(size);
+
+		while (n < size) {
+			ssize_t r = read(fd, ptr_add_offset(base, n), size - n);
+
+			if ((ssize_t) -1 == r || 0 == r) {
+				g_warning("%s(): cannot read \"%s\": %m", G_STRFUNC, path);
+				goto done;
+			}
+			n += r;
+		}
+	}
+#endif	/* HAS_MMAP */
+
+	fd_forget_and_close(&fd);
+
+	bs = bstr_open(base, size, 0);
+
+	if (
+		!bstr_read(bs, magic, sizeof magic) ||
+		!bstr_read_be32(bs, &version) ||
+		!bstr_read(bs, &fingerprint, SHA1_RAW_SIZE) ||
+		!bstr_read_be32(bs, &count)
+	) {
+		error = "truncated header";
+	} else if (0 != memcmp(magic, SHARE_INDEX_MAGIC, sizeof magic)) {
+		error = "bad magic";
+	} else if (version != SHARE_INDEX_VERSION) {
+		error = "unsupported version";
+	} else {
+		share_index_fingerprint(&expected);
+		if (!sha1_eq(&fingerprint, &expected))
+			error = "shared directories or extensions changed";
+	}
+
+	for (i = 0; NULL == error && i < count; i++) {
+		shared_file_t *sf;
+
+		if (!share_index_read_file(bs, &sf))
+			error = "corrupted record";
+		else if (sf != NULL)
+			files = pslist_prepend(files, shared_file_ref(sf));
+	}
+
+	if (NULL == error && !bstr_ended(bs))
+		error = "trailing garbage";
+
+	bstr_free(&bs);
+
+done:
+	fd_forget_and_close(&fd);
+
+	if (base != NULL) {
+#ifdef HAS_MMAP
+		vmm_munmap(base, size);
+#else
+		hfree(base);
+#endif
+	}
+
+	if (error != NULL) {
+		if (GNET_PROPERTY(share_debug))
+			g_debug("SHARE ignoring %s \"%s\": %s",
+				SHARE_INDEX_WHAT, path, error);
+		shared_file_slist_free_null(&files);
+	} else if (files != NULL) {
+		pslist_t *sl;
+
+		files = pslist_reverse(files);
+
+		PSLIST_FOREACH(files, sl) {
+			slist_append(ctx->shared_files, sl->data);
+		}
+
+		pslist_free_null(&files);
+		ctx->loaded = TRUE;
+
+		if (GNET_PROPERTY(share_debug)) {
+			g_debug("SHARE loaded %u file%s from %s",
+				PLURAL(slist_length(ctx->shared_files)), SHARE_INDEX_WHAT);
+		}
+	}
+
+	HFREE_NULL(path);
+	return ctx->loaded;
+}
+
+/**
+ * Load the library from the index, if possible.
+ *
+ * When the index can be loaded, the shared directories are kept aside to
+ * be validated later.  Otherwise, they will be scanned.
+ */
+static bgret_t
+recursive_scan_step_load_index(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+	const char *dir;
+
+	recursive_scan_check(ctx);
+	(void) ticks;
+
+	if (!share_index_load(ctx))
+		goto done;
+
+	ctx->scope = htable_create(HASH_KEY_STRING, 0);
+
+	while (NULL != (dir = slist_shift(ctx->base_dirs))) {
+		struct share_delta_dir *d;
+
+		WALLOC0(d);
+		d->dir = dir;				/* Takes over the atom */
+		d->base = atom_str_get(dir);
+		d->recursive = TRUE;
+		htable_insert(ctx->scope, d->dir, d);
+	}
+
+done:
+	bg_task_ticks_used(bt, slist_length(ctx->shared_files) / 10);
+	return BGR_NEXT;
+}
+
+/**
+ * Prepare validation of the library loaded from the index, by rescanning
+ * all the shared directories and computing the differences.
+ */
+static bgret_t
+recursive_scan_step_validate(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+	htable_iter_t *iter;
+	void *value;
+
+	recursive_scan_check(ctx);
+	(void) ticks;
+
+	/*
+	 * The digest restoration step used a snapshot of the file table, which
+	 * we do not need any longer.
+	 */
+
+	recursive_scan_free_ftable(ctx);
+
+	/*
+	 * If the index could not be loaded, the library was just scanned and
+	 * there is nothing to validate: the scope will remain empty.
+	 */
+
+	if (NULL == ctx->scope)
+		ctx->scope = htable_create(HASH_KEY_STRING, 0);
+
+	ctx->deltas = slist_new();
+
+	iter = htable_iter_new(ctx->scope);
+
+	while (htable_iter_next(iter, NULL, &value)) {
+		slist_append(ctx->deltas, value);
+	}
+
+	htable_iter_release(&iter);
+
+	if (GNET_PROPERTY(share_debug) && ctx->loaded) {
+		g_debug("SHARE validating %s against %zu shared director%s",
+			SHARE_INDEX_WHAT, PLURAL_Y(htable_count(ctx->scope)));
+	}
+
+	bg_task_ticks_used(bt, 0);
+	return BGR_NEXT;
+}
+
+/**
+ * Save the library we just built into the index.
+ */
+static bgret_t
+recursive_scan_step_save_index(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+	(void) ticks;
+
+	share_index_save();
+
+	bg_task_ticks_used(bt, ctx->files_scanned / 10);
+	return BGR_NEXT;
+}
+
+static bgret_t
+recursive_scan_step_request_sha1(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+
+	/*
+	 * The new library has been installed, we must now access the global
+	 * variables.
+	 */
+
+	g_assert(NULL == ctx->files);		/* Indicates installation was done */
+
+	ctx->ticks = 0;
+
+	/*
+	 * All the files are now shared and visible in the global data structures,
+	 * yet we need to iterate to request SHA1 computation.
+	 *
+	 * To avoid taking the global lock for too long, we duplicate the
+	 * file_table[] array, increment the reference on all the items, and
+	 * then release the global lock.
+	 *
+	 * Iterating on the copy is OK because request_sha1() will do nothing if
+	 * the file is no longer indexed.
+	 */
+
+	if (0 == ctx->idx)
+		recursive_scan_load_ftable(ctx);
+
+	while (UNSIGNED(ctx->idx) < ctx->ftable_capacity) {
+		shared_file_t *sf;
+		int i = ctx->idx++;
+
+		sf = ctx->ftable[i];
+
+		if (NULL == sf)
+			continue;
+
+		shared_file_check(sf);
+
+		/*
+		 * We must not change the file index after request_sha1() since this
+		 * can synchronously call routines to set the SHA1 if it's known
+		 * already.
+		 *
+		 * When the library was loaded from the index, the digests it
+		 * recorded are used unless the SHA1 cache knows about the file.
+		 */
+
+		if (ctx->loaded && sf->sha1 != NULL && !sha1_is_cached(sf))
+			share_index_restore_digests(sf);
+		else
+			request_sha1(sf);
+
+		if (ctx->ticks++ >= ticks)
+			return BGR_MORE;
+
+		if (0 == (ctx->ticks & 0xf))
+			bg_task_cancel_test(ctx->task);
+	}
+
+	/* Done rebuilding the SHA1 table */
+	atomic_bool_set(&share_rebuilding, FALSE);
+
+	bg_task_ticks_used(bt, ctx->ticks);
+	return BGR_NEXT;
+}
+
+/**
+ * Check whether file belongs to one of the changed directories.
+ *
+ * @param scope		the changed directories (share_delta_dir structures)
+ * @param path		the full path of the file
+ *
+ * @return TRUE if file lies in a changed directory, or anywhere below a
+ * changed directory that has to be rescanned recursively.
+ */
+static bool
+share_delta_in_scope(const htable_t *scope, const char *path)
+{
+	char dir[MAX_PATH_LEN];
+	bool parent = TRUE;
+	char *p;
+
+	if (clamp_strcpy(dir, sizeof dir, path) != strlen(path))
+		return FALSE;
+
+	while (NULL != (p = strrchr(dir, G_DIR_SEPARATOR)) && p != dir) {
+		const struct share_delta_dir *d;
+
+		*p = '\0';
+		d = htable_lookup(scope, dir);
+		if (d != NULL && (parent || d->recursive))
+			return TRUE;
+		parent = FALSE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Compare what we found in the changed directories with the files we are
+ * currently sharing from there, to determine what was added and removed.
+ */
+static bgret_t
+recursive_scan_step_diff(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+	htable_t *found;
+	htable_iter_t *iter;
+	shared_file_t *sf;
+	void *value;
+	size_t i;
+
+	recursive_scan_check(ctx);
+	g_assert(NULL == ctx->ftable);
+
+	(void) ticks;
+
+	/*
+	 * Index the files we found on disk by pathname.  The same file may have
+	 * been seen twice when both a directory and one of its parents were
+	 * rescanned.
+	 */
+
+	found = htable_create(HASH_KEY_STRING, 0);
+
+	while (NULL != (sf = slist_shift(ctx->shared_files))) {
+		shared_file_check(sf);
+
+		if (htable_contains(found, sf->file_path))
+			shared_file_unref(&sf);
+		else
+			htable_insert(found, sf->file_path, sf);
+	}
+
+	/*
+	 * Work on a snapshot of the file table to avoid holding the lock whilst
+	 * we compare.  Files which did not change are kept as-is, to preserve
+	 * their index and the SHA1 we already know.  Files which changed are
+	 * replaced by their new instance.
+	 */
+
+	recursive_scan_load_ftable(ctx);
+
+	for (i = 0; i < ctx->ftable_capacity; i++) {
+		shared_file_t *cur = ctx->ftable[i];
+
+		if (NULL == cur || !shared_file_indexed(cur))
+			continue;
+
+		if (!share_delta_in_scope(ctx->scope, cur->file_path))
+			continue;
+
+		sf = htable_lookup(found, cur->file_path);
+
+		if (sf != NULL) {
+			htable_remove(found, cur->file_path);
+
+			if (
+				sf->file_size == cur->file_size &&
+				sf->mtime == cur->mtime
+			) {
+				shared_file_unref(&sf);		/* Unchanged */
+				continue;
+			}
+
+			ctx->added = pslist_prepend(ctx->added, sf);
+		}
+
+		ctx->removed = pslist_prepend(ctx->removed, shared_file_ref(cur));
+	}
+
+	/*
+	 * What remains was not shared yet.
+	 */
+
+	iter = htable_iter_new(found);
+
+	while (htable_iter_next(iter, NULL, &value)) {
+		ctx->added = pslist_prepend(ctx->added, value);
+	}
+
+	htable_iter_release(&iter);
+	htable_free_null(&found);
+
+	if (GNET_PROPERTY(share_debug)) {
+		size_t added = pslist_length(ctx->added);
+		size_t removed = pslist_length(ctx->removed);
+
+		g_debug("SHARE incremental update: %zu director%s changed, "
+			"%zu file%s added, %zu file%s removed",
+			PLURAL_Y(htable_count(ctx->scope)),
+			PLURAL(added), PLURAL(removed));
+	}
+
+	bg_task_ticks_used(bt, ctx->ftable_capacity / 10);
+	return BGR_NEXT;
+}
+
+/**
+ * Install the differences computed by the previous step in the shared
+ * library data structures.
+ */
+static bgret_t
+recursive_scan_step_install_delta(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+	shared_file_t **added = NULL, **newest = NULL, **files = NULL;
+	shared_file_t **sorted = NULL, **old_sorted = NULL, **old_table = NULL;
+	search_table_t *delta_tb, *old_tb;
+	pslist_t *sl, *delta_files = NULL, *old_files;
+	size_t i, j, k, n, count, removed = 0;
+	uint64 added_bytes = 0, removed_bytes = 0;
+
+	recursive_scan_check(ctx);
+	(void) ticks;
+
+	/*
+	 * This step is "atomic" in that it cannot be interrupted by the background
+	 * task scheduler.
+	 *
+	 * Removed files are de-indexed, which empties their slot in the file
+	 * tables: these holes are squeezed out below.  Their search table entry,
+	 * which is no longer shareable, will be ignored until the next full
+	 * rescan.
+	 */
+
+	PSLIST_FOREACH(ctx->removed, sl) {
+		shared_file_t *sf = sl->data;
+
+		if (!shared_file_indexed(sf))
+			continue;		/* Removed concurrently */
+
+		removed_bytes += sf->file_size;
+		shared_file_deindex(sf);
+		removed++;
+	}
+
+	n = pslist_length(ctx->added);
+
+	if (0 == n && 0 == removed) {
+		if (GNET_PROPERTY(share_debug) > 1)
+			g_debug("SHARE incremental update found nothing to change");
+
+		/*
+		 * No need to rebuild the QRP table, unless we are validating the
+		 * library loaded at startup, in which case it was never computed.
+		 */
+
+		bg_task_ticks_used(bt, 0);
+		return ctx->rescan ? BGR_NEXT : BGR_DONE;
+	}
+
+	/*
+	 * Added files are merged into the file table at the position given by
+	 * their modification time, since share_fill_newest() relies on the table
+	 * being sorted by mtime: a file can be added with an old mtime, when it
+	 * was moved or copied with its timestamps preserved.
+	 *
+	 * They are also inserted in a separate, small, search table holding all
+	 * the files added since the last full rescan.  We rebuild that table
+	 * from scratch, dropping the files that have been removed since.
+	 *
+	 * The library thread is the only one updating the fields of the shared
+	 * library, so we can read them without locking here.
+	 */
+
+	count = shared_libfile.files_scanned;
+	delta_tb = st_create();
+
+	PSLIST_FOREACH(shared_libfile.delta_files, sl) {
+		shared_file_t *sf = sl->data;
+
+		if (!shared_file_indexed(sf))
+			continue;
+
+		st_insert_item(delta_tb, ST_SET_PLAIN, sf->name_canonic, sf);
+		if (sf->name_normal != NULL)
+			st_insert_item(delta_tb, ST_SET_ALIAS, sf->name_normal, sf);
+		delta_files = pslist_prepend(delta_files, shared_file_ref(sf));
+	}
+
+	HALLOC0_ARRAY(files, count + n);
+	HALLOC0_ARRAY(sorted, count + n);
+
+	if (n != 0) {
+		HALLOC_ARRAY(added, n);
+
+		for (i = 0, sl = ctx->added; sl != NULL; sl = pslist_next(sl)) {
+			shared_file_t *sf = sl->data;
+
+			shared_file_check(sf);
+			g_assert(!(SHARE_F_INDEXED & sf->flags));
+
+			added[i++] = sf;
+			added_bytes += sf->file_size;
+
+			st_insert_item(delta_tb, ST_SET_PLAIN, sf->name_canonic, sf);
+			if (sf->name_normal != NULL)
+				st_insert_item(delta_tb, ST_SET_ALIAS, sf->name_normal, sf);
+			delta_files = pslist_prepend(delta_files, shared_file_ref(sf));
+		}
+
+		newest = HCOPY_ARRAY(added, n);
+
+		vsort(added, n, sizeof added[0], shared_file_sort_by_name);
+		vsort(newest, n, sizeof newest[0], shared_file_sort_by_mtime);
+	}
+
+	st_compact(delta_tb);
+
+	SHARED_LIBFILE_LOCK;
+
+	old_table = shared_libfile.file_table;
+	old_sorted = shared_libfile.sorted_file_table;
+
+	/*
+	 * Merge the added files, sorted by mtime, with the current file table,
+	 * squeezing out the removed files.  Files located before the first
+	 * change keep their index, and so does the basename entry recorded for
+	 * them.  The others are renumbered, and their basename index follows.
+	 */
+
+	for (i = j = k = 0; i < count || j < n; /* empty */) {
+		shared_file_t *sf;
+		uint val;
+
+		if (i < count && NULL == old_table[i]) {
+			i++;		/* Removed file */
+			continue;
+		}
+
+		if (i >= count)
+			sf = newest[j++];
+		else if (j >= n)
+			sf = old_table[i++];
+		else if (shared_file_sort_by_mtime(&old_table[i], &newest[j]) <= 0)
+			sf = old_table[i++];
+		else
+			sf = newest[j++];
+
+		files[k++] = sf;
+
+		if ((SHARE_F_INDEXED & sf->flags) && sf->file_index == k)
+			continue;		/* Unchanged index */
+
+		/* See recursive_scan_step_build_basenames() */
+
+		val = pointer_to_uint(
+			htable_lookup(shared_libfile.file_basenames, sf->name_nfc));
+
+		if (SHARE_F_INDEXED & sf->flags) {
+			if (val == sf->file_index) {
+				htable_insert(shared_libfile.file_basenames,
+					sf->name_nfc, uint_to_pointer(k));
+			}
+		} else {
+			sf->flags |= SHARE_F_INDEXED | SHARE_F_BASENAME;
+			shared_libfile.shared_files =
+				pslist_prepend(shared_libfile.shared_files,
+					shared_file_ref(sf));
+			val = (val != 0) ? FILENAME_CLASH : k;
+			htable_insert(shared_libfile.file_basenames,
+				sf->name_nfc, uint_to_pointer(val));
+		}
+
+		sf->file_index = k;
+	}
+
+	/*
+	 * Merge the added files, sorted by name, with the current sorted table,
+	 * squeezing out the removed files.
+	 */
+
+	for (i = j = k = 0; i < count || j < n; /* empty */) {
+		shared_file_t *sf;
+
+		if (i < count && NULL == old_sorted[i]) {
+			i++;		/* Removed file */
+			continue;
+		}
+
+		if (i >= count)
+			sf = added[j++];
+		else if (j >= n)
+			sf = old_sorted[i++];
+		else if (shared_file_sort_by_name(&old_sorted[i], &added[j]) <= 0)
+			sf = old_sorted[i++];
+		else
+			sf = added[j++];
+
+		sorted[k++] = sf;
+		sf->sort_index = k;
+	}
+
+	shared_libfile.file_table = files;
+	shared_libfile.sorted_file_table = sorted;
+	shared_libfile.files_scanned = k;
+
+	old_tb = shared_libfile.delta_table;
+	old_files = shared_libfile.delta_files;
+	shared_libfile.delta_table = delta_tb;
+	shared_libfile.delta_files = delta_files;
+	shared_libfile.delta_changes += n + removed;
+	shared_libfile.bytes_scanned += added_bytes;
+	shared_libfile.bytes_scanned -=
+		MIN(removed_bytes, shared_libfile.bytes_scanned);
+
+	SHARED_LIBFILE_UNLOCK;
+
+	st_free(&old_tb);
+	shared_file_slist_free_null(&old_files);
+	HFREE_NULL(old_table);
+	HFREE_NULL(old_sorted);
+	HFREE_NULL(newest);
+	HFREE_NULL(added);
+
+	teq_safe_rpc(THREAD_MAIN_ID, recursive_install_shared, NULL);
+
+	bg_task_ticks_used(bt, (count + n) / 10);
+	return BGR_NEXT;
+}
+
+/**
+ * Request the SHA1 of the files added by the incremental update.
+ */
+static bgret_t
+recursive_scan_step_request_delta_sha1(struct bgtask *bt,
+	void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+
+	ctx->ticks = 0;
+
+	while (ctx->added != NULL) {
+		shared_file_t *sf = pslist_shift(&ctx->added);
+
+		shared_file_check(sf);
+
+		upload_stats_enforce_local_filename(sf);
+		request_sha1(sf);
+		shared_file_unref(&sf);
+
+		if (ctx->ticks++ >= ticks)
+			return BGR_MORE;
+
+		if (0 == (ctx->ticks & 0xf))
+			bg_task_cancel_test(ctx->task);
+	}
+
+	bg_task_ticks_used(bt, ctx->ticks);
+	return BGR_NEXT;
+}
+
+static bgret_t
+recursive_scan_step_tth_cache_cleanup(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+	(void) bt;
+	(void) ticks;
+
+	/*
+	 * Now that we have the library of shared files all setup, see whether
+	 * there are entries in the TTH cache that are no longer required
+	 * because their TTH is no longer associated with a shared file.
+	 */
+
+	tth_cache_cleanup();
+	return BGR_NEXT;
+}
+
+/**
+ * First step, intalling signal handler to trap task cancel.
+ */
+static bgret_t
+recursive_scan_step_qrp_setup(struct bgtask *bt, void *data, int uticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+
+	(void) uticks;
+
+	/*
+	 * The BG_SIG_TERM signal will be sent by the background task scheduler
+	 * when the task is cancelled.
+	 */
+
+	bg_task_signal(bt, BG_SIG_TERM, recursive_scan_sighandler);
+
+	bg_task_ticks_used(bt, 0);
+	return BGR_NEXT;
+}
+
+static bgret_t
+recursive_scan_step_load_partials(struct bgtask *bt, void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+	(void) ticks;
+
+	bg_task_cancel_test(ctx->task);
+
+	if (share_can_answer_partials()) {
+		hset_iter_t *iter;
+		const void *item;
+
+		hset_lock(partial_files);
+		iter = hset_iter_new(partial_files);
+		ctx->partial_files_count = hset_count(partial_files);
+
+		while (hset_iter_next(iter, &item)) {
+			const shared_file_t *sf = item;
+			slist_append(ctx->partial_files, shared_file_ref(sf));
+		}
+
+		hset_iter_release(&iter);
+		hset_unlock(partial_files);
+	}
+
+	bg_task_ticks_used(bt, 0);
+	return BGR_NEXT;
+}
+
+static bgret_t
+recursive_scan_step_build_partial_table(struct bgtask *bt,
+	void *data, int ticks)
+{
+	struct recursive_scan *ctx = data;
+
+	recursive_scan_check(ctx);
+
+	ctx->ticks = 0;
+
+	if (NULL == ctx->iter) {
+		ctx->iter = slist_iter_before_head(ctx->partial_files);
+		g_assert(NULL == ctx->partial_tb);
+		ctx->partial_tb = st_create();
+	}
+
+	if (!share_can_answer_partials())
+		goto next;
+
+	while (slist_iter_has_next(ctx->iter)) {
+		const shared_file_t *sf = slist_iter_next(ctx->iter);
+
+		shared_file_check(sf);
+
+		/*
 		 * Since file_info_upload_stop() calls shared_file_fileinfo_unref(),
 		 * we may end-up here with a partial file that had its sf->fi cleared
 		 * due a concurrent removal of the file from the GUI.  Hence if we
@@ -2953,7 +4147,9 @@ share_rescan_create_task(bgsched_t *bs)
 		recursive_scan_step_update_scan_timing,
 		recursive_scan_step_build_sorted_table,
 		recursive_scan_step_install_shared,
+		recursive_scan_step_watch,
 		recursive_scan_step_request_sha1,
+		recursive_scan_step_save_index,
 		recursive_scan_step_tth_cache_cleanup,
 
 		/*
@@ -2972,6 +4168,7 @@ share_rescan_create_task(bgsched_t *bs)
 	struct recursive_scan *ctx;
 
 	ctx = recursive_scan_new(shared_dirs, tm_time());
+	ctx->rescan = TRUE;
 
 	return ctx->task = bg_task_create(bs, "recursive scan",
 				steps, N_ITEMS(steps),
@@ -2979,6 +4176,124 @@ share_rescan_create_task(bgsched_t *bs)
 				recursive_scan_done, NULL);
 }
 
+/**
+ * Create a new background task for loading the library from its index, then
+ * validating it against the filesystem (+ QRP rebuilding).
+ *
+ * If the index cannot be loaded, this degenerates into a library rescan.
+ *
+ * @param bs		the scheduler to which task should be inserted into
+ *
+ * @return a new background task.
+ */
+static struct bgtask *
+share_load_create_task(bgsched_t *bs)
+{
+	static const bgstep_cb_t steps[] = {
+		recursive_scan_step_setup,
+		recursive_scan_step_load_index,
+		recursive_scan_step_compute,
+		recursive_scan_step_compute_done,
+		recursive_scan_step_build_search_table,
+		recursive_scan_step_build_file_table,
+		recursive_scan_step_build_basenames,
+		recursive_scan_step_update_scan_timing,
+		recursive_scan_step_build_sorted_table,
+		recursive_scan_step_install_shared,
+		recursive_scan_step_request_sha1,
+
+		/*
+		 * The library is now served, check it against the filesystem, as
+		 * we would do for an incremental library update.
+		 */
+
+		recursive_scan_step_validate,
+		recursive_scan_step_compute,
+		recursive_scan_step_watch,
+		recursive_scan_step_diff,
+		recursive_scan_step_install_delta,
+		recursive_scan_step_request_delta_sha1,
+		recursive_scan_step_tth_cache_cleanup,
+
+		/*
+		 * The following group of steps is identical to the ones listed in
+		 * share_update_qrp_create_task().
+		 */
+
+		recursive_scan_step_load_partials,
+		recursive_scan_step_build_partial_table,
+		recursive_scan_step_install_partials,
+		recursive_scan_step_prepare_qrp,
+		recursive_scan_step_update_qrp_lib,
+		recursive_scan_step_update_qrp_partial,
+		recursive_scan_step_finalize,
+	};
+	struct recursive_scan *ctx;
+
+	ctx = recursive_scan_new(shared_dirs, tm_time());
+	ctx->rescan = TRUE;
+
+	return ctx->task = bg_task_create(bs, "library load",
+				steps, N_ITEMS(steps),
+				ctx, recursive_scan_context_free,
+				recursive_scan_done, NULL);
+}
+
+/**
+ * Create a new background task for incremental library update (+ QRP
+ * rebuilding).
+ *
+ * @param bs		the scheduler to which task should be inserted into
+ * @param deltas	changed directories (share_delta_dir), taken over
+ *
+ * @return a new background task.
+ */
+static struct bgtask *
+share_delta_create_task(bgsched_t *bs, htable_t *deltas)
+{
+	static const bgstep_cb_t steps[] = {
+		recursive_scan_step_qrp_setup,
+		recursive_scan_step_compute,
+		recursive_scan_step_watch,
+		recursive_scan_step_diff,
+		recursive_scan_step_install_delta,
+		recursive_scan_step_request_delta_sha1,
+
+		/*
+		 * The following group of steps is identical to the ones listed in
+		 * share_update_qrp_create_task().
+		 */
+
+		recursive_scan_step_load_partials,
+		recursive_scan_step_build_partial_table,
+		recursive_scan_step_install_partials,
+		recursive_scan_step_prepare_qrp,
+		recursive_scan_step_update_qrp_lib,
+		recursive_scan_step_update_qrp_partial,
+		recursive_scan_step_finalize,
+	};
+	struct recursive_scan *ctx;
+	htable_iter_t *iter;
+	void *value;
+
+	ctx = recursive_scan_new(NULL, tm_time());
+	ctx->scope = deltas;
+	ctx->deltas = slist_new();
+
+	iter = htable_iter_new(deltas);
+
+	while (htable_iter_next(iter, NULL, &value)) {
+		slist_append(ctx->deltas, value);
+	}
+
+	htable_iter_release(&iter);
+
+	return ctx->task = bg_task_create(bs, "library update",
+				steps, N_ITEMS(steps),
+				ctx, recursive_scan_context_free,
+				recursive_scan_done, NULL);
+}
+
 /**
  * Create a new background task for QRP rebuilding.
  *
@@ -3035,11 +4350,38 @@ share_thread_lib_rescan(void *unused_arg)
 	}
 
 	v->qrp_rebuild = FALSE;		/* since rescan takes care of it */
+	v->delta = FALSE;			/* idem for incremental updates */
+	share_delta_free_null(&v->deltas);
 	v->task = share_rescan_create_task(v->sched);
 
 	spinunlock(&v->lock);
 }
 
+/**
+ * Load the library from its index.
+ */
+static void
+share_thread_lib_load(void *unused_arg)
+{
+	struct share_thread_vars *v = &share_thread_vars;
+
+	(void) unused_arg;
+
+	spinlock(&v->lock);
+
+	if (v->task != NULL) {
+		bg_task_cancel(v->task);
+		v->task = NULL;
+	}
+
+	v->qrp_rebuild = FALSE;		/* since loading takes care of it */
+	v->delta = FALSE;			/* and validates the whole library */
+	share_delta_free_null(&v->deltas);
+	v->task = share_load_create_task(v->sched);
+
+	spinunlock(&v->lock);
+}
+
 /**
  * Request a QRP rebuild.
  */
@@ -3069,6 +4411,72 @@ share_thread_lib_qrp_rebuild(void *unused_arg)
 	}
 }
 
+/**
+ * Request an incremental library update, for the directories which were
+ * recorded as having changed.
+ */
+static void
+share_thread_lib_delta(void *unused_arg)
+{
+	struct share_thread_vars *v = &share_thread_vars;
+	htable_t *deltas = NULL;
+	uint64 changes, count;
+	bool rescan;
+	const char *what = "recorded";
+
+	(void) unused_arg;
+
+	SHARED_LIBFILE_LOCK;
+	changes = shared_libfile.delta_changes;
+	count = shared_libfile.files_scanned;
+	SHARED_LIBFILE_UNLOCK;
+
+	/*
+	 * Incremental updates leave holes in the file table and stale entries
+	 * in the search table.  Once enough changes have accumulated, perform
+	 * a full rescan instead, which rebuilds compact data structures.
+	 */
+
+	rescan = changes > MAX(SHARE_DELTA_MIN, count / SHARE_DELTA_RATIO);
+
+	spinlock(&v->lock);
+
+	if (v->task != NULL) {
+		v->delta = TRUE;			/* record for later */
+	} else {
+		v->delta = FALSE;
+		deltas = v->deltas;
+		v->deltas = NULL;
+
+		if (NULL == deltas) {
+			if (v->qrp_rebuild) {
+				v->task = share_update_qrp_create_task(v->sched);
+				v->qrp_rebuild = FALSE;
+			}
+			what = "empty";
+		} else if (rescan) {
+			v->task = share_rescan_create_task(v->sched);
+			v->qrp_rebuild = FALSE;
+			what = "turned into full rescan";
+		} else {
+			v->task = share_delta_create_task(v->sched, deltas);
+			v->qrp_rebuild = FALSE;
+			deltas = NULL;			/* taken over by the task */
+			what = "started";
+		}
+	}
+
+	spinunlock(&v->lock);
+
+	share_delta_free_null(&deltas);
+
+	if (GNET_PROPERTY(share_debug) > 1) {
+		g_debug("SHARE incremental library update %s "
+			"(%s change%s since last rescan)",
+			what, uint64_to_string(changes), plural(changes));
+	}
+}
+
 /*
  * The "share_lib_xxx" routine constitute the API from the "main" thread to the
  * "library" thread.
@@ -3083,6 +4491,15 @@ share_lib_rescan(void)
 	teq_post_unique(share_thread_id, share_thread_lib_rescan, NULL);
 }
 
+/**
+ * Load the library from its index.
+ */
+static void
+share_lib_load(void)
+{
+	teq_post_unique(share_thread_id, share_thread_lib_load, NULL);
+}
+
 /**
  * Request a QRP rebuild.
  *
@@ -3110,6 +4527,209 @@ share_lib_qrp_rebuild(bool force)
 	}
 }
 
+/**
+ * Request an incremental library update.
+ */
+static void
+share_lib_delta(void)
+{
+	teq_post_unique(share_thread_id, share_thread_lib_delta, NULL);
+}
+
+/**
+ * Callout queue callback to launch the incremental library update, once
+ * changes in the shared directories had some time to settle.
+ */
+static void
+share_delta_flush(cqueue_t *cq, void *unused_data)
+{
+	(void) unused_data;
+
+	cq_zero(cq, &share_delta_ev);
+	share_lib_delta();
+}
+
+/**
+ * Find the shared directory holding a given directory.
+ *
+ * @return the shared directory (atom), NULL if not found.
+ */
+static const char *
+share_delta_base(const char *dir)
+{
+	const char *base = NULL;
+	size_t base_len = 0;
+	pslist_t *sl;
+
+	PSLIST_FOREACH(shared_dirs, sl) {
+		const char *sd = sl->data;
+		size_t len = strlen(sd);
+
+		if (
+			len > base_len &&
+			0 == strncmp(dir, sd, len) &&
+			('\0' == dir[len] || is_dir_separator(dir[len]))
+		) {
+			base = sd;
+			base_len = len;
+		}
+	}
+
+	return base;
+}
+
+/**
+ * Record directory as having changed.
+ *
+ * @param dir			the changed directory
+ * @param recursive		whether its sub-directories need rescanning as well
+ */
+static void
+share_delta_record(const char *dir, bool recursive)
+{
+	struct share_thread_vars *v = &share_thread_vars;
+	struct share_delta_dir *d;
+	const char *base;
+
+	base = share_delta_base(dir);
+
+	if (NULL == base)
+		return;		/* Not within shared directories, ignore */
+
+	if (GNET_PROPERTY(share_debug) > 2) {
+		g_debug("SHARE directory \"%s\" changed%s",
+			dir, recursive ? " (recursively)" : "");
+	}
+
+	spinlock(&v->lock);
+
+	if (NULL == v->deltas)
+		v->deltas = htable_create(HASH_KEY_STRING, 0);
+
+	d = htable_lookup(v->deltas, dir);
+
+	if (NULL == d) {
+		WALLOC0(d);
+		d->dir = atom_str_get(dir);
+		d->base = atom_str_get(base);
+		htable_insert(v->deltas, d->dir, d);
+	}
+
+	d->recursive = d->recursive || recursive;
+
+	spinunlock(&v->lock);
+
+	if (NULL == share_delta_ev) {
+		share_delta_ev =
+			cq_main_insert(SHARE_DELTA_DELAY, share_delta_flush, NULL);
+	}
+}
+
+/**
+ * Directory watcher callback, invoked when a shared directory changes.
+ */
+static void
+share_watch_event(void *unused_udata, enum dirwatch_event ev,
+	const char *dir, const char *name, bool isdir)
+{
+	(void) unused_udata;
+
+	/*
+	 * If they disabled incremental updates, the watcher will be disposed
+	 * of at the next full rescan.  Until then, ignore the events.
+	 */
+
+	if (!GNET_PROPERTY(share_incremental_rescan))
+		return;
+
+	switch (ev) {
+	case DIRWATCH_OVERFLOW:
+		g_warning("SHARE lost track of library changes, rescanning");
+		share_lib_rescan();
+		return;
+	case DIRWATCH_GONE:
+		share_delta_record(dir, TRUE);
+		return;
+	case DIRWATCH_ADDED:
+	case DIRWATCH_REMOVED:
+	case DIRWATCH_CHANGED:
+		if ('.' == name[0])
+			return;			/* Hidden entries are never shared */
+
+		if (isdir) {
+			char *path = make_pathname(dir, name);
+			share_delta_record(path, TRUE);
+			HFREE_NULL(path);
+		} else if (shared_file_valid_extension(name)) {
+			share_delta_record(dir, FALSE);
+		}
+		return;
+	}
+
+	g_assert_not_reached();
+}
+
+/**
+ * Install watches on the directories scanned by a library rescan or update.
+ *
+ * This is invoked in the main thread, through an RPC from the library thread.
+ */
+static void *
+share_watch_install(void *data)
+{
+	struct recursive_scan *ctx = data;
+	slist_iter_t *iter;
+	bool ok = TRUE;
+
+	recursive_scan_check(ctx);
+
+	/*
+	 * A full rescan starts over with a new watcher: the watched directories
+	 * are exactly the ones that were scanned.
+	 */
+
+	if (ctx->rescan) {
+		dirwatch_free_null(&share_dirwatch);
+
+		if (ctx->watch) {
+			share_dirwatch = dirwatch_new(share_watch_event, NULL);
+
+			if (NULL == share_dirwatch && GNET_PROPERTY(share_debug)) {
+				g_debug("SHARE cannot monitor shared directories, "
+					"library will only be updated by full rescans");
+			}
+		}
+	}
+
+	if (NULL == share_dirwatch)
+		return NULL;
+
+	iter = slist_iter_before_head(ctx->dirs);
+
+	while (ok && slist_iter_has_next(iter)) {
+		const char *dir = slist_iter_next(iter);
+		ok = dirwatch_add(share_dirwatch, dir);
+	}
+
+	slist_iter_free(&iter);
+
+	/*
+	 * If we cannot monitor all the directories, we would miss changes.
+	 * Revert to full rescans only.
+	 */
+
+	if (!ok) {
+		g_warning("SHARE cannot monitor all the shared directories, "
+			"library will only be updated by full rescans");
+		dirwatch_free_null(&share_dirwatch);
+	} else if (GNET_PROPERTY(share_debug)) {
+		g_debug("SHARE monitoring %zu director%s for changes",
+			PLURAL_Y(dirwatch_count(share_dirwatch)));
+	}
+
+	return NULL;
+}
+
 /**
  * Is there work pending for the library thread, or is thread terminated?
  */
@@ -3119,7 +4739,8 @@ share_thread_has_work(void *unused_arg)
 	struct share_thread_vars *v = &share_thread_vars;
 	(void) unused_arg;
 
-	return atomic_bool_get(&v->exiting) || v->task != NULL || v->qrp_rebuild;
+	return atomic_bool_get(&v->exiting) || v->task != NULL ||
+		v->qrp_rebuild || v->delta;
 }
 
 /**
@@ -3170,7 +4791,7 @@ share_thread_main(void *arg)
 
 	while (!atomic_bool_get(&v->exiting)) {
 		struct bgtask *bt;
-		bool qrp_rebuild;
+		bool qrp_rebuild, delta;
 
 		if (GNET_PROPERTY(share_debug))
 			g_debug("library thread sleeping");
@@ -3193,18 +4814,22 @@ share_thread_main(void *arg)
 			thread_check_suspended();
 
 		/*
-		 * QRP table rebuilds can have been recorded whilst we were processing
-		 * the previous task.  If one is present, create the task, which will
-		 * make share_thread_has_work() to return TRUE.
+		 * QRP table rebuilds or incremental updates can have been recorded
+		 * whilst we were processing the previous task.  If one is present,
+		 * create the task, which will make share_thread_has_work() to
+		 * return TRUE.  Incremental updates also rebuild the QRP table.
 		 */
 
 		spinlock(&v->lock);
 		if (v->task == bt)
 			v->task = NULL;				/* Finished running previous task */
 		qrp_rebuild = v->qrp_rebuild;
+		delta = v->delta;
 		spinunlock(&v->lock);
 
-		if (qrp_rebuild)
+		if (delta)
+			share_thread_lib_delta(NULL);
+		else if (qrp_rebuild)
 			share_thread_lib_qrp_rebuild(NULL);
 	}
 
@@ -3252,10 +4877,29 @@ share_thread_create(void)
 /**
  * Perform scanning of the shared directories to build up the list of
  * shared files.
+ *
+ * The very first time, the library is loaded from its index when there is
+ * one, and will be checked against the filesystem afterwards.
  */
 void
 share_scan(void)
 {
+	static bool done;
+
+	if (!done && GNET_PROPERTY(share_library_index)) {
+		char *path = make_pathname(settings_config_dir(), SHARE_INDEX_FILE);
+		bool exists = file_exists(path);
+
+		HFREE_NULL(path);
+		done = TRUE;
+
+		if (exists) {
+			share_lib_load();
+			return;
+		}
+	}
+
+	done = TRUE;
 	share_lib_rescan();
 }
 
@@ -3300,6 +4944,7 @@ share_close(void)
 	 */
 
 	share_special_close();
+	share_index_save();
 	free_extensions();
 	pslist_foreach(shared_libfile.shared_files, shared_file_detach, NULL);
 	share_free();
@@ -3314,6 +4959,9 @@ share_close(void)
 	hset_free_null(&partial_files);
 	hikset_free_null(&sha1_to_share);
 	cq_cancel(&share_qrp_rebuild_ev);
+	cq_cancel(&share_delta_ev);
+	dirwatch_free_null(&share_dirwatch);
+	share_delta_free_null(&share_thread_vars.deltas);
 }
 
 /*
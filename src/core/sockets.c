@@ -34,6 +34,7 @@
  * @date 2001-2003, 2012-2013
  */
 
+#define _GNU_SOURCE			/* For recvmmsg() and sendmmsg() */
 #include "common.h"
 
 #ifdef I_NETDB
@@ -88,8 +89,11 @@
 #include "lib/once.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
+#include "lib/spinlock.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
 #include "lib/timestamp.h"
 #include "lib/tm.h"
 #include "lib/unsigned.h"
@@ -115,6 +119,69 @@
 #define UDP_QUEUED_GUESS	65536	/**< Guess amount of pending RX input */
 #define UDP_QUEUE_DELAY_MS	250		/**< RX queue processing delay */
 #define TLS_BAN_FREQ		300		/**< Avoid TLS for 5 minutes */
+#define UDP_SHARD_READ_MAX	64		/**< Max datagrams read per I/O event */
+#define UDP_SHARD_QUEUE_MAX	4096	/**< Max datagrams pending delivery */
+#define UDP_SHARD_BYTES_MAX	(4 * SOCK_UDP_RECV_BUF)	/**< Max bytes pending */
+#define UDP_SHARD_RA_MAX	(8 * SOCK_UDP_RECV_BUF)	/**< Max read-ahead bytes */
+
+#ifdef HAS_RECVMMSG
+#define UDP_BATCH_CMSG_LEN	128		/**< Ancillary data space per datagram */
+
+/**
+ * Datagrams received through a single recvmmsg() call.
+ *
+ * They are handed out one at a time by socket_udp_accept(), the buffer of
+ * each datagram being swapped with the socket's buffer to avoid copying.
+ */
+struct udp_rxbatch {
+	struct mmsghdr msg[SOCK_UDP_BATCH_MAX];
+	iovec_t iov[SOCK_UDP_BATCH_MAX];
+	socket_addr_t from[SOCK_UDP_BATCH_MAX];
+	char *buf[SOCK_UDP_BATCH_MAX];			/**< Allocated on demand */
+#if defined(CMSG_LEN) && defined(CMSG_SPACE)
+	union {
+		struct cmsghdr hdr;
+		size_t align;
+		char bytes[CMSG_SPACE(UDP_BATCH_CMSG_LEN)];
+	} cmsg[SOCK_UDP_BATCH_MAX];
+#endif /* CMSG_LEN && CMSG_SPACE */
+	uint count;					/**< Amount of datagrams received */
+	uint next;					/**< Index of next datagram to hand out */
+};
+#endif	/* HAS_RECVMMSG */
+
+enum udp_rxshard_magic { UDP_RXSHARD_MAGIC = 0x1a6c03e5 };
+
+/**
+ * Datagram reception from an I/O thread.
+ *
+ * The I/O thread reads the datagrams into the queue and the main thread is
+ * then told to process them.  The object is reference-counted because the
+ * main thread may have a pending delivery when the socket is freed.
+ */
+struct udp_rxshard {
+	enum udp_rxshard_magic magic;
+	spinlock_t lock;			/**< Thread-safe access */
+	gnutella_socket_t *s;		/**< The UDP socket, NULL once freed */
+	eslist_t queue;				/**< Datagrams read, not delivered yet */
+	size_t queued;				/**< Bytes held in the queue */
+	void *buf;					/**< Reception buffer of the I/O thread */
+	size_t buf_size;			/**< Size of reception buffer */
+	socket_addr_t from;			/**< Origin of the datagram being read */
+	int fd;						/**< The socket file descriptor */
+	enum net_type net;			/**< Network type of the socket */
+	int refcnt;					/**< Reference count */
+	unsigned posted:1;			/**< Delivery posted to the main thread */
+	unsigned edge:1;			/**< Monitored edge-triggered */
+	unsigned single:1;			/**< Read one datagram per event */
+};
+
+static inline void
+udp_rxshard_check(const struct udp_rxshard * const rx)
+{
+	g_assert(rx != NULL);
+	g_assert(UDP_RXSHARD_MAGIC == rx->magic);
+}
 
 enum {
 	SOCK_ADNS_PENDING	= 1 << 0,	/**< Don't free() the socket too early */
@@ -282,21 +349,18 @@ socket_evt_fd(struct gnutella_socket *s)
 }
 
 /**
- * Install handler callback when an input condition is satisfied on the socket.
+ * Install handler callback when an input condition is satisfied on the socket,
+ * with specific dispatching flags.
  *
  * @param s			the socket
  * @param cond		Any INPUT_EVENT_* except INPUT_EVENT_EXCEPTION.
+ * @param flags		a combination of INPUT_F_* flags
  * @param handler	the handler callback to invoke when condition is satisfied
  * @param data		opaque data to supply to the callback
- *
- * @note
- * When monitoring for INPUT_EVENT_RW(X), both INPUT_EVENT_R and
- * INPUT_EVENT_W flags can be set at the same time when the callback is
- * invoked.
  */
-void
-socket_evt_set(struct gnutella_socket *s,
-	inputevt_cond_t cond, inputevt_handler_t handler, void *data)
+static void
+socket_evt_set_flags(struct gnutella_socket *s, inputevt_cond_t cond,
+	unsigned flags, inputevt_handler_t handler, void *data)
 {
 	int fd;
 
@@ -317,7 +381,7 @@ socket_evt_set(struct gnutella_socket *s,
 			G_STRFUNC, fd, inputevt_cond_to_string(cond),
 			stacktrace_function_name(handler));
 	}
-	s->gdk_tag = inputevt_add(fd, cond, handler, data);
+	s->gdk_tag = inputevt_add_flags(fd, cond, flags, handler, data);
 	g_assert(0 != s->gdk_tag);
 
 	if ((INPUT_EVENT_R & cond) && s->pos != 0)
@@ -330,6 +394,26 @@ socket_evt_set(struct gnutella_socket *s,
 	}
 }
 
+/**
+ * Install handler callback when an input condition is satisfied on the socket.
+ *
+ * @param s			the socket
+ * @param cond		Any INPUT_EVENT_* except INPUT_EVENT_EXCEPTION.
+ * @param handler	the handler callback to invoke when condition is satisfied
+ * @param data		opaque data to supply to the callback
+ *
+ * @note
+ * When monitoring for INPUT_EVENT_RW(X), both INPUT_EVENT_R and
+ * INPUT_EVENT_W flags can be set at the same time when the callback is
+ * invoked.
+ */
+void
+socket_evt_set(struct gnutella_socket *s,
+	inputevt_cond_t cond, inputevt_handler_t handler, void *data)
+{
+	socket_evt_set_flags(s, cond, 0, handler, data);
+}
+
 /**
  * Remove I/O readiness monitoring on the socket.
  */
@@ -1303,7 +1387,8 @@ socket_enable_accept(struct gnutella_socket *s)
 	if (s) {
 		socket_check(s);
 		if (0 == s->gdk_tag) {
-			socket_evt_set(s, INPUT_EVENT_RX, socket_accept, s);
+			socket_evt_set_flags(s, INPUT_EVENT_RX, INPUT_F_URGENT,
+				socket_accept, s);
 		}
 	}
 }
@@ -1538,6 +1623,102 @@ socket_udp_qfree(void *item, void *unused_data)
 	socket_udpq_free(item);
 }
 
+/**
+ * Free the batched reception context of an UDP socket, if any.
+ */
+static void
+socket_udp_batch_free(struct udpctx *uctx)
+{
+#ifdef HAS_RECVMMSG
+	struct udp_rxbatch *rb = uctx->batch;
+	uint i;
+
+	if (NULL == rb)
+		return;
+
+	for (i = 0; i < N_ITEMS(rb->buf); i++)
+		HFREE_NULL(rb->buf[i]);
+
+	WFREE(rb);
+	uctx->batch = NULL;
+#else
+	(void) uctx;
+#endif	/* HAS_RECVMMSG */
+}
+
+/**
+ * Allocate the I/O thread reception context of an UDP socket.
+ */
+static struct udp_rxshard *
+socket_udp_rxshard_alloc(gnutella_socket_t *s)
+{
+	struct udp_rxshard *rx;
+
+	WALLOC0(rx);
+	rx->magic = UDP_RXSHARD_MAGIC;
+	spinlock_init(&rx->lock);
+	rx->s = s;
+	eslist_init(&rx->queue, offsetof(struct udpq, lnk));
+	rx->buf_size = s->buf_size;
+	rx->buf = halloc(rx->buf_size);
+	rx->fd = s->file_desc;
+	rx->net = s->net;
+	rx->refcnt = 1;
+	rx->single = booleanize(s->flags & SOCK_F_SINGLE);
+
+	return rx;
+}
+
+/**
+ * Remove a reference on the I/O thread reception context, freeing it
+ * when it was the last one.
+ */
+static void
+socket_udp_rxshard_unref(struct udp_rxshard *rx)
+{
+	bool last;
+
+	udp_rxshard_check(rx);
+
+	spinlock(&rx->lock);
+	g_assert(rx->refcnt > 0);
+	last = 0 == --rx->refcnt;
+	spinunlock(&rx->lock);
+
+	if (!last)
+		return;
+
+	eslist_foreach(&rx->queue, socket_udp_qfree, NULL);
+	HFREE_NULL(rx->buf);
+	spinlock_destroy(&rx->lock);
+	rx->magic = 0;
+	WFREE(rx);
+}
+
+/**
+ * Detach the I/O thread reception context from the UDP socket being freed.
+ *
+ * The input callback must have been removed already, so that the I/O
+ * thread can no longer access the context.
+ */
+static void
+socket_udp_rxshard_free(struct udpctx *uctx)
+{
+	struct udp_rxshard *rx = uctx->rx;
+
+	if (NULL == rx)
+		return;
+
+	udp_rxshard_check(rx);
+
+	spinlock(&rx->lock);
+	rx->s = NULL;			/* Pending delivery will discard datagrams */
+	spinunlock(&rx->lock);
+
+	socket_udp_rxshard_unref(rx);
+	uctx->rx = NULL;
+}
+
 /**
  * Dispose of socket, closing connection, removing input callback, and
  * reclaiming attached getline buffer.
@@ -1557,9 +1738,14 @@ socket_free(struct gnutella_socket *s)
 	if (s->flags & SOCK_F_UDP) {
 		struct udpctx *uctx = s->resource.udp;
 		if (uctx != NULL) {
+			if (uctx->rx != NULL) {
+				socket_evt_clear(s);	/* Waits for running I/O thread */
+				socket_udp_rxshard_free(uctx);
+			}
 			WFREE_NULL(uctx->socket_addr, sizeof(socket_addr_t));
 			eslist_foreach(&uctx->queue, socket_udp_qfree, NULL);
 			cq_cancel(&uctx->queue_ev);
+			socket_udp_batch_free(uctx);
 			WFREE(s->resource.udp);
 		}
 	} else {
@@ -2645,6 +2831,7 @@ socket_accept(void *data, int unused_source, inputevt_cond_t cond)
 	t->tls.enabled = s->tls.enabled; /* Inherit from listening socket */
 	t->tls.stage = SOCK_TLS_NONE;
 	t->tls.ctx = NULL;
+	t->tls.kernel = FALSE;
 	t->tls.snarf = 0;
 
 	if (GNET_PROPERTY(tls_debug) > 2) {
@@ -2842,7 +3029,146 @@ socket_udp_is_old(const gnutella_socket_t *s)
 }
 
 /**
- * Someone is sending us a datagram.  Read it into the socket's buffer.
+ * Check the origin of a datagram we received, accounting for it.
+ *
+ * @param addr			the address of the sender
+ * @param len			the size of the datagram
+ * @param dst_addr		if non-NULL, the address to which datagram was sent
+ * @param truncated		whether datagram was truncated
+ *
+ * @return TRUE if the datagram can be processed.
+ */
+static bool
+socket_udp_check(const host_addr_t addr, size_t len,
+	const host_addr_t *dst_addr, bool truncated)
+{
+	if (!is_host_addr(addr)) {
+		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
+		bws_udp_count_read(len, FALSE);	/* Assume not from DHT */
+		return FALSE;
+	}
+
+	if (dst_addr != NULL) {
+		static host_addr_t last_addr;
+
+		settings_addr_changed(*dst_addr, addr);
+
+		/*
+		 * Show the destination address only when it differs from
+		 * the last seen or if the debug level is higher than 1.
+		 */
+
+		if (
+			GNET_PROPERTY(socket_debug) > 1 ||
+			!host_addr_equiv(last_addr, *dst_addr)
+		) {
+			last_addr = *dst_addr;
+			if (GNET_PROPERTY(socket_debug)) {
+				g_debug("%s(): dst_addr=%s",
+					G_STRFUNC, host_addr_to_string(*dst_addr));
+			}
+		}
+	}
+
+	if (truncated)
+		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+
+	return TRUE;
+}
+
+/**
+ * Record the datagram just read into the socket's buffer.
+ *
+ * @param s				the socket which received a datagram
+ * @param r				the size of the datagram
+ * @param from_addr		the origin of the datagram
+ * @param dst_addr		if non-NULL, the address to which datagram was sent
+ * @param truncated		whether datagram was truncated
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_received(struct gnutella_socket *s, ssize_t r,
+	const socket_addr_t *from_addr, const host_addr_t *dst_addr,
+	bool truncated, bool *truncation)
+{
+	g_assert((size_t) r <= s->buf_size);
+
+	/*
+	 * We're too low level to account for the proper bandwidth here as we
+	 * want to distinguish between UDP Gnutella traffic and DHT traffic.
+	 *
+	 * This will be done in udp_receieved() which we're about to call.
+	 */
+
+	s->pos = r;
+
+	/*
+	 * Record remote address.
+	 */
+
+	s->addr = socket_addr_get_addr(from_addr);
+	s->port = socket_addr_get_port(from_addr);
+
+	if (!socket_udp_check(s->addr, r, dst_addr, truncated)) {
+		errno = EINVAL;
+		return (ssize_t) -1;
+	}
+
+	*truncation = truncated;
+	return r;
+}
+
+#ifdef HAS_RECVMMSG
+/**
+ * Refill the batch of received datagrams with a single recvmmsg() call.
+ *
+ * @return -1 on error, the amount of datagrams received otherwise.
+ */
+static int
+socket_udp_batch_fill(struct gnutella_socket *s, struct udp_rxbatch *rb,
+	uint max)
+{
+	uint i;
+	int r;
+
+	g_assert(max != 0 && max <= N_ITEMS(rb->msg));
+
+	for (i = 0; i < max; i++) {
+		struct msghdr *msg = &rb->msg[i].msg_hdr;
+
+		if (NULL == rb->buf[i])
+			rb->buf[i] = halloc(s->buf_size);
+
+		iovec_set(&rb->iov[i], rb->buf[i], s->buf_size);
+
+		ZERO(msg);
+		msg->msg_name = socket_addr_get_sockaddr(&rb->from[i]);
+		msg->msg_namelen = socket_addr_init(&rb->from[i], s->net);
+		msg->msg_iov = &rb->iov[i];
+		msg->msg_iovlen = 1;
+
+#if defined(CMSG_LEN) && defined(CMSG_SPACE)
+		ZERO(&rb->cmsg[i].hdr);
+		msg->msg_control = rb->cmsg[i].bytes;
+		msg->msg_controllen = sizeof rb->cmsg[i].bytes;
+#endif /* CMSG_LEN && CMSG_SPACE */
+
+		rb->msg[i].msg_len = 0;
+	}
+
+	r = recvmmsg(s->file_desc, rb->msg, max, 0, NULL);
+
+	rb->next = 0;
+	rb->count = MAX(r, 0);
+
+	return r;
+}
+
+/**
+ * Hand out the next datagram from the batch, reading a new batch from the
+ * kernel when the previous one was exhausted.
  *
  * @param s				the socket which receives a datagram
  * @param truncation	written with whether datagram was truncated
@@ -2850,27 +3176,110 @@ socket_udp_is_old(const gnutella_socket_t *s)
  * @return -1 on error, the size of the datagram otherwise.
  */
 static ssize_t
-socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+socket_udp_accept_batched(struct gnutella_socket *s, bool *truncation)
 {
-	socket_addr_t *from_addr;
-	struct sockaddr *from;
-	socklen_t from_len;
-	ssize_t r;
+	struct udpctx *uctx = s->resource.udp;
+	struct udp_rxbatch *rb = uctx->batch;
+	struct msghdr *msg;
 	bool truncated = FALSE, has_dst_addr = FALSE;
 	host_addr_t dst_addr;
+	uint i;
+	char *buf;
 
-	socket_check(s);
-	g_assert(s->flags & SOCK_F_UDP);
-	g_assert(s->type == SOCK_TYPE_UDP);
+	if (NULL == rb) {
+		WALLOC0(rb);
+		uctx->batch = rb;
+	}
+
+	if (rb->next >= rb->count) {
+		uint max;
+
+		/*
+		 * When processing one event at a time, do not read-ahead more
+		 * datagrams than we will be processing.
+		 */
+
+		max = (s->flags & SOCK_F_SINGLE) ? 1 :
+			MIN(GNET_PROPERTY(udp_batch_size), N_ITEMS(rb->msg));
+
+		if (-1 == socket_udp_batch_fill(s, rb, max))
+			return (ssize_t) -1;
+
+		if (GNET_PROPERTY(socket_debug) > 2) {
+			g_debug("%s(): got %u datagram%s on UDP port %u",
+				G_STRFUNC, PLURAL(rb->count), s->local_port);
+		}
+	}
+
+	g_assert(rb->next < rb->count);
+
+	i = rb->next++;
+	msg = &rb->msg[i].msg_hdr;
+
+	/* msg_flags is missing at least in some versions of IRIX. */
+#if defined(HAS_MSGHDR_MSG_FLAGS)
+	truncated = 0 != (MSG_TRUNC & msg->msg_flags);
+#endif
+
+	if (!GNET_PROPERTY(force_local_ip))
+		has_dst_addr = socket_udp_extract_dst_addr(msg, &dst_addr);
 
 	/*
-	 * Receive the datagram in the socket's buffer.
+	 * Swap buffers: the datagram becomes held in the socket's buffer and
+	 * the former socket's buffer will be used for the next batch.
 	 */
 
-	from_addr = s->resource.udp->socket_addr;
+	buf = s->buf;
+	s->buf = rb->buf[i];
+	rb->buf[i] = buf;
+
+	return socket_udp_received(s, rb->msg[i].msg_len, &rb->from[i],
+		has_dst_addr ? &dst_addr : NULL, truncated, truncation);
+}
+
+/**
+ * @return whether there are datagrams read from the kernel not handed out yet.
+ */
+static inline bool
+socket_udp_batch_pending(const struct gnutella_socket *s)
+{
+	const struct udp_rxbatch *rb = s->resource.udp->batch;
+
+	return rb != NULL && rb->next < rb->count;
+}
+#endif	/* HAS_RECVMMSG */
+
+/**
+ * Read a datagram from the UDP socket.
+ *
+ * This routine does not touch the socket object and can therefore be called
+ * from any thread.
+ *
+ * @param fd			the UDP socket file descriptor
+ * @param net			the network type of the socket
+ * @param buf			where datagram is written
+ * @param size			size of buffer
+ * @param from_addr		written with the origin of the datagram
+ * @param truncated		written with whether datagram was truncated
+ * @param dst_addr		written with the address to which datagram was sent
+ * @param has_dst_addr	written with whether dst_addr was filled
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_recv(int fd, enum net_type net, void *buf, size_t size,
+	socket_addr_t *from_addr, bool *truncated,
+	host_addr_t *dst_addr, bool *has_dst_addr)
+{
+	struct sockaddr *from;
+	socklen_t from_len;
+	ssize_t r;
+
+	*truncated = FALSE;
+	*has_dst_addr = FALSE;
 
 	/* Initialize from_addr so that it matches the socket's network type. */
-	from_len = socket_addr_init(from_addr, s->net);
+	from_len = socket_addr_init(from_addr, net);
 	g_assert(from_len > 0);
 	g_assert(from_len == socket_addr_get_len(from_addr));
 
@@ -2890,7 +3299,7 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 		struct msghdr msg;
 		iovec_t iov;
 
-		iovec_set(&iov, s->buf, s->buf_size);
+		iovec_set(&iov, buf, size);
 
 		msg = zero_msg;
 		msg.msg_name = cast_to_pointer(from);
@@ -2915,77 +3324,63 @@ socket_udp_accept(struct gnutella_socket *s, bool *truncation)
 		}
 #endif /* CMSG_LEN && CMSG_SPACE */
 
-		r = recvmsg(s->file_desc, &msg, 0);
+		r = recvmsg(fd, &msg, 0);
 
 		/* msg_flags is missing at least in some versions of IRIX. */
 #if defined(HAS_MSGHDR_MSG_FLAGS)
-		truncated = 0 != (MSG_TRUNC & msg.msg_flags);
+		*truncated = 0 != (MSG_TRUNC & msg.msg_flags);
 #endif
 
 		if ((ssize_t) -1 != r && !GNET_PROPERTY(force_local_ip)) {
-			has_dst_addr = socket_udp_extract_dst_addr(&msg, &dst_addr);
+			*has_dst_addr = socket_udp_extract_dst_addr(&msg, dst_addr);
 		}
 	}
 #else	/* !HAS_RECVMSG */
-	r = recvfrom(s->file_desc, s->buf, s->buf_size, 0,
-			cast_to_pointer(from), &from_len);
+	r = recvfrom(fd, buf, size, 0, cast_to_pointer(from), &from_len);
 #endif	/* HAS_RECVMSG */
 
-	if ((ssize_t) -1 == r)
-		return (ssize_t) -1;
+	return r;
+}
 
-	g_assert((size_t) r <= s->buf_size);
+/**
+ * Someone is sending us a datagram.  Read it into the socket's buffer.
+ *
+ * @param s				the socket which receives a datagram
+ * @param truncation	written with whether datagram was truncated
+ *
+ * @return -1 on error, the size of the datagram otherwise.
+ */
+static ssize_t
+socket_udp_accept(struct gnutella_socket *s, bool *truncation)
+{
+	socket_addr_t *from_addr;
+	ssize_t r;
+	bool truncated, has_dst_addr;
+	host_addr_t dst_addr;
 
-	/*
-	 * We're too low level to account for the proper bandwidth here as we
-	 * want to distinguish between UDP Gnutella traffic and DHT traffic.
-	 *
-	 * This will be done in udp_receieved() which we're about to call.
-	 */
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+	g_assert(s->type == SOCK_TYPE_UDP);
 
-	s->pos = r;
+#ifdef HAS_RECVMMSG
+	if (GNET_PROPERTY(udp_batch_size) > 1 || socket_udp_batch_pending(s))
+		return socket_udp_accept_batched(s, truncation);
+#endif	/* HAS_RECVMMSG */
 
 	/*
-	 * Record remote address.
+	 * Receive the datagram in the socket's buffer.
 	 */
 
-	s->addr = socket_addr_get_addr(from_addr);
-	s->port = socket_addr_get_port(from_addr);
-
-	if (!is_host_addr(s->addr)) {
-		gnet_stats_inc_general(GNR_UDP_BOGUS_SOURCE_IP);
-		bws_udp_count_read(r, FALSE);	/* Assume not from DHT */
-		errno = EINVAL;
-		return (ssize_t) -1;
-	}
-
-	if (has_dst_addr) {
-		static host_addr_t last_addr;
-
-		settings_addr_changed(dst_addr, s->addr);
-
-		/*
-		 * Show the destination address only when it differs from
-		 * the last seen or if the debug level is higher than 1.
-		 */
+	from_addr = s->resource.udp->socket_addr;
 
-		if (
-			GNET_PROPERTY(socket_debug) > 1 ||
-			!host_addr_equiv(last_addr, dst_addr)
-		) {
-			last_addr = dst_addr;
-			if (GNET_PROPERTY(socket_debug)) {
-				g_debug("%s(): dst_addr=%s",
-					G_STRFUNC, host_addr_to_string(dst_addr));
-			}
-		}
-	}
+	r = socket_udp_recv(s->file_desc, s->net, s->buf, s->buf_size,
+			from_addr, &truncated, &dst_addr, &has_dst_addr);
 
-	if (truncated)
-		gnet_stats_inc_general(GNR_UDP_RX_TRUNCATED);
+	if ((ssize_t) -1 == r)
+		return (ssize_t) -1;
 
-	*truncation = truncated;
-	return r;
+	return socket_udp_received(s, r, from_addr,
+		has_dst_addr ? &dst_addr : NULL, truncated, truncation);
 }
 
 /**
@@ -3118,7 +3513,7 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 {
 	struct gnutella_socket *s = data;
 	size_t avail, rd, qd, qn;
-	bool guessed, truncated, enqueue;
+	bool guessed, truncated, enqueue, drained = FALSE;
 	unsigned i;
 	time_delta_t processing = 0;
 	tm_t start, end;
@@ -3172,8 +3567,9 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 		r = socket_udp_accept(s, &truncated);		/* Read datagram */
 
 		if ((ssize_t) -1 == r) {
+			drained = is_temporary_error(errno);
 			/* ECONNRESET is meaningless with UDP but happens on Windows */
-			if (!is_temporary_error(errno) && errno != ECONNRESET) {
+			if (!drained && errno != ECONNRESET) {
 				g_warning("%s(): ignoring datagram reception error: %m",
 					G_STRFUNC);
 			}
@@ -3236,6 +3632,39 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 		}
 	}
 
+	/*
+	 * When monitored edge-triggered, no further event will be reported
+	 * until we get EAGAIN, so ask for another dispatch if we stopped early.
+	 */
+
+	if (uctx->edge && !drained)
+		inputevt_set_readable(s->file_desc);
+
+#ifdef HAS_RECVMMSG
+	/*
+	 * Datagrams already read from the kernel by recvmmsg() but not yet
+	 * handed out would not trigger any further input event, hence they
+	 * need to be enqueued for deferred processing.
+	 */
+
+	while (socket_udp_batch_pending(s)) {
+		ssize_t r = socket_udp_accept(s, &truncated);
+
+		if ((ssize_t) -1 == r)
+			continue;
+
+		if G_UNLIKELY(0 == r) {
+			gnet_stats_inc_general(GNR_UDP_UNPROCESSED_MESSAGE);
+			continue;
+		}
+
+		rd += r;
+		socket_udp_queue(s, truncated);
+		qd += r;
+		qn++;
+	}
+#endif	/* HAS_RECVMMSG */
+
 	if ((i > 16 || enqueue) && GNET_PROPERTY(socket_debug)) {
 		tm_now_exact(&end);
 		if (!enqueue)
@@ -3288,6 +3717,207 @@ socket_udp_event(void *data, int unused_source, inputevt_cond_t cond)
 	}
 }
 
+/**
+ * Process the datagrams read by the I/O thread, from the main thread.
+ */
+static void
+socket_udp_shard_deliver(void *data)
+{
+	struct udp_rxshard *rx = data;
+	gnutella_socket_t *s;
+	struct udpctx *uctx;
+	struct udpq *uq;
+	eslist_t list;
+
+	udp_rxshard_check(rx);
+	g_assert(thread_is_main());
+
+	eslist_init(&list, offsetof(struct udpq, lnk));
+
+	spinlock(&rx->lock);
+	eslist_append_list(&list, &rx->queue);
+	rx->queued = 0;
+	rx->posted = FALSE;
+	s = rx->s;
+	spinunlock(&rx->lock);
+
+	if G_UNLIKELY(NULL == s || socket_shutdowned) {
+		eslist_foreach(&list, socket_udp_qfree, NULL);
+		goto done;
+	}
+
+	socket_check(s);
+	g_assert(s->flags & SOCK_F_UDP);
+
+	uctx = s->resource.udp;
+
+	/*
+	 * The datagrams are appended to the read-ahead queue, which preserves
+	 * their reception order and bounds the time spent processing them.
+	 *
+	 * When the main thread cannot keep up, that queue would grow without
+	 * limit: past UDP_SHARD_RA_MAX bytes, datagrams are dropped, as the
+	 * kernel would do if we were not reading the socket fast enough.
+	 */
+
+	while (NULL != (uq = eslist_shift(&list))) {
+		if G_UNLIKELY(uctx->queued + uq->len > UDP_SHARD_RA_MAX) {
+			gnet_stats_inc_general(GNR_UDP_SHARD_READ_AHEAD_DROPPED);
+			socket_udpq_free(uq);
+			continue;
+		}
+
+		if G_UNLIKELY(0 == uq->len) {
+			g_warning("%s(): ignoring empty datagram from %s",
+				G_STRFUNC, host_addr_port_to_string(uq->addr, uq->port));
+			gnet_stats_inc_general(GNR_UDP_UNPROCESSED_MESSAGE);
+			socket_udpq_free(uq);
+			continue;
+		}
+
+		if (
+			!socket_udp_check(uq->addr, uq->len,
+				uq->has_dst ? &uq->dst_addr : NULL, uq->truncated)
+		) {
+			socket_udpq_free(uq);
+			continue;
+		}
+
+		eslist_append(&uctx->queue, uq);
+		uctx->queued = size_saturate_add(uctx->queued, uq->len);
+	}
+
+	entropy_harvest_time();
+
+	socket_udp_flush_queue(s, 2 * MAX_UDP_LOOP_MS);
+
+done:
+	socket_udp_rxshard_unref(rx);
+}
+
+/**
+ * Someone is sending us datagrams, invoked from the I/O thread.
+ *
+ * The datagrams are read, up to UDP_SHARD_READ_MAX of them, and then handed
+ * over to the main thread in one go.  When the main thread lags behind and
+ * UDP_SHARD_QUEUE_MAX datagrams or UDP_SHARD_BYTES_MAX bytes are already
+ * pending, new datagrams are read but dropped without being copied.
+ */
+static void
+socket_udp_shard_event(void *data, int unused_source, inputevt_cond_t cond)
+{
+	struct udp_rxshard *rx = data;
+	eslist_t list;
+	bool post, drained = FALSE;
+	struct udpq *uq;
+	size_t room, slots, queued = 0, dropped = 0;
+	uint i, max;
+
+	(void) unused_source;
+	udp_rxshard_check(rx);
+
+	if G_UNLIKELY(cond & INPUT_EVENT_EXCEPTION) {
+		s_warning("%s(): input exception for UDP listening socket #%d",
+			G_STRFUNC, rx->fd);
+		return;
+	}
+
+	eslist_init(&list, offsetof(struct udpq, lnk));
+
+	/*
+	 * Only this thread adds to the queue, so the room left can only grow
+	 * whilst we are reading.
+	 */
+
+	spinlock(&rx->lock);
+	room = size_saturate_sub(UDP_SHARD_BYTES_MAX, rx->queued);
+	slots = size_saturate_sub(UDP_SHARD_QUEUE_MAX, eslist_count(&rx->queue));
+	max = rx->single ? 1 : UDP_SHARD_READ_MAX;
+	spinunlock(&rx->lock);
+
+	for (i = 0; i < max; i++) {
+		host_addr_t dst_addr;
+		bool truncated, has_dst_addr;
+		ssize_t r;
+
+		r = socket_udp_recv(rx->fd, rx->net, rx->buf, rx->buf_size,
+				&rx->from, &truncated, &dst_addr, &has_dst_addr);
+
+		if ((ssize_t) -1 == r) {
+			drained = is_temporary_error(errno);
+			/* ECONNRESET is meaningless with UDP but happens on Windows */
+			if (!drained && errno != ECONNRESET) {
+				s_warning("%s(): ignoring datagram reception error: %m",
+					G_STRFUNC);
+			}
+			break;
+		}
+
+		if G_UNLIKELY(0 == slots || UNSIGNED(r) > room) {
+			dropped++;
+			continue;
+		}
+
+		slots--;
+		room -= r;
+		queued += r;
+
+		WALLOC0(uq);
+		uq->buf = 0 == r ? NULL : wcopy(rx->buf, r);
+		uq->len = r;
+		uq->queued = tm_time();
+		uq->truncated = booleanize(truncated);
+		uq->addr = socket_addr_get_addr(&rx->from);
+		uq->port = socket_addr_get_port(&rx->from);
+		uq->has_dst = booleanize(has_dst_addr);
+		if (has_dst_addr)
+			uq->dst_addr = dst_addr;
+
+		eslist_append(&list, uq);
+	}
+
+	if (rx->edge && !drained)
+		inputevt_set_readable(rx->fd);
+
+	if G_UNLIKELY(dropped != 0)
+		gnet_stats_count_general(GNR_UDP_SHARD_QUEUE_DROPPED, dropped);
+
+	if (0 == eslist_count(&list))
+		return;
+
+	/*
+	 * Only one delivery is pending at a time: datagrams read whilst the
+	 * main thread has not processed the previous ones are simply appended.
+	 */
+
+	spinlock(&rx->lock);
+	eslist_append_list(&rx->queue, &list);
+	rx->queued += queued;
+	post = !rx->posted;
+	if (post) {
+		rx->posted = TRUE;
+		rx->refcnt++;		/* Released by socket_udp_shard_deliver() */
+	}
+	spinunlock(&rx->lock);
+
+	if (post)
+		teq_safe_post(THREAD_MAIN_ID, socket_udp_shard_deliver, rx);
+}
+
+/**
+ * @return whether the UDP sockets must be read from the I/O threads.
+ */
+static bool
+socket_udp_sharding(void)
+{
+	if (0 == GNET_PROPERTY(io_threads) || socket_is_shutdowning)
+		return FALSE;
+
+	inputevt_shards_init(GNET_PROPERTY(io_threads));
+
+	return 0 != inputevt_shards();
+}
+
 static void
 socket_set_accept_filters(struct gnutella_socket *s)
 {
@@ -3599,6 +4229,7 @@ socket_connect_prepare(struct gnutella_socket *s,
 	s->tls.enabled = tls_enabled() && (SOCK_F_TLS & flags);
 	s->tls.stage = SOCK_TLS_NONE;
 	s->tls.ctx = NULL;
+	s->tls.kernel = FALSE;
 	s->tls.snarf = 0;
 
 	socket_wio_link(s);
@@ -4348,11 +4979,30 @@ socket_enable_recvdstaddr(const struct gnutella_socket *s)
 void
 socket_set_single(struct gnutella_socket *s, bool on)
 {
+	struct udpctx *uctx;
+
 	if (on) {
 		s->flags |= SOCK_F_SINGLE;
 	} else {
 		s->flags &= ~SOCK_F_SINGLE;
 	}
+
+	/*
+	 * When datagrams are read by an I/O thread, it needs to know as well.
+	 */
+
+	if (
+		(s->flags & SOCK_F_UDP) &&
+		NULL != (uctx = s->resource.udp) && uctx->rx != NULL
+	) {
+		struct udp_rxshard *rx = uctx->rx;
+
+		udp_rxshard_check(rx);
+
+		spinlock(&rx->lock);
+		rx->single = booleanize(on);
+		spinunlock(&rx->lock);
+	}
 }
 
 /**
@@ -4427,8 +5077,33 @@ socket_udp_listen(host_addr_t bind_addr, uint16 port,
 		s->local_port = socket_addr_get_port(&addr);
 	}
 
-	/* Ignore exceptions */
-	socket_evt_set(s, INPUT_EVENT_R, socket_udp_event, s);
+	/*
+	 * Ignore exceptions.
+	 *
+	 * When I/O threads are configured, they read the datagrams and hand
+	 * them over to the main thread for processing.
+	 *
+	 * Datagrams are dispatched before the other sources, to limit the
+	 * amount of datagrams the kernel could drop.
+	 */
+
+	if (socket_udp_sharding()) {
+		struct udp_rxshard *rx = socket_udp_rxshard_alloc(s);
+
+		rx->edge = booleanize(GNET_PROPERTY(udp_edge_triggered));
+		s->resource.udp->rx = rx;
+		s->gdk_tag = inputevt_add_sharded(fd, INPUT_EVENT_R,
+			INPUT_F_URGENT | (rx->edge ? INPUT_F_EDGE : 0),
+			socket_udp_shard_event, rx);
+		g_assert(0 != s->gdk_tag);
+	} else {
+		struct udpctx *uctx = s->resource.udp;
+
+		uctx->edge = booleanize(GNET_PROPERTY(udp_edge_triggered));
+		socket_evt_set_flags(s, INPUT_EVENT_R,
+			INPUT_F_URGENT | (uctx->edge ? INPUT_F_EDGE : 0),
+			socket_udp_event, s);
+	}
 
 	/*
 	 * Enlarge the RX buffer on the UDP socket to avoid loosing incoming
@@ -4754,6 +5429,79 @@ socket_plain_sendto(
 	return ret;
 }
 
+#ifdef HAS_SENDMMSG
+static int
+socket_plain_sendmmsg(struct wrap_io *wio, wrap_dgram_t *dg, int cnt)
+{
+	struct gnutella_socket *s = wio->ctx;
+	struct mmsghdr msg[SOCK_UDP_BATCH_MAX];
+	iovec_t iov[SOCK_UDP_BATCH_MAX];
+	socket_addr_t addr[SOCK_UDP_BATCH_MAX];
+	int i, n, ret;
+
+	socket_check(s);
+	g_assert(!socket_uses_tls(s));
+	g_assert(cnt > 0);
+
+	n = MIN(cnt, (int) N_ITEMS(msg));
+
+	for (i = 0; i < n; i++) {
+		host_addr_t ha;
+
+		/*
+		 * Stop the batch at the first destination we cannot convert, so
+		 * that the error is reported when it comes first in the batch.
+		 */
+
+		if (!host_addr_convert(gnet_host_get_addr(dg[i].to), &ha, s->net)) {
+			if (GNET_PROPERTY(udp_debug)) {
+				g_carp("%s(): cannot convert %s to %s",
+					G_STRFUNC,
+					host_addr_to_string(gnet_host_get_addr(dg[i].to)),
+					net_type_to_string(s->net));
+			}
+			if (0 == i) {
+				errno = EINVAL;
+				return -1;
+			}
+			break;
+		}
+
+		ZERO(&msg[i]);
+		iovec_set(&iov[i], deconstify_pointer(dg[i].data), dg[i].len);
+		msg[i].msg_hdr.msg_name = socket_addr_get_sockaddr(&addr[i]);
+		msg[i].msg_hdr.msg_namelen =
+			socket_addr_set(&addr[i], ha, gnet_host_get_port(dg[i].to));
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	ret = sendmmsg(s->file_desc, msg, i, 0);
+
+	if (-1 == ret && GNET_PROPERTY(udp_debug)) {
+		int e = errno;
+		g_warning("sendmmsg() failed: %m");
+		errno = e;
+	}
+
+	for (i = 0; i < ret; i++)
+		dg[i].sent = msg[i].msg_len;
+
+	return ret;
+}
+#endif	/* HAS_SENDMMSG */
+
+static int
+socket_no_sendmmsg(struct wrap_io *unused_wio, wrap_dgram_t *unused_dg,
+	int unused_cnt)
+{
+	(void) unused_wio;
+	(void) unused_dg;
+	(void) unused_cnt;
+	g_error("no sendmmsg() routine allowed");
+	return -1;
+}
+
 static ssize_t
 socket_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	const void *unused_buf, size_t unused_size)
@@ -4827,6 +5575,7 @@ socket_wio_link(struct gnutella_socket *s)
 	s->wio.fd = socket_get_fd;
 	s->wio.flush = socket_no_flush;
 	s->wio.bufsize = socket_get_bufsize;
+	s->wio.sendmmsg = socket_no_sendmmsg;
 
 	if (s->flags & SOCK_F_UDP) {
 		s->wio.write = socket_no_write;
@@ -4834,6 +5583,9 @@ socket_wio_link(struct gnutella_socket *s)
 		s->wio.writev = socket_no_writev;
 		s->wio.readv = socket_plain_readv;
 		s->wio.sendto = socket_plain_sendto;
+#ifdef HAS_SENDMMSG
+		s->wio.sendmmsg = socket_plain_sendmmsg;
+#endif
 	} else if (SOCK_CONN_LISTENING == s->direction) {
 		s->wio.write = socket_no_write;
 		s->wio.read = socket_no_read;
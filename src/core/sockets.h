@@ -47,6 +47,8 @@
 #include "lib/inputevt.h"
 #include "lib/eslist.h"
 
+#define SOCK_UDP_BATCH_MAX	32		/**< Max datagrams per batched syscall */
+
 enum socket_tls_stage {
 	SOCK_TLS_NONE			= 0,
 	SOCK_TLS_INITIALIZED	= 1,
@@ -57,6 +59,7 @@ struct socket_tls_ctx {
 	tls_context_t		 	ctx;
 	bool				 	enabled;
 	enum socket_tls_stage	stage;
+	bool					kernel;	/**< Outgoing records built by kernel */
 	size_t snarf;			/**< Pending bytes if write failed temporarily. */
 
 	inputevt_cond_t			cb_cond;
@@ -162,8 +165,10 @@ struct udpq {
 	void *buf;					/**< Buffer holding data */
 	size_t len;					/**< Length of data */
 	time_t queued;				/**< Time at which we read the datagram */
+	host_addr_t dst_addr;		/**< Address to which datagram was sent */
 	uint16 port;				/**< Remote UDP sender port */
 	uint8 truncated;			/**< Whether data was truncated */
+	uint8 has_dst;				/**< Whether dst_addr is known */
 };
 
 /**
@@ -175,6 +180,9 @@ struct udpctx {
 	struct cevent *queue_ev;			/**< Queue processing event */
 	eslist_t queue;						/**< Queued items (read-ahead) */
 	size_t queued;						/**< Amount of bytes queued */
+	struct udp_rxbatch *batch;			/**< Batched reception (recvmmsg) */
+	struct udp_rxshard *rx;				/**< Reception from an I/O thread */
+	bool edge;							/**< Monitored edge-triggered */
 };
 
 static inline void
@@ -220,6 +228,16 @@ socket_uses_tls(const struct gnutella_socket *s)
 	return s->tls.enabled && s->tls.stage == SOCK_TLS_ESTABLISHED;
 }
 
+/**
+ * @return whether outgoing TLS records are built by the kernel, in which
+ * case data can be written to the socket directly, even with sendfile().
+ */
+static inline bool
+socket_tls_in_kernel(const struct gnutella_socket *s)
+{
+	return socket_uses_tls(s) && s->tls.kernel;
+}
+
 static inline bool
 socket_is_corked(const struct gnutella_socket *s)
 {
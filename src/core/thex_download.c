@@ -693,6 +693,7 @@ thex_download_receive(struct thex_download *ctx,
 		struct rx_inflate_args args;
 
 		args.cb = &thex_rx_inflate_cb;
+		args.threaded = FALSE;
 
 		ctx->rx = rx_make_above(ctx->rx, rx_inflate_get_ops(), &args);
 	}
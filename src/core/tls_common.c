@@ -60,6 +60,16 @@
 #define USE_TLS_PUSHV
 #endif
 
+#if defined(HAS_KTLS) && HAS_TLS(3, 4)
+/* Need gnutls_record_get_state() to hand the session keys to the kernel */
+#define USE_KTLS
+#include <netinet/tcp.h>
+#include <linux/tls.h>
+#ifndef SOL_TLS
+#define SOL_TLS		282
+#endif
+#endif
+
 #include "tls_common.h"
 
 #include "features.h"
@@ -566,6 +576,36 @@ tls_set_errno(struct gnutella_socket *s, int errnum)
 	gnutls_transport_set_errno(tls_socket_get_session(s), errnum);
 }
 
+/**
+ * Once the kernel builds the outgoing records, GnuTLS must not send anything
+ * on the connection: its TX state is stale and the kernel would wrap these
+ * records again as application data, desynchronizing the stream with the
+ * peer.  This happens when receiving post-handshake messages such as a
+ * TLS 1.3 KeyUpdate request, to which GnuTLS replies.
+ *
+ * The connection is flagged as reset so that it is torn down.
+ *
+ * @return TRUE if GnuTLS must not write to the socket.
+ */
+static inline bool
+tls_push_refused(struct gnutella_socket *s)
+{
+	if G_LIKELY(!s->tls.kernel)
+		return FALSE;
+
+	if (GNET_PROPERTY(tls_debug)) {
+		g_warning("%s(): GnuTLS wants to send on offloaded fd=%d "
+			"for %s, resetting connection",
+			G_STRFUNC, s->file_desc,
+			host_addr_port_to_string(s->addr, s->port));
+	}
+
+	socket_connection_reset(s);
+	tls_set_errno(s, ECONNRESET);
+	errno = ECONNRESET;
+	return TRUE;
+}
+
 #ifdef USE_TLS_PUSHV
 static inline ssize_t
 tls_pushv(gnutls_transport_ptr_t ptr, const giovec_t *iov, int iovcnt)
@@ -578,6 +618,9 @@ tls_pushv(gnutls_transport_ptr_t ptr, const giovec_t *iov, int iovcnt)
 	socket_check(s);
 	g_assert(is_valid_fd(s->file_desc));
 
+	if (tls_push_refused(s))
+		return -1;
+
 	/*
 	 * On Windows, we need to convert the giovec_t structure into our
 	 * emulated iovec_t, which are actually WSABUF structures, so that
@@ -621,6 +664,9 @@ tls_push(gnutls_transport_ptr_t ptr, const void *buf, size_t size)
 	socket_check(s);
 	g_assert(is_valid_fd(s->file_desc));
 
+	if (tls_push_refused(s))
+		return -1;
+
 	ret = s_write(s->file_desc, buf, size);
 	saved_errno = errno;
 	tls_signal_pending(s);
@@ -809,6 +855,228 @@ tls_log_audit(gnutls_session_t session, const char *message)
 }
 #endif	/* TLS >= 3.0 */
 
+#ifdef USE_KTLS
+/**
+ * Fill the kernel crypto information for an AEAD cipher.
+ *
+ * The salt is the implicit part of the nonce.  With TLS 1.2 the explicit
+ * part is the record sequence number, whereas with TLS 1.3 (and always with
+ * ChaCha20) the whole nonce is derived from the write IV.
+ */
+#define TLS_KERNEL_AEAD(field, type) G_STMT_START {					\
+	const size_t salt_len = TLS_CIPHER_ ## type ## _SALT_SIZE;		\
+	const size_t iv_len = TLS_CIPHER_ ## type ## _IV_SIZE;			\
+	const bool implicit = tls13 || 0 == salt_len;					\
+																	\
+	if (															\
+		key.size != TLS_CIPHER_ ## type ## _KEY_SIZE ||				\
+		iv.size < salt_len + (implicit ? iv_len : 0)				\
+	)																\
+		goto unsupported;											\
+																	\
+	ci.info.cipher_type = TLS_CIPHER_ ## type;						\
+	memcpy(ci.field.key, key.data, key.size);						\
+	memcpy(ci.field.salt, iv.data, salt_len);						\
+	memcpy(ci.field.iv, implicit ? iv.data + salt_len : seq,		\
+		iv_len);													\
+	memcpy(ci.field.rec_seq, seq, sizeof ci.field.rec_seq);			\
+	len = sizeof ci.field;											\
+} G_STMT_END
+
+/**
+ * Hand the encryption of outgoing records to the kernel, now that the TLS
+ * handshake is completed.
+ *
+ * The kernel then builds the TLS records out of the plain data written to
+ * the socket, which saves a copy and lets sendfile() work on TLS connections.
+ * Incoming records are still decrypted by GnuTLS, which must therefore no
+ * longer send anything on the connection: should it attempt to, the push
+ * routine resets the connection (see tls_push_refused()).
+ *
+ * Nothing is changed when the negotiated cipher is not supported by the
+ * kernel, or when the "tls" TCP upper layer protocol cannot be loaded.
+ */
+static void
+tls_kernel_offload(struct gnutella_socket *s)
+{
+	gnutls_session_t session = tls_socket_get_session(s);
+	gnutls_datum_t iv, key;
+	uchar seq[8];
+	union {
+		struct tls_crypto_info info;
+		struct tls12_crypto_info_aes_gcm_128 aes128;
+#ifdef TLS_CIPHER_AES_GCM_256
+		struct tls12_crypto_info_aes_gcm_256 aes256;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+		struct tls12_crypto_info_chacha20_poly1305 chacha;
+#endif
+	} ci;
+	size_t len;
+	bool tls13;
+
+	g_assert(!s->tls.kernel);
+	g_assert(0 == s->tls.snarf);
+
+	if (!GNET_PROPERTY(tls_kernel_offload))
+		return;
+
+	ZERO(&ci);
+
+	switch (gnutls_protocol_get_version(session)) {
+	case GNUTLS_TLS1_2:
+		ci.info.version = TLS_1_2_VERSION;
+		tls13 = FALSE;
+		break;
+#if HAS_TLS(3, 6) && defined(TLS_1_3_VERSION)
+	case GNUTLS_TLS1_3:
+		ci.info.version = TLS_1_3_VERSION;
+		tls13 = TRUE;
+		break;
+#endif
+	default:
+		return;
+	}
+
+	if (0 != gnutls_record_get_state(session, FALSE, NULL, &iv, &key, seq))
+		return;
+
+	switch (gnutls_cipher_get(session)) {
+	case GNUTLS_CIPHER_AES_128_GCM:
+		TLS_KERNEL_AEAD(aes128, AES_GCM_128);
+		break;
+#ifdef TLS_CIPHER_AES_GCM_256
+	case GNUTLS_CIPHER_AES_256_GCM:
+		TLS_KERNEL_AEAD(aes256, AES_GCM_256);
+		break;
+#endif
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+	case GNUTLS_CIPHER_CHACHA20_POLY1305:
+		TLS_KERNEL_AEAD(chacha, CHACHA20_POLY1305);
+		break;
+#endif
+	default:
+		goto unsupported;
+	}
+
+	if (
+		-1 == setsockopt(s->file_desc, IPPROTO_TCP, TCP_ULP,
+			"tls", sizeof "tls")
+	) {
+		if (GNET_PROPERTY(tls_debug)) {
+			g_debug("%s(): cannot install TLS ULP on fd=%d: %m",
+				G_STRFUNC, s->file_desc);
+		}
+		goto done;
+	}
+
+	/*
+	 * If this fails, the socket stays usable: the "tls" upper layer just
+	 * passes the data through until keys are installed.
+	 */
+
+	if (-1 == setsockopt(s->file_desc, SOL_TLS, TLS_TX, &ci, len)) {
+		if (GNET_PROPERTY(tls_debug)) {
+			g_debug("%s(): cannot install TX keys on fd=%d: %m",
+				G_STRFUNC, s->file_desc);
+		}
+		goto done;
+	}
+
+	s->tls.kernel = TRUE;
+
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): kernel now encrypts %s for %s on fd=%d",
+			G_STRFUNC, gnutls_cipher_get_name(gnutls_cipher_get(session)),
+			host_addr_port_to_string(s->addr, s->port), s->file_desc);
+	}
+	goto done;
+
+unsupported:
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): %s not offloadable for %s",
+			G_STRFUNC, gnutls_cipher_get_name(gnutls_cipher_get(session)),
+			host_addr_port_to_string(s->addr, s->port));
+	}
+
+	/* FALL THROUGH */
+
+done:
+	ZERO(&ci);		/* Do not leave key material around */
+}
+
+#undef TLS_KERNEL_AEAD
+
+/**
+ * Send a close_notify alert through the kernel TLS layer.
+ */
+static void
+tls_kernel_bye(struct gnutella_socket *s)
+{
+	static const uchar alert[2] = { 1, 0 };	/* warning, close_notify */
+	char cbuf[CMSG_SPACE(sizeof(uchar))];
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	iovec_t iov;
+
+	ZERO(&msg);
+	ZERO(&cbuf);
+	iovec_set(&iov, alert, sizeof alert);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof cbuf;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uchar));
+	*CMSG_DATA(cmsg) = 21;					/* Alert record */
+	msg.msg_controllen = cmsg->cmsg_len;
+
+	if (-1 == sendmsg(s->file_desc, &msg, MSG_DONTWAIT)) {
+		if (GNET_PROPERTY(tls_debug)) {
+			g_debug("%s(): sendmsg(fd=%d) failed: %m",
+				G_STRFUNC, s->file_desc);
+		}
+	}
+}
+
+/**
+ * Write routine used once the kernel builds the outgoing records.
+ */
+static ssize_t
+tls_kernel_write(struct wrap_io *wio, const void *buf, size_t size)
+{
+	struct gnutella_socket *s = wio->ctx;
+
+	socket_check(s);
+	g_assert(socket_tls_in_kernel(s));
+
+	return s_write(s->file_desc, buf, size);
+}
+
+/**
+ * Vectorized write routine used once the kernel builds the outgoing records.
+ */
+static ssize_t
+tls_kernel_writev(struct wrap_io *wio, const iovec_t *iov, int iovcnt)
+{
+	struct gnutella_socket *s = wio->ctx;
+
+	socket_check(s);
+	g_assert(socket_tls_in_kernel(s));
+
+	return s_writev(s->file_desc, iov, iovcnt);
+}
+#else	/* !USE_KTLS */
+static inline void
+tls_kernel_offload(struct gnutella_socket *s)
+{
+	(void) s;
+}
+#endif	/* USE_KTLS */
+
 /**
  * @return	TLS_HANDSHAKE_ERROR if the TLS handshake failed.
  *			TLS_HANDSHAKE_RETRY if the handshake is incomplete; thus
@@ -848,6 +1116,7 @@ tls_handshake(struct gnutella_socket *s)
 				SOCK_CONN_INCOMING == s->direction ? "client" : "server",
 				host_addr_port_to_string(s->addr, s->port), s->file_desc);
 		}
+		tls_kernel_offload(s);
 		tls_socket_evt_change(s, SOCK_CONN_INCOMING == s->direction
 									? INPUT_EVENT_R : INPUT_EVENT_W);
 		if (GNET_PROPERTY(tls_debug > 3)) {
@@ -1057,6 +1326,7 @@ tls_free(struct gnutella_socket *s)
 		WFREE(ctx);
 		s->tls.ctx = NULL;
 	}
+	s->tls.kernel = FALSE;
 }
 
 static inline void
@@ -1395,6 +1665,17 @@ tls_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	return -1;
 }
 
+static int
+tls_no_sendmmsg(struct wrap_io *unused_wio, wrap_dgram_t *unused_dg,
+	int unused_cnt)
+{
+	(void) unused_wio;
+	(void) unused_dg;
+	(void) unused_cnt;
+	g_error("no sendmmsg() routine allowed");
+	return -1;
+}
+
 void
 tls_wio_link(struct gnutella_socket *s)
 {
@@ -1405,7 +1686,15 @@ tls_wio_link(struct gnutella_socket *s)
 	s->wio.writev = tls_writev;
 	s->wio.readv = tls_readv;
 	s->wio.sendto = tls_no_sendto;
+	s->wio.sendmmsg = tls_no_sendmmsg;
 	s->wio.flush = tls_flush;
+
+#ifdef USE_KTLS
+	if (s->tls.kernel) {
+		s->wio.write = tls_kernel_write;
+		s->wio.writev = tls_kernel_writev;
+	}
+#endif
 }
 
 void
@@ -1424,6 +1713,18 @@ tls_bye(struct gnutella_socket *s)
 		g_warning("%s(): tls_flush(fd=%d) failed", G_STRFUNC, s->file_desc);
 	}
 
+#ifdef USE_KTLS
+	/*
+	 * GnuTLS no longer knows the state of the outgoing stream, hence we
+	 * cannot let it send the alert.
+	 */
+
+	if (s->tls.kernel) {
+		tls_kernel_bye(s);
+		return;
+	}
+#endif
+
 	ret = gnutls_bye(s->tls.ctx->session,
 			SOCK_CONN_INCOMING != s->direction
 				? GNUTLS_SHUT_WR : GNUTLS_SHUT_RDWR);
@@ -59,6 +59,7 @@
 #include "if/gnet_property_priv.h"
 
 #include "lib/cq.h"
+#include "lib/iovec.h"
 #include "lib/str.h"
 #include "lib/stringify.h"		/* For plural() */
 #include "lib/walloc.h"
@@ -72,6 +73,7 @@
  */
 
 #define CHUNK_DIGITS 16 /* At most that many digits in hexa; 64-bit */
+#define CHUNK_IOV_MAX 16 /* Max data vector entries sent at once */
 
 /*
  * Private attributes for the link.
@@ -129,14 +131,11 @@ chunk_flush_header(txdrv_t *tx)
 }
 
 /**
- * Begin new chunk of said length, committing to write that much at least
- * until the new chunk header.
- *
- * @return +1 if we were able to flush the whole header, 0 if not and -1
- * if we encountered an error.
+ * Build the header of the next chunk, committing on sending `len' bytes
+ * of data, without sending it.
  */
-static ssize_t
-chunk_begin(txdrv_t *tx, size_t len, bool final)
+static void
+chunk_header(txdrv_t *tx, size_t len, bool final)
 {
 	struct attr *attr = tx->opaque;
 	size_t hlen = 0;
@@ -170,6 +169,19 @@ chunk_begin(txdrv_t *tx, size_t len, bool final)
 	attr->head_len = attr->head_remain = hlen;
 	attr->data_remain = len;
 	attr->first = FALSE;
+}
+
+/**
+ * Begin new chunk of said length, committing to write that much at least
+ * until the new chunk header.
+ *
+ * @return +1 if we were able to flush the whole header, 0 if not and -1
+ * if we encountered an error.
+ */
+static ssize_t
+chunk_begin(txdrv_t *tx, size_t len, bool final)
+{
+	chunk_header(tx, len, final);
 
 	/*
 	 * Flush the chunk header.
@@ -179,33 +191,98 @@ chunk_begin(txdrv_t *tx, size_t len, bool final)
 }
 
 /**
- * Compute how much data we can still send within the current chunk, knowing
- * that we're offered `len' bytes from the upper layer.
+ * Send the pending chunk header, if any, along with as much data from the
+ * I/O vector as the current chunk can hold, through a single gathering
+ * write to the lower layer.
+ *
+ * This avoids one system call per chunk header and lets the kernel put the
+ * framing bytes in the same segment as the data they describe.
+ *
+ * The (idx, off) cursor indicates where the unsent data start in the vector
+ * and is updated to reflect what was written.
+ *
+ * @param tx		the chunk layer
+ * @param iov		the I/O vector to send
+ * @param iovcnt	amount of entries in the I/O vector
+ * @param idx		index of the first unsent entry in the vector
+ * @param off		offset of the first unsent byte in that entry
+ * @param done		set to TRUE if the lower layer accepted all we gave it
+ *
+ * @return amount of data bytes written, -1 on error.
  */
 static ssize_t
-chunk_acceptable(txdrv_t *tx, size_t len)
+chunk_send(txdrv_t *tx, const iovec_t *iov, int iovcnt,
+	int *idx, size_t *off, bool *done)
 {
 	struct attr *attr = tx->opaque;
-	ssize_t r;
+	iovec_t vec[CHUNK_IOV_MAX + 1];
+	ssize_t hlen, dlen = 0, r, hw;
+	size_t avail, written;
+	int i, n = 0;
 
 	g_assert(attr->data_remain >= 0);
 	g_assert(attr->head_remain >= 0);
-	g_assert((size_t) -1 != len && len > 0);
 
 	/*
-	 * If we haven't committed any length yet, this begins a new chunk.
+	 * If we haven't committed any length yet, this begins a new chunk
+	 * holding all the data we have.
 	 */
 
 	if (attr->data_remain + attr->head_remain == 0) {
-		r = chunk_begin(tx, len, FALSE);
-		if (r <= 0)
-			return r;				/* Flow-controlled or error */
-	} else if (attr->head_remain) {
-		r = chunk_flush_header(tx);
-			return r;				/* Idem */
+		size_t len = iov_calculate_size(&iov[*idx], iovcnt - *idx) - *off;
+		chunk_header(tx, len, FALSE);
+	}
+
+	hlen = attr->head_remain;
+	if (hlen != 0)
+		iovec_set(&vec[n++], &attr->head[attr->head_len - hlen], hlen);
+
+	avail = attr->data_remain;
+
+	for (i = *idx; i < iovcnt && avail != 0 && n < (int) N_ITEMS(vec); i++) {
+		size_t o = (i == *idx) ? *off : 0;
+		size_t l = MIN(iovec_len(&iov[i]) - o, avail);
+
+		if (0 == l)
+			continue;
+
+		iovec_set(&vec[n++], (char *) iovec_base(&iov[i]) + o, l);
+		avail -= l;
+		dlen += l;
 	}
 
-	return MIN(attr->data_remain, (ssize_t) len);
+	r = tx_writev(tx->lower, vec, n);
+
+	if (-1 == r)
+		return -1;				/* Lower layer has invoked error callback */
+
+	*done = r == hlen + dlen;
+
+	/*
+	 * Header bytes go first, the remaining were taken from the data.
+	 */
+
+	hw = MIN(r, hlen);
+	attr->head_remain -= hw;
+	r -= hw;
+	attr->data_remain -= r;
+
+	g_assert(attr->head_remain >= 0);
+	g_assert(attr->data_remain >= 0);
+
+	for (written = r; written != 0; /* empty */) {
+		size_t l = iovec_len(&iov[*idx]) - *off;
+
+		if (written < l) {
+			*off += written;
+			break;
+		}
+		written -= l;
+		(*idx)++;
+		*off = 0;
+	}
+
+	return r;
 }
 
 /**
@@ -297,44 +374,31 @@ tx_chunk_destroy(txdrv_t *tx)
 }
 
 /**
- * Write data buffer.
+ * Write I/O vector.
  *
  * @return amount of data bytes written, or -1 on error.
  */
 static ssize_t
-tx_chunk_write(txdrv_t *tx, const void *data, size_t len)
+tx_chunk_writev(txdrv_t *tx, iovec_t *iov, int iovcnt)
 {
-	struct attr *attr = tx->opaque;
-	size_t remain = len;
-	const char *ptr = data;
+	size_t len = iov_calculate_size(iov, iovcnt);
 	size_t written = 0;
+	size_t off = 0;
+	int idx = 0;
 
 	g_assert((size_t) -1 != len && len > 0);
 
-	while (remain > 0) {
-		ssize_t acceptable = chunk_acceptable(tx, remain);
-		ssize_t r;
+	while (written != len) {
+		bool done;
+		ssize_t r = chunk_send(tx, iov, iovcnt, &idx, &off, &done);
 
-		if (acceptable < 0)
+		if (-1 == r)
 			return -1;			/* Error detected by lower layer */
 
-		if (acceptable == 0)	/* Could not flush header probably */
-			break;
+		written += r;
 
-		r = tx_write(tx->lower, ptr, acceptable);
-
-		if (r > 0) {
-			ptr += r;
-			written += r;
-			attr->data_remain -= r;
-			remain -= r;
-		}
-
-		if (r < 0)
-			return -1;			/* Lower layer has invoked error callback */
-
-		if (r != acceptable)
-			break;
+		if (!done)
+			break;				/* Lower-level flow-controls us */
 	}
 
 	/*
@@ -349,33 +413,17 @@ tx_chunk_write(txdrv_t *tx, const void *data, size_t len)
 }
 
 /**
- * Write I/O vector.
+ * Write data buffer.
  *
- * @return amount of bytes written, or -1 on error.
+ * @return amount of data bytes written, or -1 on error.
  */
 static ssize_t
-tx_chunk_writev(txdrv_t *tx, iovec_t *iov, int iovcnt)
+tx_chunk_write(txdrv_t *tx, const void *data, size_t len)
 {
-	ssize_t written = 0;
-
-	/*
-	 * XXX Highly inefficient because each item in the vector can be
-	 * a standalone chunk... Will do for now -- RAM, 2005-08-02.
-	 */
+	iovec_t iov;
 
-	while (iovcnt--) {
-		ssize_t r = tx_chunk_write(tx,
-			  iovec_base(iov), iovec_len(iov));
-		if (-1 == r)
-			return -1;
-		if (r > 0)
-			written += r;
-		if ((size_t) r != iovec_len(iov))	/* Not able to write everything */
-			break;							/* Lower-level flow-controls us */
-		iov++;
-	}
-
-	return written;
+	iovec_set(&iov, data, len);
+	return tx_chunk_writev(tx, &iov, 1);
 }
 
 /**
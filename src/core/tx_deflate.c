@@ -39,14 +39,19 @@
 
 #include "tx.h"
 #include "tx_deflate.h"
+#include "gnet_stats.h"
 #include "hosts.h"
 #include "sockets.h"
+#include "zworker.h"
 
 #include "if/gnet_property_priv.h"
 
 #include "lib/cq.h"
 #include "lib/endian.h"
+#include "lib/halloc.h"
+#include "lib/hashing.h"
 #include "lib/mempcpy.h"
+#include "lib/pow2.h"
 #include "lib/tm.h"
 #include "lib/walloc.h"
 #include "lib/zlib_util.h"
@@ -105,7 +110,17 @@ struct attr {
 		uint32		size;		/**< Payload size counter for gzip */
 		uLong		crc;		/**< CRC-32 accumlator for gzip */
 	} gzip;
+	struct deflate_job *job;	/**< Compression job in flight, if any */
+	char *inbuf;				/**< Input buffered for the next job */
+	size_t inlen;				/**< Amount of input in inbuf */
+	size_t queued;				/**< Input bytes not deflated yet */
+	char *output;				/**< Deflated output not buffered yet */
+	size_t output_len;			/**< Length of output */
+	size_t output_off;			/**< Offset of first byte not buffered */
+	int zflush;					/**< Flush mode requested for next job */
 	unsigned nagle:1;			/**< Whether to use Nagle or not */
+	unsigned threaded:1;		/**< Whether to deflate in compression threads */
+	unsigned zsend:1;			/**< Send buffer once requested flush done */
 };
 
 /*
@@ -116,8 +131,50 @@ struct attr {
 #define DF_NAGLE		0x00000002	/**< Nagle timer started */
 #define DF_FLUSH		0x00000004	/**< Flushing started */
 #define DF_SHUTDOWN		0x00000008	/**< Stack has shut down */
+#define DF_SEND			0x00000010	/**< Send filling buffer when possible */
+#define DF_FINISHED		0x00000020	/**< Compression stream finished */
+
+/*
+ * When deflating in the compression threads, the data written by the upper
+ * layer are copied into an input buffer, which is handed to the next job.
+ * There is at most one job in flight per connection, which owns the
+ * compressing stream and deflates its input into a private output buffer.
+ * Once the job completes, that output is moved to the two buffers above
+ * from the main thread, where everything else happens: the Nagle timer,
+ * flow-control and sending to the lower layer.
+ *
+ * We flow-control the upper layer when the input buffer is full, and no
+ * new job is dispatched whilst the output of the previous one could not be
+ * fully buffered, which bounds the amount of memory used per connection.
+ */
+
+#define DEFLATE_JOB_SLACK	64	/**< Extra output room for a job */
+
+enum deflate_job_magic { DEFLATE_JOB_MAGIC = 0x3e8b1d52 };
+
+struct deflate_job {
+	enum deflate_job_magic magic;
+	txdrv_t *tx;				/**< Driver, NULL if destroyed meanwhile */
+	z_streamp outz;				/**< Compressing stream */
+	char *in;					/**< Input data (walloc-ed) */
+	size_t insize;				/**< Size of the input arena */
+	size_t inlen;				/**< Amount of input data */
+	char *out;					/**< Deflated data (halloc-ed) */
+	size_t outlen;				/**< Amount of deflated data */
+	int flush;					/**< Flush mode for deflate() */
+	int ret;					/**< Status of the compression */
+	unsigned send:1;			/**< Send buffer once flushed */
+};
+
+static inline void
+deflate_job_check(const struct deflate_job * const dj)
+{
+	g_assert(dj != NULL);
+	g_assert(DEFLATE_JOB_MAGIC == dj->magic);
+}
 
 static void deflate_nagle_timeout(cqueue_t *cq, void *arg);
+static void deflate_service_upper(txdrv_t *tx);
 static size_t tx_deflate_pending(txdrv_t *tx);
 
 #define tx_deflate_debugging(lvl) \
@@ -380,10 +437,16 @@ done:
 /**
  * Flush compression within filling buffer.
  *
+ * A full flush also resets the compression state, so that data compressed
+ * afterwards do not refer to data compressed before.
+ *
+ * @param tx		the driver
+ * @param full		whether to perform a full flush
+ *
  * @return success status, failure meaning we shutdown.
  */
 static bool
-deflate_flush(txdrv_t *tx)
+deflate_flush(txdrv_t *tx, bool full)
 {
 	struct attr *attr = tx->opaque;
 	z_streamp outz = attr->outz;
@@ -418,7 +481,8 @@ retry:
 
 	g_assert(outz->avail_out > 0);
 
-	ret = deflate(outz, (tx->flags & TX_CLOSING) ? Z_FINISH : Z_SYNC_FLUSH);
+	ret = deflate(outz, (tx->flags & TX_CLOSING) ? Z_FINISH :
+		full ? Z_FULL_FLUSH : Z_SYNC_FLUSH);
 
 	switch (ret) {
 	case Z_BUF_ERROR:				/* Nothing to flush */
@@ -475,6 +539,353 @@ done:
 	return TRUE;		/* Fully flushed */
 }
 
+/**
+ * Deflate the input of the job, from a compression thread.
+ */
+static void
+deflate_job_run(void *data)
+{
+	struct deflate_job *dj = data;
+	z_streamp outz = dj->outz;
+	size_t size;
+
+	deflate_job_check(dj);
+
+	size = dj->inlen / 2 + DEFLATE_JOB_SLACK;
+	dj->out = halloc(size);
+
+	outz->next_in = cast_to_pointer(dj->in);
+	outz->avail_in = dj->inlen;
+
+	for (;;) {
+		int ret;
+
+		if (dj->outlen == size) {
+			size *= 2;
+			dj->out = hrealloc(dj->out, size);
+		}
+
+		outz->next_out = cast_to_pointer(&dj->out[dj->outlen]);
+		outz->avail_out = size - dj->outlen;
+
+		ret = deflate(outz, dj->flush);
+		dj->outlen = size - outz->avail_out;
+
+		if (Z_BUF_ERROR == ret || Z_STREAM_END == ret)
+			break;				/* Nothing more to flush, or stream ended */
+
+		if (Z_OK != ret) {
+			dj->ret = ret;
+			break;
+		}
+
+		/*
+		 * Once all the input was consumed, we're done when deflate() did
+		 * not fill the output space: any requested flush is then complete.
+		 */
+
+		if (0 == outz->avail_in && 0 != outz->avail_out)
+			break;
+	}
+}
+
+/**
+ * Free compression job.
+ */
+static void
+deflate_job_free(struct deflate_job *dj)
+{
+	deflate_job_check(dj);
+
+	if (dj->in != NULL)
+		wfree(dj->in, dj->insize);
+	HFREE_NULL(dj->out);
+	dj->magic = 0;
+	WFREE(dj);
+}
+
+/**
+ * Move deflated output into the filling buffer, rotating and sending
+ * buffers as they fill up.
+ *
+ * @return TRUE if all the deflated output was buffered.
+ */
+static bool
+deflate_drain(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+
+	while (attr->output_off < attr->output_len) {
+		struct buffer *b = &attr->buf[attr->fill_idx];	/* Buffer we fill */
+		size_t n;
+
+		if (b->wptr >= b->end) {
+			if (attr->send_idx >= 0)
+				return FALSE;				/* Wait for deflate_service() */
+
+			deflate_rotate_and_send(tx);	/* Can set TX_ERROR */
+
+			if (tx->flags & TX_ERROR)
+				return FALSE;
+
+			continue;
+		}
+
+		n = MIN(ptr_diff(b->end, b->wptr),
+				attr->output_len - attr->output_off);
+		b->wptr = mempcpy(b->wptr, &attr->output[attr->output_off], n);
+		attr->output_off += n;
+	}
+
+	HFREE_NULL(attr->output);
+	attr->output_len = attr->output_off = 0;
+
+	return TRUE;
+}
+
+static void deflate_job_done(void *data);
+
+/**
+ * Hand buffered input to the compression threads, along with any requested
+ * flush, unless a job is already in flight or deflated output is still
+ * waiting for room in our buffers.
+ */
+static void
+deflate_dispatch(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+	struct deflate_job *dj;
+	int flush;
+
+	g_assert(attr->threaded);
+
+	if (attr->job != NULL || attr->output != NULL)
+		return;
+
+	if ((tx->flags & TX_ERROR) || (attr->flags & DF_SHUTDOWN))
+		return;
+
+	/*
+	 * Avoid flushing when nothing was compressed since the last flush.
+	 */
+
+	flush = attr->zflush;
+
+	if (0 == attr->inlen) {
+		if (Z_FINISH == flush && (attr->flags & DF_FINISHED))
+			flush = Z_NO_FLUSH;
+		else if (Z_SYNC_FLUSH == flush && 0 == attr->unflushed)
+			flush = Z_NO_FLUSH;
+	}
+
+	if (Z_NO_FLUSH == flush && attr->zsend) {
+		attr->zsend = FALSE;
+		attr->flags |= DF_SEND;
+	}
+
+	attr->zflush = Z_NO_FLUSH;
+
+	if (Z_NO_FLUSH == flush && 0 == attr->inlen)
+		return;
+
+	WALLOC0(dj);
+	dj->magic = DEFLATE_JOB_MAGIC;
+	dj->tx = tx;
+	dj->outz = attr->outz;
+	dj->in = attr->inbuf;
+	dj->insize = attr->buffer_size;
+	dj->inlen = attr->inlen;
+	dj->flush = flush;
+	dj->ret = Z_OK;
+
+	if (Z_NO_FLUSH != flush) {
+		dj->send = attr->zsend;
+		attr->zsend = FALSE;
+	}
+
+	attr->inbuf = walloc(attr->buffer_size);
+	attr->inlen = 0;
+	attr->job = dj;
+
+	zworker_submit(deflate_job_run, deflate_job_done, dj);
+}
+
+/**
+ * Buffer deflated output, send the filling buffer when a flush requested
+ * it, and dispatch the next compression job.
+ */
+static void
+deflate_resume(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+
+	if (!deflate_drain(tx))
+		return;
+
+	deflate_dispatch(tx);
+
+	if ((attr->flags & DF_SEND) && -1 == attr->send_idx) {
+		struct buffer *b = &attr->buf[attr->fill_idx];
+
+		attr->flags &= ~DF_SEND;
+
+		if (b->rptr != b->wptr)			/* Something to send */
+			deflate_rotate_and_send(tx);
+	}
+}
+
+/**
+ * Compression job completed, from the main thread.
+ */
+static void
+deflate_job_done(void *data)
+{
+	struct deflate_job *dj = data;
+	txdrv_t *tx = dj->tx;
+	struct attr *attr;
+
+	deflate_job_check(dj);
+
+	/*
+	 * If the driver was destroyed whilst the job was running, we now own
+	 * the compressing stream.  We ignore errors, as we are discarding data.
+	 */
+
+	if (NULL == tx) {
+		(void) deflateEnd(dj->outz);
+		WFREE(dj->outz);
+		deflate_job_free(dj);
+		return;
+	}
+
+	attr = tx->opaque;
+	g_assert(dj == attr->job);
+	g_assert(size_is_non_negative(attr->queued - dj->inlen));
+
+	attr->job = NULL;
+	attr->queued -= dj->inlen;
+
+	if (Z_OK != dj->ret) {
+		int ret = dj->ret;
+
+		deflate_job_free(dj);
+		attr->flags |= DF_SHUTDOWN;
+		(*attr->cb->shutdown)(tx->owner, "Compression failed: %s",
+			zlib_strerror(ret));
+		return;
+	}
+
+	attr->unflushed += dj->inlen;
+	attr->flushed += dj->outlen;
+
+	if (NULL != attr->cb->add_tx_deflated)
+		attr->cb->add_tx_deflated(tx->owner, dj->outlen);
+
+	if (Z_FINISH == dj->flush)
+		attr->flags |= DF_FINISHED;
+
+	if (Z_NO_FLUSH != dj->flush)
+		deflate_flushed(tx);
+
+	if (dj->send)
+		attr->flags |= DF_SEND;
+
+	if (dj->outlen != 0) {
+		attr->output = dj->out;
+		attr->output_len = dj->outlen;
+		attr->output_off = 0;
+		dj->out = NULL;
+	}
+
+	deflate_job_free(dj);
+
+	if (tx->flags & (TX_ERROR | TX_DOWN))
+		return;
+
+	if (tx_deflate_debugging(9)) {
+		g_debug("TX %s: (%s) job done (buffer #%d, nagle %s, "
+			"flushed %zu, unflushed %zu, queued %zu) [%c%c]",
+			G_STRFUNC, gnet_host_to_string(&tx->host), attr->fill_idx,
+			(attr->flags & DF_NAGLE) ? "on" : "off",
+			attr->flushed, attr->unflushed, attr->queued,
+			(attr->flags & DF_FLOWC) ? 'C' : '-',
+			(attr->flags & DF_FLUSH) ? 'f' : '-');
+	}
+
+	deflate_resume(tx);					/* Can set TX_ERROR */
+
+	if (tx->flags & TX_ERROR)
+		return;
+
+	/*
+	 * Rotating buffers stops the Nagle timer: restart it if we still hold
+	 * data in the compressor that nobody asked to flush yet.
+	 */
+
+	if (
+		!(attr->flags & DF_NAGLE) && !(tx->flags & TX_CLOSING) &&
+		0 != attr->unflushed + attr->queued && Z_NO_FLUSH == attr->zflush &&
+		(NULL == attr->job || Z_NO_FLUSH == attr->job->flush)
+	)
+		deflate_nagle_start(tx);
+
+	/*
+	 * If we have a pending send buffer, deflate_service() will be called
+	 * when the lower layer can accept more data.
+	 */
+
+	if (-1 == attr->send_idx)
+		deflate_service_upper(tx);
+}
+
+/**
+ * Buffer data for the compression threads.
+ *
+ * @return the amount of input bytes that were buffered, -1 on error.
+ */
+static int
+deflate_queue(txdrv_t *tx, const void *data, int len)
+{
+	struct attr *attr = tx->opaque;
+	size_t n;
+
+	n = MIN(UNSIGNED(len), attr->buffer_size - attr->inlen);
+	memcpy(&attr->inbuf[attr->inlen], data, n);
+	attr->inlen += n;
+	attr->queued += n;
+
+	if (n < UNSIGNED(len))
+		deflate_set_flowc(tx, TRUE);	/* Enter flow control */
+
+	if (0 != n) {
+		if (attr->flags & DF_NAGLE)
+			deflate_nagle_delay(tx);
+		else
+			deflate_nagle_start(tx);
+	}
+
+	if (attr->unflushed + attr->queued > attr->buffer_flush)
+		attr->zflush = MAX(attr->zflush, Z_SYNC_FLUSH);
+
+	deflate_dispatch(tx);
+
+	return n;
+}
+
+/**
+ * @return whether we can leave flow-control.
+ */
+static bool
+deflate_accepting(const txdrv_t *tx)
+{
+	const struct attr *attr = tx->opaque;
+
+	if (!attr->threaded)
+		return TRUE;
+
+	return NULL == attr->output && attr->inlen < attr->buffer_size;
+}
+
 /**
  * Flush compression and send whatever we got so far.
  */
@@ -483,6 +894,19 @@ deflate_flush_send(txdrv_t *tx)
 {
 	struct attr *attr = tx->opaque;
 
+	/*
+	 * When deflating in the compression threads, the flush is done by the
+	 * next job and the buffer is sent once the job completed.
+	 */
+
+	if (attr->threaded) {
+		attr->zflush = MAX(attr->zflush,
+			(tx->flags & TX_CLOSING) ? Z_FINISH : Z_SYNC_FLUSH);
+		attr->zsend = TRUE;
+		deflate_resume(tx);
+		return;
+	}
+
 	/*
 	 * During deflate_flush(), we can fill the current buffer, then call
 	 * deflate_rotate_and_send() and finish the flush.  But it is possible
@@ -490,7 +914,7 @@ deflate_flush_send(txdrv_t *tx)
 	 * we need to recheck for attr->send_idx.
 	 */
 
-	if (deflate_flush(tx)) {
+	if (deflate_flush(tx, FALSE)) {
 		if (-1 == attr->send_idx) {			/* No write pending */
 			struct buffer *b = &attr->buf[attr->fill_idx];
 
@@ -541,6 +965,273 @@ deflate_nagle_timeout(cqueue_t *cq, void *arg)
 	deflate_flush_send(tx);
 }
 
+/*
+ * Broadcast messages relayed to several connections are the same for all of
+ * them, yet each connection deflates them again within its own stream.
+ *
+ * When enabled, these messages are registered by tx_deflate_share() and the
+ * first connection sending one deflates it into an independent block, that
+ * is a sequence of raw deflate blocks with no back-reference outside the
+ * message and ending on a sync flush point.  Such a block can be spliced
+ * as-is in any compressed stream, provided the stream was fully flushed
+ * beforehand: data compressed afterwards then cannot refer to anything
+ * preceding the block, hence the fact that the sender's window does not
+ * contain the message does not matter.  We only need to account for the
+ * message in the Adler-32 checksum of the stream.
+ *
+ * Registered messages are referenced through a small cache indexed by the
+ * address of their data, the reference we hold on the message making sure
+ * these data cannot be reused for something else meanwhile.
+ */
+
+#define DEFLATE_SHARE_SLOTS		64			/**< Cached shared blocks */
+#define DEFLATE_SHARE_MAXLEN	(16 * 1024)	/**< Max size of shared message */
+#define DEFLATE_SHARE_WBITS		14			/**< Window bits for shared blocks */
+
+struct deflate_share {
+	const void *data;			/**< Start of message data */
+	size_t len;					/**< Length of message */
+	pmsg_t *mb;					/**< Reference on the message */
+	char *block;				/**< Deflated block (halloc-ed), or NULL */
+	size_t blen;				/**< Length of deflated block */
+	uLong adler;				/**< Adler-32 checksum of the message */
+};
+
+static struct deflate_share deflate_share_cache[DEFLATE_SHARE_SLOTS];
+static z_streamp deflate_share_z;	/**< Compressor for shared blocks */
+
+/**
+ * @return cache slot for message data.
+ */
+static inline struct deflate_share *
+deflate_share_slot(const void *data)
+{
+	STATIC_ASSERT(IS_POWER_OF_2(DEFLATE_SHARE_SLOTS));
+
+	return &deflate_share_cache[pointer_hash(data) & (DEFLATE_SHARE_SLOTS - 1)];
+}
+
+/**
+ * Release cached entry.
+ */
+static void
+deflate_share_free(struct deflate_share *ds)
+{
+	pmsg_free_null(&ds->mb);
+	HFREE_NULL(ds->block);
+	ZERO(ds);
+}
+
+/**
+ * Deflate message into an independent block.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+deflate_share_build(struct deflate_share *ds)
+{
+	z_streamp z;
+	size_t size;
+	int ret;
+
+	g_assert(NULL == ds->block);
+
+	if G_UNLIKELY(NULL == deflate_share_z) {
+		WALLOC0(z);
+		z->zalloc = zlib_alloc_func;
+		z->zfree = zlib_free_func;
+		z->opaque = NULL;
+
+		/*
+		 * Our reduced streams use a 16 KiB window, hence back-references
+		 * in shared blocks must not go further for their receivers.
+		 */
+
+		ret = deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+				-DEFLATE_SHARE_WBITS, MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY);
+
+		if (Z_OK != ret) {
+			g_warning("%s(): unable to initialize compressor: %s",
+				G_STRFUNC, zlib_strerror(ret));
+			WFREE(z);
+			return FALSE;
+		}
+
+		deflate_share_z = z;
+	} else {
+		z = deflate_share_z;
+		deflateReset(z);
+	}
+
+	size = deflateBound(z, ds->len) + DEFLATE_JOB_SLACK;
+	ds->block = halloc(size);
+
+	z->next_in = deconstify_pointer(ds->data);
+	z->avail_in = ds->len;
+	z->next_out = cast_to_pointer(ds->block);
+	z->avail_out = size;
+
+	ret = deflate(z, Z_SYNC_FLUSH);
+
+	if (Z_OK != ret || 0 != z->avail_in || 0 == z->avail_out) {
+		g_carp("%s(): cannot deflate %zu-byte message: %s",
+			G_STRFUNC, ds->len, zlib_strerror(ret));
+		HFREE_NULL(ds->block);
+		return FALSE;
+	}
+
+	ds->blen = size - z->avail_out;
+	ds->adler = adler32(adler32(0, NULL, 0), ds->data, ds->len);
+
+	return TRUE;
+}
+
+/**
+ * Lookup shared block for the message data, deflating it when needed.
+ *
+ * @return the shared entry, NULL if none.
+ */
+static const struct deflate_share *
+deflate_share_lookup(const void *data, size_t len)
+{
+	struct deflate_share *ds = deflate_share_slot(data);
+
+	if (ds->data != data || ds->len != len)
+		return NULL;
+
+	if (NULL == ds->block) {
+		if (!deflate_share_build(ds)) {
+			deflate_share_free(ds);
+			return NULL;
+		}
+	} else {
+		gnet_stats_count_general(GNR_BROADCAST_DEFLATE_SAVED, len);
+	}
+
+	gnet_stats_inc_general(GNR_BROADCAST_DEFLATE_SHARED);
+
+	return ds;
+}
+
+/**
+ * Splice the shared deflated block of the message, if any, in the stream.
+ *
+ * @return the amount of input bytes that were consumed, 0 if the data have
+ * to be deflated normally or if we entered flow-control, -1 on error.
+ */
+static int
+deflate_splice(txdrv_t *tx, const void *data, int len)
+{
+	struct attr *attr = tx->opaque;
+	const struct deflate_share *ds;
+	struct buffer *b;
+
+	g_assert(!attr->threaded);
+
+	ds = deflate_share_lookup(data, len);
+
+	if (NULL == ds || ds->blen > attr->buffer_size)
+		return 0;
+
+	/*
+	 * Fully flush what we compressed so far, so that we can resume
+	 * compressing after the block without referring to anything before.
+	 */
+
+	if (!deflate_flush(tx, TRUE))
+		return -1;
+
+	if (attr->flags & DF_FLUSH)
+		return 0;				/* Flush incomplete, flow-controlled */
+
+	b = &attr->buf[attr->fill_idx];	/* Buffer we fill */
+
+	if (ds->blen > UNSIGNED(b->end - b->wptr)) {
+		if (attr->send_idx >= 0)
+			return 0;			/* Deflate the data normally */
+
+		deflate_rotate_and_send(tx);	/* Can set TX_ERROR */
+
+		if (tx->flags & TX_ERROR)
+			return -1;
+
+		b = &attr->buf[attr->fill_idx];
+		g_assert(b->wptr == b->arena);
+	}
+
+	b->wptr = mempcpy(b->wptr, ds->block, ds->blen);
+	attr->outz->adler = adler32_combine(attr->outz->adler, ds->adler, len);
+	attr->unflushed += len;
+	attr->flushed += ds->blen;
+
+	if (NULL != attr->cb->add_tx_deflated)
+		attr->cb->add_tx_deflated(tx->owner, ds->blen);
+
+	if (tx_deflate_debugging(9)) {
+		g_debug("TX %s: (%s) spliced %d bytes deflated into %zu "
+			"(buffer #%d, nagle %s) [%c%c]",
+			G_STRFUNC, gnet_host_to_string(&tx->host),
+			len, ds->blen, attr->fill_idx,
+			(attr->flags & DF_NAGLE) ? "on" : "off",
+			(attr->flags & DF_FLOWC) ? 'C' : '-',
+			(attr->flags & DF_FLUSH) ? 'f' : '-');
+	}
+
+	deflate_flushed(tx);
+
+	if (attr->flags & DF_NAGLE)
+		deflate_nagle_delay(tx);
+	else
+		deflate_nagle_start(tx);
+
+	return len;
+}
+
+/**
+ * Register broadcast message, which is about to be sent to several
+ * connections, so that it is only deflated once.
+ *
+ * @param mb		the message (a reference is taken)
+ */
+void
+tx_deflate_share(pmsg_t *mb)
+{
+	struct deflate_share *ds;
+	size_t len = pmsg_size(mb);
+
+	if (!GNET_PROPERTY(deflate_shared_broadcast))
+		return;
+
+	if (0 == len || len > DEFLATE_SHARE_MAXLEN)
+		return;
+
+	ds = deflate_share_slot(pmsg_start(mb));
+
+	if (ds->mb != NULL)
+		deflate_share_free(ds);
+
+	ds->mb = pmsg_clone(mb);
+	ds->data = pmsg_start(mb);
+	ds->len = len;
+}
+
+/**
+ * Release all shared blocks.
+ */
+void
+tx_deflate_share_close(void)
+{
+	uint i;
+
+	for (i = 0; i < N_ITEMS(deflate_share_cache); i++)
+		deflate_share_free(&deflate_share_cache[i]);
+
+	if (deflate_share_z != NULL) {
+		(void) deflateEnd(deflate_share_z);
+		WFREE_NULL(deflate_share_z, sizeof *deflate_share_z);
+	}
+}
+
 /**
  * Compress as much data as possible to the output buffer, sending data
  * as we go along.
@@ -572,6 +1263,19 @@ deflate_add(txdrv_t *tx, const void *data, int len)
 	if G_UNLIKELY(tx->flags & TX_ERROR)
 		return -1;
 
+	if (attr->threaded)
+		return deflate_queue(tx, data, len);
+
+	if (
+		NULL != deflate_share_slot(data)->mb &&
+		!attr->gzip.enabled && !(attr->flags & DF_FLUSH)
+	) {
+		int r = deflate_splice(tx, data, len);
+
+		if (r != 0 || (attr->flags & DF_FLOWC))
+			return r;
+	}
+
 	while (added < len) {
 		struct buffer *b = &attr->buf[attr->fill_idx];	/* Buffer we fill */
 		int ret;
@@ -694,7 +1398,7 @@ deflate_add(txdrv_t *tx, const void *data, int len)
 	 */
 
 	if (attr->unflushed > attr->buffer_flush) {
-		if (!deflate_flush(tx))
+		if (!deflate_flush(tx, FALSE))
 			return -1;
 	}
 
@@ -736,6 +1440,18 @@ deflate_service(void *data)
 	if (attr->send_idx >= 0)		/* Could not send it entirely */
 		return;						/* Done, servicing still enabled */
 
+	/*
+	 * When deflating in the compression threads, buffer the output that
+	 * could not fit earlier and dispatch the next job.
+	 */
+
+	if (attr->threaded) {
+		deflate_resume(tx);			/* Can set TX_ERROR */
+
+		if (tx->flags & TX_ERROR)
+			return;
+	}
+
 	/*
 	 * NB: In the following operations, order matters.  In particular, we
 	 * must disable the servicing before attempting to service the upper
@@ -766,12 +1482,23 @@ deflate_service(void *data)
 	if (-1 == attr->send_idx)
 		tx_srv_disable(tx->lower);
 
+	deflate_service_upper(tx);
+}
+
+/**
+ * Leave flow-control if we can, finish closing and service the upper layer.
+ */
+static void
+deflate_service_upper(txdrv_t *tx)
+{
+	struct attr *attr = tx->opaque;
+
 	/*
 	 * If we entered flow control, we can now safely leave it, since we
 	 * have at least a free `fill' buffer.
 	 */
 
-	if (attr->flags & DF_FLOWC)
+	if ((attr->flags & DF_FLOWC) && deflate_accepting(tx))
 		deflate_set_flowc(tx, FALSE);	/* Leave flow control state */
 
 	/*
@@ -909,6 +1636,17 @@ tx_deflate_init(txdrv_t *tx, void *args)
 
 	attr->outz = outz;
 	attr->tm_ev = NULL;
+	attr->zflush = Z_NO_FLUSH;
+
+	/*
+	 * The gzip encapsulation needs the CRC of the input and a trailer
+	 * written when closing, which is only handled synchronously.
+	 */
+
+	if (targs->threaded && !targs->gzip && zworker_is_enabled()) {
+		attr->threaded = TRUE;
+		attr->inbuf = walloc(attr->buffer_size);
+	}
 
 	for (i = 0; i < BUFFER_COUNT; i++) {
 		struct buffer *b = &attr->buf[i];
@@ -969,16 +1707,27 @@ tx_deflate_destroy(txdrv_t *tx)
 	}
 
 	/*
+	 * When a job is in flight, the compressing stream is in use by a
+	 * compression thread and will be freed when the job completes.
+	 *
 	 * We ignore Z_DATA_ERROR errors (discarded data, probably).
 	 */
 
-	ret = deflateEnd(attr->outz);
+	if (attr->job != NULL) {
+		attr->job->tx = NULL;
+	} else {
+		ret = deflateEnd(attr->outz);
+
+		if (Z_OK != ret && Z_DATA_ERROR != ret)
+			g_warning("while freeing compressor for peer %s: %s",
+				gnet_host_to_string(&tx->host), zlib_strerror(ret));
 
-	if (Z_OK != ret && Z_DATA_ERROR != ret)
-		g_warning("while freeing compressor for peer %s: %s",
-			gnet_host_to_string(&tx->host), zlib_strerror(ret));
+		WFREE(attr->outz);
+	}
 
-	WFREE(attr->outz);
+	if (attr->inbuf != NULL)
+		wfree(attr->inbuf, attr->buffer_size);
+	HFREE_NULL(attr->output);
 	cq_cancel(&attr->tm_ev);
 	WFREE(attr);
 }
@@ -1104,6 +1853,19 @@ tx_deflate_pending(txdrv_t *tx)
 		pending += attr->flushed >= projected ? 1 : projected - attr->flushed;
 	}
 
+	/*
+	 * When deflating in the compression threads, account for the input
+	 * not deflated yet and the output not buffered yet.  A job in flight
+	 * may produce output even without any input, when flushing.
+	 */
+
+	if (attr->threaded) {
+		pending += attr->queued * (1.0 - attr->ratio_ema);
+		pending += attr->output_len - attr->output_off;
+		if (attr->job != NULL)
+			pending++;
+	}
+
 	return pending;
 }
 
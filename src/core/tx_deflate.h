@@ -40,6 +40,8 @@
 #include "lib/cq.h"
 
 const struct txdrv_ops *tx_deflate_get_ops(void);
+void tx_deflate_share(pmsg_t *mb);
+void tx_deflate_share_close(void);
 
 /**
  * Callbacks used by the deflating layer.
@@ -61,6 +63,7 @@ struct tx_deflate_args {
 	bool nagle;					/**< Whether to use Nagle or not */
 	bool gzip;					/**< Whether to use gzip encapsulation */
 	bool reduced;				/**< Whether to use reduced compression */
+	bool threaded;				/**< Deflate in compression threads */
 };
 
 #endif	/* _core_tx_deflate_h_ */
@@ -258,6 +258,16 @@ udp_tx_desc_flag_release(struct udp_tx_desc *txd, udp_sched_t *us)
 	eslist_append(&us->tx_released, txd);
 }
 
+/**
+ * Dispose of TX descriptor whose message was sent or dropped.
+ */
+static void
+udp_tx_desc_done(struct udp_tx_desc *txd, udp_sched_t *us)
+{
+	us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
+	udp_tx_desc_flag_release(txd, us);
+}
+
 /**
  * Release message (eslist iterator).
  *
@@ -292,8 +302,7 @@ udp_tx_desc_drop(void *data, void *udata)
 	udp_tx_desc_check(txd);
 	g_assert(1 == pmsg_refcnt(txd->mb));
 
-	us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
-	udp_tx_desc_flag_release(txd, us);
+	udp_tx_desc_done(txd, us);
 	return TRUE;
 }
 
@@ -433,7 +442,8 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
 }
 
 /**
- * Send message block to IP:port.
+ * Check whether message block still needs to be sent and select the I/O
+ * source to use for its destination.
  *
  * @param us		the UDP scheduler
  * @param mb		the message to send
@@ -441,20 +451,17 @@ udp_tx_drop(const txdrv_t *tx, const struct tx_dgram_cb *cb)
  * @param tx		the TX stack sending the message
  * @param cb		callback actions on the datagram
  *
- * @return TRUE if message was sent or dropped, FALSE if there is no more
- * bandwidth to send anything.
+ * @return the I/O source to use, NULL if the message was dropped.
  */
-static bool
-udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+static bio_source_t *
+udp_sched_mb_source(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 	const txdrv_t *tx, const struct tx_dgram_cb *cb)
 {
-	ssize_t r;
-	int len = pmsg_size(mb);
 	bio_source_t *bio = NULL;
 
 	if (0 == gnet_host_get_port(to)) {
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_ZERO_PORT);
-		return TRUE;
+		return NULL;
 	}
 
 	/*
@@ -463,7 +470,7 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 
 	if (!pmsg_can_transmit(mb)) {
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_NO_LONGER_NEEDED);
-		return TRUE;			/* Dropped */
+		return NULL;			/* Dropped */
 	}
 
 	/*
@@ -491,27 +498,28 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 		udp_sched_log(4, "%p: discarding mb=%p (%d bytes) to %s",
 			us, mb, pmsg_written_size(mb), gnet_host_to_string(to));
 		gnet_stats_inc_general(GNR_UDP_SCHED_DROP_NO_SOCKET);
-		return udp_tx_drop(tx, cb);		/* TRUE, for "sent" */
+		udp_tx_drop(tx, cb);
+		return NULL;
 	}
 
-	/*
-	 * OK, proceed if we have bandwidth.
-	 */
-
-	r = bio_sendto(bio, to, pmsg_phys_base(mb), len);
+	return bio;
+}
 
-	if (r < 0) {		/* Error, or no bandwidth */
-		if (udp_sched_write_error(us, to, mb, G_STRFUNC)) {
-			udp_sched_log(4, "%p: dropped mb=%p (%d bytes): %m",
-				us, mb, pmsg_written_size(mb));
-			gnet_stats_inc_general(GNR_UDP_SCHED_DROP_IO_ERROR);
-			return udp_tx_drop(tx, cb);	/* TRUE, for "sent" */
-		}
-		udp_sched_log(3, "%p: no bandwidth for mb=%p (%d bytes)",
-			us, mb, pmsg_written_size(mb));
-		us->used_all = TRUE;
-		return FALSE;
-	}
+/**
+ * Account for a message block that was written to the socket.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message sent
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ * @param r			amount of bytes written
+ */
+static void
+udp_sched_mb_sent(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb, ssize_t r)
+{
+	int len = pmsg_size(mb);
 
 	if (r != len) {
 		/* This should never happen with UDP/IP since datagrams are atomic */
@@ -543,6 +551,52 @@ udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 
 		inet_udp_record_sent(gnet_host_get_addr(to));
 	}
+}
+
+/**
+ * Send message block to IP:port.
+ *
+ * @param us		the UDP scheduler
+ * @param mb		the message to send
+ * @param to		the IP:port destination of the message
+ * @param tx		the TX stack sending the message
+ * @param cb		callback actions on the datagram
+ *
+ * @return TRUE if message was sent or dropped, FALSE if there is no more
+ * bandwidth to send anything.
+ */
+static bool
+udp_sched_mb_sendto(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
+	const txdrv_t *tx, const struct tx_dgram_cb *cb)
+{
+	ssize_t r;
+	bio_source_t *bio;
+
+	bio = udp_sched_mb_source(us, mb, to, tx, cb);
+
+	if (NULL == bio)
+		return TRUE;			/* Dropped */
+
+	/*
+	 * OK, proceed if we have bandwidth.
+	 */
+
+	r = bio_sendto(bio, to, pmsg_phys_base(mb), pmsg_size(mb));
+
+	if (r < 0) {		/* Error, or no bandwidth */
+		if (udp_sched_write_error(us, to, mb, G_STRFUNC)) {
+			udp_sched_log(4, "%p: dropped mb=%p (%d bytes): %m",
+				us, mb, pmsg_written_size(mb));
+			gnet_stats_inc_general(GNR_UDP_SCHED_DROP_IO_ERROR);
+			return udp_tx_drop(tx, cb);	/* TRUE, for "sent" */
+		}
+		udp_sched_log(3, "%p: no bandwidth for mb=%p (%d bytes)",
+			us, mb, pmsg_written_size(mb));
+		us->used_all = TRUE;
+		return FALSE;
+	}
+
+	udp_sched_mb_sent(us, mb, to, tx, cb, r);
 
 	return TRUE;		/* Message sent */
 }
@@ -593,8 +647,7 @@ udp_tx_desc_send(void *data, void *udata)
 		return FALSE;		/* Unsent, leave it in the queue */
 	}
 
-	us->buffered = size_saturate_sub(us->buffered, pmsg_size(txd->mb));
-	udp_tx_desc_flag_release(txd, us);
+	udp_tx_desc_done(txd, us);
 	return TRUE;
 }
 
@@ -744,6 +797,174 @@ udp_sched_send(udp_sched_t *us, pmsg_t *mb, const gnet_host_t *to,
 	return len;		/* Message queued, but tell upper layers it's sent */
 }
 
+#ifdef HAS_SENDMMSG
+/**
+ * Check whether a batch of TX descriptors already holds a given destination.
+ */
+static bool
+udp_sched_batch_has(struct udp_tx_desc **batch, uint n, const gnet_host_t *to)
+{
+	uint i;
+
+	for (i = 0; i < n; i++) {
+		if (gnet_host_equal(batch[i]->to, to))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * Send a batch of TX descriptors through the same I/O source.
+ *
+ * @param us		the UDP scheduler
+ * @param bio		the I/O source to use
+ * @param batch		the TX descriptors to send
+ * @param n			amount of descriptors in the batch
+ *
+ * @return the amount of leading descriptors that were sent or dropped, and
+ * which have been disposed of.
+ */
+static uint
+udp_sched_batch_send(udp_sched_t *us, bio_source_t *bio,
+	struct udp_tx_desc **batch, uint n)
+{
+	wrap_dgram_t dg[SOCK_UDP_BATCH_MAX];
+	uint i;
+	int r;
+
+	g_assert(n != 0 && n <= N_ITEMS(dg));
+
+	for (i = 0; i < n; i++) {
+		const struct udp_tx_desc *txd = batch[i];
+
+		dg[i].to = txd->to;
+		dg[i].data = pmsg_phys_base(txd->mb);
+		dg[i].len = pmsg_size(txd->mb);
+		dg[i].sent = 0;
+	}
+
+	r = bio_sendmmsg(bio, dg, n);
+
+	if (r < 0) {		/* Error on first datagram, or no bandwidth */
+		struct udp_tx_desc *txd = batch[0];
+
+		if (udp_sched_write_error(us, txd->to, txd->mb, G_STRFUNC)) {
+			udp_sched_log(4, "%p: dropped mb=%p (%d bytes): %m",
+				us, txd->mb, pmsg_written_size(txd->mb));
+			gnet_stats_inc_general(GNR_UDP_SCHED_DROP_IO_ERROR);
+			udp_tx_drop(txd->tx, txd->cb);
+			udp_tx_desc_done(txd, us);
+			return 1;
+		}
+		udp_sched_log(3, "%p: no bandwidth for %u-message batch", us, n);
+		us->used_all = TRUE;
+		return 0;
+	}
+
+	udp_sched_log(5, "%p: sent %d out of %u batched messages", us, r, n);
+
+	for (i = 0; i < UNSIGNED(r); i++) {
+		struct udp_tx_desc *txd = batch[i];
+
+		udp_sched_mb_sent(us, txd->mb, txd->to, txd->tx, txd->cb, dg[i].sent);
+
+		if (PMSG_P_DATA == pmsg_prio(txd->mb) && pmsg_was_sent(txd->mb))
+			hset_insert(us->seen, atom_host_get(txd->to));
+
+		udp_tx_desc_done(txd, us);
+	}
+
+	return r;
+}
+
+/**
+ * Process LIFO queue, sending out messages in batches until we have no
+ * more bandwidth.
+ *
+ * Messages are gathered in LIFO order, applying the same destination
+ * filtering as udp_tx_desc_send(), and are unlinked from the queue whilst
+ * the batch is being sent.  Messages from the batch that could not be sent
+ * are put back at their original place in the queue.
+ *
+ * @param us		the UDP scheduler
+ * @param list		the LIFO queue to process
+ * @param max		maximum amount of messages per batch
+ */
+static void
+udp_sched_process_batched(udp_sched_t *us, eslist_t *list, uint max)
+{
+	struct udp_tx_desc *batch[SOCK_UDP_BATCH_MAX];
+	struct udp_tx_desc *before[SOCK_UDP_BATCH_MAX];
+
+	max = MIN(max, N_ITEMS(batch));
+
+	while (!us->used_all) {
+		struct udp_tx_desc *txd, *prev;
+		bio_source_t *bio = NULL;
+		uint i, n = 0, sent;
+
+		for (
+			txd = eslist_head(list), prev = NULL;
+			txd != NULL && n < max;
+			prev = txd, txd = eslist_next_data(list, txd)
+		) {
+			bio_source_t *b;
+
+			udp_tx_desc_check(txd);
+
+			if (
+				PMSG_P_DATA == pmsg_prio(txd->mb) &&
+				(
+					hset_contains(us->seen, txd->to) ||
+					udp_sched_batch_has(batch, n, txd->to)
+				)
+			) {
+				udp_sched_log(2, "%p: skipping mb=%p (%d bytes) to %s",
+					us, txd->mb, pmsg_size(txd->mb),
+					gnet_host_to_string(txd->to));
+				continue;
+			}
+
+			b = udp_sched_mb_source(us, txd->mb, txd->to, txd->tx, txd->cb);
+
+			if (NULL == b) {
+				(void) eslist_remove_after(list, prev);
+				udp_tx_desc_done(txd, us);
+				txd = prev;		/* Removed item, leave cursor before it */
+				continue;
+			}
+
+			if (bio != NULL && b != bio)
+				continue;		/* Other network, will go in another batch */
+
+			bio = b;
+			(void) eslist_remove_after(list, prev);
+			before[n] = prev;
+			batch[n++] = txd;
+			txd = prev;			/* Removed item, leave cursor before it */
+		}
+
+		if (0 == n)
+			break;
+
+		sent = udp_sched_batch_send(us, bio, batch, n);
+
+		/*
+		 * Re-insert unsent messages in reverse order so that messages which
+		 * were following the same predecessor end up in their initial order.
+		 */
+
+		for (i = n; i-- > sent; /* empty */) {
+			if (NULL == before[i])
+				eslist_prepend(list, batch[i]);
+			else
+				eslist_insert_after(list, before[i], batch[i]);
+		}
+	}
+}
+#endif	/* HAS_SENDMMSG */
+
 /**
  * Process LIFO queue, sending out messages until we have no more bandwidth.
  */
@@ -752,6 +973,13 @@ udp_sched_process(udp_sched_t *us, eslist_t *list)
 {
 	udp_sched_check(us);
 
+#ifdef HAS_SENDMMSG
+	if (GNET_PROPERTY(udp_batch_size) > 1) {
+		udp_sched_process_batched(us, list, GNET_PROPERTY(udp_batch_size));
+		return;
+	}
+#endif	/* HAS_SENDMMSG */
+
 	eslist_foreach_remove(list, udp_tx_desc_send, us);
 }
 
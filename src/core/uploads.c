@@ -89,6 +89,7 @@
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/file.h"
+#include "lib/file_aio.h"
 #include "lib/file_object.h"
 #include "lib/getdate.h"
 #include "lib/getline.h"
@@ -98,6 +99,7 @@
 #include "lib/hstrfn.h"
 #include "lib/http_range.h"
 #include "lib/idtable.h"
+#include "lib/iovec.h"
 #include "lib/iso3166.h"
 #include "lib/listener.h"
 #include "lib/misc.h"			/* For english_strerror() */
@@ -426,7 +428,8 @@ use_sendfile(struct upload *u)
 {
 	upload_check(u);
 #if defined(HAS_MMAP) || defined(HAS_SENDFILE)
-	return !sendfile_failed && !socket_uses_tls(u->socket);
+	return !sendfile_failed &&
+		(!socket_uses_tls(u->socket) || socket_tls_in_kernel(u->socket));
 #else
 	return FALSE;
 #endif /* USE_MMAP || HAS_SENDFILE */
@@ -1564,6 +1567,8 @@ upload_free_resources(struct upload *u)
 	parq_upload_upload_got_freed(u);
 
 	atom_str_free_null(&u->name);
+	if (u->aio != NULL)
+		(void) file_aio_wait(&u->aio, NULL);
 	file_object_close(&u->file);
 
 #ifdef HAS_MMAP
@@ -1625,6 +1630,7 @@ upload_clone(struct upload *u)
 
 	upload_check(u);
 	g_assert(NULL == u->reply);
+	g_assert(NULL == u->aio);
 
 	entropy_harvest_time();
 
@@ -1655,6 +1661,8 @@ upload_clone(struct upload *u)
     cu->skip = 0;
     cu->end = 0;
 	cu->sent = 0;
+	cu->sent_zerocopy = 0;
+	cu->sent_copied = 0;
 	cu->hevcnt = 0;
 	cu->error_sent = 0;
 	cu->http_status = 0;
@@ -6585,6 +6593,51 @@ upload_request(struct upload *u, header_t *header)
 	}
 }
 
+/**
+ * Completion callback for asynchronous reads into the upload buffer.
+ */
+static void
+upload_aio_read(void *arg, ssize_t ret, int error)
+{
+	struct upload *u = cast_to_upload(arg);
+
+	u->aio = NULL;			/* Freed when we return */
+
+	if ((ssize_t) -1 == ret) {
+		upload_remove(u, N_("File read error: %s"), g_strerror(error));
+		return;
+	}
+	if (0 == ret) {
+		upload_remove(u, N_("File EOF?"));
+		return;
+	}
+
+	u->bsize = (size_t) ret;
+	u->bpos = 0;
+
+	/*
+	 * Resume sending, now that we have data.
+	 */
+
+	bio_add_callback(u->bio, upload_writable, u);
+}
+
+/**
+ * Refill the upload buffer asynchronously, suspending the output
+ * until data are read.
+ */
+static void
+upload_read_async(struct upload *u)
+{
+	iovec_t iov;
+
+	g_assert(NULL == u->aio);
+
+	iov = iov_get(u->buffer, u->buf_size);
+	bio_remove_callback(u->bio);
+	u->aio = file_aio_preadv(u->file, &iov, 1, u->pos, upload_aio_read, u);
+}
+
 static void
 upload_completed(struct upload *u)
 {
@@ -6706,6 +6759,12 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 
 			g_assert(u->buffer != NULL);
 			g_assert(u->buf_size > 0);
+
+			if (file_aio_is_enabled()) {
+				upload_read_async(u);
+				return;
+			}
+
 			ret = file_object_pread(u->file, u->buffer, u->buf_size, u->pos);
 			if ((ssize_t) -1 == ret) {
 				upload_remove(u, N_("File read error: %s"), g_strerror(errno));
@@ -6770,6 +6829,10 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 	u->last_update = tm_time();
 	u->sent += written;
 	u->total_sent += written;
+	if (using_sendfile)
+		u->sent_zerocopy += written;
+	else
+		u->sent_copied += written;
 	if (u->file_info) {
 		fi_increase_uploaded(u->file_info, written);
 	}
@@ -6906,6 +6969,7 @@ upload_special_writable(void *obj)
 	u->last_update = tm_time();
 	u->sent += written;
 	u->total_sent += written;
+	u->sent_copied += written;		/* Generated data, never zero-copy */
 }
 
 /**
@@ -7097,6 +7161,8 @@ upload_get_info(gnet_upload_t uh)
 	info->gnet_addr     = u->gnet_addr;
 	info->gnet_port     = u->gnet_port;
 	info->shrunk_chunk  = u->shrunk_chunk;
+	info->zerocopy      = u->sent_zerocopy;
+	info->copied        = u->sent_copied;
 
     return info;
 }
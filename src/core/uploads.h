@@ -96,6 +96,7 @@ struct upload {
 	int bpos;
 	int bsize;
 	int buf_size;
+	struct file_aio *aio;			/**< Pending read into buffer, if any */
 
 	uint file_index;
 	uint reqnum;				/**< Request number, incremented when serving */
@@ -121,6 +122,8 @@ struct upload {
 	filesize_t pos;				/**< Read position in file we're sending */
 	filesize_t sent;			/**< Bytes sent in this request */
 	filesize_t total_sent;		/**< Total amount of bytes sent */
+	filesize_t sent_zerocopy;	/**< Bytes of request sent via sendfile() */
+	filesize_t sent_copied;		/**< Bytes of request copied to the kernel */
 	filesize_t total_requested;	/**< Total amount of bytes requested */
 	filesize_t downloaded;		/**< What they claim as downloaded so far */
 
@@ -27,7 +27,7 @@
  *
  * Asynchronous hash computation.
  *
- * Computation is done in a separate thread, but this is invisible to the
+ * Computation is done in separate threads, but this is invisible to the
  * calling thread as callbacks happen in the calling thread context.
  *
  * Each verification thread is given a thread event queue (TEQ), and the
@@ -35,17 +35,19 @@
  * dispatch callbacks.
  *
  * As work is concurrently inserted into the verification lists, a notification
- * event is sent to the computing thread to wake it up.
+ * event is sent to the computing threads to wake them up.
  *
- * On systems with 2 CPUs only, all the verifications are handled by one single
- * thread, so we continue to use the legacy code, relying on the background
- * task scheduler to properly arbitrate processing between the various hash
- * verifications.
+ * All the verifications are handled by a pool of threads, whose size is
+ * configured by the "verify_threads" property and defaults to the amount of
+ * CPUs on the machine.  Each verifier (the entity created by verify_new()
+ * for a given hash) has one worker context per pool thread, and all the
+ * workers of a verifier pull files from the same shared queue, so that
+ * several files can be hashed concurrently.
  *
- * As soon as there are 3 CPUs or more, all the verifications are handled in
- * separate threads, but there are distinct background task schedulers created,
- * so each thread can use almost all its processing ticks to actually compute
- * the hash value.
+ * Each pool thread runs its own background task scheduler, which arbitrates
+ * processing between the workers of the various verifiers it hosts: hence
+ * a high-priority request (e.g. the verification of a completed download)
+ * is never stuck behind a long library rescan in the thread.
  *
  * @author Raphael Manfredi
  * @date 2002-2003, 2013
@@ -54,6 +56,7 @@
 #include "common.h"
 
 #include "verify.h"
+#include "gnet_stats.h"
 
 #include "if/gnet_property.h"
 #include "if/gnet_property_priv.h"
@@ -72,6 +75,8 @@
 #include "lib/halloc.h"
 #include "lib/hashing.h"
 #include "lib/hashlist.h"
+#include "lib/once.h"
+#include "lib/spinlock.h"
 #include "lib/str.h"
 #include "lib/stringify.h"		/* For short_time_ascii() */
 #include "lib/teq.h"
@@ -83,24 +88,62 @@
 
 #define HASH_BUF_SIZE		(128 * 1024)	/**< Size of the reading buffer */
 
-#define HASH_THREAD_MAX			2			/**< At most 2 hashing threads */
 #define VERIFY_DEFERRED			10			/**< ms: deferred free timeout */
 #define VERIFY_PROGRESS_NOTIFY	1			/**< s: progress notification */
 
-#define VERIFY_INVALID_LOCAL_ID -1U
+/**
+ * A thread from the verification pool.
+ */
+struct verify_thread {
+	const char *name;			/**< Thread name */
+	bgsched_t *sched;			/**< Task scheduler for this thread */
+	unsigned stid;				/**< Thread small ID */
+	bool exit;					/**< Set when thread must terminate */
+	spinlock_t lock;			/**< Thread-safe access to statistics */
+	uint64 files;				/**< Files fully hashed */
+	uint64 bytes;				/**< Bytes read and hashed */
+	uint64 busy_us;				/**< Time spent processing, in usecs */
+};
+
+static struct verify_thread verify_pool[VERIFY_THREAD_MAX];
+static uint verify_pool_count;		/**< Amount of threads in pool */
+static int verify_live;				/**< Amount of live verifiers */
+
+enum verifier_magic { VERIFIER_MAGIC = 0x6e1f09b5U };
+
+/**
+ * A verifier, handling all the verifications for a given hash.
+ */
+struct verifier {
+	enum verifier_magic magic;	/**< Magic number. */
+	hash_list_t *files_to_hash;	/**< Work queue, shared by all workers */
+	const struct verify_hash hash;	/**< Hash-specific processing callbacks */
+	struct verify **workers;	/**< One worker per pool thread */
+	uint workers_count;			/**< Amount of workers */
+	uint8 shutdowned;			/**< Flag indicating verifier was shutdown */
+};
+
+static inline void
+verifier_check(const struct verifier * const v)
+{
+	g_assert(v != NULL);
+	g_assert(VERIFIER_MAGIC == v->magic);
+}
 
 enum verify_magic { VERIFY_MAGIC = 0x2dc84379U };
 
 /**
  * Verification task context.
+ *
+ * There is one such context per verifier and per pool thread, and this is
+ * the context given to the user callbacks.
  */
 struct verify {
 	enum verify_magic magic;	/**< Magic number. */
-	hash_list_t *files_to_hash;	/**< Work queue */
-	const struct verify_hash hash;	/**< Hash-specific processing callbacks */
+	struct verifier *owner;		/**< The verifier we're working for */
+	struct verify_thread *vt;	/**< The pool thread running the worker */
 	struct bgtask *task;		/**< Background task handling the processing */
-	bgsched_t *sched;			/**< Task scheduler for this thread */
-	unsigned verify_stid;		/**< Verification thread ID */
+	void *state;				/**< Hash-specific computation state */
 
 	file_object_t *file;		/**< The file object to access the file. */
 	filesize_t offset;			/**< Current offset into the file. */
@@ -110,9 +153,11 @@ struct verify {
 	time_t last_progress;		/**< Last time we informed about progress */
 	char *buffer;				/**< Read buffer */
 	size_t buffer_size;			/**< Size of buffer in bytes. */
+	uint mask;					/**< Digest selection mask for file */
+	uint digests;				/**< Amount of digests being computed */
 
 	enum verify_status status;	/**< Used for callback multiplexing. */
-	uint8 shutdowned;			/**< Flag indicating context was shutdown */
+	bool released;				/**< Released by its thread, can be freed */
 
 	/* Fields copied from currently processed verify_file entry */
 	verify_callback	callback;	/**< User-specified callback function. */
@@ -127,27 +172,28 @@ verify_check(const struct verify * const ctx)
 }
 
 static inline void
-verify_hash_init(const struct verify * const ctx)
+verify_hash_init(struct verify * const ctx)
 {
-	ctx->hash.init(ctx->end - ctx->start);
+	ctx->digests = ctx->owner->hash.init(ctx->state,
+						ctx->end - ctx->start, ctx->mask);
 }
 
 static inline int
 verify_hash_update(const struct verify * const ctx, const void *data, size_t n)
 {
-	return ctx->hash.update(data, n);
+	return ctx->owner->hash.update(ctx->state, data, n);
 }
 
 static inline int
 verify_hash_final(const struct verify * const ctx)
 {
-	return ctx->hash.final();
+	return ctx->owner->hash.final(ctx->state);
 }
 
 static inline const char *
 verify_hash_name(const struct verify * const ctx)
 {
-	return ctx->hash.name();
+	return ctx->owner->hash.name();
 }
 
 enum verify_file_magic { VERIFY_FILE_MAGIC = 0x063ac7adU };
@@ -157,6 +203,7 @@ struct verify_file {
 	const char *pathname;			/**< Absolute path of the file */
 	filesize_t offset;				/**< Offset to start at */
 	filesize_t amount;				/**< Amount of bytes to hash */
+	uint mask;						/**< Digest selection mask, 0 = all */
 	verify_callback	callback;		/**< User-specified callback function */
 	void *user_data;				/**< Callback argument */
 };
@@ -170,7 +217,7 @@ verify_file_check(const struct verify_file * const item)
 
 static struct verify_file *
 verify_file_new(const char *pathname, filesize_t offset, filesize_t amount,
-	verify_callback callback, void *user_data)
+	uint mask, verify_callback callback, void *user_data)
 {
 	struct verify_file *item;
 
@@ -182,6 +229,7 @@ verify_file_new(const char *pathname, filesize_t offset, filesize_t amount,
 	item->pathname = atom_str_get(pathname);
 	item->offset = offset;
 	item->amount = amount;
+	item->mask = mask;
 	item->callback = callback;
 	item->user_data = user_data;
 	return item;
@@ -304,6 +352,21 @@ verify_status(const struct verify *ctx)
 	return ctx->status;
 }
 
+/**
+ * The callback function may call this to obtain the digest selection mask
+ * of the current file, as given to verify_enqueue_mask().
+ *
+ * @return the selection mask, 0 meaning all the digests the hash can compute.
+ */
+uint
+verify_mask(const struct verify *ctx)
+{
+	verify_check(ctx);
+	g_assert(VERIFY_INVALID != ctx->status);
+
+	return ctx->mask;
+}
+
 /**
  * The callback function may call this to obtain the amount of bytes
  * that have been hashed of the current file so far.
@@ -366,26 +429,15 @@ verify_item_equal(const void *p, const void *q)
 }
 
 /**
- * Variables controlling asynchronous "cancellation" of verification threads.
- *
- * The verify_exit[] array is index by a small number (the "local thread ID")
- * and tells the thread whether it has received a TSIG_TERM signal.
- *
- * The verify_threads[] array contains the ID of threads, and a linear lookup
- * is used to find the proper "local thread ID", the index at which we find
- * a matching thread ID.
- */
-static bool verify_exit[HASH_THREAD_MAX];
-static unsigned verify_threads[HASH_THREAD_MAX];
-static int verify_thread_count;
-
-/**
- * Structure passed to verify_thread_has_work().
+ * @return the hash-specific computation state of the verification context,
+ * for use by the hash-specific accessors to the computed digests.
  */
-struct verify_work {
-	bgsched_t *bs;		/**< Background task scheduler */
-	int id;				/**< Local thread ID */
-};
+void *
+verify_state(const struct verify *ctx)
+{
+	verify_check(ctx);
+	return ctx->state;
+}
 
 /**
  * Is there work pending in the scheduler, or is thread terminated?
@@ -393,33 +445,14 @@ struct verify_work {
 static bool
 verify_thread_has_work(void *arg)
 {
-	struct verify_work *w = arg;
+	struct verify_thread *vt = arg;
 
 	/*
-	 * When the thread should exit, as indicated by verify_exit[] being set,
+	 * When the thread should exit, as indicated by its exit flag being set,
 	 * we return TRUE to make sure we exit from the teq_wait() call.
 	 */
 
-	return verify_exit[w->id] || 0 != bg_sched_runcount(w->bs);
-}
-
-/**
- * Compute local thread ID of verification thread.
- */
-static unsigned
-verify_thread_local_id(unsigned stid, bool panic)
-{
-	unsigned i;
-
-	for (i = 0; i < N_ITEMS(verify_threads); i++) {
-		if (verify_threads[i] == stid)
-			return i;
-	}
-
-	if (panic)
-		s_error("%s(): cannot find %s", G_STRFUNC, thread_id_name(stid));
-
-	return VERIFY_INVALID_LOCAL_ID;		/* Invalid ID, meaning not found */
+	return vt->exit || 0 != bg_sched_runcount(vt->sched);
 }
 
 /**
@@ -428,21 +461,29 @@ verify_thread_local_id(unsigned stid, bool panic)
 static void
 verify_thread_terminate(int sig)
 {
-	unsigned i;
+	unsigned stid = thread_small_id();
+	uint i;
 
 	g_assert(TSIG_TERM == sig);
 
-	i = verify_thread_local_id(thread_small_id(), TRUE);
-	verify_exit[i] = TRUE;
+	for (i = 0; i < verify_pool_count; i++) {
+		struct verify_thread *vt = &verify_pool[i];
+
+		if (vt->stid == stid) {
+			vt->exit = TRUE;
+			return;
+		}
+	}
+
+	s_error("%s(): cannot find %s", G_STRFUNC, thread_id_name(stid));
 }
 
 /**
  * Arguments passed to the verification thread.
  */
 struct verify_thread_arg {
-	const char *name;			/* Thread name */
 	barrier_t *b;				/* Setup barrier */
-	bgsched_t *sched;			/* Background task scheduler to run */
+	struct verify_thread *vt;	/* Pool thread descriptor */
 };
 
 /**
@@ -452,83 +493,84 @@ static void *
 verify_thread_main(void *p)
 {
 	struct verify_thread_arg *args = p;
-	struct verify_work winfo;
-	int i;
+	struct verify_thread *vt = args->vt;
 
-	thread_set_name(args->name);
+	thread_set_name(vt->name);
 	teq_create();				/* Queue to receive incoming work */
-	barrier_wait(args->b);		/* Thread has initialized */
-	barrier_free_null(&args->b);
-	winfo.bs = args->sched;
-	WFREE_TYPE_NULL(args);
-
-	if (GNET_PROPERTY(verify_debug))
-		g_debug("verification %s started", thread_name());
 
 	/*
 	 * Prepare for termination when receiveing a TSIG_TERM.
 	 */
 
-	winfo.id = i = atomic_int_inc(&verify_thread_count);
+	vt->stid = thread_small_id();
+	thread_signal(TSIG_TERM, verify_thread_terminate);
 
-	g_assert(i < HASH_THREAD_MAX);		/* Not creating too many threads */
+	g_assert(vt->stid != 0);	/* Not the main thread */
 
-	verify_threads[i] = thread_small_id();
-	thread_signal(TSIG_TERM, verify_thread_terminate);
+	barrier_wait(args->b);		/* Thread has initialized */
+	barrier_free_null(&args->b);
+	WFREE_TYPE_NULL(args);
 
-	g_assert(verify_threads[i] != 0);	/* Not the main thread */
+	if (GNET_PROPERTY(verify_debug))
+		g_debug("verification %s started", thread_name());
 
 	/*
 	 * Process incoming work, until thread is terminated.
 	 */
 
-	while (!verify_exit[i]) {
+	while (!vt->exit) {
+		tm_t start, end;
+
 		if (GNET_PROPERTY(verify_debug))
 			g_debug("verification %s sleeping", thread_name());
 
-		teq_wait(verify_thread_has_work, &winfo);
+		teq_wait(verify_thread_has_work, vt);
 
 		if (GNET_PROPERTY(verify_debug))
 			g_debug("verification %s awoken", thread_name());
 
-		while (0 != bg_sched_run(winfo.bs))
+		tm_now_exact(&start);
+
+		while (0 != bg_sched_run(vt->sched))
 			thread_check_suspended();
+
+		tm_now_exact(&end);
+
+		spinlock(&vt->lock);
+		vt->busy_us += tm_elapsed_us(&end, &start);
+		spinunlock(&vt->lock);
 	}
 
 	g_debug("verification %s exiting", thread_name());
 
-	bg_sched_destroy_null(&winfo.bs);
-	verify_threads[i] = 0;			/* Signals: can destroy verify context */
+	bg_sched_destroy_null(&vt->sched);
 
 	return NULL;
 }
 
 /**
- * Create a new verification thread with given name.
+ * Create a new verification thread in the pool.
  *
  * This routine does not return until the verification thread has been
  * correctly initialized, so that the caller can immediately start to
  * enqueue work to the thread.
  *
- * @param v			the verification context for which we create a thread
- * @param name		the background task scheduler to use in that thread
- * @param name		the created thread name
- *
- * @return thread ID, -1 on error.
+ * @param vt		the pool thread descriptor, with its name filled
  */
-static int
-verify_thread_create(struct verify *v, bgsched_t *bs, const char *name)
+static void
+verify_thread_create(struct verify_thread *vt)
 {
 	barrier_t *b;
 	struct verify_thread_arg *args;
-	int r;
 
 	b = barrier_new(2);
 
+	vt->sched = bg_sched_create(vt->name, 1000000);		/* 1 sec */
+	spinlock_init(&vt->lock);
+
 	WALLOC(args);
-	args->name = name;
 	args->b = barrier_refcnt_inc(b);
-	args->sched = bs;
+	args->vt = vt;
 
 	/*
 	 * The verification thread is created as a detached thread because we
@@ -537,160 +579,327 @@ verify_thread_create(struct verify *v, bgsched_t *bs, const char *name)
 	 * It is created as non-cancelable: to end it, we send it a TSIG_TERM.
 	 */
 
-	r = thread_create(verify_thread_main, args,
+	(void) thread_create(verify_thread_main, args,
 			THREAD_F_DETACH | THREAD_F_NO_CANCEL |
 				THREAD_F_NO_POOL | THREAD_F_PANIC,
 			THREAD_STACK_MIN);
 
-	v->verify_stid = r;
-	v->sched = bs;
-
 	barrier_wait(b);		/* Wait for thread to initialize */
 	barrier_free_null(&b);
-
-	return r;
 }
 
 /**
- * Create a new verification thread if necessary.
+ * Create the pool of verification threads.
  */
-static void
-verify_thread_create_if_needed(struct verify *v)
+static void G_COLD
+verify_pool_create(void)
 {
-	static unsigned verify_id;
-	static bgsched_t *verify_bs;
-	long cpus = getcpucount();
+	uint i, n = GNET_PROPERTY(verify_threads);
 
 	g_assert(thread_is_main());		/* Always called from main thread */
 
+	if (0 == n)
+		n = getcpucount();
+
+	n = MAX(n, 1);
+	n = MIN(n, VERIFY_THREAD_MAX);
+
+	for (i = 0; i < n; i++) {
+		struct verify_thread *vt = &verify_pool[i];
+
+		vt->name = constant_str(str_smsg("verify #%u", i + 1));
+		verify_thread_create(vt);
+	}
+
+	verify_pool_count = n;
+
+	if (GNET_PROPERTY(verify_debug))
+		g_debug("created %u verification thread%s", PLURAL(n));
+}
+
+/**
+ * Terminate all the threads of the verification pool.
+ */
+static void G_COLD
+verify_pool_terminate(void)
+{
+	uint i;
+
+	g_assert(thread_is_main());
+
+	for (i = 0; i < verify_pool_count; i++) {
+		thread_kill(verify_pool[i].stid, TSIG_TERM);
+	}
+}
+
+/**
+ * Create a new worker context for the verifier, attached to a pool thread.
+ */
+static struct verify *
+verify_worker_new(struct verifier *v, struct verify_thread *vt)
+{
+	struct verify *ctx;
+
+	WALLOC0(ctx);
+	ctx->magic = VERIFY_MAGIC;
+	ctx->owner = v;
+	ctx->vt = vt;
+	ctx->buffer_size = HASH_BUF_SIZE;
+
 	/*
-	 * When there are more than 2 CPUs, we are on a multi-core system and we
-	 * create one thread per verification.  If they have only 2 CPUs, then we
-	 * just create a single thread to handle all the verifications.
+	 * The read buffer and hash state are only allocated when the worker
+	 * processes its first file, in verify_next_file().
 	 */
 
-	if (cpus <= 2) {
-		if G_UNLIKELY(NULL == verify_bs) {
-			static const char name[] = "verify";
+	return ctx;
+}
 
-			verify_bs = bg_sched_create(name, 500000);		/* 500 ms */
-			verify_id = verify_thread_create(v, verify_bs, name);
-		} else {
-			v->sched = verify_bs;
-			v->verify_stid = verify_id;
-		}
-	} else {
-		const char *tname = str_smsg("verify %s", verify_hash_name(v));
-		const char *name = constant_str(tname);
+/**
+ * Free worker context.
+ */
+static void
+verify_worker_free(struct verify *ctx)
+{
+	verify_check(ctx);
+	g_assert(NULL == ctx->task);
+	g_assert(NULL == ctx->file);
 
-		bgsched_t *bs = bg_sched_create(name, 1000000);		/* 1 sec */
-		(void) verify_thread_create(v, bs, name);
-	}
+	if (ctx->state != NULL)
+		ctx->owner->hash.free_state(ctx->state);
+
+	HFREE_NULL(ctx->buffer);
+	ctx->magic = 0;
+	WFREE(ctx);
 }
 
 /**
- * Create a new verification context.
+ * Create a new verifier.
  *
  * @param hash		Hash-specific callbacks for this hash verification
  *
- * @return verification context to which work can be requested via
- * verify_enqueue()
+ * @return verifier to which work can be requested via verify_enqueue()
  */
-struct verify *
+struct verifier *
 verify_new(const struct verify_hash *hash)
 {
-	struct verify *ctx;
+	static once_flag_t pool_created;
+	struct verifier *v;
+	uint i;
 
 	g_assert(hash);
+	g_assert(thread_is_main());
 
-	WALLOC0(ctx);
-	ctx->magic = VERIFY_MAGIC;
-	ctx->buffer_size = HASH_BUF_SIZE;
-	ctx->buffer = halloc(ctx->buffer_size);
-	STATIC_ASSERT(sizeof ctx->hash == sizeof(struct verify_hash));
-	*(struct verify_hash *) &ctx->hash = *hash;		/* Assignment to "const" */
-	ctx->files_to_hash = hash_list_new(verify_item_hash, verify_item_equal);
-	hash_list_thread_safe(ctx->files_to_hash);
+	/*
+	 * We cannot use once_flag_run() because creating the pool threads will
+	 * cause the current thread to sleep on the setup barriers.
+	 */
 
-	verify_thread_create_if_needed(ctx);
+	once_flag_runwait(&pool_created, verify_pool_create);
 
-	return ctx;
+	WALLOC0(v);
+	v->magic = VERIFIER_MAGIC;
+	STATIC_ASSERT(sizeof v->hash == sizeof(struct verify_hash));
+	*(struct verify_hash *) &v->hash = *hash;		/* Assignment to "const" */
+	v->files_to_hash = hash_list_new(verify_item_hash, verify_item_equal);
+	hash_list_thread_safe(v->files_to_hash);
+
+	v->workers_count = verify_pool_count;
+	HALLOC_ARRAY(v->workers, v->workers_count);
+
+	for (i = 0; i < v->workers_count; i++) {
+		v->workers[i] = verify_worker_new(v, &verify_pool[i]);
+	}
+
+	atomic_int_inc(&verify_live);
+
+	return v;
+}
+
+/**
+ * Drop all the queued items of the verifier, notifying their owners.
+ */
+static void
+verify_queue_flush(struct verifier *v)
+{
+	struct verify_file *item;
+	struct verify *ctx;
+
+	verifier_check(v);
+	g_assert(thread_is_main());
+
+	/*
+	 * We use a transient context to call verify_shutdown() since the
+	 * workers can still be busy in their threads.
+	 */
+
+	ctx = verify_worker_new(v, NULL);
+
+	while (NULL != (item = hash_list_shift(v->files_to_hash))) {
+		/* Setup minimal context to call verify_shutdown() */
+		ctx->user_data = item->user_data;
+		ctx->callback = item->callback;
+		ctx->mask = item->mask;
+
+		verify_shutdown(ctx);
+		verify_file_free(&item);
+	}
+
+	verify_worker_free(ctx);
 }
 
 /**
- * Callout queue callback to check whether we can free the verify context.
+ * Callout queue callback to check whether we can free the verifier.
  */
 static void
 verify_deferred_free(cqueue_t *cq, void *data)
 {
-	struct verify *ctx = data;
-	unsigned i;
+	struct verifier *v = data;
+	uint i;
 
-	verify_check(ctx);
+	verifier_check(v);
 
 	/*
-	 * We do not free the verification context until the thread that uses it
-	 * has not marked it was about to exit by clearing its corresponding
-	 * entry in verify_threads[].
+	 * We do not free the verifier until all its workers have been released
+	 * by their thread and their background task has terminated.
 	 */
 
-	i = verify_thread_local_id(ctx->verify_stid, FALSE);
+	atomic_mb();
 
-	if (i != VERIFY_INVALID_LOCAL_ID) {
-		/*
-		 * Thread has not terminated yet, could have pending RPCs...
-		 */
+	for (i = 0; i < v->workers_count; i++) {
+		struct verify *ctx = v->workers[i];
 
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("verification %s for %s not terminated yet",
-				thread_id_name(ctx->verify_stid), verify_hash_name(ctx));
-		}
+		if (!ctx->released || ctx->task != NULL) {
+			/*
+			 * Worker has not terminated yet, could have pending RPCs...
+			 */
 
-		cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, ctx);
-	} else {
-		if (GNET_PROPERTY(verify_debug) > 1) {
-			g_debug("freeing %s verification context", verify_hash_name(ctx));
+			if (GNET_PROPERTY(verify_debug) > 1) {
+				g_debug("%s verification in %s not terminated yet",
+					verify_hash_name(ctx), ctx->vt->name);
+			}
+
+			cq_insert(cq, VERIFY_DEFERRED, verify_deferred_free, v);
+			return;
 		}
+	}
 
-		hash_list_free(&ctx->files_to_hash);
-		ctx->magic = 0;
-		WFREE(ctx);
+	if (GNET_PROPERTY(verify_debug) > 1) {
+		g_debug("freeing %s verifier", v->hash.name());
+	}
+
+	for (i = 0; i < v->workers_count; i++) {
+		verify_worker_free(v->workers[i]);
 	}
+
+	HFREE_NULL(v->workers);
+	hash_list_free(&v->files_to_hash);
+	v->magic = 0;
+	WFREE(v);
+
+	/*
+	 * When the last verifier is gone, the pool threads can terminate.
+	 */
+
+	if (atomic_int_dec_is_zero(&verify_live))
+		verify_pool_terminate();
 }
 
 /**
- * Free verification context and nullify its pointer.
+ * Release worker, cancelling its background task if any.
  *
- * The actual physical disposal of the verification context is deferred until
- * the thread responsible for handling the work has terminated.
+ * This is called in the thread that is running the worker, and is the last
+ * event posted to that thread concerning the worker.
+ */
+static void
+verify_worker_release(void *arg)
+{
+	struct verify *ctx = arg;
+
+	verify_check(ctx);
+	g_assert(ctx->owner->shutdowned);
+
+	if (ctx->task != NULL)
+		bg_task_cancel(ctx->task);
+
+	atomic_mb();
+	ctx->released = TRUE;
+}
+
+/**
+ * Free verifier and nullify its pointer.
+ *
+ * The actual physical disposal of the verifier is deferred until all the
+ * workers have terminated their processing.
  */
 void
-verify_free(struct verify **ptr)
+verify_free(struct verifier **ptr)
 {
-	struct verify *ctx = *ptr;
+	struct verifier *v = *ptr;
 
-	if (ctx != NULL) {
-		verify_check(ctx);
-		g_assert(!ctx->shutdowned);
+	if (v != NULL) {
+		uint i;
 
-		if (ctx->task != NULL) {
-			bg_task_cancel(ctx->task);
-			ctx->task = NULL;
-		}
+		verifier_check(v);
+		g_assert(!v->shutdowned);
+		g_assert(thread_is_main());
 
-		ctx->shutdowned = TRUE;
-		thread_kill(ctx->verify_stid, TSIG_TERM);
+		v->shutdowned = TRUE;
 		*ptr = NULL;
 
 		/*
-		 * Defer freeing of the context until the thread is dead
+		 * Flush the queue, then let each worker cancel its current task
+		 * from the thread that runs it.
+		 *
+		 * Since events are processed in the order they are posted, no
+		 * event referring to the worker will be processed after the
+		 * release one.
+		 */
+
+		verify_queue_flush(v);
+
+		for (i = 0; i < v->workers_count; i++) {
+			struct verify *ctx = v->workers[i];
+
+			teq_post(ctx->vt->stid, verify_worker_release, ctx);
+		}
+
+		/*
+		 * Defer freeing of the verifier until the workers are done.
 		 *
-		 * We leave the ctx->files_to_hash list around as well because
+		 * We leave the v->files_to_hash list around as well because
 		 * it could still be accessed by other threads.
 		 */
 
-		cq_main_insert(VERIFY_DEFERRED, verify_deferred_free, ctx);
+		cq_main_insert(VERIFY_DEFERRED, verify_deferred_free, v);
+	}
+}
+
+/**
+ * Fill the supplied vector with the statistics of the verification threads.
+ *
+ * @param vec		the vector to fill
+ * @param vcnt		amount of entries in the vector
+ *
+ * @return the amount of entries filled.
+ */
+size_t
+verify_thread_stats(struct verify_thread_stats *vec, size_t vcnt)
+{
+	size_t i, n = MIN(vcnt, verify_pool_count);
+
+	for (i = 0; i < n; i++) {
+		struct verify_thread *vt = &verify_pool[i];
+		struct verify_thread_stats *vs = &vec[i];
+
+		vs->name = vt->name;
+		spinlock(&vt->lock);
+		vs->files = vt->files;
+		vs->bytes = vt->bytes;
+		vs->busy_us = vt->busy_us;
+		spinunlock(&vt->lock);
 	}
+
+	return n;
 }
 
 static void
@@ -724,7 +933,7 @@ verify_next_file(struct verify *ctx)
 	verify_check(ctx);
 	g_assert(NULL == ctx->file);
 
-	item = hash_list_shift(ctx->files_to_hash);
+	item = hash_list_shift(ctx->owner->files_to_hash);
 	if (item != NULL) {
 		verify_file_check(item);
 
@@ -733,6 +942,7 @@ verify_next_file(struct verify *ctx)
 		ctx->start = item->offset;
 		ctx->end = item->offset + item->amount;
 		ctx->offset = ctx->start;
+		ctx->mask = item->mask;
 
 		if (verify_start(ctx)) {
 			ctx->file = file_object_open(item->pathname, O_RDONLY);
@@ -759,6 +969,10 @@ verify_next_file(struct verify *ctx)
 			g_debug("verifying %s digest for %s",
 				verify_hash_name(ctx), file_object_pathname(ctx->file));
 		}
+		if G_UNLIKELY(NULL == ctx->buffer)
+			ctx->buffer = halloc(ctx->buffer_size);
+		if G_UNLIKELY(NULL == ctx->state)
+			ctx->state = ctx->owner->hash.new_state();
 		verify_hash_init(ctx);
 		file_object_fadvise_sequential(ctx->file);
 		ctx->last_progress = ctx->started = tm_time_exact();
@@ -787,6 +1001,9 @@ verify_final(struct verify *ctx)
 			file_object_pathname(ctx->file));
 		verify_failure(ctx);
 	} else {
+		spinlock(&ctx->vt->lock);
+		ctx->vt->files++;
+		spinunlock(&ctx->vt->lock);
 		verify_done(ctx);
 	}
 	file_object_close(&ctx->file);
@@ -823,6 +1040,13 @@ verify_update(struct verify *ctx)
 
 		ctx->offset += (size_t) r;
 
+		gnet_stats_count_general(GNR_VERIFY_BYTES_READ, r);
+		gnet_stats_count_general(GNR_VERIFY_BYTES_HASHED, r * ctx->digests);
+
+		spinlock(&ctx->vt->lock);
+		ctx->vt->bytes += r;
+		spinunlock(&ctx->vt->lock);
+
 		if (verify_hash_update(ctx, ctx->buffer, r)) {
 			g_warning("%s computation error for \"%s\"",
 				verify_hash_name(ctx), file_object_pathname(ctx->file));
@@ -854,30 +1078,6 @@ error:
 	file_object_close(&ctx->file);
 }
 
-/**
- * Drop all the queued items for the verification thread.
- *
- * This is dispatched to the main thread.
- */
-static void
-verify_queue_flush(void *data)
-{
-	struct verify *ctx = data;
-	struct verify_file *item;
-
-	verify_check(ctx);
-	g_assert(thread_is_main());
-
-	while (NULL != (item = hash_list_shift(ctx->files_to_hash))) {
-		/* Setup minimal context to call verify_shutdown() */
-		ctx->user_data = item->user_data;
-		ctx->callback = item->callback;
-
-		verify_shutdown(ctx);
-		verify_file_free(&item);
-	}
-}
-
 /**
  * Signal handler for task termination.
  *
@@ -908,15 +1108,8 @@ verify_bg_sighandler(struct bgtask *bt, void *data, bgsig_t sig)
 	HFREE_NULL(ctx->buffer);
 
 	/*
-	 * Flush the queue.
-	 *
-	 * To speed things up, we'll redirect this work to the main thread: since
-	 * we're shutdowning, there's no real processing done in the main thread,
-	 * and it will be more efficient if we're currently in the library thread
-	 * since we will avoid all these TEQ RPCs between the two threads.
+	 * The queue was already flushed by verify_free(), in the main thread.
 	 */
-
-	teq_post(THREAD_MAIN_ID, verify_queue_flush, ctx);
 }
 
 /**
@@ -943,10 +1136,13 @@ verify_step_compute(struct bgtask *bt, void *data, int ticks)
 	int i = ticks;
 	int used = 0;		/* Amount used for CPU-intensive tasks */
 	int light = 0;		/* Amount used for system-intensive tasks */
+	hash_list_t *queue;
 
 	verify_check(ctx);
 	(void) bt;
 
+	queue = ctx->owner->files_to_hash;
+
 	while (i-- > 0) {
 		bg_task_cancel_test(bt);
 		if (NULL == ctx->file) {
@@ -958,7 +1154,7 @@ verify_step_compute(struct bgtask *bt, void *data, int ticks)
 		} else {
 			light++;	/* Did not open file, still processed something */
 		}
-		if (NULL == ctx->file && 0 == hash_list_length(ctx->files_to_hash))
+		if (NULL == ctx->file && 0 == hash_list_length(queue))
 			break;
 	}
 
@@ -974,7 +1170,7 @@ verify_step_compute(struct bgtask *bt, void *data, int ticks)
 	if (used < ticks)
 		bg_task_ticks_used(bt, used);
 
-	if (ctx->file || hash_list_length(ctx->files_to_hash) > 0) {
+	if (ctx->file || hash_list_length(queue) > 0) {
 		return BGR_MORE;
 	} else {
 		return BGR_DONE;
@@ -1017,7 +1213,7 @@ verify_create_task(struct verify *ctx)
 {
 	verify_check(ctx);
 
-	if (NULL == ctx->task) {
+	if (NULL == ctx->task && !ctx->owner->shutdowned) {
 		static const bgstep_cb_t step[] = {
 			verify_step_setup,
 			verify_step_compute
@@ -1028,7 +1224,7 @@ verify_create_task(struct verify *ctx)
 				verify_hash_name(ctx));
 		}
 
-		ctx->task = bg_task_create(ctx->sched, verify_hash_name(ctx),
+		ctx->task = bg_task_create(ctx->vt->sched, verify_hash_name(ctx),
 							step, N_ITEMS(step),
 			  				ctx, verify_context_free,
 							verify_bg_done, NULL);
@@ -1037,7 +1233,7 @@ verify_create_task(struct verify *ctx)
 
 /**
  * Notified that work was enqueued and should be processed by the
- * verification thread attached to the context.
+ * verification thread attached to the worker context.
  *
  * This is called in the thread that is running the verification task.
  */
@@ -1048,17 +1244,21 @@ verify_enqueued(void *arg)
 }
 
 /**
- * Enqueue file to be verified.
+ * Enqueue file to be verified, specifying which digests are wanted.
  *
  * The supplied callback will be invoked in the context of the calling thread,
  * not from the verification thread, so that multi-threading be transparent
  * for the calling thread.
  *
- * @param ctx			the verification context
+ * If an equivalent item is already enqueued, its digest selection mask is
+ * extended to also cover the digests requested here.
+ *
+ * @param v				the verifier
  * @param high_priority	whether item should be treated quickly
  * @param pathname		file to be verified
  * @param offset		starting offset where verification should start
  * @param amount		amount of data to verify in the file, starting at offset
+ * @param mask			hash-specific digest selection mask, 0 meaning all
  * @param callback		callback routine to invoke in the calling thread
  * @param user_data		context to pass to the calling routine
  *
@@ -1070,63 +1270,102 @@ verify_enqueued(void *arg)
  * already enqueued.
  */
 bool
-verify_enqueue(struct verify *ctx, int high_priority,
-	const char *pathname, filesize_t offset, filesize_t amount,
+verify_enqueue_mask(struct verifier *v, int high_priority,
+	const char *pathname, filesize_t offset, filesize_t amount, uint mask,
 	verify_callback callback, void *user_data)
 {
 	struct verify_file *item;
+	const void *orig;
 	int inserted;
 
-	verify_check(ctx);
+	verifier_check(v);
 	g_return_val_if_fail(pathname, FALSE);
 	g_return_val_if_fail(callback, FALSE);
-	g_return_val_if_fail(!ctx->shutdowned, FALSE);
+	g_return_val_if_fail(!v->shutdowned, FALSE);
 
 	entropy_harvest_many(
-		PTRLEN(ctx), VARLEN(high_priority),
+		PTRLEN(v), VARLEN(high_priority),
 		pathname, strsize(pathname),
 		VARLEN(amount), NULL);
 
-	item = verify_file_new(pathname, offset, amount, callback, user_data);
+	item = verify_file_new(pathname, offset, amount, mask, callback, user_data);
 
-	hash_list_lock(ctx->files_to_hash);
+	hash_list_lock(v->files_to_hash);
+
+	if (hash_list_find(v->files_to_hash, item, &orig)) {
+		struct verify_file *queued = deconstify_pointer(orig);
+
+		verify_file_check(queued);
+
+		if (0 == mask || 0 == queued->mask)
+			queued->mask = 0;		/* All digests requested */
+		else
+			queued->mask |= mask;
 
-	if (hash_list_contains(ctx->files_to_hash, item)) {
 		if (high_priority)
-			hash_list_moveto_head(ctx->files_to_hash, item);
+			hash_list_moveto_head(v->files_to_hash, item);
 		inserted = FALSE;
 	} else {
 		if (high_priority) {
-			hash_list_prepend(ctx->files_to_hash, item);
+			hash_list_prepend(v->files_to_hash, item);
 		} else {
-			hash_list_append(ctx->files_to_hash, item);
+			hash_list_append(v->files_to_hash, item);
 		}
 		inserted = TRUE;
 	}
 
-	hash_list_unlock(ctx->files_to_hash);
+	hash_list_unlock(v->files_to_hash);
 
 	if (GNET_PROPERTY(verify_debug)) {
 		g_debug("%s %s digest verification for %s",
 			inserted ? "enqueued" : "already had queued",
-			verify_hash_name(ctx), pathname);
+			v->hash.name(), pathname);
 	}
 
 	/*
 	 * When work was inserted into the queue (represented by the hash list
-	 * here), we signal the thread handling the verification so that it can
-	 * be awoken if it was sleeping: the TSIG_TEQ signal will let the thread
-	 * out of the teq_wait() call in its main processing loop, and the
+	 * here), we signal the threads handling the verification so that they
+	 * can be awoken if they were sleeping: the TSIG_TEQ signal will let each
+	 * thread out of the teq_wait() call in its main processing loop, and the
 	 * verify_enqueued() event callback will make sure we have a background
 	 * task to actually process the work.
+	 *
+	 * We use teq_post_unique() since there is no need to flood the threads
+	 * with identical events when many files are enqueued at once, as during
+	 * a library rescan.
 	 */
 
-	if (inserted)
-		teq_post(ctx->verify_stid, verify_enqueued, ctx);
-	else
+	if (inserted) {
+		uint i;
+
+		for (i = 0; i < v->workers_count; i++) {
+			struct verify *ctx = v->workers[i];
+
+			teq_post_unique(ctx->vt->stid, verify_enqueued, ctx);
+		}
+	} else {
 		verify_file_free(&item);
+	}
 
 	return inserted;
 }
 
+/**
+ * Enqueue file to be verified.
+ *
+ * This is the same as verify_enqueue_mask(), with all the digests that the
+ * hash can compute being requested.
+ *
+ * @return TRUE if the item was enqueued, FALSE if an equivalent item was
+ * already enqueued.
+ */
+bool
+verify_enqueue(struct verifier *v, int high_priority,
+	const char *pathname, filesize_t offset, filesize_t amount,
+	verify_callback callback, void *user_data)
+{
+	return verify_enqueue_mask(v, high_priority,
+		pathname, offset, amount, 0, callback, user_data);
+}
+
 /* vi: set ts=4 sw=4 cindent: */
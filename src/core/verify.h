@@ -50,28 +50,65 @@ enum verify_status {
 };
 
 struct verify;
+struct verifier;
 
 typedef bool (*verify_callback)(const struct verify *,
 										enum verify_status, void *user_data);
 
+/**
+ * Hash-specific processing callbacks.
+ *
+ * Since files are hashed concurrently by several threads, the computation
+ * state is allocated by the new_state() callback for each worker, and given
+ * back to the other callbacks.  It can be retrieved with verify_state() from the
+ * verification context passed to the user callback.
+ *
+ * The init() callback is given the amount of data to hash and the digest
+ * selection mask for the file, as supplied to verify_enqueue_mask(), which
+ * is meaningful only for hashes able to compute several digests at once.
+ * A zero mask means "all the digests".  It returns the amount of digests
+ * that will be computed from the data, which is used to account for the
+ * amount of bytes hashed versus the amount of bytes read.
+ */
 struct verify_hash {
 	const char *	(*name)(void);
-	void 			(*init)(filesize_t amount);
-	int  			(*update)(const void *data, size_t size);
-	int 			(*final)(void);
+	void *			(*new_state)(void);
+	void			(*free_state)(void *state);
+	uint 			(*init)(void *state, filesize_t amount, uint mask);
+	int  			(*update)(void *state, const void *data, size_t size);
+	int 			(*final)(void *state);
 };
 
-struct verify *verify_new(const struct verify_hash *);
-void verify_free(struct verify **ptr);
+#define VERIFY_THREAD_MAX	64		/**< Max size of the thread pool */
 
-bool verify_enqueue(struct verify *, int high_priority,
+/**
+ * Statistics about a verification thread.
+ */
+struct verify_thread_stats {
+	const char *name;		/**< Thread name */
+	uint64 files;			/**< Files fully hashed */
+	uint64 bytes;			/**< Bytes read and hashed */
+	uint64 busy_us;			/**< Processing time, in microseconds */
+};
+
+struct verifier *verify_new(const struct verify_hash *);
+void verify_free(struct verifier **ptr);
+
+bool verify_enqueue(struct verifier *, int high_priority,
 	const char *pathname, filesize_t offset, filesize_t filesize,
 	verify_callback callback, void *user_data);
+bool verify_enqueue_mask(struct verifier *, int high_priority,
+	const char *pathname, filesize_t offset, filesize_t filesize, uint mask,
+	verify_callback callback, void *user_data);
 
 enum verify_status verify_status(const struct verify *);
+uint verify_mask(const struct verify *);
+void *verify_state(const struct verify *);
 filesize_t verify_hashed(const struct verify *);
 uint verify_elapsed(const struct verify *);
 
+size_t verify_thread_stats(struct verify_thread_stats *vec, size_t vcnt);
+
 #endif	/* _core_verify_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Combined SHA-1 and TTH verification.
+ *
+ * The file is read only once and each buffer is fed to both the SHA-1 and
+ * the Tiger tree computations, which halves the I/O required to index a
+ * new file in the library compared to running the SHA-1 and TTH verifications
+ * one after the other.
+ *
+ * Each enqueued file carries a selection mask telling which digests are
+ * still missing, so that a file for which we only lack one of the two digests
+ * is not hashed needlessly.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "verify_bitprint.h"
+
+#include "lib/halloc.h"
+#include "lib/once.h"
+#include "lib/sha1.h"
+#include "lib/tigertree.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+static struct {
+	struct verifier	*verifier;
+} verify_bitprint;
+
+/**
+ * Combined computation state, one per verification worker.
+ */
+struct verify_bitprint_state {
+	SHA1_context	sha1_context;
+	TTH_CONTEXT		*tth_context;
+	struct sha1		sha1;
+	struct tth		tth;
+	uint			mask;		/* Digests being computed */
+};
+
+static const char *
+verify_bitprint_name(void)
+{
+	return "SHA-1+TTH";
+}
+
+static void *
+verify_bitprint_new_state(void)
+{
+	struct verify_bitprint_state *vs;
+
+	WALLOC0(vs);
+	vs->tth_context = halloc(tt_size());
+	return vs;
+}
+
+static void
+verify_bitprint_free_state(void *state)
+{
+	struct verify_bitprint_state *vs = state;
+
+	HFREE_NULL(vs->tth_context);
+	WFREE(vs);
+}
+
+static uint
+verify_bitprint_reset(void *state, filesize_t amount, uint mask)
+{
+	struct verify_bitprint_state *vs = state;
+	uint n = 0;
+
+	if (0 == mask)
+		mask = VERIFY_BITPRINT_ALL;
+
+	vs->mask = mask;
+
+	if (mask & VERIFY_BITPRINT_SHA1) {
+		int ret = SHA1_reset(&vs->sha1_context);
+		g_assert(SHA_SUCCESS == ret);
+		n++;
+	}
+
+	if (mask & VERIFY_BITPRINT_TTH) {
+		tt_init(vs->tth_context, amount);
+		n++;
+	}
+
+	return n;
+}
+
+static int
+verify_bitprint_update(void *state, const void *data, size_t size)
+{
+	struct verify_bitprint_state *vs = state;
+
+	if (vs->mask & VERIFY_BITPRINT_SHA1) {
+		int ret = SHA1_input(&vs->sha1_context, data, size);
+		if (SHA_SUCCESS != ret)
+			return -1;
+	}
+
+	if (vs->mask & VERIFY_BITPRINT_TTH)
+		tt_update(vs->tth_context, data, size);
+
+	return 0;
+}
+
+static int
+verify_bitprint_final(void *state)
+{
+	struct verify_bitprint_state *vs = state;
+
+	if (vs->mask & VERIFY_BITPRINT_SHA1) {
+		int ret = SHA1_result(&vs->sha1_context, &vs->sha1);
+		if (SHA_SUCCESS != ret)
+			return -1;
+	}
+
+	if (vs->mask & VERIFY_BITPRINT_TTH)
+		tt_digest(vs->tth_context, &vs->tth);
+
+	return 0;
+}
+
+static const struct verify_hash verify_hash_bitprint = {
+	verify_bitprint_name,
+	verify_bitprint_new_state,
+	verify_bitprint_free_state,
+	verify_bitprint_reset,
+	verify_bitprint_update,
+	verify_bitprint_final,
+};
+
+/**
+ * Enqueue file for combined hashing.
+ *
+ * @param high_priority	whether item should be treated quickly
+ * @param pathname		file to be hashed
+ * @param filesize		size of the file
+ * @param mask			which digests to compute, 0 meaning all
+ * @param callback		callback routine to invoke in the calling thread
+ * @param user_data		context to pass to the calling routine
+ *
+ * @return TRUE if the item was enqueued, FALSE if an equivalent item was
+ * already enqueued, in which case its selection mask is extended.
+ */
+bool
+verify_bitprint_enqueue(int high_priority,
+	const char *pathname, filesize_t filesize, uint mask,
+	verify_callback callback, void *user_data)
+{
+	if G_UNLIKELY(NULL == verify_bitprint.verifier)
+		return FALSE;		/* Shutdown already occurred */
+
+	return verify_enqueue_mask(verify_bitprint.verifier, high_priority,
+		pathname, 0, filesize, mask, callback, user_data);
+}
+
+/**
+ * @return the computed SHA-1, NULL if it was not requested.
+ */
+const struct sha1 *
+verify_bitprint_sha1(const struct verify *ctx)
+{
+	const struct verify_bitprint_state *vs;
+
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+
+	vs = verify_state(ctx);
+
+	if (0 == (vs->mask & VERIFY_BITPRINT_SHA1))
+		return NULL;
+
+	return &vs->sha1;
+}
+
+/**
+ * @return the computed TTH, NULL if it was not requested.
+ */
+const struct tth *
+verify_bitprint_tth(const struct verify *ctx)
+{
+	const struct verify_bitprint_state *vs;
+
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+
+	vs = verify_state(ctx);
+
+	if (0 == (vs->mask & VERIFY_BITPRINT_TTH))
+		return NULL;
+
+	return &vs->tth;
+}
+
+/**
+ * @return the TTH leaves, NULL if the TTH was not requested.
+ */
+const struct tth *
+verify_bitprint_leaves(const struct verify *ctx)
+{
+	const struct verify_bitprint_state *vs;
+
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
+
+	vs = verify_state(ctx);
+
+	if (0 == (vs->mask & VERIFY_BITPRINT_TTH))
+		return NULL;
+
+	return tt_leaves(vs->tth_context);
+}
+
+/**
+ * @return the amount of TTH leaves, 0 if the TTH was not requested.
+ */
+size_t
+verify_bitprint_leave_count(const struct verify *ctx)
+{
+	const struct verify_bitprint_state *vs;
+
+	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, 0);
+
+	vs = verify_state(ctx);
+
+	if (0 == (vs->mask & VERIFY_BITPRINT_TTH))
+		return 0;
+
+	return tt_leave_count(vs->tth_context);
+}
+
+static void G_COLD
+verify_bitprint_init_once(void)
+{
+	verify_bitprint.verifier = verify_new(&verify_hash_bitprint);
+}
+
+void G_COLD
+verify_bitprint_init(void)
+{
+	static once_flag_t initialized;
+
+	/*
+	 * Need once_flag_runwait() since verify_new() can create a thread,
+	 * see verify_sha1_init() for details.
+	 */
+
+	once_flag_runwait(&initialized, verify_bitprint_init_once);
+}
+
+/**
+ * Stops the background task for combined verification.
+ */
+void G_COLD
+verify_bitprint_shutdown(void)
+{
+	verify_free(&verify_bitprint.verifier);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Combined SHA-1 and TTH verification.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _core_verify_bitprint_h_
+#define _core_verify_bitprint_h_
+
+#include "common.h"
+
+#include "verify.h"
+
+/*
+ * Digest selection mask, given to verify_bitprint_enqueue().
+ */
+
+#define VERIFY_BITPRINT_SHA1	(1U << 0)	/**< Compute SHA-1 */
+#define VERIFY_BITPRINT_TTH		(1U << 1)	/**< Compute TTH */
+
+#define VERIFY_BITPRINT_ALL	(VERIFY_BITPRINT_SHA1 | VERIFY_BITPRINT_TTH)
+
+struct sha1;
+struct tth;
+
+bool verify_bitprint_enqueue(int high_priority,
+	const char *pathname, filesize_t filesize, uint mask,
+	verify_callback callback, void *user_data);
+
+const struct sha1 *verify_bitprint_sha1(const struct verify *);
+const struct tth *verify_bitprint_tth(const struct verify *);
+const struct tth *verify_bitprint_leaves(const struct verify *);
+size_t verify_bitprint_leave_count(const struct verify *);
+
+void verify_bitprint_init(void);
+void verify_bitprint_shutdown(void);
+
+#endif	/* _core_verify_bitprint_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
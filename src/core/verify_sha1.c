@@ -38,16 +38,23 @@
 #include "lib/misc.h"
 #include "lib/once.h"
 #include "lib/sha1.h"
+#include "lib/walloc.h"
 
 #include "core/verify_sha1.h"
 
 #include "lib/override.h"	/* Must be the last header included */
 
 static struct {
-	struct verify	*verify;
+	struct verifier	*verifier;
+} verify_sha1;
+
+/**
+ * SHA-1 computation state, one per verification worker.
+ */
+struct verify_sha1_state {
 	SHA1_context	context;
 	struct sha1		digest;
-} verify_sha1;
+};
 
 static const char *
 verify_sha1_name(void)
@@ -55,36 +62,60 @@ verify_sha1_name(void)
 	return "SHA-1";
 }
 
+static void *
+verify_sha1_new_state(void)
+{
+	struct verify_sha1_state *vs;
+
+	WALLOC0(vs);
+	return vs;
+}
+
 static void
-verify_sha1_reset(filesize_t amount)
+verify_sha1_free_state(void *state)
+{
+	struct verify_sha1_state *vs = state;
+
+	WFREE(vs);
+}
+
+static uint
+verify_sha1_reset(void *state, filesize_t amount, uint mask)
 {
+	struct verify_sha1_state *vs = state;
 	int ret;
 
 	(void) amount;
-	ret = SHA1_reset(&verify_sha1.context);
+	(void) mask;
+	ret = SHA1_reset(&vs->context);
 	g_assert(SHA_SUCCESS == ret);
+	return 1;
 }
 
 static int
-verify_sha1_update(const void *data, size_t size)
+verify_sha1_update(void *state, const void *data, size_t size)
 {
+	struct verify_sha1_state *vs = state;
 	int ret;
 
-	ret = SHA1_input(&verify_sha1.context, data, size);
+	ret = SHA1_input(&vs->context, data, size);
 	return SHA_SUCCESS == ret ? 0 : -1;
 }
 
 static int
-verify_sha1_final(void)
+verify_sha1_final(void *state)
 {
+	struct verify_sha1_state *vs = state;
 	int ret;
 
-	ret = SHA1_result(&verify_sha1.context, &verify_sha1.digest);
+	ret = SHA1_result(&vs->context, &vs->digest);
 	return SHA_SUCCESS == ret ? 0 : -1;
 }
 
 static const struct verify_hash verify_hash_sha1 = {
 	verify_sha1_name,
+	verify_sha1_new_state,
+	verify_sha1_free_state,
 	verify_sha1_reset,
 	verify_sha1_update,
 	verify_sha1_final,
@@ -95,21 +126,25 @@ verify_sha1_enqueue(int high_priority,
 	const char *pathname, filesize_t filesize,
 	verify_callback callback, void *user_data)
 {
-	return verify_enqueue(verify_sha1.verify, high_priority,
+	return verify_enqueue(verify_sha1.verifier, high_priority,
 		pathname, 0, filesize, callback, user_data);
 }
 
 const struct sha1 *
 verify_sha1_digest(const struct verify *ctx)
 {
+	const struct verify_sha1_state *vs;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return &verify_sha1.digest;
+
+	vs = verify_state(ctx);
+	return &vs->digest;
 }
 
 static void G_COLD
 verify_sha1_init_once(void)
 {
-	verify_sha1.verify = verify_new(&verify_hash_sha1);
+	verify_sha1.verifier = verify_new(&verify_hash_sha1);
 }
 
 void G_COLD
@@ -133,7 +168,7 @@ verify_sha1_init(void)
 void G_COLD
 verify_sha1_close(void)
 {
-	verify_free(&verify_sha1.verify);
+	verify_free(&verify_sha1.verifier);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
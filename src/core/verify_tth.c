@@ -48,14 +48,21 @@
 #include "lib/tiger.h"
 #include "lib/tigertree.h"
 #include "lib/tm.h"
+#include "lib/walloc.h"
 
 #include "lib/override.h"		/* Must be the last inclusion */
 
 static struct {
-	struct verify	*verify;
+	struct verifier	*verifier;
+} verify_tth;
+
+/**
+ * TTH computation state, one per verification worker.
+ */
+struct verify_tth_state {
 	TTH_CONTEXT		*context;
 	struct tth		digest;
-} verify_tth;
+};
 
 static const char *
 verify_tth_name(void)
@@ -63,35 +70,57 @@ verify_tth_name(void)
 	return "TTH";
 }
 
+static void *
+verify_tth_new_state(void)
+{
+	struct verify_tth_state *vs;
+
+	WALLOC0(vs);
+	vs->context = halloc(tt_size());
+	return vs;
+}
+
 static void
-verify_tth_reset(filesize_t size)
+verify_tth_free_state(void *state)
 {
-	if G_LIKELY(verify_tth.context != NULL)
-		tt_init(verify_tth.context, size);
+	struct verify_tth_state *vs = state;
+
+	HFREE_NULL(vs->context);
+	WFREE(vs);
+}
+
+static uint
+verify_tth_reset(void *state, filesize_t size, uint mask)
+{
+	struct verify_tth_state *vs = state;
+
+	(void) mask;
+	tt_init(vs->context, size);
+	return 1;
 }
 
 static int
-verify_tth_update(const void *data, size_t size)
+verify_tth_update(void *state, const void *data, size_t size)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_state *vs = state;
 
-	tt_update(verify_tth.context, data, size);
+	tt_update(vs->context, data, size);
 	return 0;
 }
 
 static int
-verify_tth_final(void)
+verify_tth_final(void *state)
 {
-	if G_UNLIKELY(NULL == verify_tth.context)
-		return -1;
+	struct verify_tth_state *vs = state;
 
-	tt_digest(verify_tth.context, &verify_tth.digest);
+	tt_digest(vs->context, &vs->digest);
 	return 0;
 }
 
 static const struct verify_hash verify_hash_tth = {
 	verify_tth_name,
+	verify_tth_new_state,
+	verify_tth_free_state,
 	verify_tth_reset,
 	verify_tth_update,
 	verify_tth_final,
@@ -100,29 +129,40 @@ static const struct verify_hash verify_hash_tth = {
 const struct tth *
 verify_tth_digest(const struct verify *ctx)
 {
+	const struct verify_tth_state *vs;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return &verify_tth.digest;
+
+	vs = verify_state(ctx);
+	return &vs->digest;
 }
 
 const struct tth *
 verify_tth_leaves(const struct verify *ctx)
 {
+	const struct verify_tth_state *vs;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, NULL);
-	return tt_leaves(verify_tth.context);
+
+	vs = verify_state(ctx);
+	return tt_leaves(vs->context);
 }
 
 size_t
 verify_tth_leave_count(const struct verify *ctx)
 {
+	const struct verify_tth_state *vs;
+
 	g_return_val_if_fail(verify_status(ctx) == VERIFY_DONE, 0);
-	return tt_leave_count(verify_tth.context);
+
+	vs = verify_state(ctx);
+	return tt_leave_count(vs->context);
 }
 
 static void G_COLD
 verify_tth_init_once(void)
 {
-	verify_tth.context = halloc(tt_size());
-	verify_tth.verify = verify_new(&verify_hash_tth);
+	verify_tth.verifier = verify_new(&verify_hash_tth);
 }
 
 void G_COLD
@@ -149,16 +189,7 @@ verify_tth_init(void)
 void G_COLD
 verify_tth_shutdown(void)
 {
-	verify_free(&verify_tth.verify);
-}
-
-/**
- * Release memory resources used by tigertree verification.
- */
-void G_COLD
-verify_tth_close(void)
-{
-	HFREE_NULL(verify_tth.context);
+	verify_free(&verify_tth.verifier);
 }
 
 static bool
@@ -192,7 +223,7 @@ request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 			}
 			return FALSE;
 		}
-		gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, TRUE);
+		huge_tth_job_start(ctx);
 		return TRUE;
 	case VERIFY_PROGRESS:
 		/*
@@ -246,7 +277,7 @@ request_tigertree_callback(const struct verify *ctx, enum verify_status status,
 
 done:
 	shared_file_unref(&sf);
-	gnet_prop_set_boolean_val(PROP_TTH_REBUILDING, FALSE);
+	huge_tth_job_end(ctx);
 	return TRUE;
 }
 
@@ -255,7 +286,7 @@ verify_tth_append(const char *pathname,
 	filesize_t offset, filesize_t amount,
 	verify_callback callback, void *user_data)
 {
-	return verify_enqueue(verify_tth.verify, FALSE,
+	return verify_enqueue(verify_tth.verifier, FALSE,
 				pathname, offset, amount, callback, user_data);
 }
 
@@ -264,7 +295,7 @@ verify_tth_prepend(const char *pathname,
 	filesize_t offset, filesize_t amount,
 	verify_callback callback, void *user_data)
 {
-	return verify_enqueue(verify_tth.verify, TRUE,
+	return verify_enqueue(verify_tth.verifier, TRUE,
 				pathname, offset, amount, callback, user_data);
 }
 
@@ -287,12 +318,12 @@ request_tigertree(shared_file_t *sf, bool high_priority)
 	 * verification thread.
 	 */
 
-	if G_UNLIKELY(NULL == verify_tth.verify)
+	if G_UNLIKELY(NULL == verify_tth.verifier)
 		return;
 
 	sf = shared_file_ref(sf);
 
-	inserted = verify_enqueue(verify_tth.verify, high_priority,
+	inserted = verify_enqueue(verify_tth.verifier, high_priority,
 					shared_file_path(sf), 0, shared_file_size(sf),
 					request_tigertree_callback, sf);
 
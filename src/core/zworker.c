@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Compression worker threads.
+ *
+ * The compressing and decompressing network layers can hand the deflate()
+ * and inflate() work to a pool of "zlib" threads, to spread the CPU cost of
+ * compressed Gnutella links over several cores.
+ *
+ * The pool knows nothing about zlib: it runs the work routine of a job in
+ * one of its threads and then invokes the done routine of the job from the
+ * main thread.  Jobs are not ordered between them, hence callers must have
+ * at most one job in flight per stream to preserve the ordering of data.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "zworker.h"
+
+#include "lib/aq.h"
+#include "lib/cond.h"
+#include "lib/constants.h"
+#include "lib/log.h"
+#include "lib/mutex.h"
+#include "lib/str.h"
+#include "lib/stringify.h"
+#include "lib/teq.h"
+#include "lib/thread.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"	/* Must be the last header included */
+
+#define ZWORKER_THREAD_MAX	16		/**< Max amount of compression threads */
+
+enum zworker_job_magic { ZWORKER_JOB_MAGIC = 0x5a1c9e37 };
+
+struct zworker_job {
+	enum zworker_job_magic magic;
+	zworker_fn_t work;			/**< Run by the compression thread */
+	zworker_fn_t done;			/**< Run in the main thread afterwards */
+	void *arg;					/**< Argument for both routines */
+};
+
+static inline void
+zworker_job_check(const struct zworker_job * const zj)
+{
+	g_assert(zj != NULL);
+	g_assert(ZWORKER_JOB_MAGIC == zj->magic);
+}
+
+static mutex_t zworker_mtx = MUTEX_INIT;
+static cond_t zworker_cond = COND_INIT;	/* Signals job completion */
+static aqueue_t *zworker_queue;			/* Jobs for the compression threads */
+static uint zworker_threads;			/* Amount of compression threads */
+static size_t zworker_pending;			/* Jobs not completed yet */
+static int zworker_exit;				/* Its address tells thread to exit */
+static bool zworker_enabled;
+
+#define ZWORKER_LOCK		mutex_lock(&zworker_mtx)
+#define ZWORKER_UNLOCK		mutex_unlock(&zworker_mtx)
+
+/**
+ * @return TRUE if compression jobs can be submitted.
+ */
+bool
+zworker_is_enabled(void)
+{
+	return zworker_enabled;
+}
+
+/**
+ * Deliver the completion of the job, from the main thread.
+ */
+static void
+zworker_deliver(void *data)
+{
+	struct zworker_job *zj = data;
+
+	zworker_job_check(zj);
+
+	(*zj->done)(zj->arg);
+
+	zj->magic = 0;
+	WFREE(zj);
+}
+
+/**
+ * The compression threads.
+ */
+static void *
+zworker_thread_main(void *arg)
+{
+	const char *name = arg;
+
+	thread_set_name(name);
+
+	for (;;) {
+		struct zworker_job *zj = aq_remove(zworker_queue);
+
+		if (&zworker_exit == (void *) zj)
+			break;
+
+		zworker_job_check(zj);
+
+		(*zj->work)(zj->arg);
+
+		ZWORKER_LOCK;
+		g_assert(zworker_pending != 0);
+		zworker_pending--;
+		cond_broadcast(&zworker_cond, &zworker_mtx);
+		ZWORKER_UNLOCK;
+
+		teq_safe_post(THREAD_MAIN_ID, zworker_deliver, zj);
+	}
+
+	return NULL;
+}
+
+/**
+ * Submit a compression job.
+ *
+ * The work routine must only touch data that are not accessed by the main
+ * thread until the done routine is invoked.
+ *
+ * @param work		routine run by one of the compression threads
+ * @param done		routine then invoked from the main thread
+ * @param arg		argument for both routines
+ */
+void
+zworker_submit(zworker_fn_t work, zworker_fn_t done, void *arg)
+{
+	struct zworker_job *zj;
+
+	g_assert(zworker_enabled);
+	g_assert(thread_is_main());
+	g_assert(work != NULL);
+	g_assert(done != NULL);
+
+	WALLOC0(zj);
+	zj->magic = ZWORKER_JOB_MAGIC;
+	zj->work = work;
+	zj->done = done;
+	zj->arg = arg;
+
+	ZWORKER_LOCK;
+	zworker_pending++;
+	ZWORKER_UNLOCK;
+
+	aq_put(zworker_queue, zj);
+}
+
+/**
+ * Initialize the compression threads.
+ *
+ * @param threads		amount of threads, 0 meaning inline compression
+ */
+void G_COLD
+zworker_init(uint threads)
+{
+	uint i;
+
+	g_assert(thread_is_main());
+	g_assert(!zworker_enabled);
+
+	if (0 == threads)
+		return;
+
+	threads = MIN(threads, ZWORKER_THREAD_MAX);
+	zworker_queue = aq_make();
+
+	for (i = 0; i < threads; i++) {
+		const char *name = constant_str(str_smsg("zlib #%u", i + 1));
+
+		(void) thread_create(zworker_thread_main,
+				deconstify_char(name),
+				THREAD_F_DETACH | THREAD_F_NO_CANCEL |
+					THREAD_F_NO_POOL | THREAD_F_PANIC,
+				THREAD_STACK_DFLT);
+	}
+
+	zworker_threads = threads;
+	zworker_enabled = TRUE;
+
+	s_info("link compression using %u thread%s", PLURAL(threads));
+}
+
+/**
+ * Shutdown the compression threads, waiting for all the pending jobs.
+ */
+void G_COLD
+zworker_close(void)
+{
+	uint i;
+
+	g_assert(thread_is_main());
+
+	if (!zworker_enabled)
+		return;
+
+	ZWORKER_LOCK;
+	while (zworker_pending != 0)
+		cond_wait(&zworker_cond, &zworker_mtx);
+	ZWORKER_UNLOCK;
+
+	for (i = 0; i < zworker_threads; i++)
+		aq_put(zworker_queue, &zworker_exit);
+
+	/*
+	 * The queue is referenced by the threads which may not have exited yet,
+	 * therefore we leave it around.
+	 */
+
+	zworker_threads = 0;
+	zworker_enabled = FALSE;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
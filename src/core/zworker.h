@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Compression worker threads.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _core_zworker_h_
+#define _core_zworker_h_
+
+#include "common.h"
+
+/**
+ * A compression job: the work routine is run by one of the compression
+ * threads, then the done routine is invoked from the main thread.
+ */
+typedef void (*zworker_fn_t)(void *arg);
+
+/*
+ * Public interface.
+ */
+
+void zworker_init(uint threads);
+void zworker_close(void);
+bool zworker_is_enabled(void);
+void zworker_submit(zworker_fn_t work, zworker_fn_t done, void *arg);
+
+#endif /* _core_zworker_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -1630,6 +1630,28 @@ keys_init_keyinfo(void)
 	gnet_stats_set_general(GNR_DHT_KEYS_HELD, hikset_count(keys));
 }
 
+/**
+ * Flush dirty keydata cached by the DBMW layer down to the SDBM pages.
+ *
+ * @return amount of dirty values flushed.
+ */
+size_t
+keys_db_flush(void)
+{
+	return dbstore_flush(db_keydata);
+}
+
+/**
+ * Write the dirty keydata SDBM pages to disk.
+ *
+ * @return amount of pages written.
+ */
+size_t
+keys_db_sync(void)
+{
+	return dbstore_sync(db_keydata);
+}
+
 /**
  * Periodic DB synchronization.
  */
@@ -1638,8 +1660,7 @@ keys_sync(void *unused_obj)
 {
 	(void) unused_obj;
 
-	dbstore_sync_flush(db_keydata);
-	values_sync();
+	values_sync();		/* Also synchronizes the keys database */
 
 	return TRUE;		/* Keep calling */
 }
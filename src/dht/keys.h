@@ -64,6 +64,8 @@ bool keys_is_nearby(const kuid_t *id);
 double keys_decimation_factor(const kuid_t *key);
 void keys_update_kball();
 void keys_offload(const knode_t *kn);
+size_t keys_db_flush(void);
+size_t keys_db_sync(void);
 
 #endif /* _dht_keys_h_ */
 
@@ -84,6 +84,8 @@
 #define NL_VAL_MAX_RETRY	3		/* Max RPC retries to fetch sec keys */
 #define NL_FIND_DELAY		5000	/* 5 seconds, in ms */
 #define NL_VAL_DELAY		1000	/* 1 second, in ms */
+#define NL_ALPHA_MAX		(3 * KDA_ALPHA)	/* Max adaptive parallelism */
+#define NL_CANDIDATES		(2 * NL_ALPHA_MAX)	/* Max candidates per hop */
 
 /**
  * Maximum number of nodes from a class C network that we can return in
@@ -688,6 +690,48 @@ log_patricia_dump(nlookup_t *nl, patricia_t *pt, const char *what, uint level)
 	patricia_iterator_release(&iter);
 }
 
+/**
+ * Account ending lookup in the histograms of lookup durations and hops.
+ *
+ * @param nl		the ending lookup
+ * @param elapsed	lookup duration, in seconds
+ */
+static void
+lookup_histograms(const nlookup_t *nl, double elapsed)
+{
+	static const gnr_stats_t time_stats[] = {
+		GNR_DHT_LOOKUP_TIME_1S,
+		GNR_DHT_LOOKUP_TIME_2S,
+		GNR_DHT_LOOKUP_TIME_4S,
+		GNR_DHT_LOOKUP_TIME_8S,
+		GNR_DHT_LOOKUP_TIME_16S,
+		GNR_DHT_LOOKUP_TIME_32S,
+		GNR_DHT_LOOKUP_TIME_MORE,
+	};
+	static const gnr_stats_t hops_stats[] = {
+		GNR_DHT_LOOKUP_HOPS_2,
+		GNR_DHT_LOOKUP_HOPS_4,
+		GNR_DHT_LOOKUP_HOPS_8,
+		GNR_DHT_LOOKUP_HOPS_16,
+		GNR_DHT_LOOKUP_HOPS_MORE,
+	};
+	double limit;
+	uint32 hops;
+	uint i;
+
+	for (i = 0, limit = 1.0; i < N_ITEMS(time_stats) - 1; i++, limit *= 2) {
+		if (elapsed <= limit)
+			break;
+	}
+	gnet_stats_inc_general(time_stats[i]);
+
+	for (i = 0, hops = 2; i < N_ITEMS(hops_stats) - 1; i++, hops *= 2) {
+		if (nl->hops <= hops)
+			break;
+	}
+	gnet_stats_inc_general(hops_stats[i]);
+}
+
 /**
  * Invoke statistics callback, if added by user.
  * Log final statistics.
@@ -700,6 +744,7 @@ lookup_final_stats(const nlookup_t *nl)
 	lookup_check(nl);
 
 	tm_now_exact(&end);
+	lookup_histograms(nl, tm_elapsed_f(&end, &nl->start));
 
 	if (GNET_PROPERTY(dht_lookup_debug) > 1 || GNET_PROPERTY(dht_debug) > 1)
 		g_debug("DHT LOOKUP[%s] type %s, took %g secs, "
@@ -3992,6 +4037,94 @@ lookup_async_iterate(nlookup_t *nl)
 	nl->delay_ev = cq_main_insert(1, lookup_delay_expired, nl);
 }
 
+/**
+ * Compute the amount of RPCs to keep in flight, based on the RPC timeout
+ * rate and the average RTT of replies we observe globally.
+ *
+ * Each RPC that times out ties its slot up during the RPC timeout instead of
+ * the RTT.  To keep getting replies at the rate KDA_ALPHA parallel RPCs
+ * would give us without any timeout, we need to send:
+ *
+ *    alpha = KDA_ALPHA * (1 + p * T / ((1 - p) * rtt))
+ *
+ * where p is the timeout rate and T the RPC timeout, which is about the
+ * minimum RPC delay plus 3 times the RTT.
+ *
+ * @return parallelism to use for lookups.
+ */
+static int
+lookup_alpha(void)
+{
+	uint64 rtt = dht_rpc_average_rtt();
+	uint64 rate = dht_rpc_timeout_rate();	/* In thousandths */
+	uint64 extra;
+	int alpha;
+
+	if (0 == rtt || rate >= 1000) {
+		alpha = 0 == rtt ? KDA_ALPHA : NL_ALPHA_MAX;
+	} else {
+		extra = KDA_ALPHA * rate * (DHT_RPC_MINDELAY + 3 * rtt) /
+			((1000 - rate) * rtt);
+		alpha = KDA_ALPHA + MIN(extra, NL_ALPHA_MAX - KDA_ALPHA);
+	}
+
+	gnet_stats_set_general(GNR_DHT_LOOKUP_ALPHA, alpha);
+
+	return alpha;
+}
+
+/**
+ * A candidate node for the next lookup hop.
+ */
+struct lookup_candidate {
+	knode_t *kn;				/**< The node */
+	size_t bits;				/**< Leading bits in common with target */
+	uint32 rtt;					/**< Known or estimated RTT, in ms */
+	int rank;					/**< Rank by XOR distance to target */
+};
+
+/**
+ * @return known RTT of node in ms, or an estimate based on the RTT of all
+ * the nodes if we never got a reply from it.
+ */
+static uint32
+lookup_node_rtt(const knode_t *kn)
+{
+	const knode_t *tkn;
+
+	if (kn->rtt != 0)
+		return kn->rtt;
+
+	/*
+	 * Nodes in the shortlist usually come from the replies of other nodes,
+	 * but we may already know them from our routing table.
+	 */
+
+	tkn = dht_find_node(kn->id);
+	if (tkn != NULL && tkn->rtt != 0)
+		return tkn->rtt;
+
+	return dht_rpc_average_rtt();
+}
+
+/**
+ * Sort lookup candidates by decreasing amount of common leading bits with
+ * the target, and then by increasing RTT.
+ */
+static int
+lookup_candidate_cmp(const void *a, const void *b)
+{
+	const struct lookup_candidate *ca = a, *cb = b;
+
+	if (ca->bits != cb->bits)
+		return ca->bits > cb->bits ? -1 : +1;
+
+	if (ca->rtt != cb->rtt)
+		return ca->rtt < cb->rtt ? -1 : +1;
+
+	return CMP(ca->rank, cb->rank);
+}
+
 /**
  * Iterate the lookup, once we have determined we must send more probes.
  */
@@ -4002,8 +4135,10 @@ lookup_iterate(nlookup_t *nl)
 	pslist_t *to_remove = NULL;
 	pslist_t *ignored = NULL;
 	pslist_t *sl;
-	int i = 0;
-	int alpha = KDA_ALPHA;
+	struct lookup_candidate cvec[NL_CANDIDATES];
+	int ccnt = 0;
+	int i = 0, j;
+	int alpha = lookup_alpha();
 	char reason[80];
 	int reason_len;
 
@@ -4066,16 +4201,20 @@ lookup_iterate(nlookup_t *nl)
 	/*
 	 * Select the alpha closest nodes from the shortlist and send them
 	 * the proper message (either FIND_NODE or FIND_VALUE).
+	 *
+	 * Nodes sharing the same amount of leading bits with the target are
+	 * considered to be at the same distance, and among these we prefer
+	 * the ones replying faster: candidates are therefore collected until
+	 * we have alpha of them and all the ones at the distance of the last.
 	 */
 
 	reason_len = GNET_PROPERTY(dht_lookup_debug) ? sizeof reason : 0;
 	iter = patricia_metric_iterator_lazy(nl->shortlist, nl->kuid, TRUE);
 
-	nl->flags |= NL_F_SENDING;		/* Protect against synchronous UDP drops */
-	nl->flags &= ~NL_F_UDP_DROP;	/* Clear condition */
-
-	while (i < alpha && patricia_iter_has_next(iter)) {
+	while (ccnt < NL_CANDIDATES && patricia_iter_has_next(iter)) {
 		knode_t *kn = patricia_iter_next_value(iter);
+		struct lookup_candidate *c;
+		size_t bits;
 
 		if (!knode_can_recontact(kn))
 			continue;
@@ -4090,18 +4229,48 @@ lookup_iterate(nlookup_t *nl)
 					nid_to_string(&nl->lid), knode_to_string(kn), reason);
 			}
 			ignored = pslist_prepend(ignored, knode_refcnt_inc(kn));
-		} else if (!map_contains(nl->queried, kn->id)) {
-			lookup_send(nl, kn);
-			if (nl->flags & NL_F_UDP_DROP)
-				break;				/* Synchronous UDP drop detected */
-			i++;
+			to_remove = pslist_prepend(to_remove, kn);
+			continue;
+		} else if (map_contains(nl->queried, kn->id)) {
+			to_remove = pslist_prepend(to_remove, kn);
+			continue;
 		}
 
+		bits = kuid_common_prefix(kn->id, nl->kuid);
+
+		if (ccnt >= alpha && bits != cvec[ccnt - 1].bits)
+			break;
+
+		c = &cvec[ccnt];
+		c->kn = kn;
+		c->bits = bits;
+		c->rtt = lookup_node_rtt(kn);
+		c->rank = ccnt++;
+	}
+
+	patricia_iterator_release(&iter);
+
+	if (ccnt > alpha)
+		vsort(cvec, ccnt, sizeof cvec[0], lookup_candidate_cmp);
+
+	nl->flags |= NL_F_SENDING;		/* Protect against synchronous UDP drops */
+	nl->flags &= ~NL_F_UDP_DROP;	/* Clear condition */
+
+	for (j = 0; j < ccnt && i < alpha; j++) {
+		knode_t *kn = cvec[j].kn;
+
+		lookup_send(nl, kn);
+		if (nl->flags & NL_F_UDP_DROP)
+			break;				/* Synchronous UDP drop detected */
+		i++;
+
+		if (cvec[j].rank >= alpha)
+			gnet_stats_inc_general(GNR_DHT_LOOKUP_FAST_NODES);
+
 		to_remove = pslist_prepend(to_remove, kn);
 	}
 
 	nl->flags &= ~NL_F_SENDING;
-	patricia_iterator_release(&iter);
 
 	/*
 	 * Remove the nodes to whom we sent a message, or which we want to ignore.
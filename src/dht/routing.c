@@ -107,6 +107,7 @@
 #include "lib/tokenizer.h"
 #include "lib/vendors.h"
 #include "lib/walloc.h"
+#include "lib/xclosest.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -264,6 +265,7 @@ static enum dht_bootsteps old_boot_status = DHT_BOOT_NONE;
 static struct kbucket *root = NULL;	/**< The root of the routing table tree. */
 static kuid_t *our_kuid;			/**< Our own KUID (atom) */
 static struct kstats stats;			/**< Statistics on the routing table */
+static xclosest_t *good_array;		/**< Flat array of all the good nodes */
 
 static const char dht_route_file[] = "dht_nodes";
 static const char dht_route_what[] = "the DHT routing table";
@@ -678,15 +680,36 @@ list_maxsize_for(knode_status_t status)
 }
 
 /**
- * Update statistics for status change.
+ * Add or remove good node from the flat array of good nodes.
+ */
+static void
+good_array_update(knode_t *kn, int delta)
+{
+	if (delta > 0) {
+		kn->slot = xclosest_add(good_array, kn->id, kn);
+	} else if (delta < 0) {
+		knode_t *moved;
+
+		g_assert(xclosest_value(good_array, kn->slot) == kn);
+
+		moved = xclosest_remove(good_array, kn->slot);
+		if (moved != NULL)
+			moved->slot = kn->slot;
+	}
+}
+
+/**
+ * Update statistics for status change of node entering or leaving the
+ * given list of its k-bucket.
  */
 static inline void
-list_update_stats(knode_status_t status, int delta)
+list_update_stats(knode_t *kn, knode_status_t status, int delta)
 {
 	switch (status) {
 	case KNODE_GOOD:
 		stats.good += delta;
 		gnet_stats_count_general(GNR_DHT_ROUTING_GOOD_NODES, delta);
+		good_array_update(kn, delta);
 		if (delta)
 			stats.dirty = TRUE;
 		break;
@@ -857,7 +880,7 @@ forget_node(knode_t *kn)
 	g_assert(kn->status != KNODE_UNKNOWN);
 	g_assert(kn->refcnt > 0);
 
-	list_update_stats(kn->status, -1);		/* Node leaving routing table */
+	list_update_stats(kn, kn->status, -1);		/* Node leaving routing table */
 	kn->flags &= ~KNODE_F_ALIVE;
 	kn->status = KNODE_UNKNOWN;
 	knode_free(kn);
@@ -879,7 +902,7 @@ forget_merged_node(knode_t *kn)
 	g_assert(kn->status != KNODE_UNKNOWN);
 	g_assert(kn->refcnt > 0);
 
-	list_update_stats(kn->status, -1);		/* Node leaving routing table */
+	list_update_stats(kn, kn->status, -1);		/* Node leaving routing table */
 	kn->flags &= ~KNODE_F_ALIVE;
 
 	/*
@@ -1605,6 +1628,7 @@ dht_initialize(bool post_init)
 	stats.lookdata = statx_make_nodata();
 	stats.netdata = statx_make_nodata();
 	c_class = acct_net_create();
+	good_array = xclosest_make(KUID_RAW_SIZE);
 
 	g_assert(0 == stats.good);
 
@@ -2103,7 +2127,7 @@ add_node(struct kbucket *kb, knode_t *kn, knode_status_t status)
 
 	kn->status = status;
 	add_node_internal(kb, kn, status, TRUE);
-	list_update_stats(status, +1);
+	list_update_stats(kn, status, +1);
 }
 
 /**
@@ -2285,7 +2309,7 @@ promote_pending_node(struct kbucket *kb)
 				knode_still_alive_probability(selected) * 100.0);
 
 		hash_list_remove(kb->nodes->pending, selected);
-		list_update_stats(KNODE_PENDING, -1);
+		list_update_stats(selected, KNODE_PENDING, -1);
 
 		/*
 		 * If there's only one reference to this node, attempt to move
@@ -2303,7 +2327,7 @@ promote_pending_node(struct kbucket *kb)
 
 		selected->status = KNODE_GOOD;
 		hash_list_insert_sorted(kb->nodes->good, selected, knode_seen_cmp);
-		list_update_stats(KNODE_GOOD, +1);
+		list_update_stats(selected, KNODE_GOOD, +1);
 
 		/*
 		 * If we haven't heard about the selected pending node for a while,
@@ -2546,7 +2570,7 @@ dht_set_node_status(knode_t *kn, knode_status_t new)
 	hl = list_for(kb, old);
 	if (!hash_list_remove(hl, tkn))
 		g_error("node %s not in its routing table list", knode_to_string(tkn));
-	list_update_stats(old, -1);
+	list_update_stats(tkn, old, -1);
 
 	tkn->status = new;
 	hl = list_for(kb, new);
@@ -2578,8 +2602,8 @@ dht_set_node_status(knode_t *kn, knode_status_t new)
 
 			removed->status = KNODE_PENDING;
 			hash_list_append(kb->nodes->pending, removed);
-			list_update_stats(new, -1);
-			list_update_stats(KNODE_PENDING, +1);
+			list_update_stats(removed, new, -1);
+			list_update_stats(removed, KNODE_PENDING, +1);
 
 			if (GNET_PROPERTY(dht_debug))
 				g_debug("DHT switched %s node %s at %s to pending in %s",
@@ -2609,7 +2633,7 @@ dht_set_node_status(knode_t *kn, knode_status_t new)
 
 	tkn = move_node(kb, tkn);
 	hash_list_append(hl, tkn);
-	list_update_stats(new, +1);
+	list_update_stats(tkn, new, +1);
 
 	/*
 	 * If moving a node out of the good list, move the node at the tail of
@@ -4611,6 +4635,23 @@ recursively_fill_closest_from(
 	return added;
 }
 
+/**
+ * Selection filter for good nodes known to be alive, other than the
+ * excluded KUID.
+ */
+static bool
+fill_closest_alive(const void *value, void *data)
+{
+	const knode_t *kn = value;
+	const kuid_t *exclude = data;
+
+	knode_check(kn);
+	g_assert(KNODE_GOOD == kn->status);
+
+	return (kn->flags & KNODE_F_ALIVE) &&
+		(!exclude || !kuid_eq(kn->id, exclude));
+}
+
 /**
  * Fill the supplied vector `kvec' whose size is `kcnt' with the knodes
  * that are the closest neighbours in the Kademlia space from a given KUID.
@@ -4637,6 +4678,24 @@ dht_fill_closest(
 	g_assert(kcnt > 0);
 	g_assert(kvec);
 
+	/*
+	 * When we only want known-to-be-alive nodes, as when answering the
+	 * FIND_NODE and FIND_VALUE requests of others, select the closest ones
+	 * among all the good nodes at once from their flat array, which is
+	 * faster than walking the tree.
+	 *
+	 * Only when the good nodes cannot fill the vector do we walk the tree,
+	 * to also consider the pending nodes of the k-buckets.
+	 */
+
+	if (alive && xclosest_count(good_array) >= UNSIGNED(kcnt)) {
+		added = xclosest_select(good_array, id, (void **) kvec, kcnt,
+			fill_closest_alive, deconstify_pointer(exclude));
+
+		if (added == kcnt)
+			goto done;
+	}
+
 	/*
 	 * Start by filling from hosts in the k-bucket of the ID.
 	 */
@@ -4670,6 +4729,7 @@ dht_fill_closest(
 		g_assert(kcnt >= 0);
 	}
 
+done:
 	if (GNET_PROPERTY(dht_debug) > 15) {
 		g_debug("DHT found %d/%d %s nodes (excluding %s) closest to %s",
 			added, wanted, alive ? "alive" : "known",
@@ -4931,6 +4991,7 @@ dht_close(bool exiting)
 
 	recursively_apply(root, dht_free_bucket, NULL);
 	root = NULL;
+	xclosest_free_null(&good_array);
 	kuid_atom_free_null(&our_kuid);
 
 	for (i = 0; i < K_REGIONS; i++) {
@@ -61,6 +61,8 @@
 
 #define DHT_RPC_RECENT_KEEP	(5*60)	/* 5 minutes */
 #define DHT_RPC_LINGER_MS	15000 	/* ms, 15 seconds */
+#define DHT_RPC_EMA_SMOOTH	32		/* Smoothing of global RPC averages */
+#define DHT_RPC_RATE_ONE	65536	/* Fixed-point 1.0 for timeout rate */
 
 enum rpc_cb_magic { RPC_CB_MAGIC = 0x74c8b10U };
 
@@ -98,6 +100,15 @@ static hikset_t *pending;		/**< Pending RPC (GUID -> rpc_cb) */
  */
 static aging_table_t *rpc_recent;
 
+/**
+ * Exponential moving averages over all the RPCs we issue, to let lookups
+ * adapt their parallelism to the network conditions.
+ */
+static struct rpc_stats {
+	int32 rtt;					/**< Average RTT of replies, in ms */
+	int32 timeouts;				/**< Fraction of timeouts, fixed-point */
+} rpc_stats;
+
 /**
  * RPC operation to string, for logs.
  */
@@ -296,6 +307,49 @@ rpc_cb_free(struct rpc_cb *rcb, bool in_shutdown)
 	WFREE(rcb);
 }
 
+/**
+ * Update the global RPC averages after an RPC completion.
+ *
+ * @param timed_out		whether the RPC timed out
+ * @param rtt			the RTT of the reply in ms, when not timed out
+ */
+static void
+rpc_stats_update(bool timed_out, int32 rtt)
+{
+	int32 timeouts = timed_out ? DHT_RPC_RATE_ONE : 0;
+
+	rpc_stats.timeouts += (timeouts - rpc_stats.timeouts) / DHT_RPC_EMA_SMOOTH;
+
+	if (!timed_out) {
+		if (0 == rpc_stats.rtt)
+			rpc_stats.rtt = MAX(rtt, 1);
+		else
+			rpc_stats.rtt += (rtt - rpc_stats.rtt) / DHT_RPC_EMA_SMOOTH;
+	}
+
+	gnet_stats_set_general(GNR_DHT_RPC_AVERAGE_RTT, rpc_stats.rtt);
+	gnet_stats_set_general(GNR_DHT_RPC_TIMEOUT_RATE,
+		dht_rpc_timeout_rate());
+}
+
+/**
+ * @return the average RTT of RPC replies in ms, 0 if unknown yet.
+ */
+uint32
+dht_rpc_average_rtt(void)
+{
+	return rpc_stats.rtt;
+}
+
+/**
+ * @return the fraction of RPCs timing out, in thousandths.
+ */
+uint
+dht_rpc_timeout_rate(void)
+{
+	return (uint64) rpc_stats.timeouts * 1000 / DHT_RPC_RATE_ONE;
+}
+
 /**
  * Compute a suitable timeout for the RPC call, in milliseconds, based
  * on the average RTT we have measured in the past for that node and the
@@ -402,6 +456,7 @@ rpc_timed_out(cqueue_t *cq, void *obj)
 
 	gnet_stats_inc_general(GNR_DHT_RPC_TIMED_OUT);
 	cq_zero(cq, &rcb->timeout);
+	rpc_stats_update(TRUE, 0);
 
 	rpc_timeout(rcb);
 }
@@ -768,6 +823,7 @@ dht_rpc_answer(const guid_t *muid,
 	 */
 
 	tm_now_exact(&now);
+	rpc_stats_update(FALSE, tm_elapsed_ms(&now, &rcb->start));
 
 	rn->rpc_timeouts = 0;
 	rn->rtt += (tm_elapsed_ms(&now, &rcb->start) >> 1) - (rn->rtt >> 1);
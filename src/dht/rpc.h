@@ -112,6 +112,8 @@ bool dht_fix_kuid_contact(const kuid_t *kuid, host_addr_t *addr, uint16 *port,
 	const char *source);
 
 bool dht_rpc_timeout(const guid_t *muid);
+uint32 dht_rpc_average_rtt(void);
+uint dht_rpc_timeout_rate(void);
 bool dht_rpc_cancel(const guid_t *muid);
 bool dht_rpc_cancel_if_no_callback(const guid_t *muid);
 bool dht_lazy_rpc_ping(knode_t *kn);
@@ -128,6 +128,8 @@
 #define VALUES_DB_CACHE_SIZE 1024	/**< Amount of values to keep cached */
 #define RAW_DB_CACHE_SIZE	 512	/**< Amount of raw data to keep cached */
 
+#define VALUES_COMMIT_STORES VALUES_DB_CACHE_SIZE /**< Pending STOREs limit */
+
 /**
  * Information about a value that is stored to disk and not kept in memory.
  * The structure is serialized first, not written as-is.
@@ -219,6 +221,30 @@ static char db_expwhat[] = "DHT expired values";
 
 static cperiodic_t *values_expire_ev;	/**< Value expire periodic event */
 
+/**
+ * Group commit of STOREs.
+ *
+ * Each STORE updates several databases (value data, raw data, expired
+ * values and key data).  Rather than letting each of these updates reach
+ * the disk on its own as cached entries get evicted, we group all the STOREs
+ * received between two periodic synchronizations: the dirty cached entries
+ * of the value, raw data and key databases are flushed in one pass, then the
+ * dirty SDBM pages are written out as a single batch, in page order.
+ *
+ * The batch is committed earlier when VALUES_COMMIT_STORES are pending,
+ * since the value cache is then about to evict dirty entries one by one.
+ *
+ * The expired values database is transient, being deleted when we close,
+ * so it is never synchronized.
+ */
+static struct values_batch {
+	size_t stores;			/**< STOREs in the pending batch */
+	uint64 batches;			/**< Batches committed so far */
+	uint64 committed;		/**< STOREs committed by batches */
+	uint64 pages;			/**< SDBM pages written by batches */
+	size_t largest;			/**< Largest batch committed */
+} values_batch;
+
 /**
  * @return amount of values managed.
  */
@@ -1802,6 +1828,66 @@ expired:
 	return STORE_SC_OK;		/* No error reported, data is stale and must die */
 }
 
+/**
+ * Commit the pending batch of STOREs to disk.
+ */
+static void
+values_batch_commit(void)
+{
+	struct values_batch *vb = &values_batch;
+	size_t flushed, pages;
+
+	/*
+	 * Flush all the dirty cached values first, so that the SDBM pages they
+	 * belong to are updated before any of them is written out.
+	 */
+
+	flushed = dbstore_flush(db_valuedata);
+	flushed += dbstore_flush(db_rawdata);
+	flushed += keys_db_flush();
+
+	pages = dbstore_sync(db_valuedata);
+	pages += dbstore_sync(db_rawdata);
+	pages += keys_db_sync();
+
+	if (0 == vb->stores)
+		return;		/* Periodic sync, no STORE received since last one */
+
+	vb->batches++;
+	vb->committed += vb->stores;
+	vb->pages += pages;
+	vb->largest = MAX(vb->largest, vb->stores);
+
+	gnet_stats_inc_general(GNR_DHT_STORE_BATCHES);
+	gnet_stats_count_general(GNR_DHT_STORE_BATCHED_VALUES, vb->stores);
+	gnet_stats_count_general(GNR_DHT_STORE_FLUSHED_VALUES, flushed);
+	gnet_stats_count_general(GNR_DHT_STORE_FLUSHED_PAGES, pages);
+	gnet_stats_set_general(GNR_DHT_STORE_BATCH_MAX, vb->largest);
+	gnet_stats_set_general(GNR_DHT_STORE_BATCH_AVERAGE,
+		vb->committed / vb->batches);
+	gnet_stats_set_general(GNR_DHT_STORE_WRITE_AMPLIFICATION,
+		vb->pages * 100 / MAX(vb->committed, 1));
+
+	if (GNET_PROPERTY(dht_storage_debug)) {
+		g_debug("DHT STORE committed batch of %zu STORE%s: "
+			"%zu dirty value%s flushed, %zu page%s written",
+			PLURAL(vb->stores), PLURAL(flushed), PLURAL(pages));
+	}
+
+	vb->stores = 0;
+}
+
+/**
+ * Record a successful STORE in the pending batch, committing it when it
+ * grows too large to wait for the next periodic synchronization.
+ */
+static void
+values_batch_add(void)
+{
+	if (++values_batch.stores >= VALUES_COMMIT_STORES)
+		values_batch_commit();
+}
+
 /**
  * Store DHT value sent out by remote node.
  *
@@ -1883,6 +1969,9 @@ values_store(const knode_t *kn, const dht_value_t *v, bool token)
 
 	status =  0 == v->length ? values_remove(kn, v) : values_publish(kn, v);
 
+	if (STORE_SC_OK == status)
+		values_batch_add();
+
 	g_assert_log(dbmw_count(db_rawdata) == (size_t) values_managed,
 		"rawdata count=%zu, values_managed=%d",
 		dbmw_count(db_rawdata), values_managed);
@@ -2125,13 +2214,14 @@ values_raw_purge(void *key, void *u_value, size_t u_len, void *data)
 }
 
 /**
- * Periodic DB synchronization.
+ * Periodic DB synchronization, also committing the pending batch of STOREs.
+ *
+ * The keys database is synchronized as part of the batch.
  */
 void
 values_sync(void)
 {
-	dbstore_sync_flush(db_valuedata);
-	dbstore_sync_flush(db_rawdata);
+	values_batch_commit();
 }
 
 /**
@@ -2259,6 +2349,8 @@ expired_free_k(const void *key, void *u_data)
 void G_COLD
 values_close(void)
 {
+	ZERO(&values_batch);
+
 	dbstore_close(db_valuedata, settings_dht_db_dir(), db_valbase);
 	dbstore_close(db_rawdata, settings_dht_db_dir(), db_rawbase);
 	dbstore_delete(db_expired);
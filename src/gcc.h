@@ -212,6 +212,19 @@
 #define G_COLD
 #endif	/* GCC >= 4.3 */
 
+/**
+ * A function tagged with G_TARGET() is compiled for the specified instruction
+ * set extensions (e.g. "avx2"), regardless of the compilation flags.  This
+ * allows CPU-specific code to be dispatched at runtime: such a routine must
+ * only be called once we know the running CPU supports these extensions.
+ */
+#if defined(HASATTRIBUTE) && HAS_GCC(4, 9)
+#define HAS_G_TARGET
+#define G_TARGET(x) __attribute__((target(x)))
+#else
+#define G_TARGET(x)
+#endif	/* GCC >= 4.9 */
+
 #if defined(HASATTRIBUTE) && HAS_GCC(3, 1)
 #define ALWAYS_INLINE __attribute__((always_inline))
 #else
@@ -166,6 +166,9 @@ struct dl_buffers {
 	slist_t *list;			/**< List of pmsg_t items */
 	size_t amount;			/**< Amount to buffer (extra is read-ahead) */
 	size_t held;			/**< Amount of data held in read buffers */
+	struct file_aio *aio;	/**< Pending asynchronous write, if any */
+	size_t inflight;		/**< Leading held data being written by `aio' */
+	uint rx_paused:1;		/**< Whether reception was disabled */
 };
 
 /**
@@ -26,6 +26,7 @@
 
 #include "common.h"
 
+#include "lib/erbtree.h"
 #include "lib/eslist.h"
 #include "lib/http_range.h"
 #include "lib/path.h"
@@ -172,6 +173,7 @@ typedef struct dl_file_info {
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
 	eslist_t chunklist;		/**< List of ranges within file */
+	erbtree_t chunktree;	/**< Same chunks, indexed by file range */
 	eslist_t available;		/**< List of ranges available, with source count */
 	http_rangeset_t *seen_on_network;  /**< Ranges available on network */
 	uint32 generation;		/**< Generation number, incremented on disk update */
@@ -206,6 +208,7 @@ typedef struct dl_file_info {
 	unsigned file_size_known:1;	/**< File size known? */
 	unsigned use_swarming:1;	/**< Use swarming? */
 	unsigned dirty:1;			/**< Does it need saving? */
+	unsigned journal:1;			/**< Needs a new fileinfo journal record? */
 	unsigned dirty_status:1;  	/**< Notify status change on next interval */
 	unsigned hashed:1;			/**< In hash tables? */
 	unsigned tth_check:1;		/**< TTH checking performed? */
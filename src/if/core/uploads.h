@@ -78,6 +78,8 @@ typedef struct gnet_upload_info {
 	filesize_t range_start;	/**< First byte to send, inclusive */
 	filesize_t range_end;	/**< Last byte to send, inclusive */
 	filesize_t available;	/**< Amount available for upload */
+	filesize_t zerocopy;	/**< Bytes sent without copying, via sendfile() */
+	filesize_t copied;		/**< Bytes copied from our buffers */
 
 	const char *name;		/**< Name of requested file (converted to UTF-8) */
 	const char *user_agent;	/**< Remote user agent (converted to UTF-8) */
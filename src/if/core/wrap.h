@@ -40,6 +40,16 @@
 
 enum wrap_io_magic { WRAP_IO_MAGIC = 0x40b20646 };
 
+/**
+ * A datagram for the sendmmsg() routine.
+ */
+typedef struct wrap_dgram {
+	const gnet_host_t *to;	/**< Destination of the datagram */
+	const void *data;		/**< Start of the datagram payload */
+	size_t len;				/**< Length of the payload */
+	ssize_t sent;			/**< Filled with the amount actually sent */
+} wrap_dgram_t;
+
 typedef struct wrap_io {
 	enum wrap_io_magic magic;
 	void *ctx;
@@ -49,6 +59,7 @@ typedef struct wrap_io {
 	ssize_t (*readv)(struct wrap_io *, iovec_t *, int);
 	ssize_t (*sendto)(struct wrap_io *, const gnet_host_t *,
 						const void *, size_t);
+	int (*sendmmsg)(struct wrap_io *, wrap_dgram_t *, int);
 	int (*flush)(struct wrap_io *);
 	int (*fd)(struct wrap_io *);
 	unsigned (*bufsize)(struct wrap_io *, enum socket_buftype);
@@ -58,6 +58,7 @@ typedef struct knode {
 	vendor_code_t vcode;		/**< Vendor code (vcode.u32 == 0 if unknown) */
 	uint32 rtt;					/**< Round-trip time in milliseconds */
 	uint32 flags;				/**< Operating flags */
+	uint32 slot;				/**< Slot among good nodes, when good */
 	host_addr_t addr;			/**< IP of the node */
 	knode_status_t status;		/**< Node status (good, stale, pending) */
 	uint16 port;				/**< Port of the node */
@@ -1,5 +1,5 @@
 /*
- * Generated on Tue Jul 18 15:56:05 2023 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Fri Oct 16 20:44:34 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -16,10 +16,17 @@
  */
 static const char *stats_symbols[] = {
 	"routing_errors",
-	"routing_table_chunks",
+	"routing_table_epochs",
 	"routing_table_capacity",
 	"routing_table_count",
+	"routing_table_rate",
+	"routing_table_lifetime",
+	"routing_table_expired_early",
+	"routing_table_misses",
 	"routing_transient_avoided",
+	"qrp_routed_queries",
+	"qrp_routing_ns",
+	"qrp_routing_max_ns",
 	"dups_with_higher_ttl",
 	"spam_sha1_hits",
 	"spam_name_hits",
@@ -30,6 +37,8 @@ static const char *stats_symbols[] = {
 	"spam_ip_held",
 	"local_searches",
 	"local_hits",
+	"query_match_offloaded",
+	"query_match_sync",
 	"local_partial_hits",
 	"local_whats_new_hits",
 	"local_query_hits",
@@ -121,6 +130,8 @@ static const char *stats_symbols[] = {
 	"udp_read_ahead_count_max",
 	"udp_read_ahead_bytes_max",
 	"udp_read_ahead_delay_max",
+	"udp_shard_queue_dropped",
+	"udp_shard_read_ahead_dropped",
 	"udp_fw2fw_pushes",
 	"udp_fw2fw_pushes_to_self",
 	"udp_fw2fw_pushes_patched",
@@ -135,6 +146,8 @@ static const char *stats_symbols[] = {
 	"udp_rx_compressed",
 	"udp_compression_attempts",
 	"udp_larger_hence_not_compressed",
+	"broadcast_deflate_shared",
+	"broadcast_deflate_saved",
 	"udp_sched_directly_sent_prio_data",
 	"udp_sched_directly_sent_prio_control",
 	"udp_sched_directly_sent_prio_urgent",
@@ -315,6 +328,8 @@ static const char *stats_symbols[] = {
 	"parq_queue_follow_ups",
 	"sha1_verifications",
 	"tth_verifications",
+	"verify_bytes_read",
+	"verify_bytes_hashed",
 	"qhit_seeding_of_orphan",
 	"upload_seeding_of_orphan",
 	"rudp_tx_bytes",
@@ -356,6 +371,20 @@ static const char *stats_symbols[] = {
 	"dht_lookup_rejected_node_on_proximity",
 	"dht_lookup_rejected_node_on_divergence",
 	"dht_lookup_fixed_node_contact",
+	"dht_lookup_alpha",
+	"dht_lookup_fast_nodes",
+	"dht_lookup_time_1s",
+	"dht_lookup_time_2s",
+	"dht_lookup_time_4s",
+	"dht_lookup_time_8s",
+	"dht_lookup_time_16s",
+	"dht_lookup_time_32s",
+	"dht_lookup_time_more",
+	"dht_lookup_hops_2",
+	"dht_lookup_hops_4",
+	"dht_lookup_hops_8",
+	"dht_lookup_hops_16",
+	"dht_lookup_hops_more",
 	"dht_keys_held",
 	"dht_cached_keys_held",
 	"dht_values_held",
@@ -379,6 +408,13 @@ static const char *stats_symbols[] = {
 	"dht_claimed_cached_secondary_keys",
 	"dht_published",
 	"dht_removed",
+	"dht_store_batches",
+	"dht_store_batched_values",
+	"dht_store_batch_max",
+	"dht_store_batch_average",
+	"dht_store_flushed_values",
+	"dht_store_flushed_pages",
+	"dht_store_write_amplification",
 	"dht_stale_replication",
 	"dht_replication",
 	"dht_republish",
@@ -408,6 +444,8 @@ static const char *stats_symbols[] = {
 	"dht_rpc_late_replies_received",
 	"dht_rpc_kuid_reply_mismatch",
 	"dht_rpc_recent_nodes_held",
+	"dht_rpc_average_rtt",
+	"dht_rpc_timeout_rate",
 	"dht_node_verifications",
 	"dht_publishing_attempts",
 	"dht_publishing_successful",
@@ -452,10 +490,17 @@ gnet_stats_general_to_string(gnr_stats_t x)
  */
 static const char *stats_text[] = {
 	N_("Routing errors"),
-	N_("Routing table chunks"),
+	N_("Routing table live epochs"),
 	N_("Routing table message capacity"),
 	N_("Routing table message count"),
+	N_("Routing table new messages per second"),
+	N_("Routing table route lifetime (seconds)"),
+	N_("Routing table messages expired before lifetime"),
+	N_("Replies not found in routing table"),
 	N_("Routing through transient node avoided"),
+	N_("Queries routed through QRP tables"),
+	N_("Nanoseconds spent routing queries through QRP"),
+	N_("Max nanoseconds spent routing a query through QRP"),
 	N_("Duplicates with higher TTL"),
 	N_("SPAM SHA1 database hits"),
 	N_("SPAM filename and size hits"),
@@ -466,6 +511,8 @@ static const char *stats_text[] = {
 	N_("SPAM spotted spamming IP addresses held"),
 	N_("Searches to local DB"),
 	N_("Hits on local DB"),
+	N_("Queries matched by the matching thread pool"),
+	N_("Queries matched synchronously, pool being busy"),
 	N_("Hits on local partial files"),
 	N_("Hits on \"what's new?\" queries"),
 	N_("Query hits received for local queries"),
@@ -557,6 +604,8 @@ static const char *stats_text[] = {
 	N_("UDP read-ahead datagram max count"),
 	N_("UDP read-ahead datagram max bytes"),
 	N_("UDP read-ahead datagram max delay"),
+	N_("UDP datagrams dropped by I/O threads: queue full"),
+	N_("UDP datagrams dropped by main thread: read-ahead full"),
 	N_("UDP push messages received for FW<->FW connections"),
 	N_("UDP push messages requesting FW<->FW connection with ourselves"),
 	N_("UDP push messages patched for FW<->FW connections"),
@@ -571,6 +620,8 @@ static const char *stats_text[] = {
 	N_("Compressed UDP messages received"),
 	N_("Candidates for UDP message compression"),
 	N_("Uncompressed UDP messages due to no gain"),
+	N_("Broadcast messages sent using a shared deflated block"),
+	N_("Broadcast bytes not deflated again thanks to sharing"),
 	N_("UDP scheduler directly sent (P_DATA)"),
 	N_("UDP scheduler directly sent (P_CONTROL)"),
 	N_("UDP scheduler directly sent (P_URGENT)"),
@@ -751,6 +802,8 @@ static const char *stats_text[] = {
 	N_("PARQ QUEUE follow-up requests received"),
 	N_("Launched SHA-1 file verifications"),
 	N_("Launched TTH file verifications"),
+	N_("Bytes read from disk for hash verifications"),
+	N_("Bytes processed by hash verifications (all digests)"),
 	N_("Re-seeding of orphan downloads through query hits"),
 	N_("Re-seeding of orphan downloads through upload requests"),
 	N_("RUDP sent bytes"),
@@ -792,6 +845,20 @@ static const char *stats_text[] = {
 	N_("DHT nodes rejected during lookup based on suspicious proximity"),
 	N_("DHT nodes rejected during lookup based on frequency divergence"),
 	N_("DHT node contact IP addresses fixed during lookup"),
+	N_("DHT lookup parallelism, as last adapted"),
+	N_("DHT lookup RPCs sent to faster nodes"),
+	N_("DHT lookups lasting up to 1 sec"),
+	N_("DHT lookups lasting 1 to 2 secs"),
+	N_("DHT lookups lasting 2 to 4 secs"),
+	N_("DHT lookups lasting 4 to 8 secs"),
+	N_("DHT lookups lasting 8 to 16 secs"),
+	N_("DHT lookups lasting 16 to 32 secs"),
+	N_("DHT lookups lasting more than 32 secs"),
+	N_("DHT lookups ending after up to 2 hops"),
+	N_("DHT lookups ending after 3 to 4 hops"),
+	N_("DHT lookups ending after 5 to 8 hops"),
+	N_("DHT lookups ending after 9 to 16 hops"),
+	N_("DHT lookups ending after more than 16 hops"),
 	N_("DHT keys held"),
 	N_("DHT cached keys held"),
 	N_("DHT values held"),
@@ -815,6 +882,13 @@ static const char *stats_text[] = {
 	N_("DHT claimed cached values via secondary keys"),
 	N_("DHT successfully received value publications"),
 	N_("DHT successfully received value removals"),
+	N_("DHT batches of received STOREs committed"),
+	N_("DHT received STOREs committed by batches"),
+	N_("DHT largest batch of committed STOREs"),
+	N_("DHT average batch of committed STOREs"),
+	N_("DHT dirty DB values flushed by STORE batches"),
+	N_("DHT DB pages written by STORE batches"),
+	N_("DHT DB pages written per 100 STOREs"),
 	N_("DHT replication of stale value avoided"),
 	N_("DHT replication of held values"),
 	N_("DHT republishing of held values"),
@@ -844,6 +918,8 @@ static const char *stats_text[] = {
 	N_("DHT RPC late replies received"),
 	N_("DHT RPC detected KUID mismatches on reply"),
 	N_("DHT RPC recent nodes held"),
+	N_("DHT RPC average round-trip time (ms)"),
+	N_("DHT RPC timeout rate (per thousand)"),
 	N_("DHT node verifications"),
 	N_("DHT publishing attempts"),
 	N_("DHT publishing ended successfully (all roots)"),
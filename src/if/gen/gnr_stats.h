@@ -1,5 +1,5 @@
 /*
- * Generated on Tue Jul 18 15:56:05 2023 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Fri Oct 16 20:44:34 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,14 +8,21 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 415
+ * Enum count: 453
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
-	GNR_ROUTING_TABLE_CHUNKS,
+	GNR_ROUTING_TABLE_EPOCHS,
 	GNR_ROUTING_TABLE_CAPACITY,
 	GNR_ROUTING_TABLE_COUNT,
+	GNR_ROUTING_TABLE_RATE,
+	GNR_ROUTING_TABLE_LIFETIME,
+	GNR_ROUTING_TABLE_EXPIRED_EARLY,
+	GNR_ROUTING_TABLE_MISSES,
 	GNR_ROUTING_TRANSIENT_AVOIDED,
+	GNR_QRP_ROUTED_QUERIES,
+	GNR_QRP_ROUTING_NS,
+	GNR_QRP_ROUTING_MAX_NS,
 	GNR_DUPS_WITH_HIGHER_TTL,
 	GNR_SPAM_SHA1_HITS,
 	GNR_SPAM_NAME_HITS,
@@ -26,6 +33,8 @@ typedef enum {
 	GNR_SPAM_IP_HELD,
 	GNR_LOCAL_SEARCHES,
 	GNR_LOCAL_HITS,
+	GNR_QUERY_MATCH_OFFLOADED,
+	GNR_QUERY_MATCH_SYNC,
 	GNR_LOCAL_PARTIAL_HITS,
 	GNR_LOCAL_WHATS_NEW_HITS,
 	GNR_LOCAL_QUERY_HITS,
@@ -117,6 +126,8 @@ typedef enum {
 	GNR_UDP_READ_AHEAD_COUNT_MAX,
 	GNR_UDP_READ_AHEAD_BYTES_MAX,
 	GNR_UDP_READ_AHEAD_DELAY_MAX,
+	GNR_UDP_SHARD_QUEUE_DROPPED,
+	GNR_UDP_SHARD_READ_AHEAD_DROPPED,
 	GNR_UDP_FW2FW_PUSHES,
 	GNR_UDP_FW2FW_PUSHES_TO_SELF,
 	GNR_UDP_FW2FW_PUSHES_PATCHED,
@@ -131,6 +142,8 @@ typedef enum {
 	GNR_UDP_RX_COMPRESSED,
 	GNR_UDP_COMPRESSION_ATTEMPTS,
 	GNR_UDP_LARGER_HENCE_NOT_COMPRESSED,
+	GNR_BROADCAST_DEFLATE_SHARED,
+	GNR_BROADCAST_DEFLATE_SAVED,
 	GNR_UDP_SCHED_DIRECTLY_SENT_PRIO_DATA,
 	GNR_UDP_SCHED_DIRECTLY_SENT_PRIO_CONTROL,
 	GNR_UDP_SCHED_DIRECTLY_SENT_PRIO_URGENT,
@@ -311,6 +324,8 @@ typedef enum {
 	GNR_PARQ_QUEUE_FOLLOW_UPS,
 	GNR_SHA1_VERIFICATIONS,
 	GNR_TTH_VERIFICATIONS,
+	GNR_VERIFY_BYTES_READ,
+	GNR_VERIFY_BYTES_HASHED,
 	GNR_QHIT_SEEDING_OF_ORPHAN,
 	GNR_UPLOAD_SEEDING_OF_ORPHAN,
 	GNR_RUDP_TX_BYTES,
@@ -352,6 +367,20 @@ typedef enum {
 	GNR_DHT_LOOKUP_REJECTED_NODE_ON_PROXIMITY,
 	GNR_DHT_LOOKUP_REJECTED_NODE_ON_DIVERGENCE,
 	GNR_DHT_LOOKUP_FIXED_NODE_CONTACT,
+	GNR_DHT_LOOKUP_ALPHA,
+	GNR_DHT_LOOKUP_FAST_NODES,
+	GNR_DHT_LOOKUP_TIME_1S,
+	GNR_DHT_LOOKUP_TIME_2S,
+	GNR_DHT_LOOKUP_TIME_4S,
+	GNR_DHT_LOOKUP_TIME_8S,
+	GNR_DHT_LOOKUP_TIME_16S,
+	GNR_DHT_LOOKUP_TIME_32S,
+	GNR_DHT_LOOKUP_TIME_MORE,
+	GNR_DHT_LOOKUP_HOPS_2,
+	GNR_DHT_LOOKUP_HOPS_4,
+	GNR_DHT_LOOKUP_HOPS_8,
+	GNR_DHT_LOOKUP_HOPS_16,
+	GNR_DHT_LOOKUP_HOPS_MORE,
 	GNR_DHT_KEYS_HELD,
 	GNR_DHT_CACHED_KEYS_HELD,
 	GNR_DHT_VALUES_HELD,
@@ -375,6 +404,13 @@ typedef enum {
 	GNR_DHT_CLAIMED_CACHED_SECONDARY_KEYS,
 	GNR_DHT_PUBLISHED,
 	GNR_DHT_REMOVED,
+	GNR_DHT_STORE_BATCHES,
+	GNR_DHT_STORE_BATCHED_VALUES,
+	GNR_DHT_STORE_BATCH_MAX,
+	GNR_DHT_STORE_BATCH_AVERAGE,
+	GNR_DHT_STORE_FLUSHED_VALUES,
+	GNR_DHT_STORE_FLUSHED_PAGES,
+	GNR_DHT_STORE_WRITE_AMPLIFICATION,
 	GNR_DHT_STALE_REPLICATION,
 	GNR_DHT_REPLICATION,
 	GNR_DHT_REPUBLISH,
@@ -404,6 +440,8 @@ typedef enum {
 	GNR_DHT_RPC_LATE_REPLIES_RECEIVED,
 	GNR_DHT_RPC_KUID_REPLY_MISMATCH,
 	GNR_DHT_RPC_RECENT_NODES_HELD,
+	GNR_DHT_RPC_AVERAGE_RTT,
+	GNR_DHT_RPC_TIMEOUT_RATE,
 	GNR_DHT_NODE_VERIFICATIONS,
 	GNR_DHT_PUBLISHING_ATTEMPTS,
 	GNR_DHT_PUBLISHING_SUCCESSFUL,
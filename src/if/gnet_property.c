@@ -1164,6 +1164,32 @@ guint64  gnet_property_variable_bc_loopback_in		= 0;
 static const guint64  gnet_property_variable_bc_loopback_in_default = 0;
 guint64  gnet_property_variable_bc_private_in		= 0;
 static const guint64  gnet_property_variable_bc_private_in_default = 0;
+guint32  gnet_property_variable_verify_threads		= 0;
+static const guint32  gnet_property_variable_verify_threads_default = 0;
+gboolean  gnet_property_variable_share_incremental_rescan		= TRUE;
+static const gboolean  gnet_property_variable_share_incremental_rescan_default = TRUE;
+gboolean  gnet_property_variable_share_library_index		= TRUE;
+static const gboolean  gnet_property_variable_share_library_index_default = TRUE;
+gboolean  gnet_property_variable_search_posting_lists		= TRUE;
+static const gboolean  gnet_property_variable_search_posting_lists_default = TRUE;
+guint32  gnet_property_variable_search_match_threads		= 0;
+static const guint32  gnet_property_variable_search_match_threads_default = 0;
+guint32  gnet_property_variable_disk_io_threads		= 2;
+static const guint32  gnet_property_variable_disk_io_threads_default = 2;
+gboolean  gnet_property_variable_disk_io_uring		= TRUE;
+static const gboolean  gnet_property_variable_disk_io_uring_default = TRUE;
+guint32  gnet_property_variable_compression_threads		= 0;
+static const guint32  gnet_property_variable_compression_threads_default = 0;
+gboolean  gnet_property_variable_deflate_shared_broadcast		= FALSE;
+static const gboolean  gnet_property_variable_deflate_shared_broadcast_default = FALSE;
+guint32  gnet_property_variable_udp_batch_size		= 16;
+static const guint32  gnet_property_variable_udp_batch_size_default = 16;
+guint32  gnet_property_variable_io_threads		= 0;
+static const guint32  gnet_property_variable_io_threads_default = 0;
+gboolean  gnet_property_variable_udp_edge_triggered		= TRUE;
+static const gboolean  gnet_property_variable_udp_edge_triggered_default = TRUE;
+gboolean  gnet_property_variable_tls_kernel_offload		= TRUE;
+static const gboolean  gnet_property_variable_tls_kernel_offload_default = TRUE;
 
 static prop_set_t *gnet_property;
 
@@ -11778,6 +11804,271 @@ gnet_prop_init(void) {
 	gnet_property->props[503].data.guint64.max	= (guint64) -1;
 	gnet_property->props[503].data.guint64.min	= 0x0000000000000000;
 
+
+	/*
+	 * PROP_VERIFY_THREADS:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[504].name = "verify_threads";
+	gnet_property->props[504].desc = _("Amount of threads in the file verification pool, shared by all the hash computations.  When set to 0, one thread per CPU is used.  Changes are taken into account at the next startup.");
+	gnet_property->props[504].ev_changed = event_new("verify_threads_changed");
+	gnet_property->props[504].save = TRUE;
+	gnet_property->props[504].internal = FALSE;
+	gnet_property->props[504].vector_size = 1;
+	mutex_init(&gnet_property->props[504].lock);
+
+	/* Type specific data: */
+	gnet_property->props[504].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[504].data.guint32.def	= (void *) &gnet_property_variable_verify_threads_default;
+	gnet_property->props[504].data.guint32.value = (void *) &gnet_property_variable_verify_threads;
+	gnet_property->props[504].data.guint32.choices = NULL;
+	gnet_property->props[504].data.guint32.max	= 0x00000040;
+	gnet_property->props[504].data.guint32.min	= 0x00000000;
+
+
+	/*
+	 * PROP_SHARE_INCREMENTAL_RESCAN:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[505].name = "share_incremental_rescan";
+	gnet_property->props[505].desc = _("Whether the library should be kept up-to-date by monitoring the shared directories for changes, applying only the differences, instead of relying solely on full rescans.  This requires support from the operating system and takes effect at the next full rescan.");
+	gnet_property->props[505].ev_changed = event_new("share_incremental_rescan_changed");
+	gnet_property->props[505].save = TRUE;
+	gnet_property->props[505].internal = FALSE;
+	gnet_property->props[505].vector_size = 1;
+	mutex_init(&gnet_property->props[505].lock);
+
+	/* Type specific data: */
+	gnet_property->props[505].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[505].data.boolean.def	= (void *) &gnet_property_variable_share_incremental_rescan_default;
+	gnet_property->props[505].data.boolean.value = (void *) &gnet_property_variable_share_incremental_rescan;
+
+
+	/*
+	 * PROP_SHARE_LIBRARY_INDEX:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[506].name = "share_library_index";
+	gnet_property->props[506].desc = _("Whether to persist the library index to disk, so that files can be served right away at startup whilst the library is being checked against the filesystem in the background.");
+	gnet_property->props[506].ev_changed = event_new("share_library_index_changed");
+	gnet_property->props[506].save = TRUE;
+	gnet_property->props[506].internal = FALSE;
+	gnet_property->props[506].vector_size = 1;
+	mutex_init(&gnet_property->props[506].lock);
+
+	/* Type specific data: */
+	gnet_property->props[506].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[506].data.boolean.def	= (void *) &gnet_property_variable_share_library_index_default;
+	gnet_property->props[506].data.boolean.value = (void *) &gnet_property_variable_share_library_index;
+
+
+	/*
+	 * PROP_SEARCH_POSTING_LISTS:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[507].name = "search_posting_lists";
+	gnet_property->props[507].desc = _("Whether to also index shared file names by trigram, using compressed posting lists.  Queries made of words of at least 3 characters then only examine the files holding all these trigrams, instead of scanning the smallest two-character bin.  This requires more memory and is taken into account at the next library rescan.");
+	gnet_property->props[507].ev_changed = event_new("search_posting_lists_changed");
+	gnet_property->props[507].save = TRUE;
+	gnet_property->props[507].internal = FALSE;
+	gnet_property->props[507].vector_size = 1;
+	mutex_init(&gnet_property->props[507].lock);
+
+	/* Type specific data: */
+	gnet_property->props[507].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[507].data.boolean.def	= (void *) &gnet_property_variable_search_posting_lists_default;
+	gnet_property->props[507].data.boolean.value = (void *) &gnet_property_variable_search_posting_lists;
+
+
+	/*
+	 * PROP_SEARCH_MATCH_THREADS:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[508].name = "search_match_threads";
+	gnet_property->props[508].desc = _("Amount of threads used to match incoming queries against the library, away from the main thread which then only builds and sends the query hits.  When set to 0, queries are matched synchronously by the main thread.  Changes are taken into account at the next startup.");
+	gnet_property->props[508].ev_changed = event_new("search_match_threads_changed");
+	gnet_property->props[508].save = TRUE;
+	gnet_property->props[508].internal = FALSE;
+	gnet_property->props[508].vector_size = 1;
+	mutex_init(&gnet_property->props[508].lock);
+
+	/* Type specific data: */
+	gnet_property->props[508].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[508].data.guint32.def	= (void *) &gnet_property_variable_search_match_threads_default;
+	gnet_property->props[508].data.guint32.value = (void *) &gnet_property_variable_search_match_threads;
+	gnet_property->props[508].data.guint32.choices = NULL;
+	gnet_property->props[508].data.guint32.max	= 0x00000020;
+	gnet_property->props[508].data.guint32.min	= 0x00000000;
+
+
+	/*
+	 * PROP_DISK_IO_THREADS:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[509].name = "disk_io_threads";
+	gnet_property->props[509].desc = _("Amount of threads used to perform disk I/O for downloads and uploads asynchronously, away from the main thread.  When io_uring is available and enabled, a single thread is used to handle the requests that cannot be queued to the kernel.  When set to 0, disk I/O is synchronous.  Changes are taken into account at the next startup.");
+	gnet_property->props[509].ev_changed = event_new("disk_io_threads_changed");
+	gnet_property->props[509].save = TRUE;
+	gnet_property->props[509].internal = FALSE;
+	gnet_property->props[509].vector_size = 1;
+	mutex_init(&gnet_property->props[509].lock);
+
+	/* Type specific data: */
+	gnet_property->props[509].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[509].data.guint32.def	= (void *) &gnet_property_variable_disk_io_threads_default;
+	gnet_property->props[509].data.guint32.value = (void *) &gnet_property_variable_disk_io_threads;
+	gnet_property->props[509].data.guint32.choices = NULL;
+	gnet_property->props[509].data.guint32.max	= 0x00000010;
+	gnet_property->props[509].data.guint32.min	= 0x00000000;
+
+
+	/*
+	 * PROP_DISK_IO_URING:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[510].name = "disk_io_uring";
+	gnet_property->props[510].desc = _("Whether the Linux io_uring interface should be used to perform asynchronous disk I/O, when available.  Changes are taken into account at the next startup.");
+	gnet_property->props[510].ev_changed = event_new("disk_io_uring_changed");
+	gnet_property->props[510].save = TRUE;
+	gnet_property->props[510].internal = FALSE;
+	gnet_property->props[510].vector_size = 1;
+	mutex_init(&gnet_property->props[510].lock);
+
+	/* Type specific data: */
+	gnet_property->props[510].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[510].data.boolean.def	= (void *) &gnet_property_variable_disk_io_uring_default;
+	gnet_property->props[510].data.boolean.value = (void *) &gnet_property_variable_disk_io_uring;
+
+
+	/*
+	 * PROP_COMPRESSION_THREADS:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[511].name = "compression_threads";
+	gnet_property->props[511].desc = _("Amount of threads used to compress and decompress the traffic of Gnutella connections, away from the main thread.  Each connection has at most one compression job at a time, so that data remain ordered.  When set to 0, compression is done by the main thread.  Changes are taken into account at the next startup.");
+	gnet_property->props[511].ev_changed = event_new("compression_threads_changed");
+	gnet_property->props[511].save = TRUE;
+	gnet_property->props[511].internal = FALSE;
+	gnet_property->props[511].vector_size = 1;
+	mutex_init(&gnet_property->props[511].lock);
+
+	/* Type specific data: */
+	gnet_property->props[511].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[511].data.guint32.def	= (void *) &gnet_property_variable_compression_threads_default;
+	gnet_property->props[511].data.guint32.value = (void *) &gnet_property_variable_compression_threads;
+	gnet_property->props[511].data.guint32.choices = NULL;
+	gnet_property->props[511].data.guint32.max	= 0x00000010;
+	gnet_property->props[511].data.guint32.min	= 0x00000000;
+
+
+	/*
+	 * PROP_DEFLATE_SHARED_BROADCAST:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[512].name = "deflate_shared_broadcast";
+	gnet_property->props[512].desc = _("Whether broadcast messages relayed to several compressed Gnutella connections should be deflated only once, the resulting block being spliced into the compressed stream of each connection after a full flush.  This saves CPU on ultrapeers at the expense of a slightly lower compression ratio.");
+	gnet_property->props[512].ev_changed = event_new("deflate_shared_broadcast_changed");
+	gnet_property->props[512].save = TRUE;
+	gnet_property->props[512].internal = FALSE;
+	gnet_property->props[512].vector_size = 1;
+	mutex_init(&gnet_property->props[512].lock);
+
+	/* Type specific data: */
+	gnet_property->props[512].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[512].data.boolean.def	= (void *) &gnet_property_variable_deflate_shared_broadcast_default;
+	gnet_property->props[512].data.boolean.value = (void *) &gnet_property_variable_deflate_shared_broadcast;
+
+
+	/*
+	 * PROP_UDP_BATCH_SIZE:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[513].name = "udp_batch_size";
+	gnet_property->props[513].desc = _("Maximum amount of UDP datagrams received or sent with a single system call, when the system supports recvmmsg and sendmmsg. Setting it to 1 disables batched UDP I/O.");
+	gnet_property->props[513].ev_changed = event_new("udp_batch_size_changed");
+	gnet_property->props[513].save = TRUE;
+	gnet_property->props[513].internal = FALSE;
+	gnet_property->props[513].vector_size = 1;
+	mutex_init(&gnet_property->props[513].lock);
+
+	/* Type specific data: */
+	gnet_property->props[513].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[513].data.guint32.def	= (void *) &gnet_property_variable_udp_batch_size_default;
+	gnet_property->props[513].data.guint32.value = (void *) &gnet_property_variable_udp_batch_size;
+	gnet_property->props[513].data.guint32.choices = NULL;
+	gnet_property->props[513].data.guint32.max	= 0x00000020;
+	gnet_property->props[513].data.guint32.min	= 0x00000001;
+
+
+	/*
+	 * PROP_IO_THREADS:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[514].name = "io_threads";
+	gnet_property->props[514].desc = _("Amount of I/O threads reading the UDP sockets, 0 meaning that datagrams are read by the main thread.  Taken into account at the next restart.");
+	gnet_property->props[514].ev_changed = event_new("io_threads_changed");
+	gnet_property->props[514].save = TRUE;
+	gnet_property->props[514].internal = FALSE;
+	gnet_property->props[514].vector_size = 1;
+	mutex_init(&gnet_property->props[514].lock);
+
+	/* Type specific data: */
+	gnet_property->props[514].type				= PROP_TYPE_GUINT32;
+	gnet_property->props[514].data.guint32.def	= (void *) &gnet_property_variable_io_threads_default;
+	gnet_property->props[514].data.guint32.value = (void *) &gnet_property_variable_io_threads;
+	gnet_property->props[514].data.guint32.choices = NULL;
+	gnet_property->props[514].data.guint32.max	= 0x0000000f;
+	gnet_property->props[514].data.guint32.min	= 0x00000000;
+
+
+	/*
+	 * PROP_UDP_EDGE_TRIGGERED:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[515].name = "udp_edge_triggered";
+	gnet_property->props[515].desc = _("Whether UDP sockets should be monitored edge-triggered when epoll() is used, the datagrams being read until the kernel queue is empty.  Taken into account at the next restart.");
+	gnet_property->props[515].ev_changed = event_new("udp_edge_triggered_changed");
+	gnet_property->props[515].save = TRUE;
+	gnet_property->props[515].internal = FALSE;
+	gnet_property->props[515].vector_size = 1;
+	mutex_init(&gnet_property->props[515].lock);
+
+	/* Type specific data: */
+	gnet_property->props[515].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[515].data.boolean.def	= (void *) &gnet_property_variable_udp_edge_triggered_default;
+	gnet_property->props[515].data.boolean.value = (void *) &gnet_property_variable_udp_edge_triggered;
+
+
+	/*
+	 * PROP_TLS_KERNEL_OFFLOAD:
+	 *
+	 * General data:
+	 */
+	gnet_property->props[516].name = "tls_kernel_offload";
+	gnet_property->props[516].desc = _("Whether encryption of outgoing TLS records should be handed to the kernel once the TLS handshake is done, when supported by the system.  This allows files to be sent with sendfile() to TLS peers.  Only applies to new connections.");
+	gnet_property->props[516].ev_changed = event_new("tls_kernel_offload_changed");
+	gnet_property->props[516].save = TRUE;
+	gnet_property->props[516].internal = FALSE;
+	gnet_property->props[516].vector_size = 1;
+	mutex_init(&gnet_property->props[516].lock);
+
+	/* Type specific data: */
+	gnet_property->props[516].type				= PROP_TYPE_BOOLEAN;
+	gnet_property->props[516].data.boolean.def	= (void *) &gnet_property_variable_tls_kernel_offload_default;
+	gnet_property->props[516].data.boolean.value = (void *) &gnet_property_variable_tls_kernel_offload;
+
 	gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
 	for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
 		htable_insert(gnet_property->by_name,
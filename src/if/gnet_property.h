@@ -540,6 +540,19 @@ typedef enum {
 	PROP_BC_DHT_IN,
 	PROP_BC_LOOPBACK_IN,
 	PROP_BC_PRIVATE_IN,
+	PROP_VERIFY_THREADS,
+	PROP_SHARE_INCREMENTAL_RESCAN,
+	PROP_SHARE_LIBRARY_INDEX,
+	PROP_SEARCH_POSTING_LISTS,
+	PROP_SEARCH_MATCH_THREADS,
+	PROP_DISK_IO_THREADS,
+	PROP_DISK_IO_URING,
+	PROP_COMPRESSION_THREADS,
+	PROP_DEFLATE_SHARED_BROADCAST,
+	PROP_UDP_BATCH_SIZE,
+	PROP_IO_THREADS,
+	PROP_UDP_EDGE_TRIGGERED,
+	PROP_TLS_KERNEL_OFFLOAD,
 	GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -555,6 +555,19 @@ extern const guint64	gnet_property_variable_bc_dht_in;
 extern const guint64	gnet_property_variable_bc_loopback_in;
 extern const guint64	gnet_property_variable_bc_private_in;
 
+extern const guint32	gnet_property_variable_verify_threads;
+extern const gboolean	gnet_property_variable_share_incremental_rescan;
+extern const gboolean	gnet_property_variable_share_library_index;
+extern const gboolean	gnet_property_variable_search_posting_lists;
+extern const guint32	gnet_property_variable_search_match_threads;
+extern const guint32	gnet_property_variable_disk_io_threads;
+extern const gboolean	gnet_property_variable_disk_io_uring;
+extern const guint32	gnet_property_variable_compression_threads;
+extern const gboolean	gnet_property_variable_deflate_shared_broadcast;
+extern const guint32	gnet_property_variable_udp_batch_size;
+extern const guint32	gnet_property_variable_io_threads;
+extern const gboolean	gnet_property_variable_udp_edge_triggered;
+extern const gboolean	gnet_property_variable_tls_kernel_offload;
 
 prop_set_t *gnet_prop_init(void);
 void gnet_prop_shutdown(void);
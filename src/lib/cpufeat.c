@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Runtime detection of CPU instruction set extensions.
+ *
+ * This is used to select, at runtime, accelerated versions of the routines
+ * that are critical for performance, e.g. the hashing kernels.  The portable
+ * version is always kept around and used when the CPU lacks the extension,
+ * or when the code could not be compiled for it.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "cpufeat.h"
+
+#ifdef HAS_CPUFEAT_X86
+#include <cpuid.h>
+#endif
+
+#include "once.h"
+
+#include "override.h"			/* Must be the last header included */
+
+static uint cpufeat_flags;
+
+#ifdef HAS_CPUFEAT_X86
+/**
+ * Read the extended control register XCR0, to know which register states
+ * are saved by the OS on context switches.
+ */
+static uint64
+cpufeat_xgetbv(void)
+{
+	uint32 lo, hi;
+
+	/* The "xgetbv" opcode, for assemblers that do not know about it */
+	__asm__ __volatile__(".byte 0x0f, 0x01, 0xd0"
+		: "=a" (lo), "=d" (hi) : "c" (0));
+
+	return ((uint64) hi << 32) | lo;
+}
+
+/**
+ * Probe the CPU for the extensions we know about.
+ */
+static void
+cpufeat_probe(void)
+{
+	uint eax, ebx, ecx, edx, max;
+	uint flags = 0;
+
+	max = __get_cpuid_max(0, NULL);
+	if (max < 1)
+		return;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+
+	if (ecx & bit_SSSE3)
+		flags |= CPUFEAT_SSSE3;
+	if (ecx & bit_SSE4_1)
+		flags |= CPUFEAT_SSE4_1;
+
+	if (max >= 7) {
+		/*
+		 * AVX2 requires AVX, and the OS to save the YMM registers, which it
+		 * tells us through the OSXSAVE flag and the XCR0 register (bits 1
+		 * and 2 for the SSE and AVX states).  XGETBV must not be used when
+		 * OSXSAVE is not set, since the instruction would fault.
+		 */
+
+		bool ymm = (ecx & bit_OSXSAVE) && (ecx & bit_AVX) &&
+			0x6 == (cpufeat_xgetbv() & 0x6);
+
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+		if (ymm && (ebx & (1U << 5)))		/* AVX2 */
+			flags |= CPUFEAT_AVX2;
+		if (ebx & (1U << 29))				/* SHA */
+			flags |= CPUFEAT_SHA;
+	}
+
+	cpufeat_flags = flags;
+}
+#else	/* !HAS_CPUFEAT_X86 */
+static void
+cpufeat_probe(void)
+{
+	/* Nothing to probe, no CPU-specific code is compiled */
+}
+#endif	/* HAS_CPUFEAT_X86 */
+
+/**
+ * Get the set of supported CPU extensions.
+ *
+ * @return a combination of CPUFEAT_* flags.
+ */
+uint
+cpufeat_get(void)
+{
+	static once_flag_t probed;
+
+	ONCE_FLAG_RUN(probed, cpufeat_probe);
+
+	return cpufeat_flags;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
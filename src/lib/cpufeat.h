@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Runtime detection of CPU instruction set extensions.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _cpufeat_h_
+#define _cpufeat_h_
+
+/*
+ * Instruction set extensions we may want to use when available.
+ */
+#define CPUFEAT_SSSE3	(1U << 0)		/**< Supplemental SSE3 */
+#define CPUFEAT_SSE4_1	(1U << 1)		/**< SSE 4.1 */
+#define CPUFEAT_AVX2	(1U << 2)		/**< AVX2, with OS support for YMM */
+#define CPUFEAT_SHA		(1U << 3)		/**< SHA extensions (SHA-NI) */
+
+/*
+ * Whether we can compile CPU-specific x86 code, to be dispatched at runtime.
+ */
+#if defined(HAS_G_TARGET) && (defined(__x86_64__) || defined(__i386__))
+#define HAS_CPUFEAT_X86
+#endif
+
+/*
+ * Public interface.
+ */
+
+uint cpufeat_get(void);
+
+/**
+ * @return whether the CPU supports all the extensions given in the mask.
+ */
+static inline bool
+cpufeat_has(uint mask)
+{
+	return mask == (cpufeat_get() & mask);
+}
+
+#endif /* _cpufeat_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
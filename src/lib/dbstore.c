@@ -238,8 +238,10 @@ dbstore_open(const char *name, const char *dir, const char *base,
 
 /**
  * Synchronize a DBMW database, flushing its SDBM cache.
+ *
+ * @return amount of SDBM pages written, 0 on error.
  */
-void
+size_t
 dbstore_sync(dbmw_t *dw)
 {
 	ssize_t n;
@@ -248,16 +250,21 @@ dbstore_sync(dbmw_t *dw)
 	if (-1 == n) {
 		g_warning("DBSTORE could not synchronize DBMW \"%s\": %m",
 			dbmw_name(dw));
+		return 0;
 	} else if (n && dbstore_debug > 1) {
 		g_debug("DBSTORE flushed %u SDBM page%s in DBMW \"%s\"",
 			(unsigned) PLURAL(n), dbmw_name(dw));
 	}
+
+	return n;
 }
 
 /**
  * Synchronize a DBMW database, flushing its local cache.
+ *
+ * @return amount of dirty values flushed, 0 on error.
  */
-void
+size_t
 dbstore_flush(dbmw_t *dw)
 {
 	ssize_t n;
@@ -266,10 +273,13 @@ dbstore_flush(dbmw_t *dw)
 	if (-1 == n) {
 		g_warning("DBSTORE could not flush cache for DBMW \"%s\": %m",
 			dbmw_name(dw));
+		return 0;
 	} else if (n && dbstore_debug > 1) {
 		g_debug("DBSTORE flushed %u dirty value%s in DBMW \"%s\"",
 			(unsigned) PLURAL(n), dbmw_name(dw));
 	}
+
+	return n;
 }
 
 /**
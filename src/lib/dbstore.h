@@ -79,8 +79,8 @@ dbmw_t *dbstore_open(const char *name, const char *dir, const char *base,
 	size_t cache_size, hash_fn_t hash_func, eq_fn_t eq_func,
 	bool incore);
 
-void dbstore_sync(dbmw_t *dw);
-void dbstore_flush(dbmw_t *dw);
+size_t dbstore_sync(dbmw_t *dw);
+size_t dbstore_flush(dbmw_t *dw);
 void dbstore_sync_flush(dbmw_t *dw);
 void dbstore_close(dbmw_t *dw, const char *dir, const char *base);
 void dbstore_delete(dbmw_t *dw);
@@ -0,0 +1,465 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Directory watcher.
+ *
+ * Unlike the file watcher, which periodically polls the modification time
+ * of a few files, this relies on the kernel to notify us about entries being
+ * added, removed or rewritten in a set of directories.  It is only available
+ * when the system supports inotify(): dirwatch_new() returns NULL otherwise
+ * and the caller has to fall back to scanning the directories itself.
+ *
+ * Directories are not watched recursively: each directory of interest must be
+ * explicitly added.  When a sub-directory is removed or moved away, all the
+ * watched directories below it are automatically forgotten.
+ *
+ * Events are dispatched from the I/O event loop, hence a watcher must only be
+ * used from the thread running that loop, i.e. the main thread.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "dirwatch.h"
+
+#ifdef HAS_INOTIFY
+#include <sys/inotify.h>
+#endif
+
+#include "atoms.h"
+#include "fd.h"
+#include "halloc.h"
+#include "htable.h"
+#include "inputevt.h"
+#include "misc.h"
+#include "path.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#ifdef HAS_INOTIFY
+
+#define DIRWATCH_MASK \
+	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+	 IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+#define DIRWATCH_BUFSIZE	(16 * 1024)	/**< Size of reading buffer */
+#define DIRWATCH_READS		16			/**< Max reads per I/O event */
+
+enum dirwatch_magic { DIRWATCH_MAGIC = 0x2d1f5e93 };
+
+/**
+ * A directory watcher.
+ */
+struct dirwatch {
+	enum dirwatch_magic magic;
+	int fd;					/**< The inotify file descriptor */
+	uint event_id;			/**< I/O event ID, for the inotify descriptor */
+	htable_t *by_wd;		/**< watch descriptor -> directory (atom) */
+	htable_t *by_dir;		/**< directory (atom) -> watch descriptor */
+	dirwatch_cb_t cb;		/**< Callback to invoke on changes */
+	void *udata;			/**< User-supplied callback argument */
+};
+
+static inline void
+dirwatch_check(const struct dirwatch * const dw)
+{
+	g_assert(dw != NULL);
+	g_assert(DIRWATCH_MAGIC == dw->magic);
+}
+
+/**
+ * Forget about watch descriptor, which the kernel has already removed.
+ */
+static void
+dirwatch_forget(dirwatch_t *dw, int wd)
+{
+	const char *dir;
+
+	dir = htable_lookup(dw->by_wd, int_to_pointer(wd));
+	if (NULL == dir)
+		return;
+
+	htable_remove(dw->by_wd, int_to_pointer(wd));
+	htable_remove(dw->by_dir, dir);
+	atom_str_free(dir);
+}
+
+struct dirwatch_tree {
+	dirwatch_t *dw;
+	const char *dir;
+	size_t len;
+};
+
+/**
+ * htable_foreach_remove() callback to remove watches on a whole tree.
+ */
+static bool
+dirwatch_remove_tree_item(const void *key, void *value, void *data)
+{
+	const char *dir = key;
+	int wd = pointer_to_int(value);
+	struct dirwatch_tree *dt = data;
+
+	if (0 != strncmp(dir, dt->dir, dt->len))
+		return FALSE;
+
+	if ('\0' != dir[dt->len] && !is_dir_separator(dir[dt->len]))
+		return FALSE;
+
+	inotify_rm_watch(dt->dw->fd, wd);
+	htable_remove(dt->dw->by_wd, value);
+	atom_str_free(dir);
+
+	return TRUE;
+}
+
+/**
+ * Stop watching directory and all the watched directories below it.
+ */
+static void
+dirwatch_remove_tree(dirwatch_t *dw, const char *dir)
+{
+	struct dirwatch_tree dt;
+
+	dt.dw = dw;
+	dt.dir = dir;
+	dt.len = strlen(dir);
+
+	htable_foreach_remove(dw->by_dir, dirwatch_remove_tree_item, &dt);
+}
+
+/**
+ * Dispatch a single inotify event.
+ */
+static void
+dirwatch_dispatch(dirwatch_t *dw, const struct inotify_event *ie)
+{
+	const char *dir, *name;
+	bool isdir;
+
+	if (ie->mask & IN_Q_OVERFLOW) {
+		(*dw->cb)(dw->udata, DIRWATCH_OVERFLOW, NULL, NULL, FALSE);
+		return;
+	}
+
+	dir = htable_lookup(dw->by_wd, int_to_pointer(ie->wd));
+	if (NULL == dir)
+		return;			/* Watch was removed, stale event */
+
+	if (ie->mask & IN_IGNORED) {
+		dirwatch_forget(dw, ie->wd);
+		return;
+	}
+
+	/*
+	 * Grab our own reference on the directory name since the callback
+	 * may decide to stop watching it.
+	 */
+
+	dir = atom_str_get(dir);
+	name = 0 == ie->len ? NULL : ie->name;
+	isdir = booleanize(ie->mask & IN_ISDIR);
+
+	if (ie->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+		dirwatch_remove_tree(dw, dir);
+		(*dw->cb)(dw->udata, DIRWATCH_GONE, dir, NULL, TRUE);
+	} else if (NULL == name) {
+		/* Ignore, all other events must concern an entry */
+	} else if (ie->mask & (IN_CREATE | IN_MOVED_TO)) {
+		(*dw->cb)(dw->udata, DIRWATCH_ADDED, dir, name, isdir);
+	} else if (ie->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		if (isdir) {
+			char *path = make_pathname(dir, name);
+			dirwatch_remove_tree(dw, path);
+			HFREE_NULL(path);
+		}
+		(*dw->cb)(dw->udata, DIRWATCH_REMOVED, dir, name, isdir);
+	} else if (ie->mask & IN_CLOSE_WRITE) {
+		(*dw->cb)(dw->udata, DIRWATCH_CHANGED, dir, name, isdir);
+	}
+
+	atom_str_free(dir);
+}
+
+/**
+ * I/O callback invoked when the inotify descriptor has pending events.
+ */
+static void
+dirwatch_read(void *data, int unused_source, inputevt_cond_t cond)
+{
+	dirwatch_t *dw = data;
+	union {
+		struct inotify_event ie;
+		char buf[DIRWATCH_BUFSIZE];
+	} u;
+	int i;
+
+	dirwatch_check(dw);
+	(void) unused_source;
+
+	if G_UNLIKELY(cond & INPUT_EVENT_EXCEPTION) {
+		s_warning("%s(): exception on inotify descriptor #%d",
+			G_STRFUNC, dw->fd);
+		(*dw->cb)(dw->udata, DIRWATCH_OVERFLOW, NULL, NULL, FALSE);
+		return;
+	}
+
+	for (i = 0; i < DIRWATCH_READS; i++) {
+		ssize_t r;
+		size_t offset;
+
+		r = read(dw->fd, u.buf, sizeof u.buf);
+
+		if (-1 == r) {
+			if (!is_temporary_error(errno)) {
+				s_warning("%s(): cannot read inotify descriptor #%d: %m",
+					G_STRFUNC, dw->fd);
+				(*dw->cb)(dw->udata, DIRWATCH_OVERFLOW, NULL, NULL, FALSE);
+			}
+			return;
+		}
+
+		for (offset = 0; offset < UNSIGNED(r); /* empty */) {
+			const struct inotify_event *ie = (void *) &u.buf[offset];
+
+			dirwatch_dispatch(dw, ie);
+			offset += sizeof *ie + ie->len;
+		}
+	}
+}
+
+/**
+ * Create a new directory watcher.
+ *
+ * @param cb		the callback to invoke when watched directories change
+ * @param udata		additional user data to pass to the callback
+ *
+ * @return a new watcher, or NULL if directory watching is not supported.
+ */
+dirwatch_t *
+dirwatch_new(dirwatch_cb_t cb, void *udata)
+{
+	dirwatch_t *dw;
+	int fd;
+
+	g_assert(cb != NULL);
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (-1 == fd) {
+		s_warning("%s(): cannot create inotify descriptor: %m", G_STRFUNC);
+		return NULL;
+	}
+
+	WALLOC0(dw);
+	dw->magic = DIRWATCH_MAGIC;
+	dw->fd = fd;
+	dw->cb = cb;
+	dw->udata = udata;
+	dw->by_wd = htable_create(HASH_KEY_SELF, 0);
+	dw->by_dir = htable_create(HASH_KEY_STRING, 0);
+	dw->event_id = inputevt_add(fd, INPUT_EVENT_RX, dirwatch_read, dw);
+
+	return dw;
+}
+
+/**
+ * htable_foreach() callback to free directory atoms.
+ */
+static void
+dirwatch_free_dir(const void *key, void *unused_value, void *unused_data)
+{
+	(void) unused_value;
+	(void) unused_data;
+
+	atom_str_free(key);
+}
+
+/**
+ * Free directory watcher and nullify its pointer.
+ */
+void
+dirwatch_free_null(dirwatch_t **dw_ptr)
+{
+	dirwatch_t *dw = *dw_ptr;
+
+	if (dw != NULL) {
+		dirwatch_check(dw);
+
+		inputevt_remove(&dw->event_id);
+		fd_close(&dw->fd);
+		htable_foreach(dw->by_dir, dirwatch_free_dir, NULL);
+		htable_free_null(&dw->by_dir);
+		htable_free_null(&dw->by_wd);
+		dw->magic = 0;
+		WFREE(dw);
+		*dw_ptr = NULL;
+	}
+}
+
+/**
+ * Start watching a directory.
+ *
+ * Adding a directory that is already watched is harmless.
+ *
+ * @return TRUE if directory is watched, FALSE on error.
+ */
+bool
+dirwatch_add(dirwatch_t *dw, const char *dir)
+{
+	const char *old;
+	int wd;
+
+	dirwatch_check(dw);
+	g_assert(dir != NULL);
+
+	wd = inotify_add_watch(dw->fd, dir, DIRWATCH_MASK);
+
+	if (-1 == wd) {
+		static bool warned;
+
+		/*
+		 * The amount of watches is limited by the kernel, warn only once
+		 * if we reach the limit, the caller will see the failures anyway.
+		 */
+
+		if (ENOSPC != errno) {
+			s_warning("%s(): cannot watch \"%s\": %m", G_STRFUNC, dir);
+		} else if (!warned) {
+			warned = TRUE;
+			s_warning("%s(): inotify watch limit reached, "
+				"consider raising /proc/sys/fs/inotify/max_user_watches",
+				G_STRFUNC);
+		}
+		return FALSE;
+	}
+
+	/*
+	 * Adding a watch for an inode which is already watched returns the same
+	 * watch descriptor: the directory may have been renamed since.
+	 */
+
+	old = htable_lookup(dw->by_wd, int_to_pointer(wd));
+
+	if (old != NULL) {
+		if (0 == strcmp(old, dir))
+			return TRUE;
+		dirwatch_forget(dw, wd);
+	}
+
+	if (htable_contains(dw->by_dir, dir)) {
+		/* Same path, new inode: the old watch is gone */
+		int owd = pointer_to_int(htable_lookup(dw->by_dir, dir));
+		inotify_rm_watch(dw->fd, owd);
+		dirwatch_forget(dw, owd);
+	}
+
+	dir = atom_str_get(dir);
+	htable_insert(dw->by_wd, int_to_pointer(wd), deconstify_char(dir));
+	htable_insert(dw->by_dir, dir, int_to_pointer(wd));
+
+	return TRUE;
+}
+
+/**
+ * Stop watching a directory.
+ */
+void
+dirwatch_remove(dirwatch_t *dw, const char *dir)
+{
+	int wd;
+
+	dirwatch_check(dw);
+	g_assert(dir != NULL);
+
+	if (!htable_contains(dw->by_dir, dir))
+		return;
+
+	wd = pointer_to_int(htable_lookup(dw->by_dir, dir));
+	inotify_rm_watch(dw->fd, wd);
+	dirwatch_forget(dw, wd);
+}
+
+/**
+ * @return the amount of directories being watched.
+ */
+size_t
+dirwatch_count(const dirwatch_t *dw)
+{
+	dirwatch_check(dw);
+
+	return htable_count(dw->by_dir);
+}
+
+#else	/* !HAS_INOTIFY */
+
+dirwatch_t *
+dirwatch_new(dirwatch_cb_t cb, void *udata)
+{
+	(void) cb;
+	(void) udata;
+
+	return NULL;	/* Not supported */
+}
+
+void
+dirwatch_free_null(dirwatch_t **dw_ptr)
+{
+	g_assert(NULL == *dw_ptr);
+}
+
+bool
+dirwatch_add(dirwatch_t *dw, const char *dir)
+{
+	(void) dw;
+	(void) dir;
+
+	g_assert_not_reached();
+}
+
+void
+dirwatch_remove(dirwatch_t *dw, const char *dir)
+{
+	(void) dw;
+	(void) dir;
+
+	g_assert_not_reached();
+}
+
+size_t
+dirwatch_count(const dirwatch_t *dw)
+{
+	(void) dw;
+
+	return 0;
+}
+
+#endif	/* HAS_INOTIFY */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Directory watcher.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _dirwatch_h_
+#define _dirwatch_h_
+
+/**
+ * Events reported for watched directories.
+ */
+enum dirwatch_event {
+	DIRWATCH_ADDED = 0,		/**< Entry created or moved into directory */
+	DIRWATCH_REMOVED,		/**< Entry deleted or moved out of directory */
+	DIRWATCH_CHANGED,		/**< File closed after having been written to */
+	DIRWATCH_GONE,			/**< Watched directory itself disappeared */
+	DIRWATCH_OVERFLOW		/**< Events were lost, everything is suspect */
+};
+
+/**
+ * The callback invoked when a watched directory changes.
+ *
+ * @param udata		user-supplied data
+ * @param ev		the event
+ * @param dir		the watched directory (NULL for DIRWATCH_OVERFLOW)
+ * @param name		the entry name in dir (NULL unless ADDED, REMOVED, CHANGED)
+ * @param isdir		whether the entry is a directory
+ */
+typedef void (*dirwatch_cb_t)(void *udata, enum dirwatch_event ev,
+	const char *dir, const char *name, bool isdir);
+
+typedef struct dirwatch dirwatch_t;
+
+/*
+ * Public interface.
+ */
+
+dirwatch_t *dirwatch_new(dirwatch_cb_t cb, void *udata);
+void dirwatch_free_null(dirwatch_t **dw_ptr);
+bool dirwatch_add(dirwatch_t *dw, const char *dir);
+void dirwatch_remove(dirwatch_t *dw, const char *dir);
+size_t dirwatch_count(const dirwatch_t *dw);
+
+#endif /* _dirwatch_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
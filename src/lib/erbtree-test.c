@@ -0,0 +1,527 @@
+/*
+ * erbtree-test -- embedded red-black tree tests and interval benchmarking.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/erbtree.h"
+#include "lib/eslist.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_CHUNKS		2000		/* Chunks in the test map */
+#define TEST_OPS		20000		/* Random split / merge operations */
+#define TEST_LOOKUPS	20000		/* Random lookups checked */
+
+#define BENCH_CHUNKS	50000		/* Default benchmark fragmentation */
+#define BENCH_LOOKUPS	10000		/* Default amount of benchmark lookups */
+
+#define CHUNK_MAXLEN	65536		/* Maximum length of initial chunks */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htV] [-c chunks] [-n lookups] [-R seed]\n"
+		"  -c : sets amount of chunks in the benchmarked file\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of lookups for benchmarking\n"
+		"  -t : time list scanning versus tree lookups\n"
+		"  -R : seed for repeatable random data sequence\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(void)
+{
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+enum chunk_status {
+	CHUNK_EMPTY = 0,
+	CHUNK_BUSY,
+	CHUNK_DONE,
+
+	CHUNK_STATUS_COUNT
+};
+
+/**
+ * A file chunk, modelled after the fileinfo chunks.
+ */
+struct chunk {
+	uint64 from;				/**< First byte of the chunk */
+	uint64 to;					/**< First byte after the chunk */
+	enum chunk_status status;
+	slink_t lk;					/**< Embedded one-way link */
+	rbnode_t node;				/**< Embedded red-black tree node */
+};
+
+/**
+ * A fragmented file, held both as an ordered list and as a tree.
+ */
+struct chunk_map {
+	eslist_t list;
+	erbtree_t tree;
+	uint64 size;
+};
+
+static int
+chunk_overlap_cmp(const void *a, const void *b)
+{
+	const struct chunk *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+static uint64
+random_offset(uint64 max)
+{
+	uint64 v = ((uint64) rand31() << 31) | rand31();
+
+	return 0 == max ? 0 : v % max;
+}
+
+static struct chunk *
+chunk_alloc(uint64 from, uint64 to, enum chunk_status status)
+{
+	struct chunk *c;
+
+	XMALLOC0(c);
+	c->from = from;
+	c->to = to;
+	c->status = status;
+
+	return c;
+}
+
+static void
+chunk_map_make(struct chunk_map *cm, size_t chunks)
+{
+	size_t i;
+
+	eslist_init(&cm->list, offsetof(struct chunk, lk));
+	erbtree_init(&cm->tree, chunk_overlap_cmp, offsetof(struct chunk, node));
+	cm->size = 0;
+
+	for (i = 0; i < chunks; i++) {
+		uint64 len = 1 + random_offset(CHUNK_MAXLEN);
+		struct chunk *c;
+		void *old;
+
+		c = chunk_alloc(cm->size, cm->size + len,
+			random_offset(CHUNK_STATUS_COUNT));
+		cm->size += len;
+
+		eslist_append(&cm->list, c);
+		old = erbtree_insert(&cm->tree, &c->node);
+
+		if (old != NULL) {
+			printf("chunk [%s, %s[ unexpectedly overlapping\n",
+				uint64_to_string(c->from), uint64_to_string2(c->to));
+			test_abort();
+		}
+	}
+}
+
+static void
+chunk_map_free(struct chunk_map *cm)
+{
+	struct chunk *c;
+
+	erbtree_clear(&cm->tree);
+	while (NULL != (c = eslist_shift(&cm->list)))
+		xfree(c);
+}
+
+/**
+ * Check that the tree and the list describe the same contiguous chunks.
+ */
+static void
+chunk_map_check(const struct chunk_map *cm)
+{
+	const struct chunk *c;
+	const rbnode_t *rn;
+	uint64 last = 0;
+
+	if (eslist_count(&cm->list) != erbtree_count(&cm->tree)) {
+		printf("list has %zu item%s, tree has %zu\n",
+			PLURAL(eslist_count(&cm->list)), erbtree_count(&cm->tree));
+		test_abort();
+	}
+
+	rn = erbtree_first(&cm->tree);
+
+	ESLIST_FOREACH_DATA(&cm->list, c) {
+		if (c->from != last || c->from >= c->to) {
+			printf("chunk [%s, %s[ does not start at %s\n",
+				uint64_to_string(c->from), uint64_to_string2(c->to),
+				uint64_to_string3(last));
+			test_abort();
+		}
+		if (rn != &c->node) {
+			printf("tree not ordered as list at [%s, %s[\n",
+				uint64_to_string(c->from), uint64_to_string2(c->to));
+			test_abort();
+		}
+		last = c->to;
+		rn = erbtree_next(rn);
+	}
+
+	if (last != cm->size) {
+		printf("chunks end at %s, file size is %s\n",
+			uint64_to_string(last), uint64_to_string2(cm->size));
+		test_abort();
+	}
+}
+
+static struct chunk *
+list_lookup(const struct chunk_map *cm, uint64 pos)
+{
+	struct chunk *c;
+
+	ESLIST_FOREACH_DATA(&cm->list, c) {
+		if (pos >= c->from && pos < c->to)
+			return c;
+	}
+
+	return NULL;
+}
+
+static struct chunk *
+tree_lookup(const struct chunk_map *cm, uint64 pos)
+{
+	struct chunk key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return erbtree_lookup(&cm->tree, &key);
+}
+
+static struct chunk *
+list_lookup_empty(const struct chunk_map *cm, uint64 from, uint64 to)
+{
+	struct chunk *c;
+
+	ESLIST_FOREACH_DATA(&cm->list, c) {
+		if (c->to <= from)
+			continue;
+		if (c->from >= to)
+			break;
+		if (CHUNK_EMPTY == c->status)
+			return c;
+	}
+
+	return NULL;
+}
+
+static struct chunk *
+tree_lookup_empty(const struct chunk_map *cm, uint64 from, uint64 to)
+{
+	struct chunk key;
+	rbnode_t *rn, *prev;
+
+	key.from = from;
+	key.to = to;
+
+	rn = erbtree_getnode(&cm->tree, &key);
+
+	if (NULL == rn)
+		return NULL;
+
+	while (NULL != (prev = erbtree_prev(rn))) {
+		const struct chunk *c = erbtree_data(&cm->tree, prev);
+
+		if (c->to <= from)
+			break;
+		rn = prev;
+	}
+
+	for (; rn != NULL; rn = erbtree_next(rn)) {
+		struct chunk *c = erbtree_data(&cm->tree, rn);
+
+		if (c->from >= to)
+			break;
+		if (CHUNK_EMPTY == c->status)
+			return c;
+	}
+
+	return NULL;
+}
+
+/**
+ * Split the chunk holding `pos', the way fileinfo does it: the original
+ * chunk is shrunk before the new one is inserted after it.
+ */
+static bool
+chunk_map_split(struct chunk_map *cm, uint64 pos)
+{
+	struct chunk *c, *nc;
+	void *old;
+
+	c = tree_lookup(cm, pos);
+	g_assert(c != NULL);
+
+	if (c->from == pos)
+		return FALSE;
+
+	nc = chunk_alloc(pos, c->to, random_offset(CHUNK_STATUS_COUNT));
+	c->to = pos;
+
+	eslist_insert_after(&cm->list, c, nc);
+	old = erbtree_insert(&cm->tree, &nc->node);
+
+	if (old != NULL) {
+		printf("split chunk at %s overlaps\n", uint64_to_string(pos));
+		test_abort();
+	}
+
+	return TRUE;
+}
+
+/**
+ * Merge the chunk holding `pos' with its successor, the way fileinfo does
+ * it: the chunk is extended before its successor is removed.
+ */
+static bool
+chunk_map_merge(struct chunk_map *cm, uint64 pos)
+{
+	struct chunk *c, *nc;
+
+	c = tree_lookup(cm, pos);
+	g_assert(c != NULL);
+
+	if (NULL == eslist_next(&c->lk))
+		return FALSE;
+
+	c->to = ((struct chunk *) eslist_next_data(&cm->list, c))->to;
+	nc = eslist_remove_after(&cm->list, c);
+	erbtree_remove(&cm->tree, &nc->node);
+	xfree(nc);
+
+	return TRUE;
+}
+
+/**
+ * Check tree lookups against list scans on a randomly changing chunk map.
+ */
+static void
+interval_test(void)
+{
+	struct chunk_map cm;
+	size_t i, splits = 0, merges = 0;
+
+	chunk_map_make(&cm, TEST_CHUNKS);
+	chunk_map_check(&cm);
+
+	for (i = 0; i < TEST_OPS; i++) {
+		uint64 pos = random_offset(cm.size);
+
+		if (rand31_value(1)) {
+			if (chunk_map_split(&cm, pos))
+				splits++;
+		} else {
+			if (chunk_map_merge(&cm, pos))
+				merges++;
+		}
+	}
+
+	chunk_map_check(&cm);
+
+	if (verbose_mode) {
+		printf("%u operations: %zu split%s, %zu merge%s, %zu chunk%s left\n",
+			TEST_OPS, PLURAL(splits), PLURAL(merges),
+			PLURAL(eslist_count(&cm.list)));
+	}
+
+	for (i = 0; i < TEST_LOOKUPS; i++) {
+		uint64 from = random_offset(cm.size);
+		uint64 to = from + 1 + random_offset(4 * CHUNK_MAXLEN);
+
+		if (list_lookup(&cm, from) != tree_lookup(&cm, from)) {
+			printf("lookup of %s differs\n", uint64_to_string(from));
+			test_abort();
+		}
+		if (
+			list_lookup_empty(&cm, from, to) !=
+			tree_lookup_empty(&cm, from, to)
+		) {
+			printf("empty chunk lookup in [%s, %s[ differs\n",
+				uint64_to_string(from), uint64_to_string2(to));
+			test_abort();
+		}
+	}
+
+	if (tree_lookup(&cm, cm.size) != NULL) {
+		printf("found chunk past the end of the file\n");
+		test_abort();
+	}
+
+	chunk_map_free(&cm);
+
+	printf("List scanning versus tree lookups: all OK\n");
+}
+
+/**
+ * Benchmark list scanning against tree lookups on a fragmented file.
+ */
+static void
+interval_bench(size_t chunks, size_t lookups)
+{
+	struct chunk_map cm;
+	uint64 *pos;
+	tm_t start, end;
+	double lscan, tscan, lempty, tempty;
+	size_t i, ln = 0, tn = 0;
+
+	chunk_map_make(&cm, chunks);
+
+	XMALLOC_ARRAY(pos, lookups);
+	for (i = 0; i < lookups; i++)
+		pos[i] = random_offset(cm.size);
+
+	tm_now_exact(&start);
+	for (i = 0; i < lookups; i++)
+		ln += list_lookup(&cm, pos[i])->status;
+	tm_now_exact(&end);
+	lscan = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	for (i = 0; i < lookups; i++)
+		tn += tree_lookup(&cm, pos[i])->status;
+	tm_now_exact(&end);
+	tscan = tm_elapsed_f(&end, &start);
+
+	if (ln != tn) {
+		printf("list lookups sum to %zu, tree lookups to %zu\n", ln, tn);
+		test_abort();
+	}
+
+	tm_now_exact(&start);
+	for (i = 0; i < lookups; i++)
+		ln += NULL == list_lookup_empty(&cm, pos[i], pos[i] + CHUNK_MAXLEN);
+	tm_now_exact(&end);
+	lempty = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	for (i = 0; i < lookups; i++)
+		tn += NULL == tree_lookup_empty(&cm, pos[i], pos[i] + CHUNK_MAXLEN);
+	tm_now_exact(&end);
+	tempty = tm_elapsed_f(&end, &start);
+
+	if (ln != tn) {
+		printf("list and tree disagree on empty chunk lookups\n");
+		test_abort();
+	}
+
+	printf("Running %zu lookup%s on a %s-byte file with %zu chunk%s:\n",
+		PLURAL(lookups), uint64_to_string(cm.size), PLURAL(chunks));
+	printf("  status at offset: list %.3f secs, tree %.3f secs, "
+		"speedup %.2f\n", lscan, tscan, lscan / MAX(tscan, 1e-6));
+	printf("  empty chunk in range: list %.3f secs, tree %.3f secs, "
+		"speedup %.2f\n", lempty, tempty, lempty / MAX(tempty, 1e-6));
+
+	XFREE_NULL(pos);
+	chunk_map_free(&cm);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t chunks = BENCH_CHUNKS;
+	size_t lookups = BENCH_LOOKUPS;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "c:hn:tR:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of chunks */
+			chunks = atol(optarg);
+			break;
+		case 'n':			/* amount of lookups */
+			lookups = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag = TRUE;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	chunks = MAX(chunks, 1);
+	lookups = MAX(lookups, 1);
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	interval_test();
+
+	if (tflag)
+		interval_bench(chunks, lookups);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
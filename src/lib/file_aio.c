@@ -0,0 +1,833 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Asynchronous file I/O.
+ *
+ * Positional vectored reads and writes on file objects are issued from the
+ * main thread and performed in the background, the outcome being reported
+ * through a callback invoked from the main thread once the I/O is done.
+ *
+ * When io_uring is available and could be initialized, requests are handed
+ * to the kernel and a single "aio reaper" thread collects completions.
+ * Otherwise, or when the submission ring is full, requests are performed
+ * synchronously by a pool of "aio" threads.
+ *
+ * The I/O vector is copied when the request is issued, but the buffers it
+ * refers to must remain valid until completion.  Likewise, the file object
+ * must not be closed before the request completed: callers that need to
+ * release these resources early can use file_aio_wait() to synchronously
+ * wait for the request, in which case the callback is not invoked.
+ *
+ * The amount of pending requests and bytes are tracked so that callers can
+ * apply back-pressure when the disk cannot keep up: see file_aio_congested().
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "file_aio.h"
+
+#include "aq.h"
+#include "atomic.h"
+#include "cond.h"
+#include "constants.h"
+#include "fd.h"
+#include "halloc.h"
+#include "iovec.h"
+#include "log.h"
+#include "mutex.h"
+#include "str.h"
+#include "stringify.h"
+#include "teq.h"
+#include "thread.h"
+#include "walloc.h"
+
+#ifdef HAS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "override.h"		/* Must be the last header included */
+
+#define FILE_AIO_THREAD_MAX		16		/**< Max amount of I/O threads */
+#define FILE_AIO_URING_ENTRIES	256		/**< Size of the submission ring */
+#define FILE_AIO_URING_RETRIES	3		/**< Interrupted submit retries */
+#define FILE_AIO_CONGESTED		(32 * 1024 * 1024)	/**< Pending bytes */
+
+enum file_aio_op {
+	FILE_AIO_READ,
+	FILE_AIO_WRITE
+};
+
+enum file_aio_magic { FILE_AIO_MAGIC = 0x1f4a5c03 };
+
+struct file_aio {
+	enum file_aio_magic magic;
+	enum file_aio_op op;		/**< Operation to perform */
+	const file_object_t *fo;	/**< The file object */
+	iovec_t *iov;				/**< Copy of the I/O vector (halloc-ed) */
+	int iov_cnt;				/**< Amount of entries in iov[] */
+	filesize_t offset;			/**< File offset */
+	size_t size;				/**< Total size of the I/O vector */
+	file_aio_cb_t cb;			/**< Completion callback */
+	void *arg;					/**< Callback argument */
+	ssize_t ret;				/**< Result of the I/O, once done */
+	int error;					/**< The errno value if ret == -1 */
+	int refcnt;					/**< Handle + completion event */
+	uint done:1;				/**< Set when I/O completed */
+	uint waited:1;				/**< Set when file_aio_wait() was used */
+};
+
+static inline void
+file_aio_check(const struct file_aio * const fa)
+{
+	g_assert(fa != NULL);
+	g_assert(FILE_AIO_MAGIC == fa->magic);
+}
+
+static mutex_t file_aio_mtx = MUTEX_INIT;
+static cond_t file_aio_cond = COND_INIT;	/* Signals request completion */
+static aqueue_t *file_aio_queue;			/* Requests for the I/O threads */
+static uint file_aio_threads;				/* Amount of I/O threads */
+static size_t file_aio_pending_count;		/* Requests not completed yet */
+static size_t file_aio_pending_size;		/* Bytes not transferred yet */
+static int file_aio_exit;					/* Its address tells thread to exit */
+static bool file_aio_enabled;
+
+#define FILE_AIO_LOCK		mutex_lock(&file_aio_mtx)
+#define FILE_AIO_UNLOCK		mutex_unlock(&file_aio_mtx)
+
+static void file_aio_complete(file_aio_t *fa, ssize_t ret, int error);
+
+#ifdef HAS_IO_URING
+
+/**
+ * The io_uring rings, shared with the kernel.
+ */
+static struct file_aio_uring {
+	int fd;						/**< The io_uring file descriptor */
+	uint entries;				/**< Amount of submission entries */
+	uint inflight;				/**< Entries submitted, not reaped yet */
+	uint reaper;				/**< Thread ID of the reaper */
+	uint *sq_head;
+	uint *sq_tail;
+	uint *sq_mask;
+	uint *sq_array;
+	struct io_uring_sqe *sqes;
+	uint *cq_head;
+	uint *cq_tail;
+	uint *cq_mask;
+	struct io_uring_cqe *cqes;
+	void *sq_ring;
+	void *cq_ring;
+	size_t sq_ring_size;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} file_aio_ring = { -1, 0, 0, 0, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, 0 };
+
+static inline int
+file_aio_uring_enter(uint to_submit, uint min_complete, uint flags)
+{
+	return syscall(__NR_io_uring_enter,
+		file_aio_ring.fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/**
+ * Unmap the rings and close the io_uring file descriptor.
+ */
+static void
+file_aio_uring_release(void)
+{
+	struct file_aio_uring *r = &file_aio_ring;
+
+	if (r->sqes != NULL && MAP_FAILED != (void *) r->sqes)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ring != NULL && MAP_FAILED != r->cq_ring)
+		munmap(r->cq_ring, r->cq_ring_size);
+	if (r->sq_ring != NULL && MAP_FAILED != r->sq_ring)
+		munmap(r->sq_ring, r->sq_ring_size);
+
+	fd_close(&r->fd);
+
+	r->sqes = NULL;
+	r->cq_ring = r->sq_ring = NULL;
+	r->entries = 0;
+}
+
+/**
+ * Create the io_uring instance and map its rings.
+ *
+ * @return TRUE if io_uring can be used.
+ */
+static bool
+file_aio_uring_setup(void)
+{
+	struct file_aio_uring *r = &file_aio_ring;
+	struct io_uring_params p;
+	int fd;
+
+	ZERO(&p);
+	fd = syscall(__NR_io_uring_setup, FILE_AIO_URING_ENTRIES, &p);
+
+	if (-1 == fd) {
+		s_info("%s(): cannot use io_uring: %m", G_STRFUNC);
+		return FALSE;
+	}
+
+	r->fd = fd;
+	r->entries = p.sq_entries;
+	r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint);
+	r->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (MAP_FAILED == r->sq_ring)
+		goto failed;
+
+	r->cq_ring = mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	if (MAP_FAILED == r->cq_ring)
+		goto failed;
+
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (MAP_FAILED == (void *) r->sqes)
+		goto failed;
+
+	r->sq_head  = ptr_add_offset(r->sq_ring, p.sq_off.head);
+	r->sq_tail  = ptr_add_offset(r->sq_ring, p.sq_off.tail);
+	r->sq_mask  = ptr_add_offset(r->sq_ring, p.sq_off.ring_mask);
+	r->sq_array = ptr_add_offset(r->sq_ring, p.sq_off.array);
+	r->cq_head  = ptr_add_offset(r->cq_ring, p.cq_off.head);
+	r->cq_tail  = ptr_add_offset(r->cq_ring, p.cq_off.tail);
+	r->cq_mask  = ptr_add_offset(r->cq_ring, p.cq_off.ring_mask);
+	r->cqes     = ptr_add_offset(r->cq_ring, p.cq_off.cqes);
+
+	return TRUE;
+
+failed:
+	s_warning("%s(): cannot map io_uring rings: %m", G_STRFUNC);
+	file_aio_uring_release();
+	return FALSE;
+}
+
+/**
+ * Queue an entry in the submission ring and tell the kernel about it.
+ *
+ * This must be called with the lock held.
+ *
+ * @param fa		the request, NULL to wake up the reaper and make it exit
+ *
+ * @return TRUE if the entry was submitted, FALSE if the ring is full or
+ * the kernel did not take the entry.
+ */
+static bool
+file_aio_uring_submit(file_aio_t *fa)
+{
+	struct file_aio_uring *r = &file_aio_ring;
+	struct io_uring_sqe *sqe;
+	uint head, tail, idx;
+	int n, retries = 0;
+
+	assert_mutex_is_owned(&file_aio_mtx);
+
+	/*
+	 * The completion ring holds twice as many entries as the submission
+	 * ring, so limiting the entries in flight to the size of the latter
+	 * guarantees that completions can never overflow.
+	 */
+
+	if (r->inflight >= r->entries)
+		return FALSE;
+
+	head = atomic_uint_get(r->sq_head);
+	tail = *r->sq_tail;
+
+	if (tail - head >= r->entries)
+		return FALSE;
+
+	idx = tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	ZERO(sqe);
+
+	if (NULL == fa) {
+		sqe->opcode = IORING_OP_NOP;
+	} else {
+		sqe->opcode =
+			FILE_AIO_WRITE == fa->op ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe->fd = file_object_fd(fa->fo);
+		sqe->addr = pointer_to_ulong(fa->iov);
+		sqe->len = fa->iov_cnt;
+		sqe->off = fa->offset;
+		sqe->user_data = pointer_to_ulong(fa);
+	}
+
+	r->sq_array[idx] = idx;
+	atomic_mb();
+	atomic_uint_set(r->sq_tail, tail + 1);
+	r->inflight++;
+
+	/*
+	 * Without kernel-side polling, the kernel consumes the entries within
+	 * io_uring_enter(): once it returns, the entry was either taken, and
+	 * its completion will be seen by the reaper, or it was not, and nobody
+	 * will ever process it.  In the latter case, the entry is removed from
+	 * the ring and the caller must handle the request another way.
+	 */
+
+	do {
+		n = file_aio_uring_enter(tail + 1 - head, 0, 0);
+	} while (
+		-1 == n && (EINTR == errno || EAGAIN == errno) &&
+		retries++ < FILE_AIO_URING_RETRIES
+	);
+
+	if G_UNLIKELY(atomic_uint_get(r->sq_head) != tail + 1) {
+		if (-1 == n)
+			s_carp_once("%s(): io_uring_enter() failed: %m", G_STRFUNC);
+		else
+			s_carp_once("%s(): io_uring_enter() submitted nothing", G_STRFUNC);
+
+		atomic_uint_set(r->sq_tail, tail);
+		r->inflight--;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * The io_uring completion reaper.
+ */
+static void *
+file_aio_uring_reaper(void *unused_arg)
+{
+	struct file_aio_uring *r = &file_aio_ring;
+	bool done = FALSE;
+
+	(void) unused_arg;
+
+	thread_set_name("aio reaper");
+
+	while (!done) {
+		uint head, tail;
+
+		if (-1 == file_aio_uring_enter(0, 1, IORING_ENTER_GETEVENTS)) {
+			if (EINTR == errno || EAGAIN == errno)
+				continue;
+			s_error("%s(): io_uring_enter() failed: %m", G_STRFUNC);
+		}
+
+		head = *r->cq_head;
+		tail = atomic_uint_get(r->cq_tail);
+		atomic_mb();
+
+		while (head != tail) {
+			const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+			file_aio_t *fa = ulong_to_pointer(cqe->user_data);
+			int res = cqe->res;
+
+			head++;
+
+			FILE_AIO_LOCK;
+			r->inflight--;
+			FILE_AIO_UNLOCK;
+
+			if (NULL == fa)
+				done = TRUE;
+			else if (res < 0)
+				file_aio_complete(fa, -1, -res);
+			else
+				file_aio_complete(fa, res, 0);
+		}
+
+		atomic_mb();
+		atomic_uint_set(r->cq_head, head);
+	}
+
+	return NULL;
+}
+
+/**
+ * Initialize the io_uring back-end.
+ *
+ * @return TRUE if io_uring will be used.
+ */
+static bool
+file_aio_uring_init(void)
+{
+	int id;
+
+	if (!file_aio_uring_setup())
+		return FALSE;
+
+	id = thread_create(file_aio_uring_reaper, NULL,
+			THREAD_F_NO_CANCEL | THREAD_F_NO_POOL | THREAD_F_PANIC,
+			THREAD_STACK_DFLT);
+
+	if (-1 == id) {
+		s_warning("%s(): cannot create reaper thread: %m", G_STRFUNC);
+		file_aio_uring_release();
+		return FALSE;
+	}
+
+	file_aio_ring.reaper = id;
+	return TRUE;
+}
+
+/**
+ * Shutdown the io_uring back-end.
+ */
+static void
+file_aio_uring_close(void)
+{
+	if (0 == file_aio_ring.entries)
+		return;
+
+	/*
+	 * Since there are no more pending requests, the NOP can always be
+	 * submitted, and it is the last completion the reaper will see.
+	 */
+
+	FILE_AIO_LOCK;
+	if (!file_aio_uring_submit(NULL)) {
+		FILE_AIO_UNLOCK;
+		s_warning("%s(): cannot stop the io_uring reaper", G_STRFUNC);
+		return;		/* Leave the rings mapped, the reaper uses them */
+	}
+	FILE_AIO_UNLOCK;
+
+	thread_join(file_aio_ring.reaper, NULL);
+	file_aio_uring_release();
+}
+
+static inline bool
+file_aio_uring_enabled(void)
+{
+	return 0 != file_aio_ring.entries;
+}
+
+#else	/* !HAS_IO_URING */
+
+#define file_aio_uring_init()		FALSE
+#define file_aio_uring_close()
+#define file_aio_uring_enabled()	FALSE
+#define file_aio_uring_submit(x)	((void) (x), FALSE)
+
+#endif	/* HAS_IO_URING */
+
+/**
+ * @return TRUE if I/O requests are performed asynchronously.
+ */
+bool
+file_aio_is_enabled(void)
+{
+	return file_aio_enabled;
+}
+
+/**
+ * @return name of the back-end being used.
+ */
+const char *
+file_aio_backend(void)
+{
+	if (!file_aio_enabled)
+		return "none";
+
+	return file_aio_uring_enabled() ? "io_uring" : "threads";
+}
+
+/**
+ * Free request.
+ */
+static void
+file_aio_free(file_aio_t *fa)
+{
+	file_aio_check(fa);
+
+	HFREE_NULL(fa->iov);
+	fa->magic = 0;
+	WFREE(fa);
+}
+
+/**
+ * Remove a reference on the request, freeing it when it was the last one.
+ */
+static void
+file_aio_unref(file_aio_t *fa)
+{
+	file_aio_check(fa);
+	g_assert(fa->refcnt > 0);
+	g_assert(thread_is_main());
+
+	if (0 == --fa->refcnt)
+		file_aio_free(fa);
+}
+
+/**
+ * Deliver the completion of the request, from the main thread.
+ */
+static void
+file_aio_deliver(void *data)
+{
+	file_aio_t *fa = data;
+
+	file_aio_check(fa);
+	g_assert(fa->done);
+
+	/*
+	 * When the request was waited for, the handle reference is already
+	 * gone and the callback must not be invoked.
+	 */
+
+	if (!fa->waited) {
+		(*fa->cb)(fa->arg, fa->ret, fa->error);
+		file_aio_unref(fa);		/* The handle reference */
+	}
+
+	file_aio_unref(fa);			/* The event reference */
+}
+
+/**
+ * Record the completion of the request and post its delivery to the main
+ * thread.
+ *
+ * This is called from the thread that saw the I/O complete.
+ */
+static void
+file_aio_complete(file_aio_t *fa, ssize_t ret, int error)
+{
+	file_aio_check(fa);
+
+	FILE_AIO_LOCK;
+	g_assert(!fa->done);
+	g_assert(file_aio_pending_count != 0);
+	g_assert(file_aio_pending_size >= fa->size);
+
+	fa->ret = ret;
+	fa->error = error;
+	fa->done = TRUE;
+	file_aio_pending_count--;
+	file_aio_pending_size -= fa->size;
+	cond_broadcast(&file_aio_cond, &file_aio_mtx);
+	FILE_AIO_UNLOCK;
+
+	teq_safe_post(THREAD_MAIN_ID, file_aio_deliver, fa);
+}
+
+/**
+ * Perform the I/O synchronously.
+ */
+static void
+file_aio_perform(file_aio_t *fa)
+{
+	ssize_t r;
+
+	file_aio_check(fa);
+
+	if (FILE_AIO_WRITE == fa->op)
+		r = file_object_pwritev(fa->fo, fa->iov, fa->iov_cnt, fa->offset);
+	else
+		r = file_object_preadv(fa->fo, fa->iov, fa->iov_cnt, fa->offset);
+
+	file_aio_complete(fa, r, -1 == r ? errno : 0);
+}
+
+/**
+ * The I/O threads.
+ */
+static void *
+file_aio_thread_main(void *arg)
+{
+	const char *name = arg;
+
+	thread_set_name(name);
+
+	for (;;) {
+		file_aio_t *fa = aq_remove(file_aio_queue);
+
+		if (&file_aio_exit == (void *) fa)
+			break;
+
+		file_aio_perform(fa);
+	}
+
+	return NULL;
+}
+
+/**
+ * Issue an I/O request.
+ */
+static file_aio_t *
+file_aio_issue(enum file_aio_op op, const file_object_t *fo,
+	const iovec_t *iov, int iov_cnt, filesize_t offset,
+	file_aio_cb_t cb, void *arg)
+{
+	file_aio_t *fa;
+	bool submitted;
+
+	g_assert(file_aio_enabled);
+	g_assert(thread_is_main());
+	g_assert(iov != NULL);
+	g_assert(iov_cnt > 0);
+	g_assert(cb != NULL);
+
+	WALLOC0(fa);
+	fa->magic = FILE_AIO_MAGIC;
+	fa->op = op;
+	fa->fo = fo;
+	fa->iov = HCOPY_ARRAY(iov, iov_cnt);
+	fa->iov_cnt = iov_cnt;
+	fa->offset = offset;
+	fa->size = iov_calculate_size(iov, iov_cnt);
+	fa->cb = cb;
+	fa->arg = arg;
+	fa->refcnt = 2;
+
+	FILE_AIO_LOCK;
+	file_aio_pending_count++;
+	file_aio_pending_size += fa->size;
+	submitted = file_aio_uring_enabled() && file_aio_uring_submit(fa);
+	FILE_AIO_UNLOCK;
+
+	/*
+	 * When the io_uring submission ring is full, or when io_uring is not
+	 * used, the request goes to the pool of I/O threads.
+	 */
+
+	if (!submitted)
+		aq_put(file_aio_queue, fa);
+
+	return fa;
+}
+
+/**
+ * Write data to the file object at the given offset, asynchronously.
+ *
+ * @param fo		the file object
+ * @param iov		the I/O vector (copied, but not the buffers it refers to)
+ * @param iov_cnt	amount of entries in iov[]
+ * @param offset	the file offset where data is written
+ * @param cb		the completion callback
+ * @param arg		the additional callback argument
+ *
+ * @return a request handle, which can be passed to file_aio_wait().
+ */
+file_aio_t *
+file_aio_pwritev(const file_object_t *fo,
+	const iovec_t *iov, int iov_cnt, filesize_t offset,
+	file_aio_cb_t cb, void *arg)
+{
+	return file_aio_issue(FILE_AIO_WRITE, fo, iov, iov_cnt, offset, cb, arg);
+}
+
+/**
+ * Read data from the file object at the given offset, asynchronously.
+ *
+ * @param fo		the file object
+ * @param iov		the I/O vector (copied, but not the buffers it refers to)
+ * @param iov_cnt	amount of entries in iov[]
+ * @param offset	the file offset where data is read from
+ * @param cb		the completion callback
+ * @param arg		the additional callback argument
+ *
+ * @return a request handle, which can be passed to file_aio_wait().
+ */
+file_aio_t *
+file_aio_preadv(const file_object_t *fo,
+	const iovec_t *iov, int iov_cnt, filesize_t offset,
+	file_aio_cb_t cb, void *arg)
+{
+	return file_aio_issue(FILE_AIO_READ, fo, iov, iov_cnt, offset, cb, arg);
+}
+
+/**
+ * Synchronously wait for the completion of the request.
+ *
+ * The completion callback will not be invoked and the handle is nullified.
+ * This must only be used when the callback has not been invoked yet, since
+ * the handle is no longer valid afterwards.
+ *
+ * @param fa_ptr	pointer to the request handle, nullified on return
+ * @param error		if non-NULL, written with the errno value on error
+ *
+ * @return the amount of bytes transferred, -1 on error.
+ */
+ssize_t
+file_aio_wait(file_aio_t **fa_ptr, int *error)
+{
+	file_aio_t *fa = *fa_ptr;
+	ssize_t ret;
+
+	file_aio_check(fa);
+	g_assert(thread_is_main());
+	g_assert(!fa->waited);
+
+	FILE_AIO_LOCK;
+	while (!fa->done)
+		cond_wait(&file_aio_cond, &file_aio_mtx);
+	FILE_AIO_UNLOCK;
+
+	ret = fa->ret;
+	if (error != NULL)
+		*error = fa->error;
+
+	fa->waited = TRUE;
+	file_aio_unref(fa);		/* The handle reference */
+	*fa_ptr = NULL;
+
+	return ret;
+}
+
+/**
+ * @return amount of requests not completed yet.
+ */
+size_t
+file_aio_pending(void)
+{
+	size_t n;
+
+	FILE_AIO_LOCK;
+	n = file_aio_pending_count;
+	FILE_AIO_UNLOCK;
+
+	return n;
+}
+
+/**
+ * @return amount of bytes to be transferred by the pending requests.
+ */
+size_t
+file_aio_pending_bytes(void)
+{
+	size_t n;
+
+	FILE_AIO_LOCK;
+	n = file_aio_pending_size;
+	FILE_AIO_UNLOCK;
+
+	return n;
+}
+
+/**
+ * Is the disk lagging behind?
+ *
+ * Callers producing data to be written should stop doing so until the
+ * pending requests complete.
+ *
+ * @return TRUE if too many bytes are waiting to be transferred.
+ */
+bool
+file_aio_congested(void)
+{
+	return file_aio_pending_bytes() >= FILE_AIO_CONGESTED;
+}
+
+/**
+ * Initialize asynchronous I/O.
+ *
+ * @param threads		amount of I/O threads, 0 meaning synchronous I/O
+ * @param use_uring		whether to use io_uring, when available
+ */
+void G_COLD
+file_aio_init(uint threads, bool use_uring)
+{
+	uint i;
+
+	g_assert(thread_is_main());
+	g_assert(!file_aio_enabled);
+
+	if (0 == threads)
+		return;
+
+	/*
+	 * With io_uring, the threads are only used when the submission ring is
+	 * full, so a single one is enough.
+	 */
+
+	if (use_uring && file_aio_uring_init())
+		threads = 1;
+
+	threads = MIN(threads, FILE_AIO_THREAD_MAX);
+	file_aio_queue = aq_make();
+
+	for (i = 0; i < threads; i++) {
+		const char *name = constant_str(str_smsg("aio #%u", i + 1));
+
+		(void) thread_create(file_aio_thread_main,
+				deconstify_char(name),
+				THREAD_F_DETACH | THREAD_F_NO_CANCEL |
+					THREAD_F_NO_POOL | THREAD_F_PANIC,
+				THREAD_STACK_DFLT);
+	}
+
+	file_aio_threads = threads;
+	file_aio_enabled = TRUE;
+
+	s_info("asynchronous disk I/O using %s (%u thread%s)",
+		file_aio_backend(), PLURAL(threads));
+}
+
+/**
+ * Shutdown asynchronous I/O, waiting for all the pending requests.
+ */
+void G_COLD
+file_aio_close(void)
+{
+	uint i;
+
+	g_assert(thread_is_main());
+
+	if (!file_aio_enabled)
+		return;
+
+	FILE_AIO_LOCK;
+	while (file_aio_pending_count != 0)
+		cond_wait(&file_aio_cond, &file_aio_mtx);
+	FILE_AIO_UNLOCK;
+
+	file_aio_uring_close();
+
+	for (i = 0; i < file_aio_threads; i++)
+		aq_put(file_aio_queue, &file_aio_exit);
+
+	/*
+	 * The queue is referenced by the threads which may not have exited yet,
+	 * therefore we leave it around.
+	 */
+
+	file_aio_threads = 0;
+	file_aio_enabled = FALSE;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
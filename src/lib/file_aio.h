@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Asynchronous file I/O.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _file_aio_h_
+#define _file_aio_h_
+
+#include "file_object.h"
+
+typedef struct file_aio file_aio_t;
+
+/**
+ * Completion callback, invoked from the main thread.
+ *
+ * The request is freed after the callback returns, hence the handle that
+ * was returned when the request was issued must be forgotten.
+ *
+ * @param arg		user-supplied argument
+ * @param ret		amount of bytes transferred, -1 on error
+ * @param error		the errno value on error, 0 otherwise
+ */
+typedef void (*file_aio_cb_t)(void *arg, ssize_t ret, int error);
+
+/*
+ * Public interface.
+ */
+
+void file_aio_init(uint threads, bool use_uring);
+void file_aio_close(void);
+bool file_aio_is_enabled(void);
+const char *file_aio_backend(void);
+
+file_aio_t *file_aio_pwritev(const file_object_t *fo,
+	const iovec_t *iov, int iov_cnt, filesize_t offset,
+	file_aio_cb_t cb, void *arg);
+file_aio_t *file_aio_preadv(const file_object_t *fo,
+	const iovec_t *iov, int iov_cnt, filesize_t offset,
+	file_aio_cb_t cb, void *arg);
+
+ssize_t file_aio_wait(file_aio_t **fa_ptr, int *error);
+
+size_t file_aio_pending(void);
+size_t file_aio_pending_bytes(void);
+bool file_aio_congested(void);
+
+#endif /* _file_aio_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -34,6 +34,22 @@
  * The intent here is to break the GDK dependency but retain
  * the same behavior, to avoid disturbing too much of the existing code.
  *
+ * Besides the main context, which is driven by the GLib main loop, a set of
+ * "shards" can be created: each shard is a separate polling context owned by
+ * a dedicated I/O thread, which invokes the handlers of the sources that were
+ * registered through inputevt_add_sharded().  Such handlers therefore run
+ * concurrently with the main thread and must hand over their work to it (via
+ * the thread event queue) for anything that is not thread-safe.
+ *
+ * Sources flagged as INPUT_F_URGENT are dispatched before the others, and
+ * sources flagged as INPUT_F_EDGE are monitored edge-triggered with epoll():
+ * their handlers must read until EAGAIN, or call inputevt_set_readable() when
+ * they stop early, since no further event will be reported otherwise.
+ *
+ * The time elapsed between the collection of an event and its dispatching,
+ * as well as the time spent in the handler, are recorded per handler into
+ * histograms, to spot event loop stalls.
+ *
  * @author ko (ko-@wanadoo.fr)
  * @date 2002
  * @author Christian Biere
@@ -108,11 +124,14 @@ typedef struct {
 
 #include "inputevt.h"
 
+#include "atoms.h"
 #include "bit_array.h"
 #include "compat_poll.h"
+#include "cond.h"
 #include "fd.h"
 #include "glib-missing.h"	/* For g_main_context_get_poll_func() with GTK1 */
 #include "halloc.h"
+#include "hashing.h"		/* For integer_hash() */
 #include "hashlist.h"
 #include "htable.h"
 #include "log.h"			/* For s_error() */
@@ -120,7 +139,9 @@ typedef struct {
 #include "mutex.h"
 #include "plist.h"
 #include "pslist.h"
+#include "spinlock.h"
 #include "stacktrace.h"
+#include "str.h"
 #include "stringify.h"
 #include "thread.h"			/* For thread_in_syscall_set() */
 #include "tm.h"
@@ -129,8 +150,15 @@ typedef struct {
 
 #include "override.h"		/* Must be the last header included */
 
+#define INPUTEVT_SHARD_MAX		15		/**< Max amount of I/O threads */
+#define INPUTEVT_SHARD_SHIFT	24		/**< Shard index bits in event IDs */
+#define INPUTEVT_SHARD_WAIT_MS	100		/**< Max I/O thread waiting time */
+
+#define INPUTEVT_ID_MASK		((1U << INPUTEVT_SHARD_SHIFT) - 1)
+
 static unsigned inputevt_debug;
 static bool inputevt_trace;
+static bool inputevt_use_poll;
 static unsigned inputevt_stid = THREAD_INVALID_ID;
 
 /**
@@ -180,6 +208,24 @@ inputevt_cond_to_string(inputevt_cond_t cond)
 	return "?";
 }
 
+/**
+ * Dispatching statistics of a handler.
+ */
+struct inputevt_stats {
+	inputevt_handler_t handler;
+	uint64 calls;						/**< Amount of dispatched events */
+	uint64 wait[INPUTEVT_HIST_BUCKETS];	/**< Delay before dispatching */
+	uint64 run[INPUTEVT_HIST_BUCKETS];	/**< Time spent in handler */
+	uint64 wait_max;					/**< Max delay, in usecs */
+	uint64 run_max;						/**< Max handler time, in usecs */
+};
+
+static htable_t *inputevt_stats_ht;		/**< handler -> inputevt_stats */
+static spinlock_t inputevt_stats_slk = SPINLOCK_INIT;
+
+#define STATS_LOCK		spinlock(&inputevt_stats_slk)
+#define STATS_UNLOCK	spinunlock(&inputevt_stats_slk)
+
 /**
  * The relay structure is used as a bridge to provide GDK-compatible
  * input condition flags.
@@ -187,7 +233,9 @@ inputevt_cond_to_string(inputevt_cond_t cond)
 typedef struct {
 	inputevt_handler_t handler;
 	void *data;
+	struct inputevt_stats *stats;
 	inputevt_cond_t condition;
+	unsigned flags;
 	int fd;
 } inputevt_relay_t;
 
@@ -195,7 +243,10 @@ typedef struct relay_list {
 	pslist_t *sl;
 	size_t readers;
 	size_t writers;
+	size_t level;		/**< Relays not flagged INPUT_F_EDGE */
+	size_t urgent;		/**< Relays flagged INPUT_F_URGENT */
 	unsigned poll_idx;
+	bool edge;			/**< Whether fd is monitored edge-triggered */
 } relay_list_t;
 
 struct event {
@@ -227,9 +278,15 @@ struct poll_ctx {
 	unsigned num_poll_idx;		/**< Length of used_poll_idx array */
 	unsigned max_poll_idx;
 	unsigned num_ready;			/**< Used for /dev/poll only */
+	unsigned shard;				/**< Shard index, 0 for the main context */
+	unsigned stid;				/**< Thread dispatching shard events */
+	int thread;					/**< Thread ID of the shard, -1 if none */
+	cond_t dispatched;			/**< Signals end of shard dispatching */
+	unsigned readable_idle;		/**< GLib idle source to dispatch readable */
 	unsigned initialized:1;		/**< TRUE if the context has been initialized */
 	unsigned dispatching:1;		/**< TRUE if dispatching events */
 	unsigned collecting:1;		/**< TRUE when collecing / waiting for events */
+	unsigned stopping:1;		/**< TRUE when shard thread must exit */
 
 #ifdef HAS_KQUEUE
 	struct kevent *kev_arr;
@@ -283,6 +340,25 @@ get_global_poll_ctx(void)
 	return &ctx;
 }
 
+static struct poll_ctx *inputevt_shard[INPUTEVT_SHARD_MAX];
+static unsigned inputevt_shard_count;
+
+/**
+ * @return the polling context to which the event ID belongs.
+ */
+static inline struct poll_ctx *
+get_poll_ctx_by_id(unsigned id)
+{
+	unsigned shard = id >> INPUTEVT_SHARD_SHIFT;
+
+	if G_LIKELY(0 == shard)
+		return get_global_poll_ctx();
+
+	g_assert(shard <= inputevt_shard_count);
+
+	return inputevt_shard[shard - 1];
+}
+
 /**
  * Start "collecting" events through a possibly blocking system call.
  */
@@ -508,13 +584,23 @@ event_set_mask_with_epoll(struct poll_ctx *ctx, int fd,
 {
 	static const struct epoll_event zero_ev;
 	struct epoll_event ev;
+	relay_list_t *rl;
+	bool edge;
 	int op;
 
 	g_assert(CTX_IS_LOCKED(ctx));
 
+	/*
+	 * The file descriptor is monitored edge-triggered only when all its
+	 * relays are prepared to drain it.
+	 */
+
+	rl = htable_lookup(ctx->ht, int_to_pointer(fd));
+	edge = rl != NULL && 0 == rl->level;
+
 	old &= INPUT_EVENT_RW;
 	cur &= INPUT_EVENT_RW;
-	if (cur == old)
+	if (cur == old && (NULL == rl || edge == rl->edge))
 		return 0;
 
 	ev = zero_ev;
@@ -524,6 +610,11 @@ event_set_mask_with_epoll(struct poll_ctx *ctx, int fd,
 		ev.events |= EPOLLIN | EPOLLPRI;
 	if (INPUT_EVENT_W & cur)
 		ev.events |= EPOLLOUT;
+	if (edge)
+		ev.events |= EPOLLET;
+
+	if (rl != NULL)
+		rl->edge = edge;
 
 	if (0 == old)
 		op = EPOLL_CTL_ADD;
@@ -958,11 +1049,96 @@ inputevt_purge_removed(struct poll_ctx *ctx)
 	pslist_free_null(&ctx->removed);
 }
 
+/**
+ * @return the histogram bucket for a latency expressed in usecs.
+ */
+static inline unsigned
+inputevt_hist_bucket(uint64 us)
+{
+	unsigned i;
+
+	for (i = 0; i < INPUTEVT_HIST_BUCKETS - 1; i++) {
+		if (us < INPUTEVT_HIST_LIMIT(i))
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * Account for the dispatching of an event.
+ *
+ * @param st		the statistics of the handler
+ * @param wait		delay between event collection and dispatching (usecs)
+ * @param run		time spent in the handler (usecs)
+ */
+static void
+inputevt_stats_update(struct inputevt_stats *st, time_delta_t wait,
+	time_delta_t run)
+{
+	uint64 w = MAX(wait, 0), r = MAX(run, 0);
+
+	STATS_LOCK;
+	st->calls++;
+	st->wait[inputevt_hist_bucket(w)]++;
+	st->run[inputevt_hist_bucket(r)]++;
+	st->wait_max = MAX(st->wait_max, w);
+	st->run_max = MAX(st->run_max, r);
+	STATS_UNLOCK;
+}
+
+/**
+ * Get the statistics of a handler, creating them if needed.
+ */
+static struct inputevt_stats *
+inputevt_stats_get(inputevt_handler_t handler)
+{
+	struct inputevt_stats *st;
+	const void *key = func_to_pointer(handler);
+
+	STATS_LOCK;
+
+	if G_UNLIKELY(NULL == inputevt_stats_ht)
+		inputevt_stats_ht = htable_create(HASH_KEY_SELF, 0);
+
+	st = htable_lookup(inputevt_stats_ht, key);
+
+	if (NULL == st) {
+		XMALLOC0(st);
+		st->handler = handler;
+		htable_insert(inputevt_stats_ht, key, st);
+	}
+
+	STATS_UNLOCK;
+
+	return st;
+}
+
+/**
+ * Free the statistics of a handler, htable_foreach() callback.
+ */
+static void
+inputevt_stats_free_kv(const void *unused_key, void *value, void *unused_data)
+{
+	struct inputevt_stats *st = value;
+
+	(void) unused_key;
+	(void) unused_data;
+
+	XFREE_NULL(st);
+}
+
 /**
  * Handle event on given file descriptor.
+ *
+ * @param ctx		the polling context
+ * @param fd		the file descriptor
+ * @param condition	the condition reported for the file descriptor
+ * @param collected	when event was collected, for latency accounting
  */
 static void
-inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition)
+inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition,
+	const tm_t *collected)
 {
 	relay_list_t *rl;
 	pslist_t *sl;
@@ -993,7 +1169,11 @@ inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition)
 			continue;
 
 		if (condition & relay->condition) {
+			struct inputevt_stats *st = relay->stats;
+			tm_t start, end;
+
 			data_available = 0;		/* FIXME: not thread-safe */
+			tm_now_exact(&start);
 
 			if G_UNLIKELY(inputevt_trace) {
 				void *handler = relay->handler;
@@ -1008,10 +1188,55 @@ inputevt_handle(const struct poll_ctx *ctx, int fd, inputevt_cond_t condition)
 			} else {
 				relay->handler(relay->data, fd, condition);
 			}
+
+			tm_now_exact(&end);
+			inputevt_stats_update(st,
+				tm_elapsed_us(&start, collected), tm_elapsed_us(&end, &start));
 		}
 	}
 }
 
+/**
+ * Record event in the list for its priority.
+ */
+static void
+inputevt_event_enqueue(const struct poll_ctx *ctx, const struct event *ev,
+	pslist_t **urgent, pslist_t **regular)
+{
+	relay_list_t *rl;
+
+	g_assert(CTX_IS_LOCKED(ctx));
+
+	rl = htable_lookup(ctx->ht, int_to_pointer(ev->fd));
+
+	if (rl != NULL && rl->urgent != 0)
+		*urgent = pslist_prepend(*urgent, WCOPY(ev));
+	else
+		*regular = pslist_prepend(*regular, WCOPY(ev));
+}
+
+/**
+ * Dispatch the collected events, then free the list.
+ *
+ * The context must not be locked, so that handlers are invoked without any
+ * lock held.
+ */
+static void
+inputevt_event_dispatch(const struct poll_ctx *ctx, pslist_t *evlist,
+	const tm_t *collected)
+{
+	pslist_t *es;
+
+	PSLIST_FOREACH(evlist, es) {
+		struct event *event = es->data;
+
+		inputevt_handle(ctx, event->fd, event->condition, collected);
+		WFREE(event);
+	}
+
+	pslist_free_null(&evlist);
+}
+
 /**
  * Our main I/O event dispatching loop.
  */
@@ -1019,6 +1244,7 @@ static void G_HOT
 inputevt_timer(struct poll_ctx *ctx)
 {
 	int num_events;
+	tm_t collected;
 
 	g_assert(ctx != NULL);
 
@@ -1042,10 +1268,11 @@ inputevt_timer(struct poll_ctx *ctx)
 	}
 
 	ctx->dispatching = TRUE;
+	tm_now_exact(&collected);
 
 	if (num_events > 0) {
 		unsigned idx;
-		pslist_t *evlist = NULL, *es;
+		pslist_t *urgent = NULL, *regular = NULL;
 
 		g_assert(UNSIGNED(num_events) <= ctx->num_ev);
 
@@ -1059,34 +1286,46 @@ inputevt_timer(struct poll_ctx *ctx)
 				continue;
 
 			num_events--;
-			evlist = pslist_prepend(evlist, WCOPY(&event));
+			inputevt_event_enqueue(ctx, &event, &urgent, &regular);
 		}
 
 		/*
-		 * Invoke I/O callbacks without any locks.
+		 * Invoke I/O callbacks without any locks, urgent sources first.
 		 *
-		 * Becauuse ctx->dispatching is TRUE, no changes to the relay list
-		 * can happen concurrently (hopefully -- RAM).
+		 * Because ctx->dispatching is TRUE, no changes to the relay list
+		 * can happen concurrently: other threads adding or removing sources
+		 * of a shard wait for the end of the dispatching.
 		 */
 
 		CTX_UNLOCK(ctx);
-
-		PSLIST_FOREACH(evlist, es) {
-			struct event *event = es->data;
-
-			inputevt_handle(ctx, event->fd, event->condition);
-			WFREE(event);
-		}
-
-		pslist_free_null(&evlist);
+		inputevt_event_dispatch(ctx, pslist_concat(urgent, regular),
+			&collected);
 		CTX_LOCK(ctx);
 	}
 
 	if (hash_list_length(ctx->readable) > 0) {
 		plist_t *iter, *list = hash_list_list(ctx->readable);
+		pslist_t *urgent = NULL, *regular = NULL;
 
 		hash_list_clear(ctx->readable);
 
+		if (inputevt_debug > 2) {
+			unsigned long count = plist_length(list);
+			s_debug("%s(): %lu fake event%s", G_STRFUNC, PLURAL(count));
+		}
+
+		PLIST_FOREACH(list, iter) {
+			struct event event;
+
+			event.fd = pointer_to_int(iter->data);
+			event.condition = INPUT_EVENT_R;
+			event.data_available = 0;
+
+			inputevt_event_enqueue(ctx, &event, &urgent, &regular);
+		}
+
+		plist_free_null(&list);
+
 		/*
 		 * Now that we snapshot the list of readable file descriptors, we
 		 * can release the context lock to make sure callbacks are invoked
@@ -1097,20 +1336,10 @@ inputevt_timer(struct poll_ctx *ctx)
 		 * processing whilst we no longer hold the lock.	--RAM
 		 */
 
-		if (inputevt_debug > 2) {
-			unsigned long count = plist_length(list);
-			s_debug("%s(): %lu fake event%s", G_STRFUNC, PLURAL(count));
-		}
-
+		tm_now_exact(&collected);
 		CTX_UNLOCK(ctx);
-
-		PLIST_FOREACH(list, iter) {
-			int fd = pointer_to_int(iter->data);
-
-			inputevt_handle(ctx, fd, INPUT_EVENT_R);
-		}
-
-		plist_free_null(&list);
+		inputevt_event_dispatch(ctx, pslist_concat(urgent, regular),
+			&collected);
 		CTX_LOCK(ctx);
 	}
 
@@ -1120,6 +1349,9 @@ inputevt_timer(struct poll_ctx *ctx)
 		inputevt_purge_removed(ctx);
 	}
 
+	if (ctx->shard != 0)
+		cond_broadcast(&ctx->dispatched, &ctx->lock);
+
 	CTX_UNLOCK(ctx);
 }
 
@@ -1212,7 +1444,8 @@ inputevt_remove(unsigned *id_ptr)
 	if G_UNLIKELY(0 == id)
 		return;
 
-	ctx = get_global_poll_ctx();
+	ctx = get_poll_ctx_by_id(id);
+	id &= INPUTEVT_ID_MASK;
 	g_assert(ctx->initialized);
 	g_assert(ctx->ht);
 	g_assert(0 != id);
@@ -1221,6 +1454,17 @@ inputevt_remove(unsigned *id_ptr)
 
 	CTX_LOCK(ctx);
 
+	/*
+	 * The handlers of a shard are invoked from its I/O thread: make sure
+	 * they are not running when we return, since the caller is then free
+	 * to release the data given to the handler.
+	 */
+
+	if (ctx->shard != 0 && ctx->stid != thread_small_id()) {
+		while (ctx->dispatching)
+			cond_wait(&ctx->dispatched, &ctx->lock);
+	}
+
 	relay = ctx->relay[id];
 	g_assert(NULL != relay);
 	g_assert(zero_handler != relay->handler);
@@ -1243,6 +1487,14 @@ inputevt_remove(unsigned *id_ptr)
 		g_assert(rl->writers > 0);
 		--rl->writers;
 	}
+	if (!(INPUT_F_EDGE & relay->flags)) {
+		g_assert(rl->level > 0);
+		--rl->level;
+	}
+	if (INPUT_F_URGENT & relay->flags) {
+		g_assert(rl->urgent > 0);
+		--rl->urgent;
+	}
 
 	cur = (rl->readers ? INPUT_EVENT_R : 0) |
 		(rl->writers ? INPUT_EVENT_W : 0);
@@ -1374,6 +1626,9 @@ inputevt_add_source(struct poll_ctx *ctx, inputevt_relay_t *relay, uint id)
 			WALLOC(rl);
 			rl->readers = 0;
 			rl->writers = 0;
+			rl->level = 0;
+			rl->urgent = 0;
+			rl->edge = FALSE;
 			rl->sl = NULL;
 			rl->poll_idx = inputevt_poll_idx_new(ctx, relay->fd);
 			old = 0;
@@ -1384,6 +1639,10 @@ inputevt_add_source(struct poll_ctx *ctx, inputevt_relay_t *relay, uint id)
 			rl->readers++;
 		if (INPUT_EVENT_W & relay->condition)
 			rl->writers++;
+		if (!(INPUT_F_EDGE & relay->flags))
+			rl->level++;
+		if (INPUT_F_URGENT & relay->flags)
+			rl->urgent++;
 
 		rl->sl = pslist_prepend(rl->sl, uint_to_pointer(id));
 	}
@@ -1419,27 +1678,78 @@ inputevt_process_added(struct poll_ctx *ctx)
 	pslist_free_null(&ctx->added_relays);
 }
 
+/**
+ * GLib idle callback to dispatch the file descriptors flagged as readable.
+ */
+static bool
+inputevt_readable_idle(void *data)
+{
+	struct poll_ctx *ctx = data;
+
+	CTX_LOCK(ctx);
+	ctx->readable_idle = 0;
+	CTX_UNLOCK(ctx);
+
+	inputevt_timer(ctx);
+	return FALSE;		/* Remove idle source */
+}
+
+/**
+ * Record file descriptor as readable in the polling context.
+ *
+ * @return TRUE if the file descriptor is monitored by the context.
+ */
+static bool
+inputevt_ctx_set_readable(struct poll_ctx *ctx, int fd)
+{
+	void *key = int_to_pointer(fd);
+	bool found;
+
+	CTX_LOCK(ctx);
+
+	found = htable_contains(ctx->ht, key);
+
+	if (found && !hash_list_contains(ctx->readable, key))
+		hash_list_append(ctx->readable, key);
+
+	/*
+	 * Edge-triggered sources that were not drained will get no further
+	 * event from the kernel, hence we cannot wait for the master fd to
+	 * become readable to dispatch the main context.
+	 *
+	 * Shards do not need this since they check for readable sources before
+	 * waiting for events.
+	 */
+
+	if (
+		found && 0 == ctx->shard && 0 == ctx->readable_idle &&
+		thread_is_main()
+	) {
+		ctx->readable_idle = g_idle_add(inputevt_readable_idle, ctx);
+	}
+
+	CTX_UNLOCK(ctx);
+
+	return found;
+}
+
 void
 inputevt_set_readable(int fd)
 {
-	struct poll_ctx *ctx = get_global_poll_ctx();
-	void *key = int_to_pointer(fd);
+	unsigned i;
 
 	if (inputevt_debug > 3) {
 		s_debug("%s(): fd=%d", G_STRFUNC, fd);
 	}
 	g_assert(is_valid_fd(fd));
 
-	CTX_LOCK(ctx);
+	if (inputevt_ctx_set_readable(get_global_poll_ctx(), fd))
+		return;
 
-	if (
-		htable_contains(ctx->ht, key) &&
-		!hash_list_contains(ctx->readable, key)
-	) {
-		hash_list_append(ctx->readable, key);
+	for (i = 0; i < inputevt_shard_count; i++) {
+		if (inputevt_ctx_set_readable(inputevt_shard[i], fd))
+			return;
 	}
-
-	CTX_UNLOCK(ctx);
 }
 
 static int
@@ -1455,7 +1765,8 @@ init_with_kqueue(struct poll_ctx *ctx)
 
 	g_assert(CTX_IS_LOCKED(ctx));
 
-	g_main_context_set_poll_func(NULL, default_poll_func);
+	if (0 == ctx->shard)
+		g_main_context_set_poll_func(NULL, default_poll_func);
 	ctx->master_fd = fd;
 	ctx->polling_method = "kqueue()";
 	ctx->collect_events = NULL; /* master fd can be polled */
@@ -1485,7 +1796,8 @@ init_with_devpoll(struct poll_ctx *ctx)
 
 	g_assert(CTX_IS_LOCKED(ctx));
 
-	g_main_context_set_poll_func(NULL, default_poll_func);
+	if (0 == ctx->shard)
+		g_main_context_set_poll_func(NULL, default_poll_func);
 	ctx->master_fd = fd;
 	ctx->polling_method = "/dev/poll";
 	ctx->collect_events = collect_events_with_devpoll;
@@ -1515,7 +1827,8 @@ init_with_epoll(struct poll_ctx *ctx)
 
 	g_assert(CTX_IS_LOCKED(ctx));
 
-	g_main_context_set_poll_func(NULL, default_poll_func);
+	if (0 == ctx->shard)
+		g_main_context_set_poll_func(NULL, default_poll_func);
 	ctx->master_fd = fd;
 	ctx->polling_method = "epoll()";
 	ctx->collect_events = NULL; /* master fd can be polled */
@@ -1535,11 +1848,17 @@ init_with_epoll(struct poll_ctx *ctx)
 static int
 init_with_poll(struct poll_ctx *ctx)
 {
-	default_poll_func = g_main_context_get_poll_func(NULL);
-
 	g_assert(CTX_IS_LOCKED(ctx));
 
-	g_main_context_set_poll_func(NULL, poll_func);
+	/*
+	 * Shards are not driven by the GLib main loop but by their own thread.
+	 */
+
+	if (0 == ctx->shard) {
+		default_poll_func = g_main_context_get_poll_func(NULL);
+		g_main_context_set_poll_func(NULL, poll_func);
+	}
+
 	ctx->master_fd = -1;
 	ctx->polling_method = "poll()";
 	ctx->collect_events = collect_events_with_poll;
@@ -1567,18 +1886,13 @@ inputevt_thread_id(void)
 }
 
 /**
- * Performs module initialization.
- * @param use_poll If TRUE, kqueue(), epoll(), /dev/poll etc. won't be used.
+ * Initialize polling context.
  */
-void
-inputevt_init(int use_poll)
+static void
+inputevt_ctx_init(struct poll_ctx *ctx)
 {
-	struct poll_ctx *ctx;
-
-	ctx = get_global_poll_ctx();
-	inputevt_stid = thread_small_id();
-
 	g_assert(!ctx->initialized);
+
 	ctx->initialized = TRUE;
 	ctx->ht = htable_create(HASH_KEY_SELF, 0);
 	ctx->readable = hash_list_new(NULL, NULL);
@@ -1595,7 +1909,7 @@ inputevt_init(int use_poll)
 
 	init_with_poll(ctx); /* Must be called first and provides the default */
 
-	if (!use_poll) {
+	if (!inputevt_use_poll) {
 		if (init_with_kqueue(ctx)) {
 			if (init_with_epoll(ctx)) {
 				init_with_devpoll(ctx);
@@ -1605,11 +1919,28 @@ inputevt_init(int use_poll)
 
 	CTX_UNLOCK(ctx);
 
+	if (is_valid_fd(ctx->master_fd))
+		fd_set_close_on_exec(ctx->master_fd);	/* Just in case */
+}
+
+/**
+ * Performs module initialization.
+ * @param use_poll If TRUE, kqueue(), epoll(), /dev/poll etc. won't be used.
+ */
+void
+inputevt_init(int use_poll)
+{
+	struct poll_ctx *ctx;
+
+	ctx = get_global_poll_ctx();
+	inputevt_stid = thread_small_id();
+	inputevt_use_poll = booleanize(use_poll);
+
+	inputevt_ctx_init(ctx);
+
 	if (is_valid_fd(ctx->master_fd)) {
 		GIOChannel *ch;
 
-		fd_set_close_on_exec(ctx->master_fd);	/* Just in case */
-
 		ch = g_io_channel_unix_new(ctx->master_fd);
 
 #if GLIB_CHECK_VERSION(2, 0, 0)
@@ -1626,18 +1957,137 @@ inputevt_init(int use_poll)
 }
 
 /**
- * Adds an event source to the main GLIB monitor queue.
+ * Wait for events in a shard, for at most INPUTEVT_SHARD_WAIT_MS.
+ */
+static void
+inputevt_shard_wait(struct poll_ctx *ctx)
+{
+	int timeout_ms = INPUTEVT_SHARD_WAIT_MS;
+
+	CTX_LOCK(ctx);
+
+	/*
+	 * Do not wait when there are sources flagged as readable, which
+	 * inputevt_timer() is going to dispatch.
+	 */
+
+	if (0 != hash_list_length(ctx->readable)) {
+		CTX_UNLOCK(ctx);
+		return;
+	}
+
+	if (NULL == ctx->collect_events) {
+		struct pollfd pfd;
+
+		/*
+		 * The master fd can be polled, wait until it becomes readable.
+		 *
+		 * Since compat_poll() already accounts for the system call, we pass
+		 * a timeout of 0 to make sure inputevt_collect_start() is not
+		 * declaring it again to the thread layer.
+		 */
+
+		pfd.fd = ctx->master_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		inputevt_collect_start(ctx, 0);
+		(void) compat_poll(&pfd, 1, timeout_ms);
+		inputevt_collect_end(ctx, 0);
+	} else if (0 == ctx->max_poll_idx) {
+		CTX_UNLOCK(ctx);
+		thread_sleep_ms(timeout_ms);	/* Nothing to monitor yet */
+		return;
+	} else if (0 == ctx->num_ready) {
+		check_for_events(ctx, &timeout_ms);
+	}
+
+	CTX_UNLOCK(ctx);
+}
+
+/**
+ * The I/O thread of a shard.
+ */
+static void *
+inputevt_shard_main(void *arg)
+{
+	struct poll_ctx *ctx = arg;
+
+	thread_set_name_atom(str_smsg("I/O #%u", ctx->shard));
+	ctx->stid = thread_small_id();
+
+	while (!ctx->stopping) {
+		inputevt_shard_wait(ctx);
+		inputevt_timer(ctx);
+	}
+
+	return NULL;
+}
+
+/**
+ * Create I/O threads, each owning its own polling context.
  *
- * A replacement for gdk_input_add().
- * Behaves exactly the same, except destroy notification has
- * been removed (since gtkg does not use it).
+ * Only the first call has an effect, the amount of shards being fixed
+ * thereafter.
+ *
+ * @param n		amount of I/O threads (capped to INPUTEVT_SHARD_MAX)
+ */
+void
+inputevt_shards_init(unsigned n)
+{
+	unsigned i;
+
+	g_assert(thread_is_main());
+	g_assert(get_global_poll_ctx()->initialized);
+
+	if (inputevt_shard_count != 0)
+		return;
+
+	n = MIN(n, INPUTEVT_SHARD_MAX);
+
+	for (i = 0; i < n; i++) {
+		struct poll_ctx *ctx;
+
+		XMALLOC0(ctx);
+		ctx->shard = i + 1;
+		ctx->stid = THREAD_INVALID_ID;
+		ctx->dispatched = COND_INIT;
+		inputevt_ctx_init(ctx);
+
+		ctx->thread = thread_create(inputevt_shard_main, ctx,
+			THREAD_F_NO_CANCEL | THREAD_F_NO_POOL | THREAD_F_PANIC,
+			THREAD_STACK_DFLT);
+
+		inputevt_shard[i] = ctx;
+	}
+
+	inputevt_shard_count = n;
+
+	if (n != 0) {
+		s_info("INPUTEVT using %u I/O thread%s with %s",
+			PLURAL(n), inputevt_shard[0]->polling_method);
+	}
+}
+
+/**
+ * @return the amount of shards (I/O threads) available.
  */
 unsigned
-inputevt_add(int fd, inputevt_cond_t cond,
-	inputevt_handler_t handler, void *data)
+inputevt_shards(void)
+{
+	return inputevt_shard_count;
+}
+
+/**
+ * Adds an event source to the polling context.
+ *
+ * @return the ID of the source within the context.
+ */
+static unsigned
+inputevt_add_ctx(struct poll_ctx *ctx, int fd, inputevt_cond_t cond,
+	unsigned flags, inputevt_handler_t handler, void *data)
 {
 	inputevt_relay_t *relay;
-	struct poll_ctx *ctx;
 	uint id;
 
 	g_assert(is_valid_fd(fd));
@@ -1646,8 +2096,6 @@ inputevt_add(int fd, inputevt_cond_t cond,
 	safety_assert(is_open_fd(fd));
 	safety_assert(is_a_socket(fd) || is_a_fifo(fd));
 
-	ctx = get_global_poll_ctx();
-
 	g_assert(ctx->initialized);
 	g_assert(ctx->ht != NULL);
 
@@ -1669,13 +2117,15 @@ inputevt_add(int fd, inputevt_cond_t cond,
 cond_is_okay:
 	WALLOC(relay);
 	relay->condition = cond;
+	relay->flags = flags;
 	relay->handler = handler;
 	relay->data = data;
 	relay->fd = fd;
+	relay->stats = inputevt_stats_get(handler);
 
 	if (inputevt_debug > 3) {
-		s_debug("%s(): fd=%d, cond=%s, handler=%s()",
-			G_STRFUNC, fd, inputevt_cond_to_string(cond),
+		s_debug("%s(): fd=%d, cond=%s, flags=0x%x, handler=%s()",
+			G_STRFUNC, fd, inputevt_cond_to_string(cond), flags,
 			stacktrace_function_name(handler));
 	}
 
@@ -1692,6 +2142,17 @@ cond_is_okay:
 
 	CTX_LOCK(ctx);
 
+	/*
+	 * The I/O thread of a shard dispatches its events without holding the
+	 * context lock, reading the relay and event arrays that adding a source
+	 * may need to resize: wait until it is done, as inputevt_remove() does.
+	 */
+
+	if (ctx->shard != 0 && ctx->stid != thread_small_id()) {
+		while (ctx->dispatching)
+			cond_wait(&ctx->dispatched, &ctx->lock);
+	}
+
 	{
 		uint f = inputevt_get_free_id(ctx);
 		g_assert((unsigned) -1 == f || f < ctx->num_ev);
@@ -1710,6 +2171,8 @@ cond_is_okay:
 		}
 	}
 
+	g_assert(id <= INPUTEVT_ID_MASK);
+
 	if (ctx->collecting) {
 		struct new_relay *nr;
 
@@ -1726,6 +2189,149 @@ cond_is_okay:
 	return id;
 }
 
+/**
+ * Adds an event source to the main GLIB monitor queue.
+ *
+ * A replacement for gdk_input_add().
+ * Behaves exactly the same, except destroy notification has
+ * been removed (since gtkg does not use it).
+ */
+unsigned
+inputevt_add(int fd, inputevt_cond_t cond,
+	inputevt_handler_t handler, void *data)
+{
+	return inputevt_add_ctx(get_global_poll_ctx(),
+		fd, cond, 0, handler, data);
+}
+
+/**
+ * Adds an event source to the main GLIB monitor queue, with dispatching flags.
+ *
+ * @param fd		the file descriptor to monitor
+ * @param cond		the condition to monitor
+ * @param flags		a combination of INPUT_F_* flags
+ * @param handler	the handler to invoke when condition is satisfied
+ * @param data		opaque data to supply to the handler
+ */
+unsigned
+inputevt_add_flags(int fd, inputevt_cond_t cond, unsigned flags,
+	inputevt_handler_t handler, void *data)
+{
+	return inputevt_add_ctx(get_global_poll_ctx(),
+		fd, cond, flags, handler, data);
+}
+
+/**
+ * Adds an event source to one of the shards, chosen by hashing the file
+ * descriptor, or to the main queue if there are no shards.
+ *
+ * The handler is invoked from the I/O thread of the shard.  The source is
+ * removed via inputevt_remove(), which waits for any running handler of the
+ * shard to complete.
+ */
+unsigned
+inputevt_add_sharded(int fd, inputevt_cond_t cond, unsigned flags,
+	inputevt_handler_t handler, void *data)
+{
+	unsigned shard;
+
+	if (0 == inputevt_shard_count)
+		return inputevt_add_flags(fd, cond, flags, handler, data);
+
+	shard = integer_hash(fd) % inputevt_shard_count;
+
+	return ((shard + 1) << INPUTEVT_SHARD_SHIFT) |
+		inputevt_add_ctx(inputevt_shard[shard],
+			fd, cond, flags, handler, data);
+}
+
+/**
+ * Snapshot the statistics of a handler, htable_foreach() callback.
+ */
+static void
+inputevt_stats_copy(const void *unused_key, void *value, void *data)
+{
+	const struct inputevt_stats *st = value;
+	pslist_t **sl_ptr = data;
+
+	(void) unused_key;
+
+	*sl_ptr = pslist_prepend(*sl_ptr, XCOPY(st));
+}
+
+static int
+inputevt_info_cmp(const void *a, const void *b)
+{
+	const inputevt_info_t *ia = a, *ib = b;
+
+	return strcmp(ia->name, ib->name);
+}
+
+/**
+ * Retrieve the dispatching statistics of all the handlers.
+ *
+ * @return list of inputevt_info_t, sorted by handler name, which must be
+ * freed with inputevt_info_list_free_null().
+ */
+pslist_t *
+inputevt_info_list(void)
+{
+	pslist_t *sl = NULL, *snapshot = NULL;
+	struct inputevt_stats *st;
+
+	/*
+	 * Handler names are resolved outside of the critical section, which
+	 * must remain short since it is also taken when dispatching events.
+	 */
+
+	STATS_LOCK;
+	if (inputevt_stats_ht != NULL)
+		htable_foreach(inputevt_stats_ht, inputevt_stats_copy, &snapshot);
+	STATS_UNLOCK;
+
+	while (NULL != (st = pslist_shift(&snapshot))) {
+		inputevt_info_t *iei;
+
+		WALLOC0(iei);
+		iei->magic = INPUTEVT_INFO_MAGIC;
+		iei->name = atom_str_get(stacktrace_function_name(st->handler));
+		iei->calls = st->calls;
+		iei->wait_max = st->wait_max;
+		iei->run_max = st->run_max;
+		memcpy(iei->wait, st->wait, sizeof iei->wait);
+		memcpy(iei->run, st->run, sizeof iei->run);
+
+		sl = pslist_prepend(sl, iei);
+		XFREE_NULL(st);
+	}
+
+	return pslist_sort(sl, inputevt_info_cmp);
+}
+
+static void
+inputevt_info_free(void *data, void *udata)
+{
+	inputevt_info_t *iei = data;
+
+	inputevt_info_check(iei);
+	(void) udata;
+
+	atom_str_free_null(&iei->name);
+	WFREE(iei);
+}
+
+/**
+ * Free list created by inputevt_info_list() and nullify pointer.
+ */
+void
+inputevt_info_list_free_null(pslist_t **sl_ptr)
+{
+	pslist_t *sl = *sl_ptr;
+
+	pslist_foreach(sl, inputevt_info_free, NULL);
+	pslist_free_null(sl_ptr);
+}
+
 /**
  * Force I/O processing for all the ready sources.
  *
@@ -1741,18 +2347,18 @@ inputevt_dispatch(void)
 }
 
 /**
- * Performs module cleanup.
+ * Free polling context.
  */
-void
-inputevt_close(void)
+static void
+inputevt_ctx_close(struct poll_ctx *ctx)
 {
-	struct poll_ctx *ctx;
-
-	ctx = get_global_poll_ctx();
-	inputevt_stid = THREAD_INVALID_ID;
-
 	CTX_LOCK(ctx);
 
+	if (ctx->readable_idle != 0) {
+		g_source_remove(ctx->readable_idle);
+		ctx->readable_idle = 0;
+	}
+
 	inputevt_purge_removed(ctx);
 	htable_free_null(&ctx->ht);
 	hash_list_free(&ctx->readable);
@@ -1767,4 +2373,43 @@ inputevt_close(void)
 	mutex_destroy(&ctx->lock);
 }
 
+/**
+ * Performs module cleanup.
+ */
+void
+inputevt_close(void)
+{
+	unsigned i;
+
+	/*
+	 * Stop the I/O threads first: they can still be running handlers.
+	 */
+
+	for (i = 0; i < inputevt_shard_count; i++)
+		inputevt_shard[i]->stopping = TRUE;
+
+	for (i = 0; i < inputevt_shard_count; i++) {
+		struct poll_ctx *ctx = inputevt_shard[i];
+
+		if (-1 != ctx->thread && -1 == thread_join(ctx->thread, NULL))
+			s_warning("%s(): cannot join with I/O thread: %m", G_STRFUNC);
+
+		inputevt_ctx_close(ctx);
+		cond_destroy(&ctx->dispatched);
+		XFREE_NULL(inputevt_shard[i]);
+	}
+
+	inputevt_shard_count = 0;
+
+	inputevt_stid = THREAD_INVALID_ID;
+	inputevt_ctx_close(get_global_poll_ctx());
+
+	STATS_LOCK;
+	if (inputevt_stats_ht != NULL) {
+		htable_foreach(inputevt_stats_ht, inputevt_stats_free_kv, NULL);
+		htable_free_null(&inputevt_stats_ht);
+	}
+	STATS_UNLOCK;
+}
+
 /* vi: set ts=4 sw=4 cindent: */
@@ -56,6 +56,14 @@ typedef enum {
 	INPUT_EVENT_RWX = ((uint) INPUT_EVENT_RW | (uint) INPUT_EVENT_EXCEPTION)
 } inputevt_cond_t;
 
+/**
+ * Source dispatching flags.
+ */
+enum {
+	INPUT_F_EDGE	= 1 << 0,	/* edge-triggered, handler drains the source */
+	INPUT_F_URGENT	= 1 << 1	/* dispatched before regular sources */
+};
+
 /**
  * And the handler function type.
  */
@@ -65,6 +73,36 @@ typedef void (*inputevt_handler_t) (
 	inputevt_cond_t condition
 );
 
+#define INPUTEVT_HIST_BUCKETS	8	/**< Latency histogram buckets */
+
+/**
+ * Upper limit, in usecs, of the latencies counted by a histogram bucket,
+ * the last bucket counting all the latencies above the previous limit.
+ */
+#define INPUTEVT_HIST_LIMIT(i)	(16U << (2 * (i)))
+
+enum inputevt_info_magic { INPUTEVT_INFO_MAGIC = 0x1f4e60b9 };
+
+/**
+ * Dispatching statistics of an event handler that can be retrieved.
+ */
+typedef struct {
+	enum inputevt_info_magic magic;
+	const char *name;					/**< Handler name (atom) */
+	uint64 calls;						/**< Amount of dispatched events */
+	uint64 wait[INPUTEVT_HIST_BUCKETS];	/**< Delay before dispatching */
+	uint64 run[INPUTEVT_HIST_BUCKETS];	/**< Time spent in handler */
+	uint64 wait_max;					/**< Max delay, in usecs */
+	uint64 run_max;						/**< Max handler time, in usecs */
+} inputevt_info_t;
+
+static inline void
+inputevt_info_check(const inputevt_info_t * const iei)
+{
+	g_assert(iei != NULL);
+	g_assert(INPUTEVT_INFO_MAGIC == iei->magic);
+}
+
 /*
  * Module initialization and cleanup functions.
  */
@@ -76,18 +114,27 @@ void inputevt_dispatch(void);
 void inputevt_set_debug(unsigned level);
 void inputevt_set_trace(bool on);
 unsigned inputevt_thread_id(void);
+void inputevt_shards_init(unsigned n);
+unsigned inputevt_shards(void);
 
 /**
  * This emulates the GDK input interface.
  */
 unsigned inputevt_add(int source, inputevt_cond_t condition,
 	inputevt_handler_t handler, void *data);
+unsigned inputevt_add_flags(int source, inputevt_cond_t condition,
+	unsigned flags, inputevt_handler_t handler, void *data);
+unsigned inputevt_add_sharded(int source, inputevt_cond_t condition,
+	unsigned flags, inputevt_handler_t handler, void *data);
 
 const char *inputevt_cond_to_string(inputevt_cond_t cond);
 size_t inputevt_data_available(void);
 void inputevt_remove(unsigned *id_ptr);
 void inputevt_set_readable(int fd);
 
+struct pslist *inputevt_info_list(void);
+void inputevt_info_list_free_null(struct pslist **sl_ptr);
+
 #endif  /* _inputevt_h_ */
 
 /* vi: set ts=4 sw=4 cindent: */
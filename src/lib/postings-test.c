@@ -0,0 +1,757 @@
+/*
+ * postings-test -- posting lists tests and search index benchmarking.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/mempcpy.h"
+#include "lib/misc.h"
+#include "lib/postings.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_LISTS		2000		/* Random list pairs to intersect */
+#define TEST_LIST_MAX	5000		/* Max items in random lists */
+#define TEST_NAMES		20000		/* Synthetic library size for tests */
+#define TEST_QUERIES	2000		/* Queries run against test library */
+
+#define BENCH_NAMES		1000000		/* Default benchmark library size */
+#define BENCH_QUERIES	10000		/* Default amount of benchmark queries */
+
+#define VOCABULARY		50000		/* Distinct words in file names */
+#define WORD_MAXLEN		10
+#define NAME_MAXWORDS	7
+#define QUERY_MAXWORDS	3
+
+#define NLETTERS		26
+#define NTRIGRAMS		(NLETTERS * NLETTERS * NLETTERS)
+#define NBIGRAMS		(NLETTERS * NLETTERS)
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htV] [-n names] [-q queries] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of file names for benchmarking\n"
+		"  -q : sets amount of queries for benchmarking\n"
+		"  -t : time bin scanning versus posting list intersection\n"
+		"  -R : seed for repeatable random data sequence\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(void)
+{
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+/**
+ * Sort and remove duplicates from an array of identifiers.
+ *
+ * @return new amount of items.
+ */
+static size_t
+ids_normalize(uint32 *ids, size_t n)
+{
+	size_t i, j;
+
+	/* Insertion sort is slow, but this is test code on small arrays */
+
+	for (i = 1; i < n; i++) {
+		uint32 v = ids[i];
+
+		for (j = i; j > 0 && ids[j-1] > v; j--)
+			ids[j] = ids[j-1];
+		ids[j] = v;
+	}
+
+	for (i = j = 0; i < n; i++) {
+		if (0 == j || ids[j-1] != ids[i])
+			ids[j++] = ids[i];
+	}
+
+	return j;
+}
+
+/**
+ * Generate a random sorted array of distinct identifiers.
+ */
+static uint32 *
+ids_random(size_t max, uint32 range, size_t *count)
+{
+	uint32 *ids;
+	size_t i, n = rand31_value(max);
+
+	XMALLOC_ARRAY(ids, n + 1);
+
+	for (i = 0; i < n; i++)
+		ids[i] = rand31_value(range);
+
+	*count = ids_normalize(ids, n);
+	return ids;
+}
+
+/**
+ * Check encoding, decoding and intersection of random lists.
+ */
+static void
+postings_test(void)
+{
+	size_t t;
+
+	for (t = 0; t < TEST_LISTS; t++) {
+		uint32 range = 1 + rand31_value(t & 1 ? 100000 : 1U << 30);
+		size_t bmax = (t % 3) ? TEST_LIST_MAX : TEST_LIST_MAX / 100;
+		size_t na, nb, nd, n1, n2, i, j;
+		uint32 *a, *b, *d, *r1, *r2;
+		postings_t *pl;
+
+		a = ids_random(TEST_LIST_MAX, range, &na);
+		b = ids_random(bmax, range, &nb);
+
+		pl = postings_make();
+		for (i = 0; i < na; i++) {
+			postings_append(pl, a[i]);
+			if (0 == rand31_value(3))
+				postings_append(pl, a[i]);	/* Repeats are ignored */
+		}
+		postings_compact(pl);
+
+		XMALLOC_ARRAY(d, na + 1);
+		nd = postings_decode(pl, d);
+
+		if (nd != na || 0 != memcmp(d, a, na * sizeof a[0])) {
+			printf("list #%zu: decoded %zu item%s, expected %zu\n",
+				t, PLURAL(nd), na);
+			test_abort();
+		}
+
+		XMALLOC_ARRAY(r1, MIN(na, nb) + 1);
+		XMALLOC_ARRAY(r2, MIN(na, nb) + 1);
+
+		n1 = postings_intersect(a, na, b, nb, r1);
+
+		for (i = j = n2 = 0; i < na && j < nb; /* empty */) {
+			if (a[i] < b[j]) {
+				i++;
+			} else if (a[i] > b[j]) {
+				j++;
+			} else {
+				r2[n2++] = a[i];
+				i++;
+				j++;
+			}
+		}
+
+		if (n1 != n2 || 0 != memcmp(r1, r2, n1 * sizeof r1[0])) {
+			printf("list #%zu: intersecting %zu and %zu items "
+				"gave %zu, expected %zu\n", t, na, nb, n1, n2);
+			test_abort();
+		}
+
+		if (verbose_mode) {
+			printf("list #%zu: %zu item%s in %zu bytes, "
+				"%zu common with %zu item%s OK\n",
+				t, PLURAL(na), postings_memory(pl), n1, PLURAL(nb));
+		}
+
+		postings_free_null(&pl);
+		XFREE_NULL(a);
+		XFREE_NULL(b);
+		XFREE_NULL(d);
+		XFREE_NULL(r1);
+		XFREE_NULL(r2);
+	}
+
+	printf("Posting lists encoding and intersection: all OK\n");
+}
+
+/*
+ * Synthetic library.
+ *
+ * File names are made of words picked from a vocabulary with a skewed
+ * distribution, so that some words (and hence letter pairs) are much more
+ * common than others, as they are in real libraries.
+ */
+
+static char *vocabulary[VOCABULARY];
+
+struct library {
+	char **names;
+	size_t count;
+};
+
+struct bin_index {
+	uint32 *ids[NBIGRAMS];
+	size_t count[NBIGRAMS];
+	size_t size[NBIGRAMS];
+};
+
+struct trigram_index {
+	postings_t *lists[NTRIGRAMS];
+};
+
+/**
+ * Pick a random word, small indices being much more frequent.
+ */
+static const char *
+word_pick(void)
+{
+	double u = rand31_double();
+
+	return vocabulary[(size_t) (u * u * u * VOCABULARY)];
+}
+
+static void
+vocabulary_init(void)
+{
+	size_t i, j;
+
+	for (i = 0; i < VOCABULARY; i++) {
+		size_t len = 3 + rand31_value(WORD_MAXLEN - 3);
+		char *w = xmalloc(len + 1);
+
+		for (j = 0; j < len; j++)
+			w[j] = 'a' + rand31_value(NLETTERS - 1);
+		w[len] = '\0';
+		vocabulary[i] = w;
+	}
+}
+
+static void
+vocabulary_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < VOCABULARY; i++)
+		XFREE_NULL(vocabulary[i]);
+}
+
+static void
+library_make(struct library *lib, size_t count)
+{
+	char buf[NAME_MAXWORDS * (WORD_MAXLEN + 1) + 1];
+	size_t i, j;
+
+	lib->count = count;
+	XMALLOC_ARRAY(lib->names, count);
+
+	for (i = 0; i < count; i++) {
+		size_t words = 2 + rand31_value(NAME_MAXWORDS - 2);
+		char *p = buf;
+
+		for (j = 0; j < words; j++) {
+			const char *w = word_pick();
+			if (j != 0)
+				*p++ = ' ';
+			p = mempcpy(p, w, vstrlen(w));
+		}
+		*p = '\0';
+		lib->names[i] = xstrdup(buf);
+	}
+}
+
+static void
+library_free(struct library *lib)
+{
+	size_t i;
+
+	for (i = 0; i < lib->count; i++)
+		XFREE_NULL(lib->names[i]);
+	XFREE_NULL(lib->names);
+}
+
+static inline uint
+letter(char c)
+{
+	return (uchar) c - 'a';
+}
+
+static inline bool
+is_letter(char c)
+{
+	return c >= 'a' && c <= 'z';
+}
+
+/**
+ * Build the bin index: each pair of letters lists the names holding it.
+ */
+static void
+bin_index_make(struct bin_index *bi, const struct library *lib)
+{
+	size_t i;
+
+	ZERO(bi);
+
+	for (i = 0; i < lib->count; i++) {
+		const char *s = lib->names[i];
+
+		for (/* empty */; s[0] != '\0' && s[1] != '\0'; s++) {
+			uint key;
+
+			if (!is_letter(s[0]) || !is_letter(s[1]))
+				continue;
+
+			key = letter(s[0]) * NLETTERS + letter(s[1]);
+			if (bi->count[key] != 0 && bi->ids[key][bi->count[key] - 1] == i)
+				continue;
+			if (bi->count[key] == bi->size[key]) {
+				bi->size[key] = MAX(4, bi->size[key] * 2);
+				XREALLOC_ARRAY(bi->ids[key], bi->size[key]);
+			}
+			bi->ids[key][bi->count[key]++] = i;
+		}
+	}
+}
+
+static size_t
+bin_index_memory(const struct bin_index *bi)
+{
+	size_t i, total = 0;
+
+	/* The search table uses pointers, not 32-bit indices */
+
+	for (i = 0; i < NBIGRAMS; i++)
+		total += bi->count[i] * sizeof(void *);
+
+	return total;
+}
+
+static void
+bin_index_free(struct bin_index *bi)
+{
+	size_t i;
+
+	for (i = 0; i < NBIGRAMS; i++)
+		XFREE_NULL(bi->ids[i]);
+}
+
+/**
+ * Build the trigram index: each sequence of 3 letters within a word has
+ * a posting list of the names holding it.
+ */
+static void
+trigram_index_make(struct trigram_index *ti, const struct library *lib)
+{
+	size_t i;
+
+	ZERO(ti);
+
+	for (i = 0; i < lib->count; i++) {
+		const char *s = lib->names[i];
+
+		for (/* empty */; s[0] != '\0' && s[1] != '\0' && s[2] != '\0'; s++) {
+			uint key;
+
+			if (!is_letter(s[0]) || !is_letter(s[1]) || !is_letter(s[2]))
+				continue;
+
+			key = (letter(s[0]) * NLETTERS + letter(s[1])) * NLETTERS +
+				letter(s[2]);
+			if (NULL == ti->lists[key])
+				ti->lists[key] = postings_make();
+			postings_append(ti->lists[key], i);
+		}
+	}
+
+	for (i = 0; i < NTRIGRAMS; i++) {
+		if (ti->lists[i] != NULL)
+			postings_compact(ti->lists[i]);
+	}
+}
+
+static size_t
+trigram_index_memory(const struct trigram_index *ti)
+{
+	size_t i, total = 0;
+
+	for (i = 0; i < NTRIGRAMS; i++) {
+		if (ti->lists[i] != NULL)
+			total += postings_memory(ti->lists[i]);
+	}
+
+	return total;
+}
+
+static void
+trigram_index_free(struct trigram_index *ti)
+{
+	size_t i;
+
+	for (i = 0; i < NTRIGRAMS; i++)
+		postings_free_null(&ti->lists[i]);
+}
+
+struct query {
+	const char *words[QUERY_MAXWORDS];
+	size_t count;
+};
+
+static void
+query_make(struct query *q)
+{
+	size_t i;
+
+	q->count = 1 + rand31_value(QUERY_MAXWORDS - 1);
+
+	for (i = 0; i < q->count; i++)
+		q->words[i] = word_pick();
+}
+
+/**
+ * Check whether all the query words appear at the beginning of a word
+ * in the name, which is how the search table matches.
+ */
+static bool
+query_match(const struct query *q, const char *name)
+{
+	size_t i;
+
+	for (i = 0; i < q->count; i++) {
+		const char *w = q->words[i];
+		const char *p = name;
+		bool found = FALSE;
+
+		while (NULL != (p = vstrstr(p, w))) {
+			if (p == name || ' ' == p[-1]) {
+				found = TRUE;
+				break;
+			}
+			p++;
+		}
+
+		if (!found)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Run query by scanning the smallest bin among the query letter pairs.
+ *
+ * @return amount of matches, the amount of scanned names being added
+ * to `scanned'.
+ */
+static size_t
+bin_search(const struct bin_index *bi, const struct library *lib,
+	const struct query *q, size_t *scanned)
+{
+	size_t i, best = (size_t) -1, best_count = (size_t) -1, n = 0;
+
+	for (i = 0; i < q->count; i++) {
+		const char *s = q->words[i];
+
+		for (/* empty */; s[0] != '\0' && s[1] != '\0'; s++) {
+			uint key = letter(s[0]) * NLETTERS + letter(s[1]);
+
+			if (bi->count[key] < best_count) {
+				best = key;
+				best_count = bi->count[key];
+			}
+		}
+	}
+
+	if (0 == best_count)
+		return 0;
+
+	for (i = 0; i < best_count; i++) {
+		if (query_match(q, lib->names[bi->ids[best][i]]))
+			n++;
+	}
+
+	*scanned += best_count;
+	return n;
+}
+
+/**
+ * Run query by intersecting the posting lists of the query trigrams.
+ *
+ * @return amount of matches, the amount of scanned names being added
+ * to `scanned'.
+ */
+static size_t
+trigram_search(const struct trigram_index *ti, const struct library *lib,
+	const struct query *q, size_t *scanned)
+{
+	const postings_t *lists[QUERY_MAXWORDS * WORD_MAXLEN];
+	size_t i, j, nl = 0, cnt, n = 0, maxcnt = 0;
+	uint32 *ids, *buf, *tmp;
+
+	for (i = 0; i < q->count; i++) {
+		const char *s = q->words[i];
+
+		for (/* empty */; s[0] != '\0' && s[1] != '\0' && s[2] != '\0'; s++) {
+			uint key = (letter(s[0]) * NLETTERS + letter(s[1])) * NLETTERS +
+				letter(s[2]);
+			const postings_t *pl = ti->lists[key];
+
+			if (NULL == pl)
+				return 0;
+
+			for (j = 0; j < nl; j++) {
+				if (pl == lists[j])
+					break;
+			}
+			if (j == nl) {
+				lists[nl++] = pl;
+				maxcnt = MAX(maxcnt, postings_count(pl));
+			}
+		}
+	}
+
+	for (i = 1; i < nl; i++) {
+		const postings_t *pl = lists[i];
+		size_t count = postings_count(pl);
+
+		for (j = i; j > 0 && postings_count(lists[j-1]) > count; j--)
+			lists[j] = lists[j-1];
+		lists[j] = pl;
+	}
+
+	XMALLOC_ARRAY(ids, maxcnt);
+	XMALLOC_ARRAY(buf, maxcnt);
+	XMALLOC_ARRAY(tmp, maxcnt);
+
+	cnt = postings_decode(lists[0], ids);
+
+	for (i = 1; i < nl && cnt != 0; i++) {
+		uint32 *swap;
+		size_t bcnt = postings_decode(lists[i], buf);
+
+		cnt = postings_intersect(ids, cnt, buf, bcnt, tmp);
+		swap = ids;
+		ids = tmp;
+		tmp = swap;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		if (query_match(q, lib->names[ids[i]]))
+			n++;
+	}
+
+	XFREE_NULL(ids);
+	XFREE_NULL(buf);
+	XFREE_NULL(tmp);
+
+	*scanned += cnt;
+	return n;
+}
+
+/**
+ * Check that both indexing approaches find the same matches.
+ */
+static void
+search_test(void)
+{
+	struct library lib;
+	struct bin_index *bi;
+	struct trigram_index *ti;
+	size_t i, bscan = 0, tscan = 0, matches = 0;
+
+	library_make(&lib, TEST_NAMES);
+	XMALLOC(bi);
+	XMALLOC(ti);
+	bin_index_make(bi, &lib);
+	trigram_index_make(ti, &lib);
+
+	for (i = 0; i < TEST_QUERIES; i++) {
+		struct query q;
+		size_t bn, tn;
+
+		query_make(&q);
+		bn = bin_search(bi, &lib, &q, &bscan);
+		tn = trigram_search(ti, &lib, &q, &tscan);
+
+		if (bn != tn) {
+			printf("query #%zu: bins found %zu match%s, trigrams %zu\n",
+				i, PLURAL_ES(bn), tn);
+			test_abort();
+		}
+
+		matches += bn;
+	}
+
+	if (verbose_mode) {
+		printf("%u queries on %u names: %zu match%s, "
+			"scanned %zu via bins, %zu via trigrams\n",
+			TEST_QUERIES, TEST_NAMES, PLURAL_ES(matches), bscan, tscan);
+	}
+
+	bin_index_free(bi);
+	trigram_index_free(ti);
+	XFREE_NULL(bi);
+	XFREE_NULL(ti);
+	library_free(&lib);
+
+	printf("Bin scanning versus posting list intersection: all OK\n");
+}
+
+/**
+ * Benchmark bin scanning against posting list intersection.
+ */
+static void
+search_bench(size_t names, size_t queries)
+{
+	struct library lib;
+	struct bin_index *bi;
+	struct trigram_index *ti;
+	struct query *q;
+	tm_t start, end;
+	double bbuild, tbuild, bsearch, tsearch;
+	size_t i, bscan = 0, tscan = 0, bn = 0, tn = 0;
+
+	library_make(&lib, names);
+	XMALLOC(bi);
+	XMALLOC(ti);
+
+	tm_now_exact(&start);
+	bin_index_make(bi, &lib);
+	tm_now_exact(&end);
+	bbuild = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	trigram_index_make(ti, &lib);
+	tm_now_exact(&end);
+	tbuild = tm_elapsed_f(&end, &start);
+
+	XMALLOC_ARRAY(q, queries);
+	for (i = 0; i < queries; i++)
+		query_make(&q[i]);
+
+	tm_now_exact(&start);
+	for (i = 0; i < queries; i++)
+		bn += bin_search(bi, &lib, &q[i], &bscan);
+	tm_now_exact(&end);
+	bsearch = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	for (i = 0; i < queries; i++)
+		tn += trigram_search(ti, &lib, &q[i], &tscan);
+	tm_now_exact(&end);
+	tsearch = tm_elapsed_f(&end, &start);
+
+	if (bn != tn) {
+		printf("bins found %zu match%s, trigrams %zu\n", PLURAL_ES(bn), tn);
+		test_abort();
+	}
+
+	printf("Running %zu quer%s on %zu names (%zu match%s):\n",
+		PLURAL_Y(queries), names, PLURAL_ES(bn));
+	printf("  bins:     built in %.3f secs, %s, "
+		"%.3f secs to search, %.1f names scanned per query\n",
+		bbuild, short_size(bin_index_memory(bi), FALSE),
+		bsearch, (double) bscan / queries);
+	printf("  trigrams: built in %.3f secs, %s, "
+		"%.3f secs to search, %.1f names scanned per query\n",
+		tbuild, short_size(trigram_index_memory(ti), FALSE),
+		tsearch, (double) tscan / queries);
+	printf("  speedup %.2f\n", bsearch / MAX(tsearch, 1e-6));
+
+	XFREE_NULL(q);
+	bin_index_free(bi);
+	trigram_index_free(ti);
+	XFREE_NULL(bi);
+	XFREE_NULL(ti);
+	library_free(&lib);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t names = BENCH_NAMES;
+	size_t queries = BENCH_QUERIES;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "hn:q:tR:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'n':			/* amount of names */
+			names = atol(optarg);
+			break;
+		case 'q':			/* amount of queries */
+			queries = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	names = MAX(names, 1);
+	queries = MAX(queries, 1);
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	vocabulary_init();
+
+	postings_test();
+	search_test();
+
+	if (tflag)
+		search_bench(names, queries);
+
+	vocabulary_free();
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Compressed posting lists.
+ *
+ * A posting list is a sorted set of 32-bit identifiers, typically the
+ * indices of the documents containing a given term.  The list is built
+ * by appending identifiers in increasing order and is stored as a sequence
+ * of deltas, each encoded on a variable amount of bytes, 7 bits at a time.
+ * Dense lists therefore use about one byte per identifier.
+ *
+ * Lists are decoded into plain arrays before being intersected with
+ * postings_intersect(), which picks the best algorithm given the
+ * respective list sizes and the CPU abilities.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "postings.h"
+
+#include "cpufeat.h"
+#include "halloc.h"
+#include "pow2.h"
+#include "walloc.h"
+
+#ifdef HAS_CPUFEAT_X86
+#include <immintrin.h>
+#define POSTINGS_AVX2		/* Can compile the AVX2 intersection */
+#endif
+
+#include "override.h"		/* Must be the last header included */
+
+#define POSTINGS_MIN_SIZE	16	/**< Initial data size, in bytes */
+#define POSTINGS_GALLOP		32	/**< Size ratio above which we gallop */
+
+enum postings_magic { POSTINGS_MAGIC = 0x5e1b0a37 };
+
+struct postings {
+	enum postings_magic magic;
+	uint32 count;			/**< Amount of identifiers in list */
+	uint32 last;			/**< Last identifier appended */
+	uint32 len;				/**< Bytes used in data[] */
+	uint32 size;			/**< Bytes allocated for data[] */
+	uchar *data;			/**< Encoded deltas */
+};
+
+static inline void
+postings_check(const struct postings * const pl)
+{
+	g_assert(pl != NULL);
+	g_assert(POSTINGS_MAGIC == pl->magic);
+}
+
+/**
+ * Create a new empty posting list.
+ */
+postings_t *
+postings_make(void)
+{
+	postings_t *pl;
+
+	WALLOC0(pl);
+	pl->magic = POSTINGS_MAGIC;
+
+	return pl;
+}
+
+/**
+ * Free posting list and nullify its pointer.
+ */
+void
+postings_free_null(postings_t **pl_ptr)
+{
+	postings_t *pl = *pl_ptr;
+
+	if (pl != NULL) {
+		postings_check(pl);
+		HFREE_NULL(pl->data);
+		pl->magic = 0;
+		WFREE(pl);
+		*pl_ptr = NULL;
+	}
+}
+
+/**
+ * Append identifier to the posting list.
+ *
+ * Identifiers must be appended in increasing order, but appending the
+ * last identifier again is allowed and does nothing: this lets callers
+ * index all the terms of a document without having to remove duplicates.
+ */
+void
+postings_append(postings_t *pl, uint32 id)
+{
+	uint32 delta;
+
+	postings_check(pl);
+
+	if (pl->count != 0) {
+		if G_UNLIKELY(id == pl->last)
+			return;
+		g_assert_log(id > pl->last,
+			"%s(): id=%u, last=%u", G_STRFUNC, id, pl->last);
+		delta = id - pl->last;
+	} else {
+		delta = id;
+	}
+
+	/*
+	 * A 32-bit delta needs at most 5 bytes.
+	 */
+
+	if G_UNLIKELY(pl->len + 5 > pl->size) {
+		pl->size = MAX(POSTINGS_MIN_SIZE, pl->size * 2);
+		HREALLOC_ARRAY(pl->data, pl->size);
+	}
+
+	while (delta >= 0x80) {
+		pl->data[pl->len++] = (delta & 0x7f) | 0x80;
+		delta >>= 7;
+	}
+	pl->data[pl->len++] = delta;
+
+	pl->last = id;
+	pl->count++;
+}
+
+/**
+ * Release the unused space at the end of the list, once built.
+ */
+void
+postings_compact(postings_t *pl)
+{
+	postings_check(pl);
+
+	if (pl->len != pl->size) {
+		pl->size = pl->len;
+		HREALLOC_ARRAY(pl->data, pl->size);
+	}
+}
+
+/**
+ * @return amount of identifiers held in the list.
+ */
+size_t
+postings_count(const postings_t *pl)
+{
+	postings_check(pl);
+
+	return pl->count;
+}
+
+/**
+ * @return amount of memory used by the list, in bytes.
+ */
+size_t
+postings_memory(const postings_t *pl)
+{
+	postings_check(pl);
+
+	return sizeof *pl + pl->size;
+}
+
+/**
+ * Decode the posting list.
+ *
+ * @param pl		the posting list
+ * @param dst		where identifiers are written, must hold postings_count()
+ *
+ * @return amount of identifiers written to dst[].
+ */
+size_t G_HOT
+postings_decode(const postings_t *pl, uint32 *dst)
+{
+	const uchar *p, *end;
+	uint32 id = 0;
+	size_t n = 0;
+
+	postings_check(pl);
+
+	p = pl->data;
+	end = p + pl->len;
+
+	while (p < end) {
+		uint32 delta = *p++;
+
+		if G_UNLIKELY(delta & 0x80) {
+			uint shift = 7;
+
+			delta &= 0x7f;
+			do {
+				g_assert(p < end);
+				delta |= (uint32) (*p & 0x7f) << shift;
+				shift += 7;
+			} while (*p++ & 0x80);
+		}
+
+		id += delta;
+		dst[n++] = id;
+	}
+
+	g_assert(n == pl->count);
+
+	return n;
+}
+
+/**
+ * Intersect two sorted arrays by merging them.
+ */
+static size_t
+postings_intersect_merge(const uint32 *a, size_t na,
+	const uint32 *b, size_t nb, uint32 *dst)
+{
+	size_t i = 0, j = 0, n = 0;
+
+	while (i < na && j < nb) {
+		if (a[i] < b[j]) {
+			i++;
+		} else if (a[i] > b[j]) {
+			j++;
+		} else {
+			dst[n++] = a[i];
+			i++;
+			j++;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * Intersect a small sorted array with a much larger one, locating each
+ * item of the small array in the large one by exponential search.
+ */
+static size_t
+postings_intersect_gallop(const uint32 *small, size_t ns,
+	const uint32 *large, size_t nl, uint32 *dst)
+{
+	size_t i, j = 0, n = 0;
+
+	for (i = 0; i < ns && j < nl; i++) {
+		uint32 x = small[i];
+		size_t lo = j, hi, step = 1;
+
+		while (lo + step < nl && large[lo + step] < x) {
+			lo += step;
+			step <<= 1;
+		}
+
+		/* The first item >= x is within [lo, hi], hi meaning "none" */
+
+		hi = MIN(lo + step, nl);
+
+		while (lo < hi) {
+			size_t mid = lo + (hi - lo) / 2;
+
+			if (large[mid] < x)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		j = lo;
+		if (j < nl && large[j] == x) {
+			dst[n++] = x;
+			j++;
+		}
+	}
+
+	return n;
+}
+
+#ifdef POSTINGS_AVX2
+/**
+ * Intersect two sorted arrays, 8 items at a time.
+ *
+ * Each block of 8 items from a[] is compared with all the items of the
+ * current block of b[] by rotating the latter 7 times.  We then move to
+ * the next block in the array whose current block ends with the smallest
+ * item (both when they end with the same item).
+ */
+static size_t G_HOT G_TARGET("avx2")
+postings_intersect_x8(const uint32 *a, size_t na,
+	const uint32 *b, size_t nb, uint32 *dst)
+{
+	const __m256i rot = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+	size_t i = 0, j = 0, n = 0;
+
+	while (i + 8 <= na && j + 8 <= nb) {
+		__m256i va = _mm256_loadu_si256((const __m256i *) &a[i]);
+		__m256i vb = _mm256_loadu_si256((const __m256i *) &b[j]);
+		__m256i eq = _mm256_cmpeq_epi32(va, vb);
+		uint32 amax = a[i + 7], bmax = b[j + 7];
+		uint k, mask;
+
+		for (k = 1; k < 8; k++) {
+			vb = _mm256_permutevar8x32_epi32(vb, rot);
+			eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(va, vb));
+		}
+
+		mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+
+		while (mask != 0) {
+			dst[n++] = a[i + ctz(mask)];
+			mask &= mask - 1;
+		}
+
+		if (amax <= bmax)
+			i += 8;
+		if (bmax <= amax)
+			j += 8;
+	}
+
+	/*
+	 * Items of a[] already found in earlier blocks of b[] are all smaller
+	 * than b[j], hence they cannot be emitted again by the merge below.
+	 */
+
+	return n + postings_intersect_merge(&a[i], na - i, &b[j], nb - j, &dst[n]);
+}
+#endif	/* POSTINGS_AVX2 */
+
+/**
+ * Intersect two sorted arrays of distinct identifiers.
+ *
+ * @param a		the first array
+ * @param na	amount of items in a[]
+ * @param b		the second array
+ * @param nb	amount of items in b[]
+ * @param dst	where the common items are written, in increasing order.
+ *				It must hold MIN(na, nb) items and must not overlap a[]
+ *				or b[].
+ *
+ * @return amount of items written to dst[].
+ */
+size_t G_HOT
+postings_intersect(const uint32 *a, size_t na,
+	const uint32 *b, size_t nb, uint32 *dst)
+{
+	if (0 == na || 0 == nb)
+		return 0;
+
+	if (na > nb) {
+		const uint32 *t = a;
+		size_t nt = na;
+		a = b; na = nb;
+		b = t; nb = nt;
+	}
+
+	if (na * POSTINGS_GALLOP < nb)
+		return postings_intersect_gallop(a, na, b, nb, dst);
+
+#ifdef POSTINGS_AVX2
+	if (cpufeat_has(CPUFEAT_AVX2))
+		return postings_intersect_x8(a, na, b, nb, dst);
+#endif
+
+	return postings_intersect_merge(a, na, b, nb, dst);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
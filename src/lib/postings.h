@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Compressed posting lists.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _postings_h_
+#define _postings_h_
+
+typedef struct postings postings_t;
+
+/*
+ * Public interface.
+ */
+
+postings_t *postings_make(void);
+void postings_free_null(postings_t **pl_ptr);
+void postings_append(postings_t *pl, uint32 id);
+void postings_compact(postings_t *pl);
+size_t postings_count(const postings_t *pl);
+size_t postings_memory(const postings_t *pl);
+size_t postings_decode(const postings_t *pl, uint32 *dst);
+
+size_t postings_intersect(const uint32 *a, size_t na,
+	const uint32 *b, size_t nb, uint32 *dst);
+
+#endif /* _postings_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,805 @@
+/*
+ * rtable-test -- message routing table tests and traffic replay benchmark.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "if/core/guid.h"
+
+#include "lib/atoms.h"
+#include "lib/hashing.h"
+#include "lib/hikset.h"
+#include "lib/misc.h"
+#include "lib/pow2.h"
+#include "lib/progname.h"
+#include "lib/pslist.h"
+#include "lib/rand31.h"
+#include "lib/rtable.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
+
+#define TEST_MESSAGES	100000		/* Messages inserted by the tests */
+#define TEST_ROUTES		40			/* Maximum routes per tested message */
+
+#define BENCH_MESSAGES	2000000		/* Default amount of replayed messages */
+#define BENCH_NODES		32			/* Default amount of neighbours */
+#define BENCH_RECENT	65536		/* Recent queries kept for replies */
+#define BENCH_MIN		16384		/* Minimum table size */
+#define BENCH_MAX		(1U << 20)	/* Maximum table size */
+
+#define RATE_LIFETIME	80			/* Route lifetime for the rate tests */
+#define RATE_LOW		10			/* Low rate, messages per second */
+#define RATE_HIGH		600			/* High rate, messages per second */
+#define RATE_EPOCHS		8			/* Epochs per lifetime, as in rtable.c */
+
+#define FUNC_QUERY		0x80		/* Gnutella query */
+#define FUNC_HIT		0x81		/* Gnutella query hit */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+static size_t routes_freed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htV] [-f trace] [-n messages] [-N nodes] [-R seed]\n"
+		"  -f : replay messages from trace file instead of random traffic\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of random messages to replay\n"
+		"  -N : sets amount of neighbours sending random messages\n"
+		"  -t : time old routing table versus new one on message traffic\n"
+		"  -R : seed for repeatable random data sequence\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		"Each line of a trace file holds the message function, the message\n"
+		"ID in hexadecimal and the number of the node it came from.\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(void)
+{
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static void
+route_freed(void *route)
+{
+	(void) route;
+	routes_freed++;
+}
+
+static void *
+node_route(uint node)
+{
+	return uint_to_pointer(node + 1);
+}
+
+/**
+ * Check insertion, lookups and route handling within entries.
+ */
+static void
+entry_test(void)
+{
+	rtable_t *rt;
+	guid_t *muid;
+	void *ref[TEST_ROUTES];
+	size_t i;
+
+	rt = rtable_make(64, TEST_MESSAGES * 2, 3600, route_freed);
+
+	XMALLOC_ARRAY(muid, TEST_MESSAGES);
+	rand31_bytes(muid, TEST_MESSAGES * sizeof muid[0]);
+
+	for (i = 0; i < TEST_MESSAGES; i++) {
+		rtable_entry_t *e = rtable_insert(rt, &muid[i], FUNC_QUERY);
+
+		rtable_entry_add_route(e, node_route(i), i & 0xff);
+		rtable_entry_set_ttl(e, i & 0xff);
+	}
+
+	if (rtable_count(rt) != TEST_MESSAGES || routes_freed != 0) {
+		printf("table holds %zu messages, %zu routes freed\n",
+			rtable_count(rt), routes_freed);
+		test_abort();
+	}
+
+	for (i = 0; i < TEST_MESSAGES; i++) {
+		const rtable_entry_t *e = rtable_lookup(rt, &muid[i], FUNC_QUERY);
+
+		if (
+			NULL == e || 1 != rtable_entry_route_count(e) ||
+			rtable_entry_route(e, 0) != node_route(i) ||
+			rtable_entry_route_ttl(e, 0) != (i & 0xff) ||
+			rtable_entry_ttl(e) != (i & 0xff)
+		) {
+			printf("bad entry for message #%zu\n", i);
+			test_abort();
+		}
+		if (rtable_lookup(rt, &muid[i], FUNC_HIT) != NULL) {
+			printf("found hit for message #%zu\n", i);
+			test_abort();
+		}
+	}
+
+	if (verbose_mode)
+		printf("%u messages inserted and looked up\n", TEST_MESSAGES);
+
+	/*
+	 * Add and remove routes randomly, checking they remain in order.
+	 */
+
+	for (i = 0; i < TEST_MESSAGES / 10; i++) {
+		rtable_entry_t *e = rtable_lookup(rt, &muid[i], FUNC_QUERY);
+		uint j, n = 1, ops = rand31_value(4 * TEST_ROUTES);
+
+		ref[0] = node_route(i);
+
+		for (j = 0; j < ops; j++) {
+			if (n < TEST_ROUTES && (0 == n || rand31_value(2) != 0)) {
+				void *route = node_route(rand31_u32());
+
+				rtable_entry_add_route(e, route, n);
+				ref[n++] = route;
+			} else {
+				uint k = rand31_value(n - 1);
+
+				rtable_entry_remove_route(e, k);
+				memmove(&ref[k], &ref[k + 1], (n - k - 1) * sizeof ref[0]);
+				n--;
+			}
+		}
+
+		if (rtable_entry_route_count(e) != n) {
+			printf("message #%zu has %u routes, expected %u\n",
+				i, rtable_entry_route_count(e), n);
+			test_abort();
+		}
+
+		for (j = 0; j < n; j++) {
+			if (
+				rtable_entry_route(e, j) != ref[j] ||
+				rtable_entry_route_index(e, ref[j]) != (int) j
+			) {
+				printf("message #%zu has bad route #%u\n", i, j);
+				test_abort();
+			}
+		}
+	}
+
+	if (verbose_mode)
+		printf("route additions and removals OK\n");
+
+	i = rtable_count(rt);
+	rtable_clear(rt);
+
+	if (rtable_count(rt) != 0 || rtable_capacity(rt) > 64) {
+		printf("table not cleared: %zu messages, capacity %zu\n",
+			rtable_count(rt), rtable_capacity(rt));
+		test_abort();
+	}
+
+	if (verbose_mode)
+		printf("%zu routes freed from %zu messages\n", routes_freed, i);
+
+	rtable_free_null(&rt);
+	XFREE_NULL(muid);
+
+	printf("Routing table entries: all OK\n");
+}
+
+/**
+ * Check that a table which cannot grow expires its oldest messages only.
+ */
+static void
+expire_test(void)
+{
+	rtable_t *rt;
+	guid_t *muid;
+	size_t i, capacity, epoch;
+
+	routes_freed = 0;
+	rt = rtable_make(4096, 4096, 3600, route_freed);
+	capacity = rtable_capacity(rt);
+	epoch = capacity / 8;
+
+	XMALLOC_ARRAY(muid, TEST_MESSAGES);
+	rand31_bytes(muid, TEST_MESSAGES * sizeof muid[0]);
+
+	for (i = 0; i < TEST_MESSAGES; i++) {
+		rtable_entry_t *e = rtable_insert(rt, &muid[i], FUNC_QUERY);
+
+		rtable_entry_add_route(e, node_route(0), 1);
+		rtable_entry_add_route(e, node_route(1), 1);
+
+		/*
+		 * Keep the first message alive by touching it regularly.
+		 */
+
+		if (0 == i % (epoch / 2)) {
+			e = rtable_lookup(rt, &muid[0], FUNC_QUERY);
+			if (NULL == e) {
+				printf("touched message lost after %zu insertions\n", i);
+				test_abort();
+			}
+			rtable_touch(rt, e);
+		}
+
+		if (rtable_count(rt) > capacity) {
+			printf("table overflowed after %zu insertions\n", i);
+			test_abort();
+		}
+	}
+
+	if (rtable_capacity(rt) != capacity) {
+		printf("table capacity changed from %zu to %zu\n",
+			capacity, rtable_capacity(rt));
+		test_abort();
+	}
+
+	if (rtable_count(rt) + routes_freed / 2 != TEST_MESSAGES) {
+		printf("%zu messages held, %zu routes freed, for %u inserted\n",
+			rtable_count(rt), routes_freed, TEST_MESSAGES);
+		test_abort();
+	}
+
+	if (rtable_expired_early(rt) != routes_freed / 2) {
+		printf("%s messages expired early, %zu expired\n",
+			uint64_to_string(rtable_expired_early(rt)), routes_freed / 2);
+		test_abort();
+	}
+
+	for (i = TEST_MESSAGES - (capacity - 2 * epoch); i < TEST_MESSAGES; i++) {
+		if (NULL == rtable_lookup(rt, &muid[i], FUNC_QUERY)) {
+			printf("recent message #%zu was expired\n", i);
+			test_abort();
+		}
+	}
+
+	if (verbose_mode) {
+		printf("%u insertions, %zu messages expired, %u live epochs\n",
+			TEST_MESSAGES, routes_freed / 2, rtable_epochs(rt));
+	}
+
+	rtable_free_null(&rt);
+
+	/*
+	 * With routes younger than the lifetime, the table must grow instead.
+	 */
+
+	routes_freed = 0;
+	rt = rtable_make(64, 2 * TEST_MESSAGES, 3600, route_freed);
+
+	for (i = 0; i < TEST_MESSAGES; i++)
+		(void) rtable_insert(rt, &muid[i], FUNC_HIT);
+
+	if (rtable_count(rt) != TEST_MESSAGES) {
+		printf("growing table holds %zu messages, expected %u\n",
+			rtable_count(rt), TEST_MESSAGES);
+		test_abort();
+	}
+
+	if (verbose_mode)
+		printf("table grew to a capacity of %zu\n", rtable_capacity(rt));
+
+	rtable_free_null(&rt);
+	XFREE_NULL(muid);
+
+	printf("Routing table expiration: all OK\n");
+}
+
+/**
+ * Move the cached clock forward, as seen by tm_time().
+ */
+static void
+clock_advance(time_delta_t secs)
+{
+	tm_cached_now.tv_sec += secs;
+}
+
+/**
+ * @return the capacity needed to keep a whole lifetime of messages at
+ * the given steady rate, as sized by rtable_target_size().
+ */
+static size_t
+rate_capacity(uint rate)
+{
+	size_t need = rate * RATE_LIFETIME;
+
+	need = need * RATE_EPOCHS / (RATE_EPOCHS - 1);
+	return next_pow2(need / 3 * 4 + 4) / 4 * 3;
+}
+
+/**
+ * Insert messages at a steady rate for the given duration.
+ */
+static void
+rate_feed(rtable_t *rt, uint rate, time_delta_t duration)
+{
+	time_delta_t t;
+
+	for (t = 0; t < duration; t++) {
+		uint i;
+
+		for (i = 0; i < rate; i++) {
+			guid_t muid;
+
+			rand31_bytes(&muid, sizeof muid);
+			(void) rtable_insert(rt, &muid, FUNC_QUERY);
+		}
+
+		clock_advance(1);
+	}
+}
+
+/**
+ * Check that the table has adapted to a steady rate, holding routes for
+ * their lifetime with epochs bounded in time.
+ */
+static void
+rate_check(const rtable_t *rt, uint rate, size_t capacity, const char *what)
+{
+	time_delta_t lifetime = rtable_lifetime(rt);
+
+	if (rtable_rate(rt) < rate * 7 / 8 || rtable_rate(rt) > rate) {
+		printf("%s rate: measured %u messages/sec, expected %u\n",
+			what, rtable_rate(rt), rate);
+		test_abort();
+	}
+
+	if (rtable_capacity(rt) != capacity) {
+		printf("%s rate: capacity is %zu, expected %zu\n",
+			what, rtable_capacity(rt), capacity);
+		test_abort();
+	}
+
+	if (
+		lifetime < RATE_LIFETIME ||
+		lifetime > RATE_LIFETIME + 2 * RATE_LIFETIME / RATE_EPOCHS
+	) {
+		printf("%s rate: routes kept %ld secs, expected %d\n",
+			what, (long) lifetime, RATE_LIFETIME);
+		test_abort();
+	}
+
+	if (
+		rtable_epochs(rt) < RATE_EPOCHS ||
+		rtable_epochs(rt) > RATE_EPOCHS + 2
+	) {
+		printf("%s rate: %u live epochs, expected about %u\n",
+			what, rtable_epochs(rt), RATE_EPOCHS);
+		test_abort();
+	}
+
+	if (rtable_expired_early(rt) != 0) {
+		printf("%s rate: %s messages expired early\n",
+			what, uint64_to_string(rtable_expired_early(rt)));
+		test_abort();
+	}
+
+	if (verbose_mode) {
+		printf("%s rate: %u messages/sec, capacity %zu, "
+			"routes kept %ld secs in %u epochs\n",
+			what, rtable_rate(rt), rtable_capacity(rt),
+			(long) lifetime, rtable_epochs(rt));
+	}
+}
+
+/**
+ * Check that the table is sized from the measured message rate: it grows
+ * to the size needed to keep routes for their lifetime, and shrinks back
+ * when the rate drops, but only down to twice the needed size.
+ */
+static void
+rate_test(void)
+{
+	rtable_t *rt;
+
+	rt = rtable_make(64, 1U << 20, RATE_LIFETIME, NULL);
+
+	rate_feed(rt, RATE_LOW, 4 * RATE_LIFETIME);
+	rate_check(rt, RATE_LOW, rate_capacity(RATE_LOW), "low");
+
+	rate_feed(rt, RATE_HIGH, 2 * RATE_LIFETIME);
+	rate_check(rt, RATE_HIGH, rate_capacity(RATE_HIGH), "high");
+
+	rate_feed(rt, RATE_LOW, 3 * RATE_LIFETIME);
+	rate_check(rt, RATE_LOW, 2 * rate_capacity(RATE_LOW), "lowered");
+
+	rtable_free_null(&rt);
+
+	printf("Routing table sizing: all OK\n");
+}
+
+/**
+ * A message seen on the network.
+ */
+struct traffic {
+	guid_t muid;
+	uint8 function;
+	uint node;
+};
+
+/**
+ * Generate random query traffic: new queries, duplicates of recent queries
+ * coming from other neighbours, and hits routed back for recent queries.
+ */
+static struct traffic *
+traffic_generate(size_t n, uint nodes)
+{
+	struct traffic *t;
+	guid_t *recent;
+	size_t i, queries = 0;
+
+	XMALLOC_ARRAY(t, n);
+	XMALLOC_ARRAY(recent, BENCH_RECENT);
+
+	for (i = 0; i < n; i++) {
+		uint r = rand31_value(99);
+
+		t[i].node = rand31_value(nodes - 1);
+
+		if (0 == queries || r < 50) {
+			rand31_bytes(&t[i].muid, sizeof t[i].muid);
+			t[i].function = FUNC_QUERY;
+			recent[queries++ % BENCH_RECENT] = t[i].muid;
+		} else {
+			size_t k = rand31_value(MIN(queries, BENCH_RECENT) - 1);
+
+			t[i].muid = recent[k];
+			t[i].function = r < 85 ? FUNC_QUERY : FUNC_HIT;
+		}
+	}
+
+	XFREE_NULL(recent);
+	return t;
+}
+
+/**
+ * Load traffic from a trace file.
+ */
+static struct traffic *
+traffic_load(const char *file, size_t *count)
+{
+	struct traffic *t = NULL;
+	size_t n = 0, size = 0, line = 0;
+	char buf[128], hex[64];
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (NULL == f) {
+		fprintf(stderr, "%s: cannot open %s: %m\n", getprogname(), file);
+		exit(EXIT_FAILURE);
+	}
+
+	while (fgets(buf, sizeof buf, f) != NULL) {
+		uint function, node;
+
+		line++;
+
+		if (n == size) {
+			size = MAX(1024, 2 * size);
+			XREALLOC_ARRAY(t, size);
+		}
+
+		if (
+			3 != sscanf(buf, "%i %63s %u", &function, hex, &node) ||
+			!hex_to_guid(hex, &t[n].muid)
+		) {
+			fprintf(stderr, "%s: %s, line %zu: cannot parse \"%s\"\n",
+				getprogname(), file, line, buf);
+			exit(EXIT_FAILURE);
+		}
+
+		t[n].function = function;
+		t[n].node = node;
+		n++;
+	}
+
+	fclose(f);
+	*count = n;
+
+	return t;
+}
+
+/**
+ * Replay traffic on the routing table, the way routing.c uses it.
+ *
+ * @return amount of duplicates and routed hits, for cross-checking.
+ */
+static size_t
+rtable_replay(rtable_t *rt, const struct traffic *t, size_t n)
+{
+	size_t i, seen = 0;
+
+	for (i = 0; i < n; i++) {
+		void *route = node_route(t[i].node);
+		rtable_entry_t *e;
+
+		if (FUNC_HIT == t[i].function) {
+			e = rtable_lookup(rt, &t[i].muid, FUNC_QUERY);
+			if (e != NULL) {
+				seen += rtable_entry_route_count(e);
+				rtable_touch(rt, e);
+			}
+		}
+
+		e = rtable_lookup(rt, &t[i].muid, t[i].function);
+
+		if (NULL == e) {
+			e = rtable_insert(rt, &t[i].muid, t[i].function);
+			rtable_entry_add_route(e, route, 7);
+		} else if (-1 == rtable_entry_route_index(e, route)) {
+			rtable_entry_add_route(e, route, 7);
+			seen++;
+		} else {
+			seen++;
+		}
+	}
+
+	return seen;
+}
+
+/**
+ * The former routing table: messages were allocated separately, held in
+ * a hash set and recycled in insertion order, with routes in linked lists.
+ */
+struct old_message {
+	guid_t muid;
+	uint8 function;
+	pslist_t *routes;
+	pslist_t *ttls;
+};
+
+struct old_table {
+	hikset_t *messages;
+	struct old_message **slot;
+	size_t count;
+	size_t next;
+	size_t capacity;
+};
+
+static uint
+old_message_hash(const void *key)
+{
+	const struct old_message *m = key;
+
+	return binary_hash(&m->muid, sizeof m->muid) ^ m->function;
+}
+
+static bool
+old_message_eq(const void *a, const void *b)
+{
+	const struct old_message *ma = a, *mb = b;
+
+	return ma->function == mb->function && guid_eq(&ma->muid, &mb->muid);
+}
+
+static void
+old_table_init(struct old_table *ot, size_t capacity)
+{
+	ot->messages = hikset_create_any(0, old_message_hash, old_message_eq);
+	ot->capacity = capacity;
+	ot->count = ot->next = 0;
+	XMALLOC0_ARRAY(ot->slot, capacity);
+}
+
+static void
+old_message_free(struct old_message *m)
+{
+	pslist_free(m->routes);
+	pslist_free(m->ttls);
+	WFREE(m);
+}
+
+static void
+old_table_free(struct old_table *ot)
+{
+	size_t i;
+
+	for (i = 0; i < ot->capacity; i++) {
+		if (ot->slot[i] != NULL)
+			old_message_free(ot->slot[i]);
+	}
+
+	hikset_free_null(&ot->messages);
+	XFREE_NULL(ot->slot);
+}
+
+static struct old_message *
+old_table_lookup(const struct old_table *ot, const guid_t *muid, uint8 func)
+{
+	struct old_message key;
+
+	key.muid = *muid;
+	key.function = func;
+
+	return hikset_lookup(ot->messages, &key);
+}
+
+static size_t
+old_replay(struct old_table *ot, const struct traffic *t, size_t n)
+{
+	size_t i, seen = 0;
+
+	for (i = 0; i < n; i++) {
+		void *route = node_route(t[i].node);
+		struct old_message *m;
+
+		if (FUNC_HIT == t[i].function) {
+			m = old_table_lookup(ot, &t[i].muid, FUNC_QUERY);
+			if (m != NULL)
+				seen += pslist_length(m->routes);
+		}
+
+		m = old_table_lookup(ot, &t[i].muid, t[i].function);
+
+		if (NULL == m) {
+			struct old_message *old = ot->slot[ot->next];
+
+			if (old != NULL) {
+				hikset_remove(ot->messages, old);
+				old_message_free(old);
+			}
+
+			WALLOC0(m);
+			m->muid = t[i].muid;
+			m->function = t[i].function;
+			m->routes = pslist_prepend(NULL, route);
+			m->ttls = pslist_prepend(NULL, uint_to_pointer(7));
+			hikset_insert(ot->messages, m);
+			ot->slot[ot->next] = m;
+			ot->next = (ot->next + 1) % ot->capacity;
+		} else if (NULL == pslist_find(m->routes, route)) {
+			m->routes = pslist_append(m->routes, route);
+			m->ttls = pslist_append(m->ttls, uint_to_pointer(7));
+			seen++;
+		} else {
+			seen++;
+		}
+	}
+
+	return seen;
+}
+
+/**
+ * Benchmark the former routing table against the new one.
+ */
+static void
+replay_bench(const struct traffic *t, size_t n)
+{
+	struct old_table ot;
+	rtable_t *rt;
+	tm_t start, end;
+	double old_time, new_time;
+	size_t old_seen, new_seen;
+
+	rt = rtable_make(BENCH_MIN, BENCH_MAX, 3600, NULL);
+	old_table_init(&ot, BENCH_MAX);
+
+	tm_now_exact(&start);
+	old_seen = old_replay(&ot, t, n);
+	tm_now_exact(&end);
+	old_time = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	new_seen = rtable_replay(rt, t, n);
+	tm_now_exact(&end);
+	new_time = tm_elapsed_f(&end, &start);
+
+	printf("Replaying %zu message%s:\n", PLURAL(n));
+	printf("  hash set and lists: %.3f secs, %zu duplicates and routes\n",
+		old_time, old_seen);
+	printf("  routing table: %.3f secs, %zu duplicates and routes\n",
+		new_time, new_seen);
+	printf("  %zu messages held, capacity %zu, %u live epochs\n",
+		rtable_count(rt), rtable_capacity(rt), rtable_epochs(rt));
+	printf("  speedup %.2f\n", old_time / MAX(new_time, 1e-6));
+
+	rtable_free_null(&rt);
+	old_table_free(&ot);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t messages = BENCH_MESSAGES;
+	uint nodes = BENCH_NODES;
+	const char *trace = NULL;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "f:hn:N:tR:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'f':			/* trace file */
+			trace = optarg;
+			break;
+		case 'n':			/* amount of messages */
+			messages = atol(optarg);
+			break;
+		case 'N':			/* amount of nodes */
+			nodes = atoi(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag = TRUE;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	messages = MAX(messages, 1);
+	nodes = MAX(nodes, 2);
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	entry_test();
+	expire_test();
+	rate_test();
+
+	if (tflag) {
+		struct traffic *t;
+
+		if (trace != NULL)
+			t = traffic_load(trace, &messages);
+		else
+			t = traffic_generate(messages, nodes);
+
+		replay_bench(t, messages);
+		XFREE_NULL(t);
+	}
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,890 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Message routing table.
+ *
+ * The table remembers messages by MUID and function, along with the list
+ * of routes (opaque pointers) through which they came and the TTL seen on
+ * each route.
+ *
+ * All the entries are held in a single open-addressed array, using linear
+ * probing.  An entry is the size of a cache line and holds the first few
+ * routes inline: only messages seen from more routes than that need an
+ * additional allocation.  Looking up a message for duplicate detection or
+ * reply routing therefore usually touches a single cache line.
+ *
+ * Entries are stamped with the epoch during which they were inserted or
+ * last touched.  Epochs are time buckets: a new epoch starts each time an
+ * eighth of the configured lifetime has elapsed, or earlier if an eighth of
+ * the usable capacity has been inserted.  Touching an entry makes it part of
+ * the current epoch again, without moving it.
+ *
+ * When a new epoch starts, the epochs holding routes older than the lifetime
+ * are expired together in one sweep, and the table is resized to hold the
+ * messages inserted during a whole lifetime, based on the insertion rate
+ * measured over the live epochs.  Bursts make the table grow further, up to
+ * its maximum size, after which the oldest epochs are expired early.
+ *
+ * Deletions shift the following entries of the cluster back, hence entry
+ * pointers are only valid until the next insertion in the table.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "rtable.h"
+
+#include "hashing.h"
+#include "misc.h"
+#include "pow2.h"
+#include "tm.h"
+#include "vmm.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define RTABLE_INLINE		3	/**< Routes held within the entry */
+#define RTABLE_SPILL_MIN	4	/**< Minimum size of the spilled vector */
+#define RTABLE_EPOCHS		8	/**< Epochs needed to fill the table */
+#define RTABLE_EPOCH_MAX	256	/**< Maximum amount of live epochs */
+
+#define RTABLE_LOAD(n)		((n) / 4 * 3)	/**< Usable capacity: 75% */
+#define RTABLE_ROUTE_MAX	MAX_INT_VAL(uint16)
+
+enum rtable_magic { RTABLE_MAGIC = 0x2a7e0b19 };
+
+/**
+ * A spilled route, beyond the ones held inline.
+ */
+struct rtable_hop {
+	void *route;				/**< The route */
+	uint8 ttl;					/**< TTL of the message along that route */
+};
+
+/**
+ * A routing table entry, which fits in one cache line on 64-bit machines.
+ */
+struct rtable_entry {
+	char muid[GUID_RAW_SIZE];	/**< Message ID */
+	uint32 epoch;				/**< Epoch of insertion or last touch */
+	uint8 function;				/**< Message function */
+	uint8 ttl;					/**< Highest TTL seen for the message */
+	uint16 routes;				/**< Amount of routes */
+	uint8 ttls[RTABLE_INLINE];	/**< TTL along the inline routes */
+	uint8 used;					/**< Whether entry is used */
+	void *route[RTABLE_INLINE];	/**< The first routes */
+	struct rtable_hop *spill;	/**< Routes past the inline ones */
+};
+
+struct rtable {
+	enum rtable_magic magic;
+	struct rtable_entry *table;	/**< The open-addressed array */
+	size_t size;				/**< Amount of slots, a power of 2 */
+	size_t count;				/**< Amount of entries held */
+	size_t min_size;			/**< Minimum amount of slots */
+	size_t max_size;			/**< Maximum amount of slots */
+	time_delta_t lifetime;		/**< Keep routes that long, if possible */
+	time_delta_t bucket;		/**< Maximum duration of an epoch */
+	free_fn_t route_free;		/**< Invoked on routes of expired entries */
+	uint64 expired_early;		/**< Entries expired before their lifetime */
+	uint32 rate;				/**< Insertions per second, last measured */
+	uint32 epoch;				/**< Current epoch */
+	uint32 oldest;				/**< Oldest epoch still present */
+	uint32 epoch_count[RTABLE_EPOCH_MAX];		/**< Entries per live epoch */
+	uint32 epoch_inserted[RTABLE_EPOCH_MAX];	/**< Insertions per epoch */
+	time_t epoch_start[RTABLE_EPOCH_MAX];		/**< Start of live epochs */
+};
+
+static inline void
+rtable_check(const struct rtable * const rt)
+{
+	g_assert(rt != NULL);
+	g_assert(RTABLE_MAGIC == rt->magic);
+}
+
+static inline void
+rtable_entry_check(const struct rtable_entry * const e)
+{
+	g_assert(e != NULL);
+	g_assert(e->used);
+}
+
+#define EPOCH_SLOT(e)	((e) & (RTABLE_EPOCH_MAX - 1))
+
+/**
+ * Hash message identification.
+ */
+static inline size_t
+rtable_hash(const void *muid, uint8 function)
+{
+	return binary_hash(muid, GUID_RAW_SIZE) ^ integer_hash_fast(function);
+}
+
+/**
+ * Locate message in the table.
+ *
+ * @param rt		the routing table
+ * @param muid		the message ID
+ * @param function	the message function
+ * @param found		set to whether the message is present
+ *
+ * @return index of the message if found, of the free slot where it would
+ * be inserted otherwise.
+ */
+static size_t
+rtable_probe(const rtable_t *rt, const void *muid, uint8 function,
+	bool *found)
+{
+	size_t mask = rt->size - 1;
+	size_t i = rtable_hash(muid, function) & mask;
+
+	for (;;) {
+		const struct rtable_entry *e = &rt->table[i];
+
+		if (!e->used) {
+			*found = FALSE;
+			return i;
+		}
+
+		if (
+			e->function == function &&
+			0 == memcmp(e->muid, muid, GUID_RAW_SIZE)
+		) {
+			*found = TRUE;
+			return i;
+		}
+
+		i = (i + 1) & mask;
+	}
+}
+
+/**
+ * @return size of the spilled vector needed for that many routes.
+ */
+static inline size_t
+rtable_spill_size(uint routes)
+{
+	uint n;
+
+	g_assert(routes > RTABLE_INLINE);
+
+	n = routes - RTABLE_INLINE;
+	n = n <= RTABLE_SPILL_MIN ? RTABLE_SPILL_MIN : next_pow2(n);
+
+	return n * sizeof(struct rtable_hop);
+}
+
+/**
+ * Release all the routes of an entry.
+ */
+static void
+rtable_entry_release(rtable_t *rt, struct rtable_entry *e)
+{
+	uint i;
+
+	if (rt->route_free != NULL) {
+		for (i = 0; i < e->routes; i++)
+			(*rt->route_free)(rtable_entry_route(e, i));
+	}
+
+	if (e->spill != NULL)
+		wfree(e->spill, rtable_spill_size(e->routes));
+
+	g_assert(rt->epoch_count[EPOCH_SLOT(e->epoch)] != 0);
+
+	rt->epoch_count[EPOCH_SLOT(e->epoch)]--;
+}
+
+/**
+ * Delete the entry at the specified index, shifting back the entries that
+ * follow in the cluster and would become unreachable otherwise.
+ */
+static void
+rtable_delete(rtable_t *rt, size_t i)
+{
+	size_t mask = rt->size - 1;
+	size_t j = i;
+
+	for (;;) {
+		struct rtable_entry *e;
+		size_t k;
+
+		j = (j + 1) & mask;
+		e = &rt->table[j];
+
+		if (!e->used)
+			break;
+
+		/*
+		 * Entry can stay where it is if its natural slot is cyclically
+		 * within (i, j].
+		 */
+
+		k = rtable_hash(e->muid, e->function) & mask;
+
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+
+		rt->table[i] = *e;
+		i = j;
+	}
+
+	ZERO(&rt->table[i]);
+	rt->count--;
+}
+
+/**
+ * @return the amount of insertions allowed during an epoch.
+ */
+static inline size_t
+rtable_quota(size_t size)
+{
+	return MAX(1, RTABLE_LOAD(size) / RTABLE_EPOCHS);
+}
+
+/**
+ * @return the time at which given epoch ended, the current one being still
+ * running.
+ */
+static inline time_t
+rtable_epoch_end(const rtable_t *rt, uint32 e)
+{
+	return e == rt->epoch ? tm_time() : rt->epoch_start[EPOCH_SLOT(e + 1)];
+}
+
+/**
+ * Expire all the entries stamped up to the given epoch, in one sweep.
+ */
+static void
+rtable_expire(rtable_t *rt, uint32 upto)
+{
+	time_t now = tm_time();
+	size_t i = 0;
+	uint32 e;
+
+	g_assert(upto - rt->oldest < rt->epoch - rt->oldest);
+
+	for (e = rt->oldest; e != upto + 1; e++) {
+		if (delta_time(now, rtable_epoch_end(rt, e)) < rt->lifetime)
+			rt->expired_early += rt->epoch_count[EPOCH_SLOT(e)];
+	}
+
+	while (i < rt->size) {
+		struct rtable_entry *entry = &rt->table[i];
+
+		if (entry->used && entry->epoch - rt->oldest <= upto - rt->oldest) {
+			rtable_entry_release(rt, entry);
+			rtable_delete(rt, i);
+			continue;		/* Slot may have been refilled, check it again */
+		}
+		i++;
+	}
+
+	for (e = rt->oldest; e != upto + 1; e++)
+		g_assert(0 == rt->epoch_count[EPOCH_SLOT(e)]);
+
+	rt->oldest = upto + 1;
+}
+
+/**
+ * Move all the entries to a new array of the specified size.
+ */
+static void
+rtable_resize(rtable_t *rt, size_t size)
+{
+	struct rtable_entry *old = rt->table;
+	size_t i, osize = rt->size;
+
+	g_assert(is_pow2(size));
+	g_assert(RTABLE_LOAD(size) > rt->count);
+
+	rt->table = vmm_alloc0(size * sizeof rt->table[0]);
+	rt->size = size;
+
+	for (i = 0; i < osize; i++) {
+		const struct rtable_entry *e = &old[i];
+		size_t j;
+		bool found;
+
+		if (!e->used)
+			continue;
+
+		j = rtable_probe(rt, e->muid, e->function, &found);
+		g_assert(!found);
+		rt->table[j] = *e;
+	}
+
+	vmm_free(old, osize * sizeof old[0]);
+}
+
+/**
+ * Compute the size the table needs to hold the messages inserted during
+ * a whole lifetime, at the insertion rate measured over the live epochs.
+ *
+ * @return the target size, within the configured bounds.
+ */
+static size_t
+rtable_target_size(rtable_t *rt, time_t now)
+{
+	uint64 inserted = 0, need;
+	time_delta_t window;
+	uint32 e;
+
+	for (e = rt->oldest; e != rt->epoch + 1; e++)
+		inserted += rt->epoch_inserted[EPOCH_SLOT(e)];
+
+	/*
+	 * Measuring over at least a whole epoch prevents a burst at startup
+	 * from making the table grow to its maximum size at once.
+	 */
+
+	window = delta_time(now, rt->epoch_start[EPOCH_SLOT(rt->oldest)]);
+	window = MAX(window, rt->bucket);
+	rt->rate = MIN(inserted / window, MAX_INT_VAL(uint32));
+
+	/*
+	 * These messages must fit in the usable capacity, minus the eighth
+	 * we keep as room for the next epoch.
+	 */
+
+	need = inserted * rt->lifetime / window;
+	need = need * RTABLE_EPOCHS / (RTABLE_EPOCHS - 1);
+	need = need / 3 * 4 + 4;
+
+	if (need >= rt->max_size)
+		return rt->max_size;
+
+	return MAX(rt->min_size, next_pow2(need));
+}
+
+/**
+ * Start a new epoch, making sure there is room for a whole epoch worth of
+ * insertions.
+ */
+static void
+rtable_new_epoch(rtable_t *rt)
+{
+	time_t now = tm_time();
+	size_t size, target;
+	uint32 e;
+
+	/*
+	 * We can only remember so many epochs.
+	 */
+
+	if (rt->epoch + 1 - rt->oldest >= RTABLE_EPOCH_MAX)
+		rtable_expire(rt, rt->oldest);
+
+	rt->epoch++;
+	rt->epoch_count[EPOCH_SLOT(rt->epoch)] = 0;
+	rt->epoch_inserted[EPOCH_SLOT(rt->epoch)] = 0;
+	rt->epoch_start[EPOCH_SLOT(rt->epoch)] = now;
+
+	/*
+	 * Recycle all the epochs holding routes older than the lifetime.
+	 */
+
+	for (e = rt->oldest; e != rt->epoch; e++) {
+		if (delta_time(now, rtable_epoch_end(rt, e)) <= rt->lifetime)
+			break;
+	}
+
+	if (e != rt->oldest)
+		rtable_expire(rt, e - 1);
+
+	/*
+	 * Size the table for the traffic.  We do not shrink below twice the
+	 * target size, to avoid resizing back and forth as the rate varies,
+	 * nor below what we currently hold.
+	 */
+
+	target = rtable_target_size(rt, now);
+
+	for (size = rt->size; size > 2 * target; size /= 2) {
+		if (rt->count + rtable_quota(size / 2) > RTABLE_LOAD(size / 2))
+			break;
+	}
+
+	size = MAX(size, target);
+
+	if (size != rt->size)
+		rtable_resize(rt, size);
+
+	/*
+	 * Make room for the new epoch, growing the table to absorb bursts.
+	 * At the maximum size, we have to expire routes younger than the
+	 * lifetime.  The new epoch being empty, expiring all the previous ones
+	 * always makes enough room.
+	 */
+
+	while (rt->count + rtable_quota(rt->size) > RTABLE_LOAD(rt->size)) {
+		size_t need = rt->count + rtable_quota(rt->size) -
+			RTABLE_LOAD(rt->size);
+		size_t freed = 0;
+
+		if (rt->size < rt->max_size) {
+			rtable_resize(rt, rt->size * 2);
+			continue;
+		}
+
+		g_assert(rt->oldest != rt->epoch);
+
+		for (e = rt->oldest; e != rt->epoch - 1; e++) {
+			freed += rt->epoch_count[EPOCH_SLOT(e)];
+			if (freed >= need)
+				break;
+		}
+
+		rtable_expire(rt, e);
+	}
+}
+
+/**
+ * Create a new routing table.
+ *
+ * @param min_size		minimum amount of slots
+ * @param max_size		maximum amount of slots
+ * @param lifetime		target lifetime of routes, in seconds
+ * @param route_free	if non-NULL, invoked on each route of expired entries
+ *
+ * @return new routing table.
+ */
+rtable_t *
+rtable_make(size_t min_size, size_t max_size, time_delta_t lifetime,
+	free_fn_t route_free)
+{
+	rtable_t *rt;
+
+	g_assert(min_size <= max_size);
+	g_assert(lifetime >= 0);
+
+	STATIC_ASSERT(IS_POWER_OF_2(RTABLE_EPOCH_MAX));
+
+	WALLOC0(rt);
+	rt->magic = RTABLE_MAGIC;
+	rt->min_size = next_pow2(MAX(min_size, 4 * RTABLE_EPOCHS));
+	rt->max_size = next_pow2(MAX(max_size, rt->min_size));
+	rt->lifetime = lifetime;
+	rt->bucket = MAX(1, lifetime / RTABLE_EPOCHS);
+	rt->route_free = route_free;
+	rt->size = rt->min_size;
+	rt->table = vmm_alloc0(rt->size * sizeof rt->table[0]);
+	rt->epoch_start[EPOCH_SLOT(rt->epoch)] = tm_time();
+
+	return rt;
+}
+
+/**
+ * Release all the entries of the table, along with the table array.
+ */
+static void
+rtable_release_all(rtable_t *rt)
+{
+	size_t i;
+
+	for (i = 0; i < rt->size; i++) {
+		struct rtable_entry *e = &rt->table[i];
+
+		if (e->used)
+			rtable_entry_release(rt, e);
+	}
+
+	vmm_free(rt->table, rt->size * sizeof rt->table[0]);
+	rt->table = NULL;
+	rt->count = 0;
+}
+
+/**
+ * Remove all the entries from the table, shrinking it to its minimum size.
+ */
+void
+rtable_clear(rtable_t *rt)
+{
+	rtable_check(rt);
+
+	rtable_release_all(rt);
+
+	rt->size = rt->min_size;
+	rt->table = vmm_alloc0(rt->size * sizeof rt->table[0]);
+	rt->rate = 0;
+	rt->oldest = ++rt->epoch;
+	rt->epoch_count[EPOCH_SLOT(rt->epoch)] = 0;
+	rt->epoch_inserted[EPOCH_SLOT(rt->epoch)] = 0;
+	rt->epoch_start[EPOCH_SLOT(rt->epoch)] = tm_time();
+}
+
+/**
+ * Free the routing table and nullify its pointer.
+ */
+void
+rtable_free_null(rtable_t **rt_ptr)
+{
+	rtable_t *rt = *rt_ptr;
+
+	if (rt != NULL) {
+		rtable_check(rt);
+		rtable_release_all(rt);
+		rt->magic = 0;
+		WFREE(rt);
+		*rt_ptr = NULL;
+	}
+}
+
+/**
+ * @return amount of messages held in the table.
+ */
+size_t
+rtable_count(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return rt->count;
+}
+
+/**
+ * @return amount of messages the table can hold before it must grow or
+ * expire entries.
+ */
+size_t
+rtable_capacity(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return RTABLE_LOAD(rt->size);
+}
+
+/**
+ * @return amount of epochs present in the table.
+ */
+uint
+rtable_epochs(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return rt->epoch - rt->oldest + 1;
+}
+
+/**
+ * @return amount of messages inserted per second, as measured when the
+ * current epoch started.
+ */
+uint
+rtable_rate(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return rt->rate;
+}
+
+/**
+ * @return age of the oldest epoch, i.e. how long routes are being kept.
+ */
+time_delta_t
+rtable_lifetime(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return delta_time(tm_time(), rt->epoch_start[EPOCH_SLOT(rt->oldest)]);
+}
+
+/**
+ * @return amount of messages expired before reaching the target lifetime,
+ * because the table had reached its maximum size.
+ */
+uint64
+rtable_expired_early(const rtable_t *rt)
+{
+	rtable_check(rt);
+
+	return rt->expired_early;
+}
+
+/**
+ * Look for a message in the table.
+ *
+ * @return the entry if found, NULL otherwise.
+ */
+rtable_entry_t *
+rtable_lookup(const rtable_t *rt, const struct guid *muid, uint8 function)
+{
+	size_t i;
+	bool found;
+
+	rtable_check(rt);
+	g_assert(muid != NULL);
+
+	i = rtable_probe(rt, muid, function, &found);
+
+	return found ? &rt->table[i] : NULL;
+}
+
+/**
+ * Insert a new message, which must not already be present, in the table.
+ *
+ * This can expire older entries or move entries around, invalidating all
+ * the entry pointers previously obtained.
+ *
+ * @return the new entry, with no routes.
+ */
+rtable_entry_t *
+rtable_insert(rtable_t *rt, const struct guid *muid, uint8 function)
+{
+	struct rtable_entry *e;
+	size_t i;
+	bool found;
+
+	rtable_check(rt);
+	g_assert(muid != NULL);
+
+	if G_UNLIKELY(
+		rt->epoch_inserted[EPOCH_SLOT(rt->epoch)] >= rtable_quota(rt->size) ||
+		delta_time(tm_time(), rt->epoch_start[EPOCH_SLOT(rt->epoch)])
+			>= rt->bucket
+	)
+		rtable_new_epoch(rt);
+
+	i = rtable_probe(rt, muid, function, &found);
+
+	g_assert(!found);
+	g_assert(rt->count < RTABLE_LOAD(rt->size));
+
+	e = &rt->table[i];
+	memcpy(e->muid, muid, GUID_RAW_SIZE);
+	e->function = function;
+	e->epoch = rt->epoch;
+	e->used = TRUE;
+
+	rt->count++;
+	rt->epoch_count[EPOCH_SLOT(rt->epoch)]++;
+	rt->epoch_inserted[EPOCH_SLOT(rt->epoch)]++;
+
+	return e;
+}
+
+/**
+ * Revitalize entry by moving it to the current epoch, to delay its expiration.
+ */
+void
+rtable_touch(rtable_t *rt, rtable_entry_t *e)
+{
+	rtable_check(rt);
+	rtable_entry_check(e);
+
+	if (e->epoch == rt->epoch)
+		return;
+
+	g_assert(rt->epoch_count[EPOCH_SLOT(e->epoch)] != 0);
+
+	rt->epoch_count[EPOCH_SLOT(e->epoch)]--;
+	rt->epoch_count[EPOCH_SLOT(rt->epoch)]++;
+	e->epoch = rt->epoch;
+}
+
+/**
+ * @return the function of the message.
+ */
+uint8
+rtable_entry_function(const rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	return e->function;
+}
+
+/**
+ * @return the highest TTL recorded for the message.
+ */
+uint8
+rtable_entry_ttl(const rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	return e->ttl;
+}
+
+/**
+ * Record the highest TTL seen for the message.
+ */
+void
+rtable_entry_set_ttl(rtable_entry_t *e, uint8 ttl)
+{
+	rtable_entry_check(e);
+
+	e->ttl = ttl;
+}
+
+/**
+ * @return amount of routes recorded for the message.
+ */
+uint
+rtable_entry_route_count(const rtable_entry_t *e)
+{
+	rtable_entry_check(e);
+
+	return e->routes;
+}
+
+/**
+ * @return the i-th route of the message, in insertion order.
+ */
+void *
+rtable_entry_route(const rtable_entry_t *e, uint i)
+{
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	return i < RTABLE_INLINE ? e->route[i] : e->spill[i - RTABLE_INLINE].route;
+}
+
+/**
+ * @return the TTL of the message along its i-th route.
+ */
+uint8
+rtable_entry_route_ttl(const rtable_entry_t *e, uint i)
+{
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	return i < RTABLE_INLINE ? e->ttls[i] : e->spill[i - RTABLE_INLINE].ttl;
+}
+
+/**
+ * Set the i-th route of the message.
+ */
+static inline void
+rtable_entry_set(rtable_entry_t *e, uint i, void *route, uint8 ttl)
+{
+	if (i < RTABLE_INLINE) {
+		e->route[i] = route;
+		e->ttls[i] = ttl;
+	} else {
+		e->spill[i - RTABLE_INLINE].route = route;
+		e->spill[i - RTABLE_INLINE].ttl = ttl;
+	}
+}
+
+/**
+ * Update the TTL of the message along its i-th route.
+ */
+void
+rtable_entry_set_route_ttl(rtable_entry_t *e, uint i, uint8 ttl)
+{
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	if (i < RTABLE_INLINE)
+		e->ttls[i] = ttl;
+	else
+		e->spill[i - RTABLE_INLINE].ttl = ttl;
+}
+
+/**
+ * @return index of the route in the message, -1 if not found.
+ */
+int
+rtable_entry_route_index(const rtable_entry_t *e, const void *route)
+{
+	uint i, n;
+
+	rtable_entry_check(e);
+
+	n = MIN(e->routes, RTABLE_INLINE);
+
+	for (i = 0; i < n; i++) {
+		if (route == e->route[i])
+			return i;
+	}
+
+	for (/* empty */; i < e->routes; i++) {
+		if (route == e->spill[i - RTABLE_INLINE].route)
+			return i;
+	}
+
+	return -1;
+}
+
+/**
+ * Append a route to the message.
+ */
+void
+rtable_entry_add_route(rtable_entry_t *e, void *route, uint8 ttl)
+{
+	uint i;
+
+	rtable_entry_check(e);
+	g_return_unless(e->routes < RTABLE_ROUTE_MAX);
+
+	i = e->routes;
+
+	if (i >= RTABLE_INLINE) {
+		size_t size = rtable_spill_size(i + 1);
+
+		if (NULL == e->spill)
+			e->spill = walloc(size);
+		else if (size != rtable_spill_size(i))
+			e->spill = wrealloc(e->spill, rtable_spill_size(i), size);
+	}
+
+	rtable_entry_set(e, i, route, ttl);
+	e->routes++;
+}
+
+/**
+ * Remove the i-th route of the message, preserving the order of the others.
+ */
+void
+rtable_entry_remove_route(rtable_entry_t *e, uint i)
+{
+	uint n;
+
+	rtable_entry_check(e);
+	g_assert(i < e->routes);
+
+	n = e->routes - 1;
+
+	for (/* empty */; i < n; i++) {
+		rtable_entry_set(e, i,
+			rtable_entry_route(e, i + 1), rtable_entry_route_ttl(e, i + 1));
+	}
+
+	if (n >= RTABLE_INLINE) {
+		size_t size = rtable_spill_size(n + 1);
+
+		if (n == RTABLE_INLINE) {
+			wfree(e->spill, size);
+			e->spill = NULL;
+		} else if (size != rtable_spill_size(n)) {
+			e->spill = wrealloc(e->spill, size, rtable_spill_size(n));
+		}
+	}
+
+	e->routes = n;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
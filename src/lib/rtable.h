@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Message routing table.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _rtable_h_
+#define _rtable_h_
+
+#include "common.h"
+
+#include "tm.h"			/* For time_delta_t */
+
+typedef struct rtable rtable_t;
+typedef struct rtable_entry rtable_entry_t;
+
+struct guid;
+
+/*
+ * Public interface.
+ */
+
+rtable_t *rtable_make(size_t min_size, size_t max_size,
+	time_delta_t lifetime, free_fn_t route_free);
+void rtable_free_null(rtable_t **rt_ptr);
+void rtable_clear(rtable_t *rt);
+
+size_t rtable_count(const rtable_t *rt);
+size_t rtable_capacity(const rtable_t *rt);
+uint rtable_epochs(const rtable_t *rt);
+uint rtable_rate(const rtable_t *rt);
+time_delta_t rtable_lifetime(const rtable_t *rt);
+uint64 rtable_expired_early(const rtable_t *rt);
+
+rtable_entry_t *rtable_lookup(const rtable_t *rt,
+	const struct guid *muid, uint8 function);
+rtable_entry_t *rtable_insert(rtable_t *rt,
+	const struct guid *muid, uint8 function);
+void rtable_touch(rtable_t *rt, rtable_entry_t *e);
+
+uint8 rtable_entry_function(const rtable_entry_t *e);
+uint8 rtable_entry_ttl(const rtable_entry_t *e);
+void rtable_entry_set_ttl(rtable_entry_t *e, uint8 ttl);
+
+uint rtable_entry_route_count(const rtable_entry_t *e);
+void *rtable_entry_route(const rtable_entry_t *e, uint i);
+uint8 rtable_entry_route_ttl(const rtable_entry_t *e, uint i);
+void rtable_entry_set_route_ttl(rtable_entry_t *e, uint i, uint8 ttl);
+int rtable_entry_route_index(const rtable_entry_t *e, const void *route);
+void rtable_entry_add_route(rtable_entry_t *e, void *route, uint8 ttl);
+void rtable_entry_remove_route(rtable_entry_t *e, uint i);
+
+#endif /* _rtable_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -67,14 +67,82 @@
 #include "common.h"
 #include "endian.h"
 #include "sha1.h"
+#include "base16.h"
+#include "cpufeat.h"
+#include "halloc.h"
 #include "misc.h"			/* For RCSID */
+
+#ifdef HAS_CPUFEAT_X86
+#include <immintrin.h>
+#define SHA1_SHANI			/* Can compile the SHA-NI back-end */
+#endif
+
 #include "override.h"		/* Must be the last header included */
 
 #define SHA1_BLEN	64		/**< Message block length */
 
+typedef void (*sha1_process_t)(uint32 *ihash, const void *data, size_t n);
+
 /* Local Function Prototyptes */
 static void SHA1_pad_message(SHA1_context *);
-static void SHA1_process_message_block(SHA1_context *, const void *mblock);
+static void SHA1_process_scalar(uint32 *ihash, const void *data, size_t n);
+#ifdef SHA1_SHANI
+static void SHA1_process_shani(uint32 *ihash, const void *data, size_t n);
+#endif
+
+/**
+ * The block processing back-ends, the best ones being listed last.
+ */
+static const struct sha1_backend {
+	const char *name;			/**< Back-end name, for logging */
+	sha1_process_t process;		/**< Processes n consecutive blocks */
+	uint cpufeat;				/**< Required CPU extensions */
+} sha1_backends[] = {
+	{ "scalar", SHA1_process_scalar, 0 },
+#ifdef SHA1_SHANI
+	{ "SHA-NI", SHA1_process_shani,
+		CPUFEAT_SHA | CPUFEAT_SSSE3 | CPUFEAT_SSE4_1 },
+#endif
+};
+
+/**
+ * @return the best block processing routine for the running CPU.
+ */
+static sha1_process_t
+SHA1_backend(void)
+{
+	static sha1_process_t process;
+
+	/*
+	 * No need to protect this with a lock: all the threads would compute
+	 * the same value anyway.
+	 */
+
+	if G_UNLIKELY(NULL == process) {
+		uint i;
+
+		for (i = N_ITEMS(sha1_backends); i != 0; i--) {
+			const struct sha1_backend *b = &sha1_backends[i - 1];
+
+			if (cpufeat_has(b->cpufeat)) {
+				process = b->process;
+				break;
+			}
+		}
+	}
+
+	return process;
+}
+
+/**
+ * Process the (complete) message block held in the context.
+ */
+static inline void
+SHA1_process_message_block(SHA1_context *context)
+{
+	(*context->process)(context->ihash, context->mblock, 1);
+	context->midx = 0;
+}
 
 /**
  *  SHA1_reset
@@ -99,7 +167,7 @@ SHA1_reset(SHA1_context *context)
 
 	/*
 	 * We rely on mblock[] being aligned on a 32-bit boundary, to be able
-	 * to cast it to a uint32 * in SHA1_process_message_block().
+	 * to cast it to a uint32 * in SHA1_process_block().
 	 */
 	STATIC_ASSERT(0 == offsetof(struct SHA1_context, mblock) % 4);
 
@@ -113,6 +181,8 @@ SHA1_reset(SHA1_context *context)
 	context->ihash[3]  = 0x10325476;
 	context->ihash[4]  = 0xC3D2E1F0;
 
+	context->process   = SHA1_backend();
+
 	return SHA_SUCCESS;
 }
 
@@ -242,26 +312,33 @@ SHA1_input(SHA1_context *context, const void *data, size_t length)
 	/*
 	 * Optimization: if the data block is aligned on a 32-bit boundary and
 	 * is at least 64-byte long, we can avoid moving data around and feed
-	 * them directly to SHA1_process_message_block(), as long as there are
+	 * them directly to the block processing routine, as long as there are
 	 * no pending bytes in the context.  This will likely be happening when
 	 * large chunks of data are fed to the routine, e.g. when processing a file.
 	 *		--RAM, 2015-03-14
+	 *
+	 * All the consecutive blocks are handed at once to the back-end, which
+	 * lets accelerated versions keep their state in registers.
 	 */
 
 	if G_UNLIKELY(0 != context->midx || 0 != pointer_to_long(mp) % 4)
 		goto slowpath;
 
 fastpath:
-	for (/**/; length >= SHA1_BLEN; mp += SHA1_BLEN, length -= SHA1_BLEN) {
-		context->length += 8 * SHA1_BLEN;		/* Counts bits, not bytes */
+	if (length >= SHA1_BLEN) {
+		size_t n = length / SHA1_BLEN;
+		uint64 bits = (uint64) n * 8 * SHA1_BLEN;	/* Counts bits */
 
-		if G_UNLIKELY(context->length < 8 * SHA1_BLEN) {
+		if G_UNLIKELY(context->length + bits < context->length) {
 			/* Message is too long */
 			context->corrupted = SHA_INPUT_TOO_LONG;
 			return SHA_INPUT_TOO_LONG;
 		}
 
-		SHA1_process_message_block(context, mp);
+		context->length += bits;
+		(*context->process)(context->ihash, mp, n);
+		mp += n * SHA1_BLEN;
+		length -= n * SHA1_BLEN;
 	}
 
 	/* FALL THROUGH */
@@ -282,7 +359,7 @@ slowpath:
 		}
 
 		if G_UNLIKELY(SHA1_BLEN == context->midx) {
-			SHA1_process_message_block(context, context->mblock);
+			SHA1_process_message_block(context);
 			if (length >= SHA1_BLEN && 0 == pointer_to_long(mp) % 4)
 				goto fastpath;		/* Can use faster processing now */
 		}
@@ -292,13 +369,15 @@ slowpath:
 }
 
 /**
- *  SHA1_process_message_block
+ *  SHA1_process_block
  *
  *  Description:
  *      This function will process the next 512 bits of the message
  *      stored in the mblock parameter.
  *
  *  Parameters:
+ *      ihash: [in/out]
+ *          The intermediate message digest to update
  *      mblock: [in]
  *          Start of the next 64 message bytes to process
  *
@@ -311,7 +390,7 @@ slowpath:
  *      names used in the publication.
  */
 static void G_HOT
-SHA1_process_message_block(SHA1_context *context, const void *mblock)
+SHA1_process_block(uint32 *ihash, const void *mblock)
 {
 	const uint32 K[] = {       /* Constants defined in SHA-1 */
 		0x5A827999,
@@ -365,11 +444,11 @@ SHA1_process_message_block(SHA1_context *context, const void *mblock)
 		CRUNCH; wp++;		/* t+9 */
 	}
 
-	a = context->ihash[0];
-	b = context->ihash[1];
-	c = context->ihash[2];
-	d = context->ihash[3];
-	e = context->ihash[4];
+	a = ihash[0];
+	b = ihash[1];
+	c = ihash[2];
+	d = ihash[3];
+	e = ihash[4];
 
 	wp = &W[0];
 
@@ -489,14 +568,127 @@ SHA1_process_message_block(SHA1_context *context, const void *mblock)
 	ROTATE(3, c, d, e, a, b, M3);
 	ROTATE(3, b, c, d, e, a, M3);
 
-	context->ihash[0] += a;
-	context->ihash[1] += b;
-	context->ihash[2] += c;
-	context->ihash[3] += d;
-	context->ihash[4] += e;
+	ihash[0] += a;
+	ihash[1] += b;
+	ihash[2] += c;
+	ihash[3] += d;
+	ihash[4] += e;
+}
 
-	context->midx = 0;
+/**
+ * Portable back-end: process n consecutive message blocks.
+ */
+static void
+SHA1_process_scalar(uint32 *ihash, const void *data, size_t n)
+{
+	const uint8 *p = data;
+
+	while (n-- != 0) {
+		SHA1_process_block(ihash, p);
+		p += SHA1_BLEN;
+	}
+}
+
+#ifdef SHA1_SHANI
+/**
+ * SHA-NI back-end: process n consecutive message blocks using the Intel
+ * SHA extensions.
+ *
+ * Each group of 4 rounds is performed by a single sha1rnds4 instruction,
+ * the message schedule being expanded 4 words at a time by the sha1msg1
+ * and sha1msg2 instructions.  The "E" value is carried in the upper word
+ * of a separate register, and is derived by sha1nexte.
+ */
+static void G_HOT G_TARGET("sha,ssse3,sse4.1")
+SHA1_process_shani(uint32 *ihash, const void *data, size_t n)
+{
+	const __m128i bswap =
+		_mm_set_epi64x(0x0001020304050607LL, 0x08090a0b0c0d0e0fLL);
+	const uint8 *p = data;
+	__m128i abcd, abcd_save, e0, e1, e_save;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_loadu_si128((const __m128i *) ihash);
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);		/* Reverse word order */
+	e0 = _mm_set_epi32(ihash[4], 0, 0, 0);
+
+#define LOAD(m, i) \
+	m = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (p + 16 * i)), bswap)
+
+	/*
+	 * Four rounds, using "e" as the E value and saving ABCD into "enext",
+	 * which becomes the input E for the next group of rounds.
+	 */
+#define ROUNDS4(e, enext, m, f) \
+	e = _mm_sha1nexte_epu32(e, m); \
+	enext = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, f)
+
+#define MSG1(m, mnext)	m = _mm_sha1msg1_epu32(m, mnext)
+#define MSG2(m, mprev)	m = _mm_sha1msg2_epu32(m, mprev)
+#define MXOR(m, mprev)	m = _mm_xor_si128(m, mprev)
+
+	while (n-- != 0) {
+		abcd_save = abcd;
+		e_save = e0;
+
+		/* Rounds 0-3 */
+		LOAD(m0, 0);
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		/* Rounds 4-7 */
+		LOAD(m1, 1);
+		ROUNDS4(e1, e0, m1, 0);
+		MSG1(m0, m1);
+
+		/* Rounds 8-11 */
+		LOAD(m2, 2);
+		ROUNDS4(e0, e1, m2, 0);
+		MSG1(m1, m2); MXOR(m0, m2);
+
+		/* Rounds 12-15 */
+		LOAD(m3, 3);
+		ROUNDS4(e1, e0, m3, 0);
+		MSG2(m0, m3); MSG1(m2, m3); MXOR(m1, m3);
+
+		/* Rounds 16-79, with the same pattern on rotating registers */
+		ROUNDS4(e0, e1, m0, 0); MSG2(m1, m0); MSG1(m3, m0); MXOR(m2, m0);
+		ROUNDS4(e1, e0, m1, 1); MSG2(m2, m1); MSG1(m0, m1); MXOR(m3, m1);
+		ROUNDS4(e0, e1, m2, 1); MSG2(m3, m2); MSG1(m1, m2); MXOR(m0, m2);
+		ROUNDS4(e1, e0, m3, 1); MSG2(m0, m3); MSG1(m2, m3); MXOR(m1, m3);
+		ROUNDS4(e0, e1, m0, 1); MSG2(m1, m0); MSG1(m3, m0); MXOR(m2, m0);
+		ROUNDS4(e1, e0, m1, 1); MSG2(m2, m1); MSG1(m0, m1); MXOR(m3, m1);
+		ROUNDS4(e0, e1, m2, 2); MSG2(m3, m2); MSG1(m1, m2); MXOR(m0, m2);
+		ROUNDS4(e1, e0, m3, 2); MSG2(m0, m3); MSG1(m2, m3); MXOR(m1, m3);
+		ROUNDS4(e0, e1, m0, 2); MSG2(m1, m0); MSG1(m3, m0); MXOR(m2, m0);
+		ROUNDS4(e1, e0, m1, 2); MSG2(m2, m1); MSG1(m0, m1); MXOR(m3, m1);
+		ROUNDS4(e0, e1, m2, 2); MSG2(m3, m2); MSG1(m1, m2); MXOR(m0, m2);
+		ROUNDS4(e1, e0, m3, 3); MSG2(m0, m3); MSG1(m2, m3); MXOR(m1, m3);
+		ROUNDS4(e0, e1, m0, 3); MSG2(m1, m0); MSG1(m3, m0); MXOR(m2, m0);
+		ROUNDS4(e1, e0, m1, 3); MSG2(m2, m1); MSG1(m0, m1); MXOR(m3, m1);
+		ROUNDS4(e0, e1, m2, 3); MSG2(m3, m2);
+		ROUNDS4(e1, e0, m3, 3);
+
+		/* Add this block's hash to the result so far */
+		e0 = _mm_sha1nexte_epu32(e0, e_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+
+		p += SHA1_BLEN;
+	}
+
+#undef LOAD
+#undef ROUNDS4
+#undef MSG1
+#undef MSG2
+#undef MXOR
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1b);
+	_mm_storeu_si128((__m128i *) ihash, abcd);
+	ihash[4] = _mm_extract_epi32(e0, 3);
 }
+#endif	/* SHA1_SHANI */
 
 /**
  *  SHA1_pad_message
@@ -534,7 +726,7 @@ SHA1_pad_message(SHA1_context *context)
 			context->mblock[context->midx++] = 0;
 		}
 
-		SHA1_process_message_block(context, context->mblock);
+		SHA1_process_message_block(context);
 
 		while (context->midx < SHA1_BUP) {
 			context->mblock[context->midx++] = 0;
@@ -551,7 +743,117 @@ SHA1_pad_message(SHA1_context *context)
 	 */
 
 	poke_be64(&context->mblock[SHA1_BUP], context->length);
-	SHA1_process_message_block(context, context->mblock);
+	SHA1_process_message_block(context);
+}
+
+/**
+ * Compute the SHA1 of the data, repeated ``count'' times, using the
+ * specified back-end.
+ */
+static void G_COLD
+sha1_compute_with(const struct sha1_backend *b,
+	const void *data, size_t len, size_t count, struct sha1 *digest)
+{
+	SHA1_context ctx;
+
+	SHA1_reset(&ctx);
+	ctx.process = b->process;
+	while (count-- != 0)
+		SHA1_input(&ctx, data, len);
+	SHA1_result(&ctx, digest);
+}
+
+static void G_COLD
+sha1_check_digest(const struct sha1_backend *b, const char *expected,
+	const void *data, size_t len, size_t count)
+{
+	char hex[2 * SHA1_RAW_SIZE + 1];
+	struct sha1 digest;
+
+	sha1_compute_with(b, data, len, count, &digest);
+
+	ZERO(&hex);
+	base16_encode(ARYLEN(hex), ARYLEN(digest.data));
+	hex[N_ITEMS(hex) - 1] = '\0';
+
+	if (0 != strcmp(expected, hex)) {
+		g_warning("%s(): with %s back-end:\n"
+			"Expected: \"%s\"\nGot:      \"%s\"",
+			G_STRFUNC, b->name, expected, hex);
+		g_error("SHA1 implementation is defective.");
+	}
+}
+
+/**
+ * Runs the test cases from RFC 3174 through all the back-ends supported
+ * by the CPU, then cross-checks the accelerated back-ends against the
+ * portable one on data of various lengths and alignments.
+ */
+void G_COLD
+sha1_test(void)
+{
+	static const char test4[] =
+		"01234567012345670123456701234567"
+		"01234567012345670123456701234567";
+	char *buf;
+	size_t bufsize = 4 * 1024 + 16;
+	uint i, j, seed = 1;
+
+	buf = halloc(bufsize);
+
+	for (i = 0; i < N_ITEMS(sha1_backends); i++) {
+		const struct sha1_backend *b = &sha1_backends[i];
+
+		if (!cpufeat_has(b->cpufeat))
+			continue;
+
+		sha1_check_digest(b,
+			"a9993e364706816aba3e25717850c26c9cd0d89d", "abc", 3, 1);
+		sha1_check_digest(b,
+			"84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+			"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 56, 1);
+		memset(buf, 'a', 1000);
+		sha1_check_digest(b,
+			"34aa973cd4c4daa4f61eeb2bdbad27316534016f", buf, 1000, 1000);
+		sha1_check_digest(b,
+			"dea356a2cddd90c7a7ecedc5ebb563934f460452",
+			test4, CONST_STRLEN(test4), 10);
+	}
+
+	/*
+	 * Deterministic pseudo-random data: these checks are about comparing
+	 * back-ends, not about the hash quality.
+	 */
+
+	for (i = 0; i < bufsize; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	for (i = 1; i < N_ITEMS(sha1_backends); i++) {
+		const struct sha1_backend *b = &sha1_backends[i];
+
+		if (!cpufeat_has(b->cpufeat))
+			continue;
+
+		for (j = 0; j < 200; j++) {
+			struct sha1 expected, digest;
+			size_t offset = j % 8;
+			size_t len = (j * 97) % (bufsize - offset);
+
+			sha1_compute_with(&sha1_backends[0],
+				buf + offset, len, 1, &expected);
+			sha1_compute_with(b, buf + offset, len, 1, &digest);
+
+			if (0 != memcmp(&expected, &digest, sizeof digest)) {
+				g_warning("%s(): %s back-end differs for %zu bytes at +%zu",
+					G_STRFUNC, b->name, len, offset);
+				g_error("SHA1 implementation is defective.");
+			}
+		}
+	}
+
+	hfree(buf);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -68,6 +68,7 @@ typedef struct SHA1_context {
 	uint8 mblock[64];         /* 512-bit message blocks */
 	bool computed;            /* Is the digest computed? */
 	enum SHA_code corrupted;  /* Is the message digest corrupted? */
+	void (*process)(uint32 *, const void *, size_t);	/* Block processing */
 } SHA1_context;
 
 static inline void
@@ -85,6 +86,8 @@ int SHA1_input(SHA1_context *, const void *, size_t);
 int SHA1_result(SHA1_context *, struct sha1 *digest);
 int SHA1_intermediate(const SHA1_context *, struct sha1 *digest);
 
+void sha1_test(void);
+
 /**
  * Feed the SHA1 context with the content of a variable.
  */
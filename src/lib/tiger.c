@@ -49,7 +49,14 @@
 #include "endian.h"
 #include "misc.h"
 #include "base32.h"
+#include "cpufeat.h"
 #include "tiger.h"
+
+#if defined(HAS_CPUFEAT_X86) && !IS_BIG_ENDIAN
+#include <immintrin.h>
+#define TIGER_AVX2			/* Can compile the 4-lane AVX2 back-end */
+#endif
+
 #include "override.h"		/* Must be the last header included */
 
 /* NOTE that this code is NOT FULLY OPTIMIZED for any  */
@@ -238,6 +245,278 @@ tiger(const void *data, uint64 length, char hash[24])
 }
 
 /* vi: set ai et sts=2 sw=2 cindent: */
+
+/*
+ * Multi-lane hashing.
+ *
+ * The Tiger compression function relies on table lookups, which prevents
+ * any vectorization within a single message.  However, the leaves of a
+ * Tiger tree are independent messages of the same length, and these can
+ * be hashed in parallel, each message being processed in its own lane of
+ * a vector register, the table lookups being done via gather instructions.
+ *		--RAM, 2026-10-16
+ */
+
+#ifdef TIGER_AVX2
+
+#define TIGER_LANES		4		/* 64-bit lanes in a 256-bit register */
+
+#define VT(tab, c, shift) \
+	_mm256_i64gather_epi64((const long long *) (tab), \
+		_mm256_and_si256(_mm256_srli_epi64((c), (shift)), m8), 8)
+
+#define VMUL_5(b)	_mm256_add_epi64(_mm256_slli_epi64((b), 2), (b))
+#define VMUL_7(b)	_mm256_sub_epi64(_mm256_slli_epi64((b), 3), (b))
+#define VMUL_9(b)	_mm256_add_epi64(_mm256_slli_epi64((b), 3), (b))
+
+#define VROUND(a,b,c,x,mul) \
+	c = _mm256_xor_si256(c, x); \
+	a = _mm256_sub_epi64(a, _mm256_xor_si256( \
+		_mm256_xor_si256(VT(t1, c, 0 * 8), VT(t2, c, 2 * 8)), \
+		_mm256_xor_si256(VT(t3, c, 4 * 8), VT(t4, c, 6 * 8)))); \
+	b = _mm256_add_epi64(b, _mm256_xor_si256( \
+		_mm256_xor_si256(VT(t4, c, 1 * 8), VT(t3, c, 3 * 8)), \
+		_mm256_xor_si256(VT(t2, c, 5 * 8), VT(t1, c, 7 * 8)))); \
+	b = VMUL_ ## mul(b);
+
+#define VPASS(a,b,c,mul) \
+	VROUND(a,b,c,x[0],mul) \
+	VROUND(b,c,a,x[1],mul) \
+	VROUND(c,a,b,x[2],mul) \
+	VROUND(a,b,c,x[3],mul) \
+	VROUND(b,c,a,x[4],mul) \
+	VROUND(c,a,b,x[5],mul) \
+	VROUND(a,b,c,x[6],mul) \
+	VROUND(b,c,a,x[7],mul)
+
+#define VADD(a,b)	_mm256_add_epi64((a), (b))
+#define VSUB(a,b)	_mm256_sub_epi64((a), (b))
+#define VXOR(a,b)	_mm256_xor_si256((a), (b))
+#define VNOT(a)		_mm256_xor_si256((a), ones)
+
+#define VKEY_SCHEDULE \
+	x[0] = VSUB(x[0], VXOR(x[7], k0)); \
+	x[1] = VXOR(x[1], x[0]); \
+	x[2] = VADD(x[2], x[1]); \
+	x[3] = VSUB(x[3], VXOR(x[2], _mm256_slli_epi64(VNOT(x[1]), 19))); \
+	x[4] = VXOR(x[4], x[3]); \
+	x[5] = VADD(x[5], x[4]); \
+	x[6] = VSUB(x[6], VXOR(x[5], _mm256_srli_epi64(VNOT(x[4]), 23))); \
+	x[7] = VXOR(x[7], x[6]); \
+	x[0] = VADD(x[0], x[7]); \
+	x[1] = VSUB(x[1], VXOR(x[0], _mm256_slli_epi64(VNOT(x[7]), 19))); \
+	x[2] = VXOR(x[2], x[1]); \
+	x[3] = VADD(x[3], x[2]); \
+	x[4] = VSUB(x[4], VXOR(x[3], _mm256_srli_epi64(VNOT(x[2]), 23))); \
+	x[5] = VXOR(x[5], x[4]); \
+	x[6] = VADD(x[6], x[5]); \
+	x[7] = VSUB(x[7], VXOR(x[6], k1));
+
+/**
+ * Compress one 64-byte block in each of the 4 lanes.
+ *
+ * @param blk		the message words, blk[i][lane] being word i of the lane
+ * @param state		the 3 state words, each holding the 4 lanes
+ */
+static inline void G_TARGET("avx2")
+tiger_compress_x4(const uint64 blk[8][TIGER_LANES], __m256i state[3])
+{
+	const __m256i m8 = _mm256_set1_epi64x(0xff);
+	const __m256i ones = _mm256_set1_epi64x(-1);
+	const __m256i k0 =
+		_mm256_set1_epi64x(U64_FROM_2xU32(0xA5A5A5A5UL, 0xA5A5A5A5UL));
+	const __m256i k1 =
+		_mm256_set1_epi64x(U64_FROM_2xU32(0x01234567UL, 0x89ABCDEFUL));
+	__m256i a, b, c, aa, bb, cc;
+	__m256i x[8];
+	uint i;
+
+	STATIC_ASSERT(3 == PASSES);		/* Loop for extra passes not handled */
+
+	for (i = 0; i < 8; i++)
+		x[i] = _mm256_loadu_si256((const __m256i *) blk[i]);
+
+	a = aa = state[0];
+	b = bb = state[1];
+	c = cc = state[2];
+
+	VPASS(a, b, c, 5)
+	VKEY_SCHEDULE
+	VPASS(c, a, b, 7)
+	VKEY_SCHEDULE
+	VPASS(b, c, a, 9)
+
+	state[0] = VXOR(a, aa);
+	state[1] = VSUB(b, bb);
+	state[2] = VADD(c, cc);
+}
+
+#undef VT
+#undef VMUL_5
+#undef VMUL_7
+#undef VMUL_9
+#undef VROUND
+#undef VPASS
+#undef VADD
+#undef VSUB
+#undef VXOR
+#undef VNOT
+#undef VKEY_SCHEDULE
+
+/**
+ * Compute the Tiger hash of 4 messages of the same length, in parallel.
+ *
+ * @param data		the 4 messages to hash
+ * @param length	the length of each message
+ * @param hash		where the 4 hashes are written
+ */
+static void G_HOT G_TARGET("avx2")
+tiger_x4(const void * const data[], uint64 length, char hash[][24])
+{
+	uint64 blk[8][TIGER_LANES];
+	uint8 pad[TIGER_LANES][128];
+	uint64 res[3][TIGER_LANES];
+	__m256i state[3];
+	uint64 offset, rem;
+	uint i, j, k, nb;
+
+	state[0] = _mm256_set1_epi64x(U64_FROM_2xU32(0x01234567UL, 0x89ABCDEFUL));
+	state[1] = _mm256_set1_epi64x(U64_FROM_2xU32(0xFEDCBA98UL, 0x76543210UL));
+	state[2] = _mm256_set1_epi64x(U64_FROM_2xU32(0xF096A5B4UL, 0xC3B2E187UL));
+
+	/*
+	 * Each vector holds the same word of the 4 messages, hence we need
+	 * to transpose the message blocks.
+	 */
+
+	for (offset = 0; length - offset >= 64; offset += 64) {
+		for (j = 0; j < TIGER_LANES; j++) {
+			const uint8 *p = const_ptr_add_offset(data[j], offset);
+
+			for (k = 0; k < 8; k++)
+				blk[k][j] = peek_le64(&p[k * 8]);
+		}
+		tiger_compress_x4(blk, state);
+	}
+
+	/*
+	 * Padding: a 0x01 byte, then zeroes up to the last 8 bytes of the
+	 * final block, which hold the length in bits.  The trailer spans two
+	 * blocks when the remaining bytes leave no room for the length.
+	 */
+
+	rem = length - offset;
+	nb = rem + 1 > 56 ? 2 : 1;
+
+	for (j = 0; j < TIGER_LANES; j++) {
+		ZERO(&pad[j]);
+		memcpy(pad[j], const_ptr_add_offset(data[j], offset), rem);
+		pad[j][rem] = 0x01;
+		poke_le64(&pad[j][nb * 64 - 8], length << 3);
+	}
+
+	for (i = 0; i < nb; i++) {
+		for (j = 0; j < TIGER_LANES; j++) {
+			for (k = 0; k < 8; k++)
+				blk[k][j] = peek_le64(&pad[j][i * 64 + k * 8]);
+		}
+		tiger_compress_x4(blk, state);
+	}
+
+	for (i = 0; i < 3; i++)
+		_mm256_storeu_si256((__m256i *) res[i], state[i]);
+
+	for (j = 0; j < TIGER_LANES; j++) {
+		for (i = 0; i < 3; i++)
+			poke_le64(&hash[j][i * 8], res[i][j]);
+	}
+}
+#endif	/* TIGER_AVX2 */
+
+/**
+ * @return whether multi-lane hashing can be used, in which case messages
+ * are best handed to tiger_multi() by groups of that many.
+ */
+uint
+tiger_lanes(void)
+{
+#ifdef TIGER_AVX2
+	if (cpufeat_has(CPUFEAT_AVX2))
+		return TIGER_LANES;
+#endif
+
+	return 1;
+}
+
+/**
+ * Compute the Tiger hash of several messages of the same length.
+ *
+ * When the CPU allows it, the messages are hashed in parallel by groups of
+ * tiger_lanes() items, which is faster than hashing them one after the
+ * other with tiger().
+ *
+ * @param data		the messages to hash
+ * @param n			amount of messages
+ * @param length	the length of each message
+ * @param hash		where the n hashes are written
+ */
+void
+tiger_multi(const void * const data[], size_t n, uint64 length,
+	char hash[][24])
+{
+	size_t i = 0;
+
+#ifdef TIGER_AVX2
+	if (n >= TIGER_LANES && cpufeat_has(CPUFEAT_AVX2)) {
+		for (/* empty */; n - i >= TIGER_LANES; i += TIGER_LANES)
+			tiger_x4(&data[i], length, &hash[i]);
+	}
+#endif
+
+	for (/* empty */; i < n; i++)
+		tiger(data[i], length, hash[i]);
+}
+
+/**
+ * Cross-check the multi-lane back-end, when available, against tiger() on
+ * messages of various lengths, each lane hashing different data.
+ */
+static void G_COLD
+tiger_check_multi(void)
+{
+#ifdef TIGER_AVX2
+	static char buf[TIGER_LANES * 1024 + 64];
+	uint i, j, seed = 1;
+
+	if (!cpufeat_has(CPUFEAT_AVX2))
+		return;
+
+	for (i = 0; i < sizeof buf; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	for (i = 0; i <= 1025; i += (i < 130) ? 1 : 67) {
+		const void *data[TIGER_LANES];
+		char hash[TIGER_LANES][24], expected[24];
+
+		for (j = 0; j < TIGER_LANES; j++)
+			data[j] = &buf[j * 1024 + (i % 8) + j];
+
+		tiger_x4(data, i, hash);
+
+		for (j = 0; j < TIGER_LANES; j++) {
+			tiger(data[j], i, expected);
+			if (0 != memcmp(expected, hash[j], sizeof expected)) {
+				g_warning("%s(): lane %u differs for length %u",
+					G_STRFUNC, j, i);
+				g_assert_not_reached();
+			}
+		}
+	}
+#endif	/* TIGER_AVX2 */
+}
+
 /**
  * Runs some test cases to check whether the implementation of the tiger
  * hash algorithm is alright.
@@ -277,6 +556,8 @@ tiger_check(void)
 			g_assert_not_reached();
 		}
 	}
+
+	tiger_check_multi();
 }
 
 /* vi: set ts=4 sw=4 cindent: */
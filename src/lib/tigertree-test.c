@@ -0,0 +1,313 @@
+/*
+ * tigertree-test -- Tiger tree hashing tests and benchmarking.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/base32.h"
+#include "lib/getcpucount.h"
+#include "lib/halloc.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stringify.h"
+#include "lib/tigertree.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define TEST_MAX_SIZE	(64 * 1024 * 1024)	/* Largest random size tested */
+#define TEST_RANDOM		64					/* Random sizes to test */
+
+#define BENCH_SIZE		(256 * 1024 * 1024)	/* Default benchmark size */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htV] [-n loops] [-s size] [-R seed] [-T threads]\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of benchmarking loops\n"
+		"  -s : sets data size for benchmarking, in bytes\n"
+		"  -t : time sequential versus parallel hashing\n"
+		"  -R : seed for repeatable random data sequence\n"
+		"  -T : max amount of threads to use (default = 1 per CPU)\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(void)
+{
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static const char *
+tth_to_string(const struct tth *tth)
+{
+	static char buf[TTH_BASE32_SIZE + 1];
+
+	base32_encode(ARYLEN(buf), ARYLEN(tth->data));
+	buf[N_ITEMS(buf) - 1] = '\0';
+	return buf;
+}
+
+/**
+ * Sequential TTH computation, reference for the parallel one.
+ */
+static size_t
+tth_sequential(const void *data, size_t size,
+	struct tth *hash, struct tth *leaves)
+{
+	TTH_CONTEXT *ctx;
+	size_t count;
+
+	ctx = halloc(tt_size());
+	tt_init(ctx, size);
+	tt_update(ctx, data, size);
+	tt_digest(ctx, hash);
+	count = tt_leave_count(ctx);
+	if (leaves != NULL)
+		memcpy(leaves, tt_leaves(ctx), count * sizeof leaves[0]);
+	hfree(ctx);
+
+	return count;
+}
+
+/**
+ * Check that parallel and sequential hashing of data yield the same tree.
+ */
+static void
+tth_compare(const void *data, size_t size, unsigned threads)
+{
+	struct tth *sleaves, *pleaves;
+	struct tth shash, phash;
+	size_t scount, pcount;
+
+	XMALLOC_ARRAY(sleaves, TTH_MAX_LEAVES);
+	XMALLOC_ARRAY(pleaves, TTH_MAX_LEAVES);
+
+	scount = tth_sequential(data, size, &shash, sleaves);
+	pcount = tt_parallel_digest(data, size, threads, &phash, pleaves);
+
+	if (scount != pcount) {
+		printf("size %zu: sequential has %zu leaves, parallel has %zu\n",
+			size, scount, pcount);
+		test_abort();
+	}
+
+	if (0 != memcmp(&shash, &phash, sizeof shash)) {
+		printf("size %zu: sequential root is %s", size, tth_to_string(&shash));
+		printf(", parallel root is %s\n", tth_to_string(&phash));
+		test_abort();
+	}
+
+	if (0 != memcmp(sleaves, pleaves, scount * sizeof sleaves[0])) {
+		printf("size %zu: leaves differ\n", size);
+		test_abort();
+	}
+
+	if (verbose_mode) {
+		printf("size %zu: %zu lea%s, root %s OK\n",
+			size, PLURAL_F(scount), tth_to_string(&shash));
+	}
+
+	XFREE_NULL(sleaves);
+	XFREE_NULL(pleaves);
+}
+
+/**
+ * Check hashing of empty data, which still has one (empty) leaf.
+ */
+static void
+tth_empty_test(unsigned threads)
+{
+	static const char empty[] = "LWPNACQDBZRYXW3VHJVCJ64QBZNGHOHHHZWCLNQ";
+	struct tth hash;
+	size_t count;
+
+	tth_compare(NULL, 0, threads);
+
+	count = tt_parallel_digest(NULL, 0, threads, &hash, NULL);
+
+	if (count != 1 || 0 != strcmp(tth_to_string(&hash), empty)) {
+		printf("empty data: %zu lea%s, root %s, expected %s\n",
+			PLURAL_F(count), tth_to_string(&hash), empty);
+		test_abort();
+	}
+
+	if (verbose_mode)
+		printf("empty data OK\n");
+}
+
+/**
+ * Test parallel hashing against sequential hashing for sizes around
+ * block and leaf boundaries, then for random sizes.
+ */
+static void
+tth_test(unsigned threads)
+{
+	static const size_t sizes[] = {
+		0, 1, TTH_BLOCKSIZE - 1, TTH_BLOCKSIZE, TTH_BLOCKSIZE + 1,
+		256 * 1024 - 1, 256 * 1024, 256 * 1024 + 1,
+		1024 * 1024 - TTH_BLOCKSIZE, 1024 * 1024 + TTH_BLOCKSIZE - 1,
+		3 * 1024 * 1024 + 1, 5 * 1024 * 1024 + 3 * TTH_BLOCKSIZE,
+		33 * 1024 * 1024 + 17,
+	};
+	char *data;
+	size_t i;
+
+	tth_empty_test(threads);
+
+	data = xmalloc(TEST_MAX_SIZE);
+	rand31_bytes(data, TEST_MAX_SIZE);
+
+	for (i = 0; i < N_ITEMS(sizes); i++) {
+		tth_compare(data, sizes[i], threads);
+	}
+
+	for (i = 0; i < TEST_RANDOM; i++) {
+		tth_compare(data, rand31_value(TEST_MAX_SIZE), threads);
+	}
+
+	xfree(data);
+
+	printf("Parallel Tiger tree hashing with %u thread%s: all OK\n",
+		PLURAL(threads));
+}
+
+/**
+ * Benchmark parallel hashing against sequential hashing.
+ */
+static void
+tth_bench(size_t size, size_t loops, unsigned threads)
+{
+	char *data;
+	tm_t start, end;
+	double seq, par;
+	struct tth hash;
+	size_t i;
+
+	data = xmalloc(size);
+	rand31_bytes(data, size);
+
+	tm_now_exact(&start);
+	for (i = 0; i < loops; i++) {
+		tth_sequential(data, size, &hash, NULL);
+	}
+	tm_now_exact(&end);
+	seq = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	for (i = 0; i < loops; i++) {
+		tt_parallel_digest(data, size, threads, &hash, NULL);
+	}
+	tm_now_exact(&end);
+	par = tm_elapsed_f(&end, &start);
+
+	printf("Hashing %zu bytes %zu time%s:\n", size, PLURAL(loops));
+	printf("  sequential: %.3f secs (%s/s)\n",
+		seq, short_size(size * loops / MAX(seq, 1e-6), FALSE));
+	printf("  parallel:   %.3f secs (%s/s) with %u thread%s, speedup %.2f\n",
+		par, short_size(size * loops / MAX(par, 1e-6), FALSE),
+		PLURAL(threads), seq / MAX(par, 1e-6));
+
+	xfree(data);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t size = BENCH_SIZE;
+	size_t loops = 1;
+	unsigned threads = 0;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "hn:s:tR:T:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 's':			/* data size */
+			size = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag++;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'T':			/* max amount of threads */
+			threads = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	if (0 == threads)
+		threads = getcpucount();
+
+	loops = MAX(loops, 1);
+
+	tt_check();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	tth_test(threads);
+
+	if (tflag)
+		tth_bench(size, loops, threads);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -80,10 +80,14 @@
 
 #include "tigertree.h"
 
+#include "atomic.h"
 #include "base32.h"
 #include "endian.h"
+#include "getcpucount.h"
 #include "halloc.h"
+#include "log.h"
 #include "misc.h"
+#include "thread.h"
 #include "unsigned.h"
 
 #include "override.h"		/* Must be the last header included */
@@ -97,6 +101,15 @@
  * longer than 2^64 in size), havoc may ensue. */
 #define TTH_STACKSIZE	(TIGERSIZE * 56)
 
+/* don't create threads for leaves smaller than this, in bytes */
+#define TTH_PARALLEL_THRESH	(64 * 1024)
+
+/* stack size requested for each leaf hashing thread */
+#define TTH_PARALLEL_STACK	THREAD_STACK_MIN
+
+/* max amount of leaf blocks hashed at once by tiger_multi() */
+#define TTH_LANES	4
+
 enum {
 	TTH_F_INITIALIZED	= 1 << 0,
 	TTH_F_FINISHED		= 1 << 1
@@ -117,6 +130,7 @@ struct TTH_CONTEXT {
 	} block;
 	struct tth stack[56];
 	struct tth leaves[TTH_MAX_LEAVES];
+	char lane[TTH_LANES][TTH_BLOCKSIZE + 1];	/* for tiger_multi() */
 };
 
 filesize_t
@@ -301,12 +315,15 @@ tt_collapse(TTH_CONTEXT *ctx)
 	}
 }
 
+/**
+ * Record the hash of a new leaf block, already computed at the top of the
+ * stack.
+ */
 static void
-tt_block(TTH_CONTEXT *ctx)
+tt_block_hashed(TTH_CONTEXT *ctx)
 {
 	g_assert(ctx);
 
-	tiger(ctx->block.bytes, ctx->block_fill, ctx->stack[ctx->si].data);
 	if (ctx->bpl == 1) {
 		ctx->leaves[ctx->li] = ctx->stack[ctx->si];
 		ctx->li++;
@@ -324,6 +341,51 @@ tt_block(TTH_CONTEXT *ctx)
 	tt_collapse(ctx);
 }
 
+static void
+tt_block(TTH_CONTEXT *ctx)
+{
+	g_assert(ctx);
+
+	tiger(ctx->block.bytes, ctx->block_fill, ctx->stack[ctx->si].data);
+	tt_block_hashed(ctx);
+}
+
+/**
+ * Hash n consecutive full leaf blocks at once with tiger_multi().
+ *
+ * @param ctx	the TTH context, which must not have any pending data
+ * @param data	start of the n blocks of TTH_BLOCKSIZE bytes
+ * @param n		amount of blocks
+ */
+static void
+tt_block_multi(TTH_CONTEXT *ctx, const char *data, uint n)
+{
+	const void *msg[TTH_LANES];
+	char hash[TTH_LANES][TIGERSIZE];
+	uint i;
+
+	g_assert(1 == ctx->block_fill);
+	g_assert(n <= TTH_LANES);
+
+	/*
+	 * Leaf blocks are prefixed with a 0x00 byte, hence we need to copy
+	 * the data to build the messages to hash.
+	 */
+
+	for (i = 0; i < n; i++) {
+		ctx->lane[i][0] = 0x00;
+		memcpy(&ctx->lane[i][1], &data[i * TTH_BLOCKSIZE], TTH_BLOCKSIZE);
+		msg[i] = ctx->lane[i];
+	}
+
+	tiger_multi(msg, n, TTH_BLOCKSIZE + 1, hash);
+
+	for (i = 0; i < n; i++) {
+		memcpy(ctx->stack[ctx->si].data, hash[i], TIGERSIZE);
+		tt_block_hashed(ctx);
+	}
+}
+
 static void
 tt_finish(TTH_CONTEXT *ctx)
 {
@@ -422,15 +484,34 @@ void
 tt_update(TTH_CONTEXT *ctx, const void *data, size_t size)
 {
 	const char *block = data;
+	uint lanes;
 
 	g_assert(ctx);
 	g_assert(TTH_F_INITIALIZED & ctx->flags);
 	g_assert(!(TTH_F_FINISHED & ctx->flags));
 	g_assert(size == 0 || NULL != data);
 
+	lanes = MIN(tiger_lanes(), TTH_LANES);
+
 	while (size > 0) {
 		size_t n = sizeof ctx->block.bytes - ctx->block_fill;
 
+		/*
+		 * When there are enough full blocks available and no pending
+		 * data, hash several leaf blocks at once if the CPU allows it.
+		 */
+
+		if (lanes > 1 && 1 == ctx->block_fill) {
+			size_t len = lanes * TTH_BLOCKSIZE;
+
+			if (size >= len) {
+				tt_block_multi(ctx, block, lanes);
+				block += len;
+				size -= len;
+				continue;
+			}
+		}
+
 		n = MIN(n, size);
 		memmove(&ctx->block.bytes[ctx->block_fill], block, n);
 		ctx->block_fill += n;
@@ -482,6 +563,156 @@ tt_leave_count(TTH_CONTEXT *ctx)
 	return ctx->li;
 }
 
+/**
+ * Compute the TTH node covering a range of data.
+ *
+ * The range must start on a node boundary of the whole tree, i.e. at an
+ * offset that is a multiple of its own size when that size is a power of
+ * two block count (as is the case for the leaves at the "good" depth),
+ * or be the trailing range of the data.
+ *
+ * @param ctx	the TTH context to use (scratch space)
+ * @param data	start of the range
+ * @param len	length of the range
+ * @param dst	where the node hash is written
+ */
+static void
+tt_range_digest(TTH_CONTEXT *ctx, const void *data, size_t len,
+	struct tth *dst)
+{
+	tt_init(ctx, len);
+	tt_update(ctx, data, len);
+	tt_digest(ctx, dst);
+}
+
+/**
+ * Size in bytes of the data covered by each leaf at the "good" depth.
+ */
+static filesize_t
+tt_leaf_size(filesize_t filesize)
+{
+	return tt_blocks_per_leaf(filesize) * TTH_BLOCKSIZE;
+}
+
+struct tt_parallel_args {
+	const char *data;			/* start of the data being hashed */
+	filesize_t size;			/* total data size */
+	filesize_t leaf_size;		/* bytes covered by each leaf */
+	struct tth *leaves;			/* leaves being computed */
+	uint count;					/* amount of leaves */
+	uint next;					/* next leaf to compute (atomic updates) */
+};
+
+/**
+ * Thread routine computing leaves until there are none left.
+ *
+ * Leaves are picked in sequence from a shared index so that all the threads
+ * stay busy until the end, regardless of their relative speed.
+ */
+static void *
+tt_parallel_leaves(void *arg)
+{
+	struct tt_parallel_args *pa = arg;
+	TTH_CONTEXT *ctx;
+	uint i;
+
+	ctx = halloc(sizeof *ctx);		/* Too large for the thread stack */
+
+	while ((i = atomic_uint_inc(&pa->next)) < pa->count) {
+		filesize_t offset = i * pa->leaf_size;
+		filesize_t len = MIN(pa->leaf_size, pa->size - offset);
+
+		tt_range_digest(ctx, &pa->data[offset], len, &pa->leaves[i]);
+	}
+
+	hfree(ctx);
+	return NULL;
+}
+
+/**
+ * Compute the TTH of a memory buffer, hashing the leaves at the "good" depth
+ * concurrently.
+ *
+ * Each leaf covers an independent range of data, which is hashed on its own
+ * by one of the worker threads.  The root is then composed from these leaves
+ * exactly as tt_digest() would, so the result is bit-identical to the one
+ * obtained through tt_init() / tt_update() / tt_digest().
+ *
+ * @param data		the data to hash
+ * @param size		length of data
+ * @param threads	max amount of threads to use (0 means one per CPU)
+ * @param hash		where the TTH root is written
+ * @param leaves	if non-NULL, filled with the tt_good_node_count() leaves
+ *
+ * @return the amount of leaves at the "good" depth.
+ */
+size_t
+tt_parallel_digest(const void *data, size_t size, unsigned threads,
+	struct tth *hash, struct tth *leaves)
+{
+	struct tt_parallel_args pa;
+	unsigned tid[THREAD_MAX];
+	unsigned i, n = 0;
+	size_t count;
+
+	g_assert(size == 0 || NULL != data);
+	g_assert(hash != NULL);
+
+	count = tt_good_node_count(size);
+	count = MAX(count, 1);		/* Empty data has one (empty) leaf */
+
+	g_assert(count > 0 && count <= TTH_MAX_LEAVES);
+
+	ZERO(&pa);
+	pa.data = data;
+	pa.size = size;
+	pa.leaf_size = tt_leaf_size(size);
+	pa.leaves = NULL == leaves ? halloc(count * sizeof leaves[0]) : leaves;
+	pa.count = count;
+
+	if (0 == threads)
+		threads = getcpucount();
+
+	/*
+	 * The calling thread does its share of the work, so we only need to
+	 * create threads - 1 additional ones.  Don't bother when leaves are
+	 * too small: thread creation would cost more than what we gain.
+	 */
+
+	if (pa.leaf_size >= TTH_PARALLEL_THRESH) {
+		threads = MIN(threads, count);
+		threads = MIN(threads, THREAD_MAX - 16);
+
+		for (i = 1; i < threads; i++) {
+			unsigned t;
+
+			t = thread_create(tt_parallel_leaves, &pa, 0, TTH_PARALLEL_STACK);
+			if G_UNLIKELY(THREAD_INVALID_ID == t) {
+				s_warning_once_per(LOG_PERIOD_SECOND,
+					"%s(): cannot create new thread: %m", G_STRFUNC);
+				break;
+			}
+			tid[n++] = t;
+		}
+	}
+
+	tt_parallel_leaves(&pa);
+
+	for (i = 0; i < n; i++) {
+		if (-1 == thread_join(tid[i], NULL)) {
+			s_critical("%s(): cannot join with %s: %m",
+				G_STRFUNC, thread_id_name(tid[i]));
+		}
+	}
+
+	*hash = tt_root_hash(pa.leaves, count);
+
+	if (NULL == leaves)
+		hfree(pa.leaves);
+
+	return count;
+}
+
 static void G_COLD
 tt_check_digest(const char * const expected, const void *data, size_t size)
 {
@@ -504,6 +735,52 @@ tt_check_digest(const char * const expected, const void *data, size_t size)
 	}
 }
 
+/**
+ * Check that feeding data in large chunks, which lets tt_update() hash
+ * several leaf blocks at once, yields the same tree as feeding it in small
+ * chunks, which forces leaf blocks to be hashed one by one.
+ */
+static void G_COLD
+tt_check_multi(void)
+{
+	static char buf[16 * TTH_BLOCKSIZE + 17];
+	struct tth h1, h2;
+	TTH_CONTEXT *ctx;
+	uint i, seed = 1;
+	size_t len;
+
+	if (tiger_lanes() <= 1)
+		return;
+
+	for (i = 0; i < sizeof buf; i++) {
+		seed = seed * 1103515245 + 12345;
+		buf[i] = seed >> 16;
+	}
+
+	ctx = halloc(sizeof *ctx);
+
+	for (len = 4 * TTH_BLOCKSIZE - 1; len <= sizeof buf; len += 1531) {
+		size_t j;
+
+		tt_init(ctx, len);
+		tt_update(ctx, buf, len);
+		tt_digest(ctx, &h1);
+
+		tt_init(ctx, len);
+		for (j = 0; j < len; j += 100)
+			tt_update(ctx, &buf[j], MIN(100, len - j));
+		tt_digest(ctx, &h2);
+
+		if (0 != memcmp(&h1, &h2, sizeof h1)) {
+			g_warning("%s(): multi-lane hashing differs for %zu bytes",
+				G_STRFUNC, len);
+			g_error("Tigertree implementation is defective.");
+		}
+	}
+
+	hfree(ctx);
+}
+
 void G_COLD
 tt_check(void)
 {
@@ -526,6 +803,8 @@ tt_check(void)
 		memset(buf, 'A', sizeof buf);
 		tt_check_digest("PZMRYHGY6LTBEH63ZWAHDORHSYTLO4LEFUIKHWY", ARYLEN(buf));
 	}
+
+	tt_check_multi();
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -82,6 +82,8 @@ void tt_check(void);
 void tt_init(TTH_CONTEXT *ctx, filesize_t filesize);
 void tt_update(TTH_CONTEXT *ctx, const void *data, size_t len);
 void tt_digest(TTH_CONTEXT *ctx, struct tth *tth);
+size_t tt_parallel_digest(const void *data, size_t size, unsigned threads,
+	struct tth *hash, struct tth *leaves);
 
 const struct tth *tt_leaves(TTH_CONTEXT *ctx);
 size_t tt_leave_count(TTH_CONTEXT *ctx);
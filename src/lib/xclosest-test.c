@@ -0,0 +1,392 @@
+/*
+ * xclosest-test -- XOR-closest key selection tests and benchmark.
+ *
+ * Copyright (c) 2026 Raphael Manfredi <Raphael_Manfredi@pobox.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/patricia.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/tm.h"
+#include "lib/xclosest.h"
+#include "lib/xmalloc.h"
+
+#define KEY_LEN			20			/* Same as KUIDs */
+
+#define TEST_KEYS		4000		/* Keys used by the tests */
+#define TEST_QUERIES	2000		/* Selections checked by the tests */
+#define TEST_CLOSEST	20			/* Keys selected by the tests */
+
+#define BENCH_KEYS		5000		/* Default amount of keys */
+#define BENCH_QUERIES	100000		/* Default amount of selections */
+
+struct tkey {
+	uchar v[KEY_LEN];				/* The key */
+	size_t slot;					/* Slot in the flat array */
+	uint n;							/* Key number */
+	bool held;						/* Whether key is held */
+};
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-htV] [-k closest] [-n keys] [-q queries] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -k : sets amount of closest keys selected by benchmark\n"
+		"  -n : sets amount of keys used by benchmark\n"
+		"  -q : sets amount of selections done by benchmark\n"
+		"  -t : time flat array selection versus trie walk\n"
+		"  -R : seed for repeatable random data sequence\n"
+		"  -V : verbose mode -- print status after each successful test\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(void)
+{
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+/**
+ * Selection filter rejecting one key out of three.
+ */
+static bool
+key_accept(const void *value, void *data)
+{
+	const struct tkey *k = value;
+
+	(void) data;
+	return 0 != k->n % 3;
+}
+
+/**
+ * Generate distinct random keys, some of them sharing a long prefix with
+ * another key so that their leading 64 bits are equally distant from
+ * any target.
+ */
+static struct tkey *
+keys_generate(patricia_t *pt, size_t n)
+{
+	struct tkey *keys;
+	size_t i;
+
+	XMALLOC0_ARRAY(keys, n);
+
+	for (i = 0; i < n; i++) {
+		struct tkey *k = &keys[i];
+
+		do {
+			rand31_bytes(k->v, sizeof k->v);
+			if (i != 0 && 0 == rand31_value(3)) {
+				const struct tkey *other = &keys[rand31_value(i - 1)];
+				memcpy(k->v, other->v, 8 + rand31_value(KEY_LEN - 9));
+			}
+		} while (patricia_contains(pt, k->v));
+
+		k->n = i;
+		patricia_insert(pt, k->v, k);
+	}
+
+	return keys;
+}
+
+/**
+ * Select the closest keys to the target by walking the trie.
+ */
+static size_t
+trie_select(patricia_t *pt, const void *target,
+	void **vec, size_t cnt, xclosest_accept_t accept)
+{
+	patricia_iter_t *iter;
+	size_t n = 0;
+
+	iter = patricia_metric_iterator_lazy(pt, target, TRUE);
+
+	while (n < cnt && patricia_iter_has_next(iter)) {
+		void *value = patricia_iter_next_value(iter);
+
+		if (accept != NULL && !(*accept)(value, NULL))
+			continue;
+
+		vec[n++] = value;
+	}
+
+	patricia_iterator_release(&iter);
+
+	return n;
+}
+
+/**
+ * Check that selecting from the flat array yields the same keys as the
+ * trie walk, for random targets and for held keys.
+ */
+static void
+select_check(xclosest_t *xc, patricia_t *pt, const struct tkey *keys,
+	size_t n, const char *what)
+{
+	void *vec[TEST_CLOSEST], *ref[TEST_CLOSEST];
+	size_t i;
+
+	for (i = 0; i < TEST_QUERIES; i++) {
+		uchar target[KEY_LEN];
+		xclosest_accept_t accept = (i & 1) ? key_accept : NULL;
+		size_t cnt = 1 + rand31_value(TEST_CLOSEST - 1);
+		size_t got, expected, j;
+
+		if (i & 2)
+			memcpy(target, keys[rand31_value(n - 1)].v, sizeof target);
+		else
+			rand31_bytes(target, sizeof target);
+
+		got = xclosest_select(xc, target, vec, cnt, accept, NULL);
+		expected = trie_select(pt, target, ref, cnt, accept);
+
+		if (got != expected) {
+			printf("%s: selected %zu keys instead of %zu\n",
+				what, got, expected);
+			test_abort();
+		}
+
+		for (j = 0; j < got; j++) {
+			const struct tkey *k = vec[j];
+
+			if (vec[j] != ref[j]) {
+				printf("%s: key #%zu of %zu selected is wrong\n",
+					what, j, cnt);
+				test_abort();
+			}
+			if (!k->held) {
+				printf("%s: selected removed key #%u\n", what, k->n);
+				test_abort();
+			}
+		}
+	}
+
+	if (verbose_mode)
+		printf("%s: %u selections checked\n", what, TEST_QUERIES);
+}
+
+/**
+ * Check selection of the closest keys, after additions and removals.
+ */
+static void
+select_test(void)
+{
+	xclosest_t *xc;
+	patricia_t *pt;
+	struct tkey *keys;
+	size_t i, held = TEST_KEYS;
+
+	pt = patricia_create(KEY_LEN * 8);
+	xc = xclosest_make(KEY_LEN);
+	keys = keys_generate(pt, TEST_KEYS);
+
+	for (i = 0; i < TEST_KEYS; i++) {
+		struct tkey *k = &keys[i];
+
+		k->slot = xclosest_add(xc, k->v, k);
+		k->held = TRUE;
+	}
+
+	select_check(xc, pt, keys, TEST_KEYS, "added keys");
+
+	/*
+	 * Remove half of the keys, keeping track of the slots of moved keys.
+	 */
+
+	for (i = 0; i < TEST_KEYS; i++) {
+		struct tkey *k = &keys[i];
+		struct tkey *moved;
+
+		if (rand31_value(1))
+			continue;
+
+		if (xclosest_value(xc, k->slot) != k) {
+			printf("key #%zu lost its slot\n", i);
+			test_abort();
+		}
+
+		moved = xclosest_remove(xc, k->slot);
+		if (moved != NULL)
+			moved->slot = k->slot;
+		patricia_remove(pt, k->v);
+		k->held = FALSE;
+		held--;
+	}
+
+	if (xclosest_count(xc) != held) {
+		printf("array holds %zu keys, expected %zu\n",
+			xclosest_count(xc), held);
+		test_abort();
+	}
+
+	select_check(xc, pt, keys, TEST_KEYS, "remaining keys");
+
+	xclosest_clear(xc);
+
+	if (xclosest_count(xc) != 0) {
+		printf("array not cleared: %zu keys\n", xclosest_count(xc));
+		test_abort();
+	}
+
+	xclosest_free_null(&xc);
+	patricia_destroy(pt);
+	XFREE_NULL(keys);
+
+	printf("XOR-closest selection: all OK\n");
+}
+
+/**
+ * Time selection of the closest keys from the flat array and from the trie.
+ */
+static void
+select_bench(size_t n, size_t queries, size_t cnt)
+{
+	xclosest_t *xc;
+	patricia_t *pt;
+	struct tkey *keys;
+	uchar *targets;
+	void **vec;
+	size_t i, found = 0, trie_found = 0;
+	tm_t start, end;
+	double trie_time, flat_time;
+
+	pt = patricia_create(KEY_LEN * 8);
+	xc = xclosest_make(KEY_LEN);
+	keys = keys_generate(pt, n);
+
+	for (i = 0; i < n; i++) {
+		keys[i].slot = xclosest_add(xc, keys[i].v, &keys[i]);
+	}
+
+	XMALLOC_ARRAY(targets, queries * KEY_LEN);
+	XMALLOC_ARRAY(vec, cnt);
+	rand31_bytes(targets, queries * KEY_LEN);
+
+	tm_now_exact(&start);
+	for (i = 0; i < queries; i++) {
+		trie_found +=
+			trie_select(pt, &targets[i * KEY_LEN], vec, cnt, key_accept);
+	}
+	tm_now_exact(&end);
+	trie_time = tm_elapsed_f(&end, &start);
+
+	tm_now_exact(&start);
+	for (i = 0; i < queries; i++) {
+		found += xclosest_select(xc, &targets[i * KEY_LEN],
+			vec, cnt, key_accept, NULL);
+	}
+	tm_now_exact(&end);
+	flat_time = tm_elapsed_f(&end, &start);
+
+	printf("Selecting %zu closest among %zu keys, %zu time%s:\n",
+		cnt, n, PLURAL(queries));
+	printf("  trie walk: %.3f secs, %zu keys selected\n",
+		trie_time, trie_found);
+	printf("  flat array: %.3f secs, %zu keys selected\n",
+		flat_time, found);
+	printf("  speedup %.2f\n", trie_time / MAX(flat_time, 1e-6));
+
+	xclosest_free_null(&xc);
+	patricia_destroy(pt);
+	XFREE_NULL(keys);
+	XFREE_NULL(targets);
+	XFREE_NULL(vec);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool tflag = FALSE;
+	size_t keys = BENCH_KEYS;
+	size_t queries = BENCH_QUERIES;
+	size_t closest = TEST_CLOSEST;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "hk:n:q:tR:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'k':			/* amount of closest keys */
+			closest = atol(optarg);
+			break;
+		case 'n':			/* amount of keys */
+			keys = atol(optarg);
+			break;
+		case 'q':			/* amount of selections */
+			queries = atol(optarg);
+			break;
+		case 't':			/* timing report */
+			tflag = TRUE;
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0)
+		usage();
+
+	keys = MAX(keys, 1);
+	queries = MAX(queries, 1);
+	closest = MAX(closest, 1);
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	select_test();
+
+	if (tflag)
+		select_bench(keys, queries, closest);
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Closest keys by XOR distance, from a flat array of keys.
+ *
+ * Keys of a fixed length, along with their associated value, are held in
+ * contiguous arrays, in no particular order.  Selecting the keys closest to
+ * a target, in the XOR metric, is done by scanning the whole array and
+ * keeping the best candidates seen so far in a bounded sorted vector.
+ *
+ * The leading 64 bits of each key are also kept in a separate array, as
+ * native integers: the XOR distance of these to the target is computed a
+ * block at a time, in a loop free of branches that the compiler can
+ * vectorize, and blocks holding no key closer than the farthest candidate
+ * retained are skipped entirely.  The full keys are only compared when
+ * their leading 64 bits are equally distant from the target.
+ *
+ * Slots are not stable: removing a key moves the last key of the array in
+ * the freed slot.  Callers needing to remove keys must therefore remember
+ * the slot of their values, as returned by xclosest_add() and updated via
+ * the value returned by xclosest_remove().
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "xclosest.h"
+
+#include "endian.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define XCLOSEST_LEAD		8	/**< Bytes of leading key prefix */
+#define XCLOSEST_MIN		64	/**< Initial amount of slots */
+#define XCLOSEST_BLOCK		64	/**< Distances computed at once */
+
+enum xclosest_magic { XCLOSEST_MAGIC = 0x4c0a93e5 };
+
+struct xclosest {
+	enum xclosest_magic magic;
+	size_t keylen;				/**< Length of keys, in bytes */
+	size_t count;				/**< Amount of keys held */
+	size_t capacity;			/**< Amount of slots allocated */
+	uint64 *lead;				/**< Leading 64 bits of keys, in host order */
+	uchar *keys;				/**< The flat array of keys */
+	void **value;				/**< Values associated with keys */
+	size_t *best;				/**< Selected slots, by increasing distance */
+	size_t best_size;			/**< Amount of slots in the selection */
+};
+
+static inline void
+xclosest_check(const struct xclosest * const xc)
+{
+	g_assert(xc != NULL);
+	g_assert(XCLOSEST_MAGIC == xc->magic);
+}
+
+/**
+ * @return the key held at given slot.
+ */
+static inline const uchar *
+xclosest_key(const xclosest_t *xc, size_t slot)
+{
+	return &xc->keys[slot * xc->keylen];
+}
+
+/**
+ * Compare the distance of the keys held in two slots to the target.
+ *
+ * @param xc		the key array
+ * @param target	the target key
+ * @param t			the leading 64 bits of the target
+ * @param a			first slot
+ * @param b			second slot
+ *
+ * @return -1, 0 or +1 whether the first key is closer, as close or farther
+ * from the target than the second key.
+ */
+static int
+xclosest_cmp(const xclosest_t *xc, const uchar *target, uint64 t,
+	size_t a, size_t b)
+{
+	uint64 da = xc->lead[a] ^ t, db = xc->lead[b] ^ t;
+	const uchar *ka, *kb;
+	size_t i;
+
+	if (da != db)
+		return da < db ? -1 : +1;
+
+	ka = xclosest_key(xc, a);
+	kb = xclosest_key(xc, b);
+
+	for (i = XCLOSEST_LEAD; i < xc->keylen; i++) {
+		uint d1 = ka[i] ^ target[i];
+		uint d2 = kb[i] ^ target[i];
+
+		if (d1 != d2)
+			return d1 < d2 ? -1 : +1;
+	}
+
+	return 0;
+}
+
+/**
+ * Create a new key array.
+ *
+ * @param keylen	the length of keys, at least 8 bytes
+ *
+ * @return a new key array, to be freed with xclosest_free_null().
+ */
+xclosest_t *
+xclosest_make(size_t keylen)
+{
+	xclosest_t *xc;
+
+	g_assert(keylen >= XCLOSEST_LEAD);
+
+	WALLOC0(xc);
+	xc->magic = XCLOSEST_MAGIC;
+	xc->keylen = keylen;
+
+	return xc;
+}
+
+/**
+ * Remove all the keys from the array.
+ */
+void
+xclosest_clear(xclosest_t *xc)
+{
+	xclosest_check(xc);
+
+	XFREE_NULL(xc->lead);
+	XFREE_NULL(xc->keys);
+	XFREE_NULL(xc->value);
+	XFREE_NULL(xc->best);
+	xc->count = xc->capacity = xc->best_size = 0;
+}
+
+/**
+ * Free key array and nullify its pointer.
+ */
+void
+xclosest_free_null(xclosest_t **xc_ptr)
+{
+	xclosest_t *xc = *xc_ptr;
+
+	if (xc != NULL) {
+		xclosest_clear(xc);
+		xc->magic = 0;
+		WFREE(xc);
+		*xc_ptr = NULL;
+	}
+}
+
+/**
+ * @return amount of keys held in the array.
+ */
+size_t
+xclosest_count(const xclosest_t *xc)
+{
+	xclosest_check(xc);
+
+	return xc->count;
+}
+
+/**
+ * Add key to the array.
+ *
+ * @param xc		the key array
+ * @param key		the key, copied
+ * @param value		the value associated with the key
+ *
+ * @return the slot where the key was added.
+ */
+size_t
+xclosest_add(xclosest_t *xc, const void *key, void *value)
+{
+	size_t slot;
+
+	xclosest_check(xc);
+	g_assert(key != NULL);
+
+	if (xc->count == xc->capacity) {
+		xc->capacity = MAX(XCLOSEST_MIN, 2 * xc->capacity);
+		XREALLOC_ARRAY(xc->lead, xc->capacity);
+		XREALLOC_ARRAY(xc->keys, xc->capacity * xc->keylen);
+		XREALLOC_ARRAY(xc->value, xc->capacity);
+	}
+
+	slot = xc->count++;
+	xc->lead[slot] = peek_be64(key);
+	memcpy(&xc->keys[slot * xc->keylen], key, xc->keylen);
+	xc->value[slot] = value;
+
+	return slot;
+}
+
+/**
+ * Remove the key held at given slot.
+ *
+ * The last key of the array is moved to the freed slot, if it was not
+ * the one removed.
+ *
+ * @param xc		the key array
+ * @param slot		the slot of the key to remove
+ *
+ * @return the value of the key now held at the slot, NULL if none.
+ */
+void *
+xclosest_remove(xclosest_t *xc, size_t slot)
+{
+	size_t last;
+
+	xclosest_check(xc);
+	g_assert(size_is_non_negative(slot) && slot < xc->count);
+
+	last = --xc->count;
+
+	if (slot == last)
+		return NULL;
+
+	xc->lead[slot] = xc->lead[last];
+	memcpy(&xc->keys[slot * xc->keylen], xclosest_key(xc, last), xc->keylen);
+	xc->value[slot] = xc->value[last];
+
+	return xc->value[slot];
+}
+
+/**
+ * @return the value of the key held at given slot.
+ */
+void *
+xclosest_value(const xclosest_t *xc, size_t slot)
+{
+	xclosest_check(xc);
+	g_assert(size_is_non_negative(slot) && slot < xc->count);
+
+	return xc->value[slot];
+}
+
+/**
+ * Fill the supplied vector with the values of the keys closest to the
+ * target, by increasing XOR distance.
+ *
+ * @param xc		the key array
+ * @param target	the target key
+ * @param vec		base of the vector to fill
+ * @param cnt		size of the vector
+ * @param accept	if non-NULL, filter on the values of candidate keys
+ * @param data		additional argument for the filter
+ *
+ * @return the amount of entries filled in the vector.
+ */
+size_t
+xclosest_select(xclosest_t *xc, const void *target,
+	void **vec, size_t cnt, xclosest_accept_t accept, void *data)
+{
+	uint64 d[XCLOSEST_BLOCK];
+	uint64 t, worst = MAX_INT_VAL(uint64);
+	size_t i, n = 0;
+
+	xclosest_check(xc);
+	g_assert(target != NULL);
+	g_assert(vec != NULL);
+
+	if G_UNLIKELY(0 == cnt)
+		return 0;
+
+	if (xc->best_size < cnt) {
+		XREALLOC_ARRAY(xc->best, cnt);
+		xc->best_size = cnt;
+	}
+
+	t = peek_be64(target);
+
+	for (i = 0; i < xc->count; i += XCLOSEST_BLOCK) {
+		const uint64 *lead = &xc->lead[i];
+		size_t j, len = MIN(XCLOSEST_BLOCK, xc->count - i);
+		uint64 low = MAX_INT_VAL(uint64);
+
+		for (j = 0; j < len; j++) {
+			d[j] = lead[j] ^ t;
+			low = MIN(low, d[j]);
+		}
+
+		if (low > worst)
+			continue;		/* Nothing closer in the whole block */
+
+		for (j = 0; j < len; j++) {
+			size_t k, slot = i + j;
+
+			if (d[j] > worst)
+				continue;
+
+			if (
+				n == cnt && d[j] == worst &&
+				xclosest_cmp(xc, target, t, slot, xc->best[n - 1]) >= 0
+			)
+				continue;
+
+			if (accept != NULL && !(*accept)(xc->value[slot], data))
+				continue;
+
+			/*
+			 * Insert the slot in the selection, dropping the farthest
+			 * candidate when it is full.
+			 */
+
+			k = (n < cnt) ? n++ : n - 1;
+
+			while (
+				k > 0 && xclosest_cmp(xc, target, t, slot, xc->best[k - 1]) < 0
+			) {
+				xc->best[k] = xc->best[k - 1];
+				k--;
+			}
+
+			xc->best[k] = slot;
+
+			if (n == cnt)
+				worst = xc->lead[xc->best[n - 1]] ^ t;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		vec[i] = xc->value[xc->best[i]];
+	}
+
+	return n;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026, Raphael Manfredi
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Closest keys by XOR distance, from a flat array of keys.
+ *
+ * @author Raphael Manfredi
+ * @date 2026
+ */
+
+#ifndef _xclosest_h_
+#define _xclosest_h_
+
+#include "common.h"
+
+typedef struct xclosest xclosest_t;
+
+/**
+ * Selection filter, invoked on the value of a candidate key.
+ *
+ * @return whether the value can be selected.
+ */
+typedef bool (*xclosest_accept_t)(const void *value, void *data);
+
+/*
+ * Public interface.
+ */
+
+xclosest_t *xclosest_make(size_t keylen);
+void xclosest_free_null(xclosest_t **xc_ptr);
+void xclosest_clear(xclosest_t *xc);
+
+size_t xclosest_count(const xclosest_t *xc);
+size_t xclosest_add(xclosest_t *xc, const void *key, void *value);
+void *xclosest_remove(xclosest_t *xc, size_t slot);
+void *xclosest_value(const xclosest_t *xc, size_t slot);
+
+size_t xclosest_select(xclosest_t *xc, const void *target,
+	void **vec, size_t cnt, xclosest_accept_t accept, void *data);
+
+#endif /* _xclosest_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
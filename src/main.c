@@ -100,11 +100,13 @@
 #include "core/uhc.h"
 #include "core/upload_stats.h"
 #include "core/urpc.h"
+#include "core/verify_bitprint.h"
 #include "core/verify_sha1.h"
 #include "core/verify_tth.h"
 #include "core/version.h"
 #include "core/vmsg.h"
 #include "core/whitelist.h"
+#include "core/zworker.h"
 
 #include "if/dht/dht.h"
 
@@ -126,6 +128,7 @@
 #include "lib/exit.h"
 #include "lib/exit2str.h"
 #include "lib/fd.h"
+#include "lib/file_aio.h"
 #include "lib/file_object.h"
 #include "lib/gentime.h"
 #include "lib/glib-missing.h"
@@ -726,7 +729,9 @@ gtk_gnutella_exit(int exit_code)
 	DO(parq_close_pre);
 	DO(verify_sha1_close);
 	DO(verify_tth_shutdown);
+	DO(verify_bitprint_shutdown);
 	DO(download_close);
+	DO(file_aio_close);				/* After uploads and downloads */
 	DO(file_info_store_if_dirty);	/* In case downloads had buffered data */
 	DO(parq_close);
 	DO(pproxy_close);
@@ -948,6 +953,7 @@ gtk_gnutella_exit(int exit_code)
 	DO(ext_close);
 	DO(node_close);
 	DO(g2_node_close);
+	DO(zworker_close);	/* After node_close() */
 	DO(share_close);	/* After node_close() */
 	DO(udp_close);
 	DO(urpc_close);
@@ -987,7 +993,6 @@ gtk_gnutella_exit(int exit_code)
 	DO(tls_global_close);
 	DO(misc_close);
 	DO(mingw_close);
-	DO(verify_tth_close);
 	DO(inputevt_close);
 	DO(locale_close);
 	DO(wq_close);
@@ -2492,6 +2497,7 @@ main(int argc, char **argv)
 	teq_set_throttle(70, 50);	/* 70 ms max for TEQ events, every 50 ms */
 	tiger_check();
 	tt_check();
+	sha1_test();
 	tea_test();
 	xxtea_test();
 	patricia_test();
@@ -2562,6 +2568,7 @@ main(int argc, char **argv)
 	gwc_init();
 	verify_sha1_init();
 	verify_tth_init();
+	verify_bitprint_init();
 	move_init();
 	ignore_init();
 	word_vec_init();
@@ -2571,12 +2578,15 @@ main(int argc, char **argv)
 	gmsg_init();
 	bsched_init();
 	dump_init();
+	zworker_init(GNET_PROPERTY(compression_threads));
 	node_init();
 	g2_node_init();
     hcache_retrieve_all();	/* after settings_init() and node_init() */
 	routing_init();
 	search_init();
 	share_init();
+	file_aio_init(GNET_PROPERTY(disk_io_threads),
+		GNET_PROPERTY(disk_io_uring));
 	dmesh_init();			/* MUST be done BEFORE download_init() */
 	download_init();		/* MUST be done AFTER file_info_init() */
 	upload_init();
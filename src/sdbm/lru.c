@@ -31,6 +31,8 @@
 #include "lib/stringify.h"		/* For plural() */
 #include "lib/vmm.h"
 #include "lib/walloc.h"
+#include "lib/xmalloc.h"
+#include "lib/xsort.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -382,9 +384,20 @@ flush_cpage(struct lru_cpage *cp, ssize_t *amount, int *error)
 	return TRUE;	/* Everything OK, page was clean */
 }
 
+static int
+cpage_numpag_cmp(const void *a, const void *b)
+{
+	const struct lru_cpage * const *cpa = a, * const *cpb = b;
+
+	return CMP((*cpa)->numpag, (*cpb)->numpag);
+}
+
 /**
  * Flush all the dirty pages to disk.
  *
+ * Dirty pages are written by increasing page number, and not in LRU order,
+ * so that the whole flush is a single forward sweep through the file.
+ *
  * @return the amount of pages successfully flushed as a positive number
  * if everything was fine, 0 if there was nothing to flush, and -1 if there
  * were I/O errors (errno is set).
@@ -393,7 +406,8 @@ ssize_t
 flush_dirtypag(const DBM *db)
 {
 	const struct lru_cache *cache = db->cache;
-	struct lru_cpage *cp;
+	struct lru_cpage *cp, **dirty;
+	size_t i, n = 0;
 	ssize_t amount = 0;
 	int saved_errno = 0;
 
@@ -405,8 +419,29 @@ flush_dirtypag(const DBM *db)
 
 	ELIST_FOREACH_DATA(&cache->lru, cp) {
 		sdbm_lru_cpage_valid(cp, db);
-		if (!flush_cpage(cp, &amount, &saved_errno))
-			break;
+		if (cp->dirty)
+			n++;
+	}
+
+	if (n != 0) {
+		XMALLOC_ARRAY(dirty, n);
+
+		i = 0;
+		ELIST_FOREACH_DATA(&cache->lru, cp) {
+			if (cp->dirty)
+				dirty[i++] = cp;
+		}
+
+		g_assert(i == n);
+
+		xqsort(dirty, n, sizeof dirty[0], cpage_numpag_cmp);
+
+		for (i = 0; i < n; i++) {
+			if (!flush_cpage(dirty[i], &amount, &saved_errno))
+				break;
+		}
+
+		xfree(dirty);
 	}
 
 	if (saved_errno != 0) {
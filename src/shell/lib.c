@@ -39,6 +39,7 @@
 #include "lib/cq.h"
 #include "lib/file_object.h"
 #include "lib/hset.h"
+#include "lib/inputevt.h"
 #include "lib/misc.h"
 #include "lib/pow2.h"
 #include "lib/pslist.h"
@@ -278,6 +279,65 @@ shell_exec_lib_show_files(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+/**
+ * Append I/O latency histogram to string.
+ */
+static void
+shell_lib_inputevt_hist(str_t *s, const char *what,
+	uint64 calls, const uint64 *hist, uint64 max)
+{
+	uint i;
+
+	str_catf(s, "  %-4s %10s", what, uint64_to_string(calls));
+	for (i = 0; i < INPUTEVT_HIST_BUCKETS; i++)
+		str_catf(s, " %8s", uint64_to_string(hist[i]));
+	str_catf(s, " %9s\n", uint64_to_string(max));
+}
+
+static enum shell_reply
+shell_exec_lib_show_inputevt(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	pslist_t *info, *sl;
+	str_t *s;
+	uint i;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	s = str_new(132);
+	STR_CPY(s, "  What      Calls");
+
+	for (i = 0; i < INPUTEVT_HIST_BUCKETS - 1; i++)
+		str_catf(s, " <%5uus", INPUTEVT_HIST_LIMIT(i));
+	str_catf(s, " %8s %9s\n", "more", "Max (us)");
+
+	shell_write(sh, "100~\n");
+	shell_write(sh, str_2c(s));
+
+	info = inputevt_info_list();
+
+	PSLIST_FOREACH(info, sl) {
+		inputevt_info_t *iei = sl->data;
+
+		inputevt_info_check(iei);
+
+		str_printf(s, "%s()\n", iei->name);
+		shell_lib_inputevt_hist(s, "wait", iei->calls, iei->wait,
+			iei->wait_max);
+		shell_lib_inputevt_hist(s, "run", iei->calls, iei->run,
+			iei->run_max);
+		shell_write(sh, str_2c(s));
+	}
+
+	str_destroy_null(&s);
+	inputevt_info_list_free_null(&info);
+	shell_write(sh, ".\n");
+
+	return REPLY_READY;
+}
+
 static enum shell_reply
 shell_exec_lib_show(struct gnutella_shell *sh,
 	int argc, const char *argv[])
@@ -296,6 +356,7 @@ shell_exec_lib_show(struct gnutella_shell *sh,
 
 	CMD(callout);
 	CMD(files);
+	CMD(inputevt);
 
 #undef CMD
 
@@ -346,7 +407,8 @@ shell_help_lib(int argc, const char *argv[])
 			if (2 == argc) {
 				return
 					"lib show callout      # display callout queues\n"
-					"lib show files [-duw] # display open files\n";
+					"lib show files [-duw] # display open files\n"
+					"lib show inputevt     # display I/O dispatch latencies\n";
 			} else {
 				if (0 == ascii_strcasecmp(argv[2], "callout")) {
 					return "lib show callout\n"
@@ -359,11 +421,18 @@ shell_help_lib(int argc, const char *argv[])
 						"-u: show one entry per file path "
 							"(ignoring -w if supplied)\n"
 						"-w: show where files were opened\n";
+				} else
+				if (0 == ascii_strcasecmp(argv[2], "inputevt")) {
+					return "lib show inputevt\n"
+						"display the I/O dispatching latency histograms "
+							"of each handler\n"
+						"wait: delay between event reporting and dispatching\n"
+						"run: time spent in the handler\n";
 				}
 			}
 		}
 	} else {
-		return "lib show callout|files\n";
+		return "lib show callout|files|inputevt\n";
 	}
 	return NULL;
 }
@@ -35,8 +35,10 @@
 
 #include "cmd.h"
 #include "core/gnet_stats.h"
+#include "core/verify.h"
 
 #include "lib/ascii.h"
+#include "lib/misc.h"
 #include "lib/options.h"
 #include "lib/stringify.h"
 #include "lib/teq.h"
@@ -191,6 +193,52 @@ shell_exec_stats_drop(struct gnutella_shell *sh,
 	return REPLY_READY;
 }
 
+static enum shell_reply
+shell_exec_stats_verify(struct gnutella_shell *sh,
+	int argc, const char *argv[])
+{
+	const char *pretty;
+	const option_t options[] = {
+		{ "p", &pretty },			/* pretty-print values */
+	};
+	struct verify_thread_stats *vts;
+	int parsed;
+	size_t i, n;
+
+	shell_check(sh);
+	g_assert(argv);
+	g_assert(argc > 0);
+
+	parsed = shell_options_parse(sh, argv, options, N_ITEMS(options));
+	if (parsed < 0)
+		return REPLY_ERROR;
+
+	XMALLOC0_ARRAY(vts, VERIFY_THREAD_MAX);
+	n = verify_thread_stats(vts, VERIFY_THREAD_MAX);
+
+	for (i = 0; i < n; i++) {
+		const struct verify_thread_stats *s = &vts[i];
+		uint64 rate = 0 == s->busy_us ? 0 :
+			s->bytes * UINT64_CONST(1000000) / s->busy_us;
+
+		shell_write(sh, s->name);
+		shell_write(sh, " files=");
+		shell_write(sh, pretty ?
+			uint64_to_gstring(s->files) : uint64_to_string(s->files));
+		shell_write(sh, " bytes=");
+		shell_write(sh, pretty ?
+			uint64_to_gstring(s->bytes) : uint64_to_string(s->bytes));
+		shell_write(sh, " busy=");
+		shell_write(sh, compact_time(s->busy_us / 1000000));
+		shell_write(sh, " rate=");
+		shell_write(sh, short_rate(rate, FALSE));
+		shell_write(sh, "\n");
+	}
+
+	XFREE_NULL(vts);
+	return REPLY_READY;
+}
+
 /**
  * Handle the stats command.
  */
@@ -213,6 +261,7 @@ shell_exec_stats(struct gnutella_shell *sh, int argc, const char *argv[])
 
 	CMD(general);
 	CMD(drop);
+	CMD(verify);
 
 #undef CMD
 
@@ -245,10 +294,16 @@ shell_help_stats(int argc, const char *argv[])
 				"-t : only show TCP messages.\n"
 				"-u : only show UDP messages.\n";
 		}
+		else if (0 == ascii_strcasecmp(argv[1], "verify")) {
+			return "stats verify [-p]\n"
+				"prints per-thread file verification throughput.\n"
+				"-p : pretty-print with thousands separators.\n";
+		}
 	} else {
 		return
 			"stats [general] [-p]\n"
 			"stats drop [-ptu]\n"
+			"stats verify [-p]\n"
 			;
 	}
 	return NULL;
@@ -67,6 +67,11 @@ print_upload_info(struct gnutella_shell *sh,
 		info->name ? info->name : "none",
 		info->name ? "\"" : ">");
 
+	if (info->zerocopy + info->copied != 0) {
+		str_bcatf(ARYLEN(buf), " (%u%% zero-copy)",
+			(uint) (100 * info->zerocopy / (info->zerocopy + info->copied)));
+	}
+
 	shell_write(sh, buf);
 	shell_write(sh, "\n");	/* Terminate line */
 }